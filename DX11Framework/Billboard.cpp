@@ -0,0 +1,123 @@
+#include "Billboard.h"
+
+/// <summary>
+/// world position, normal and atlas uv of one corner of a camera facing quad. the quad's normal points at the eye
+/// (flattened onto the ground plane when cylindrical), right and up span the quad with the same winding the old
+/// fixed quad used
+/// </summary>
+/// <param name="point"></param>
+/// <param name="vertexId">vertex of the draw, the corner is vertexId % 6</param>
+/// <param name="eye"></param>
+/// <param name="facing"></param>
+/// <param name="atlasColumns"></param>
+/// <param name="atlasRows"></param>
+/// <param name="position"></param>
+/// <param name="normal"></param>
+/// <param name="texcoord"></param>
+void ExpandBillboardVertex(
+	const BillboardPoint& point,
+	UINT vertexId,
+	const XMFLOAT3& eye,
+	BillboardFacing facing,
+	UINT atlasColumns,
+	UINT atlasRows,
+	XMFLOAT3& position,
+	XMFLOAT3& normal,
+	XMFLOAT2& texcoord) {
+	// corners 0 bottom left, 1 bottom right, 2 top left, 3 top right, triangles 0 2 3 and 0 3 1
+	static const UINT cornerOrder[BILLBOARD_VERTICES] = { 0, 2, 3, 0, 3, 1 };
+	UINT corner = cornerOrder[vertexId % BILLBOARD_VERTICES];
+
+	float cornerX = (corner & 1) ? 1.0f : -1.0f;
+	float cornerY = (corner & 2) ? 1.0f : -1.0f;
+
+	XMVECTOR centre = XMLoadFloat3(&point.Position);
+	XMVECTOR toEye = XMLoadFloat3(&eye) - centre;
+	XMVECTOR worldUp = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+
+	if (facing == BillboardFacing::Cylindrical) toEye = XMVectorSetY(toEye, 0.0f);
+
+	// eye on the quad's axis has no facing direction, keep the old -z facing quad
+	XMVECTOR forward = XMVectorGetX(XMVector3LengthSq(toEye)) > 1e-8f ? XMVector3Normalize(toEye) : XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f);
+
+	XMVECTOR right = XMVector3Cross(forward, worldUp);
+	right = XMVectorGetX(XMVector3LengthSq(right)) > 1e-8f ? XMVector3Normalize(right) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+
+	XMVECTOR up = facing == BillboardFacing::Cylindrical ? worldUp : XMVector3Cross(right, forward);
+
+	XMVECTOR corner3 = centre
+		+ right * (cornerX * point.Size.x * 0.5f)
+		+ up * (cornerY * point.Size.y * 0.5f);
+
+	XMStoreFloat3(&position, corner3);
+	XMStoreFloat3(&normal, forward);
+
+	UINT columns = atlasColumns ? atlasColumns : 1;
+	UINT rows = atlasRows ? atlasRows : 1;
+	UINT column = point.AtlasIndex % columns;
+	UINT row = (point.AtlasIndex / columns) % rows;
+
+	texcoord.x = (column + (cornerX * 0.5f + 0.5f)) / columns;
+	texcoord.y = (row + (0.5f - cornerY * 0.5f)) / rows;
+}
+
+/// <summary>
+/// corners worked by hand for a 2 wide, 4 high quad at the origin: looked at level and from 45 degrees above, both
+/// facings, the eye straight above it where there is no facing direction, and atlas cells including an index past the
+/// last row, which wraps
+/// </summary>
+/// <param name="caseCount">worked cases checked</param>
+/// <returns>true when every position, normal and uv is within rounding</returns>
+bool CheckBillboardExpansion(UINT& caseCount) {
+	struct ExpansionCase
+	{
+		XMFLOAT3 m_eye;
+		BillboardFacing m_facing;
+		UINT m_vertexId;
+		UINT m_atlasIndex;
+		UINT m_atlasColumns;
+		UINT m_atlasRows;
+		XMFLOAT3 m_position;
+		XMFLOAT3 m_normal;
+		XMFLOAT2 m_texcoord;
+	};
+
+	const float diagonal = 0.70710678f;
+	const ExpansionCase cases[] = {
+		// level, bottom left and top right, the second quad of the draw expands the same way
+		{ XMFLOAT3(0.0f, 0.0f, -10.0f), BillboardFacing::Cylindrical, 0, 0, 1, 1, XMFLOAT3(-1.0f, -2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.0f, 1.0f) },
+		{ XMFLOAT3(0.0f, 0.0f, -10.0f), BillboardFacing::Spherical, 8, 0, 1, 1, XMFLOAT3(1.0f, 2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(1.0f, 0.0f) },
+		// from above, cylindrical stays upright and spherical tilts back towards the eye
+		{ XMFLOAT3(0.0f, 10.0f, -10.0f), BillboardFacing::Cylindrical, 2, 0, 1, 1, XMFLOAT3(1.0f, 2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(1.0f, 0.0f) },
+		{ XMFLOAT3(0.0f, 10.0f, -10.0f), BillboardFacing::Spherical, 2, 0, 1, 1, XMFLOAT3(1.0f, 2.0f * diagonal, 2.0f * diagonal), XMFLOAT3(0.0f, diagonal, -diagonal), XMFLOAT2(1.0f, 0.0f) },
+		// eye on the axis, cylindrical keeps the -z quad and spherical lies flat with up along +z
+		{ XMFLOAT3(0.0f, 10.0f, 0.0f), BillboardFacing::Cylindrical, 0, 0, 1, 1, XMFLOAT3(-1.0f, -2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.0f, 1.0f) },
+		{ XMFLOAT3(0.0f, 10.0f, 0.0f), BillboardFacing::Spherical, 0, 0, 1, 1, XMFLOAT3(-1.0f, 0.0f, -2.0f), XMFLOAT3(0.0f, 1.0f, 0.0f), XMFLOAT2(0.0f, 1.0f) },
+		// 4 x 2 atlas, index 6 is column 2 of row 1 and index 9 wraps to column 1 of row 0
+		{ XMFLOAT3(0.0f, 0.0f, -10.0f), BillboardFacing::Cylindrical, 2, 6, 4, 2, XMFLOAT3(1.0f, 2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.75f, 0.5f) },
+		{ XMFLOAT3(0.0f, 0.0f, -10.0f), BillboardFacing::Cylindrical, 0, 6, 4, 2, XMFLOAT3(-1.0f, -2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.5f, 1.0f) },
+		{ XMFLOAT3(0.0f, 0.0f, -10.0f), BillboardFacing::Cylindrical, 5, 9, 4, 2, XMFLOAT3(1.0f, -2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), XMFLOAT2(0.5f, 0.5f) },
+	};
+
+	bool matches = true;
+
+	for (const ExpansionCase& expansion : cases) {
+		BillboardPoint point = {};
+		point.Position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		point.AtlasIndex = expansion.m_atlasIndex;
+		point.Size = XMFLOAT2(2.0f, 4.0f);
+
+		XMFLOAT3 position, normal;
+		XMFLOAT2 texcoord;
+		ExpandBillboardVertex(point, expansion.m_vertexId, expansion.m_eye, expansion.m_facing, expansion.m_atlasColumns, expansion.m_atlasRows, position, normal, texcoord);
+
+		XMVECTOR error = XMVectorAbs(XMLoadFloat3(&position) - XMLoadFloat3(&expansion.m_position));
+		error = XMVectorMax(error, XMVectorAbs(XMLoadFloat3(&normal) - XMLoadFloat3(&expansion.m_normal)));
+		error = XMVectorMax(error, XMVectorAbs(XMLoadFloat2(&texcoord) - XMLoadFloat2(&expansion.m_texcoord)));
+
+		if (!XMVector3LessOrEqual(error, XMVectorReplicate(1e-4f))) matches = false;
+	}
+
+	caseCount = sizeof(cases) / sizeof(cases[0]);
+	return matches;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Structures.h"
+
+enum class BillboardFacing : UINT
+{
+	Cylindrical, // turns about world up only, trees stay upright
+	Spherical // faces the eye fully, tilts when seen from above
+};
+
+static const UINT BILLBOARD_VERTICES = 6; // two triangles per point, no index buffer
+
+// CPU copy of BillboardShader.hlsl's VS_main, so the expansion can be checked without a device.
+// vertexId is the SV_VertexID of the draw, point vertexId / 6 is expanded
+void ExpandBillboardVertex(
+	const BillboardPoint& point,
+	UINT vertexId,
+	const XMFLOAT3& eye,
+	BillboardFacing facing,
+	UINT atlasColumns,
+	UINT atlasRows,
+	XMFLOAT3& position,
+	XMFLOAT3& normal,
+	XMFLOAT2& texcoord);
+
+bool CheckBillboardExpansion(UINT& caseCount);
@@ -28,23 +28,31 @@ struct Fog
     float m_range;
 };
 
-cbuffer ConstantBuffer : register(b0)
+cbuffer FrameBuffer : register(b0)
 {
     float4x4 Projection;
     float4x4 View;
-    float4x4 World;
-    float4 DiffuseMaterial;
-    float4 AmbientMaterial;
-    float4 SpecularMaterial;
     DirectionalLight DirLight;
     PointLight PtLight;
-    uint HasTexture;
     float3 EyePosW;
+    uint FogEnabled;
     Fog FogW;
+}
+
+cbuffer MaterialBuffer : register(b1)
+{
+    float4 DiffuseMaterial;
+    float4 AmbientMaterial;
+    float4 SpecularMaterial;
+    uint HasTexture;
     uint SpecMap;
     uint NormMap;
     float SpecularPower;
-    uint FogEnabled;
+}
+
+cbuffer ObjectBuffer : register(b2)
+{
+    float4x4 World;
 }
 
 struct VS_Out // keep most as this will be affected by light, unlike skybox
@@ -57,22 +65,61 @@ struct VS_Out // keep most as this will be affected by light, unlike skybox
     float3 EyePos : LIGHTPOS;
 };
 
-VS_Out VS_main(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoord : TEXCOORD, float3 Tangent : TANGENT)
+struct BillboardPoint
+{
+    float3 Position;
+    uint AtlasIndex;
+    float2 Size;
+    float2 padding;
+};
+
+StructuredBuffer<BillboardPoint> Billboards : register(t0); // vertex stage only, the pixel stage's t0 is diffuseTex
+
+cbuffer BillboardBuffer : register(b3)
+{
+    uint Facing; // 0 cylindrical, 1 spherical
+    uint AtlasColumns;
+    uint AtlasRows;
+    float BillboardPadding;
+}
+
+static const uint CornerOrder[6] = { 0, 2, 3, 0, 3, 1 };
+
+// six vertices per point and no vertex buffer, Billboard.cpp's ExpandBillboardVertex is the CPU copy of this
+VS_Out VS_main(uint VertexID : SV_VertexID)
 {
     VS_Out output = (VS_Out) 0;
     
-    output.texcoord = TexCoord;
+    BillboardPoint bb = Billboards[VertexID / 6];
+    uint corner = CornerOrder[VertexID % 6];
+    float2 cornerPos = float2((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f);
+    
+    float3 toEye = EyePosW - bb.Position;
+    float3 worldUp = float3(0.0f, 1.0f, 0.0f);
+    
+    if (Facing == 0)
+    {
+        toEye.y = 0.0f;
+    }
     
-    float4 Pos4 = float4(Position, 1.0f);
-    output.position = mul(Pos4, World);
-    output.WorldPos = output.position; //
+    // eye on the quad's axis has no facing direction, keep a -z facing quad
+    float3 forward = dot(toEye, toEye) > 1e-8f ? normalize(toEye) : float3(0.0f, 0.0f, -1.0f);
+    float3 right = cross(forward, worldUp);
+    right = dot(right, right) > 1e-8f ? normalize(right) : float3(1.0f, 0.0f, 0.0f);
+    float3 up = Facing == 0 ? worldUp : cross(right, forward);
     
-    output.normal = Normal;
+    float3 worldPos = bb.Position + right * (cornerPos.x * bb.Size.x * 0.5f) + up * (cornerPos.y * bb.Size.y * 0.5f);
     
-    output.EyePos = EyePosW;
+    uint columns = max(AtlasColumns, 1);
+    uint rows = max(AtlasRows, 1);
+    float2 cell = float2(bb.AtlasIndex % columns, (bb.AtlasIndex / columns) % rows);
+    output.texcoord = (cell + float2(cornerPos.x * 0.5f + 0.5f, 0.5f - cornerPos.y * 0.5f)) / float2(columns, rows);
     
-    output.position = mul(output.position, View);
+    output.WorldPos = worldPos;
+    output.normal = forward; // World is identity for billboards, so this is already world space
+    output.EyePos = EyePosW;
     
+    output.position = mul(float4(worldPos, 1.0f), View);
     output.position = mul(output.position, Projection);
     
     return output;
@@ -37,6 +37,7 @@ public:
 	XMFLOAT3 GetUp() { return m_up; }
 
 	XMFLOAT4X4* GetView() { return &m_view; }
+	float GetFarDepth() { return m_farDepth; }
 
 	D3D11_VIEWPORT* GetViewport() { return &m_viewport; }
 
@@ -0,0 +1,154 @@
+#pragma once
+#include <windows.h>
+#include <d3d11_4.h>
+#include <string.h>
+
+/// dynamic constant buffer holding one T. keeps a copy of the last upload and skips uploads that would not change anything
+template<typename T>
+class DynamicConstantBuffer
+{
+private:
+	ID3D11Buffer* m_buffer = nullptr;
+	T m_uploaded;
+	bool m_uploadedValid = false;
+
+	UINT m_uploads = 0;
+	UINT m_skipped = 0;
+
+public:
+	T m_data = {};
+
+	~DynamicConstantBuffer() { Release(); }
+
+	HRESULT Create(ID3D11Device* device) {
+		static_assert(sizeof(T) % 16 == 0, "constant buffers must be a multiple of 16 bytes");
+
+		D3D11_BUFFER_DESC desc = {};
+		desc.ByteWidth = sizeof(T);
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		return device->CreateBuffer(&desc, nullptr, &m_buffer);
+	}
+
+	void Release() {
+		if (m_buffer) m_buffer->Release();
+		m_buffer = nullptr;
+		m_uploadedValid = false;
+	}
+
+	/// <summary>
+	/// writes m_data to the GPU if it differs from the last upload
+	/// </summary>
+	/// <param name="deviceContext"></param>
+	/// <returns>true when an upload happened</returns>
+	bool Upload(ID3D11DeviceContext* deviceContext) {
+		if (m_uploadedValid && memcmp(&m_uploaded, &m_data, sizeof(T)) == 0) {
+			++m_skipped;
+			return false;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(deviceContext->Map(m_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return false;
+		memcpy(mapped.pData, &m_data, sizeof(T));
+		deviceContext->Unmap(m_buffer, 0);
+
+		m_uploaded = m_data;
+		m_uploadedValid = true;
+		++m_uploads;
+		return true;
+	}
+
+	/// <summary>
+	/// forces the next Upload through, deferred contexts need a discard map in every command list before the buffer is read
+	/// </summary>
+	void Invalidate() { m_uploadedValid = false; }
+
+	ID3D11Buffer* Get() { return m_buffer; }
+
+	UINT GetUploadCount() { return m_uploads; }
+	UINT GetSkippedCount() { return m_skipped; }
+};
+
+/// one large dynamic buffer mapped once per recording pass. every Write takes the next 256 byte slice and returns
+/// its first constant, which draws bind with the 11.1 *SetConstantBuffers1 offsets instead of mapping per draw
+class ConstantRingBuffer
+{
+public:
+	static const UINT SLICE_BYTES = 256; // offsets and ranges must be multiples of 16 constants
+	static const UINT SLICE_CONSTANTS = SLICE_BYTES / 16;
+
+private:
+	ID3D11Buffer* m_buffer = nullptr;
+	UINT m_sliceCapacity = 0;
+	BYTE* m_mapped = nullptr;
+	UINT m_nextSlice = 0;
+
+	UINT m_maps = 0;
+	UINT m_slicesWritten = 0;
+
+public:
+	~ConstantRingBuffer() { Release(); }
+
+	void Release() {
+		if (m_buffer) m_buffer->Release();
+		m_buffer = nullptr;
+		m_sliceCapacity = 0;
+	}
+
+	/// <summary>
+	/// maps the whole buffer with discard, growing it first when slices will not fit
+	/// </summary>
+	/// <param name="device"></param>
+	/// <param name="deviceContext"></param>
+	/// <param name="slices">most slices Write will be called for before End</param>
+	/// <returns>false if the buffer could not be created or mapped</returns>
+	bool Begin(ID3D11Device* device, ID3D11DeviceContext* deviceContext, UINT slices) {
+		if (slices > m_sliceCapacity) {
+			UINT capacity = m_sliceCapacity ? m_sliceCapacity : 256;
+			while (capacity < slices) capacity *= 2;
+
+			Release();
+
+			D3D11_BUFFER_DESC desc = {};
+			desc.ByteWidth = capacity * SLICE_BYTES;
+			desc.Usage = D3D11_USAGE_DYNAMIC;
+			desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+			if (FAILED(device->CreateBuffer(&desc, nullptr, &m_buffer))) return false;
+			m_sliceCapacity = capacity;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		if (FAILED(deviceContext->Map(m_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return false;
+
+		m_mapped = (BYTE*)mapped.pData;
+		m_nextSlice = 0;
+		++m_maps;
+		return true;
+	}
+
+	/// <summary>
+	/// copies data into the next slice, only valid between Begin and End
+	/// </summary>
+	/// <param name="data"></param>
+	/// <param name="bytes">at most SLICE_BYTES</param>
+	/// <returns>first constant of the slice</returns>
+	UINT Write(const void* data, UINT bytes) {
+		memcpy(m_mapped + m_nextSlice * SLICE_BYTES, data, bytes);
+		++m_slicesWritten;
+		return (m_nextSlice++) * SLICE_CONSTANTS;
+	}
+
+	void End(ID3D11DeviceContext* deviceContext) {
+		deviceContext->Unmap(m_buffer, 0);
+		m_mapped = nullptr;
+	}
+
+	ID3D11Buffer* Get() { return m_buffer; }
+
+	UINT GetMapCount() { return m_maps; }
+	UINT GetSliceCount() { return m_slicesWritten; }
+};
@@ -1,5 +1,8 @@
 #include "DX11Framework.h"
+#include <algorithm>
 #include <string>
+#include <climits>
+#include <fstream>
 
 //#define RETURNFAIL(x) if(FAILED(x)) return x;
 
@@ -102,11 +105,15 @@ HRESULT DX11Framework::CreateD3DDevice()
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     hr = baseDevice->QueryInterface(__uuidof(ID3D11Device), reinterpret_cast<void**>(&_device));
-    hr = baseDeviceContext->QueryInterface(__uuidof(ID3D11DeviceContext), reinterpret_cast<void**>(&_immediateContext));
+    hr = baseDeviceContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&_immediateContext));
+    if (FAILED(hr)) return hr;
 
     baseDevice->Release();
     baseDeviceContext->Release();
 
+    _recorders[0].m_context = _immediateContext;
+    _recorders[0].m_stateCache.SetContext(_immediateContext);
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     hr = _device->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&_dxgiDevice));
@@ -139,11 +146,20 @@ HRESULT DX11Framework::CreateSwapChainAndFrameBuffer()
     swapChainDesc.Scaling = DXGI_SCALING_STRETCH;
     swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_SEQUENTIAL;
     swapChainDesc.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
-    swapChainDesc.Flags = 0;
+    swapChainDesc.Flags = _framePacer.GetSettings().m_enabled ? DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT : 0;
 
     hr = _dxgiFactory->CreateSwapChainForHwnd(_device, _windowHandle, &swapChainDesc, nullptr, nullptr, &_swapChain);
     if (FAILED(hr)) return hr;
 
+    // the waitable object needs 8.1, without it frame pacing still caps the frame rate
+    IDXGISwapChain2* swapChain2 = nullptr;
+    if (_framePacer.GetSettings().m_enabled && SUCCEEDED(_swapChain->QueryInterface(__uuidof(IDXGISwapChain2), reinterpret_cast<void**>(&swapChain2)))) {
+        swapChain2->SetMaximumFrameLatency(_framePacer.GetSettings().m_maxFrameLatency);
+        _frameLatencyWaitable = swapChain2->GetFrameLatencyWaitableObject();
+        _framePacer.SetFrameLatencyWaitable(_frameLatencyWaitable);
+        swapChain2->Release();
+    }
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     ID3D11Texture2D* frameBuffer = nullptr;
@@ -177,31 +193,73 @@ HRESULT DX11Framework::InitShadersAndInputLayout()
 {
     // compile at run time and define part of data they recieve
     HRESULT hr = S_OK;
-    ID3DBlob* errorBlob;
 
-    DWORD dwShaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
+    _shaderFlags = D3DCOMPILE_ENABLE_STRICTNESS;
 #ifdef _DEBUG
     // Set the D3DCOMPILE_DEBUG flag to embed debug information in the shaders.
     // Setting this flag improves the shader debugging experience, but still allows 
     // the shaders to be optimized and to run exactly the way they will run in 
     // the release configuration of this program.
-    dwShaderFlags |= D3DCOMPILE_DEBUG;
+    _shaderFlags |= D3DCOMPILE_DEBUG;
 #endif
-    
-    ID3DBlob* vsBlob;
-    // compiles shaders at runtime
-    hr =  D3DCompileFromFile(L"SimpleShaders.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VS_main", "vs_5_0", dwShaderFlags, 0, &vsBlob, &errorBlob);
+
+    enum
+    {
+        SimpleVS, InstancedVS, // SimpleShaders PS_main is compiled per permutation, see CompilePixelPermutations
+        SkyboxVS, SkyboxPS,
+        BillboardVS, BillboardPS,
+        TerrainVS, TerrainPS,
+        TessVS, TessHS, TessDS, // tessellated GameObjects, pixel stage is SimpleShaders PS_main
+        TerrainPatchVS, TerrainHS, TerrainDS, // tessellated terrain, pixel stage is TerrainShader PS_main
+        ShaderCount
+    };
+
+    ShaderSource shaders[ShaderCount];
+    shaders[SimpleVS] = { L"SimpleShaders.hlsl", "VS_main", "vs_5_0" };
+    shaders[InstancedVS] = { L"SimpleShaders.hlsl", "VS_instanced", "vs_5_0" }; // world matrix rows stream per instance from slot 1
+    shaders[SkyboxVS] = { L"SkyboxShader.hlsl", "VS_main", "vs_5_0" };
+    shaders[SkyboxPS] = { L"SkyboxShader.hlsl", "PS_main", "ps_5_0" };
+    shaders[BillboardVS] = { L"BillboardShader.hlsl", "VS_main", "vs_5_0" };
+    shaders[BillboardPS] = { L"BillboardShader.hlsl", "PS_main", "ps_5_0" };
+    shaders[TerrainVS] = { L"TerrainShader.hlsl", "VS_main", "vs_5_0" };
+    shaders[TerrainPS] = { L"TerrainShader.hlsl", "PS_main", "ps_5_0" };
+    shaders[TessVS] = { L"TessellationShader.hlsl", "VS_main", "vs_5_0" };
+    shaders[TessHS] = { L"TessellationShader.hlsl", "HS_main", "hs_5_0" };
+    shaders[TessDS] = { L"TessellationShader.hlsl", "DS_main", "ds_5_0" };
+    shaders[TerrainPatchVS] = { L"TerrainShader.hlsl", "VS_patch", "vs_5_0" };
+    shaders[TerrainHS] = { L"TerrainShader.hlsl", "HS_main", "hs_5_0" };
+    shaders[TerrainDS] = { L"TerrainShader.hlsl", "DS_main", "ds_5_0" };
+
+    // cached bytecode where the sources are unchanged, everything else compiles in parallel
+    ShaderCache cache;
+    hr = cache.Compile(shaders, ShaderCount, _shaderFlags);
+
     if (FAILED(hr))
     {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
+        for (UINT i = 0; i < ShaderCount; i++)
+        {
+            if (FAILED(shaders[i].m_result) && !shaders[i].m_errors.empty()) {
+                MessageBoxA(_windowHandle, shaders[i].m_errors.c_str(), nullptr, ERROR);
+                break;
+            }
+        }
     }
 
-    hr = _device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, &_vertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[SimpleVS].m_bytecode->GetBufferPointer(), shaders[SimpleVS].m_bytecode->GetBufferSize(), nullptr, &_vertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[InstancedVS].m_bytecode->GetBufferPointer(), shaders[InstancedVS].m_bytecode->GetBufferSize(), nullptr, &_instanceVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[SkyboxVS].m_bytecode->GetBufferPointer(), shaders[SkyboxVS].m_bytecode->GetBufferSize(), nullptr, &_skyboxVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreatePixelShader(shaders[SkyboxPS].m_bytecode->GetBufferPointer(), shaders[SkyboxPS].m_bytecode->GetBufferSize(), nullptr, &_skyboxPixelShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[BillboardVS].m_bytecode->GetBufferPointer(), shaders[BillboardVS].m_bytecode->GetBufferSize(), nullptr, &_billboardVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreatePixelShader(shaders[BillboardPS].m_bytecode->GetBufferPointer(), shaders[BillboardPS].m_bytecode->GetBufferSize(), nullptr, &_billboardPixelShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[TerrainVS].m_bytecode->GetBufferPointer(), shaders[TerrainVS].m_bytecode->GetBufferSize(), nullptr, &_terrainVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreatePixelShader(shaders[TerrainPS].m_bytecode->GetBufferPointer(), shaders[TerrainPS].m_bytecode->GetBufferSize(), nullptr, &_terrainPixelShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[TessVS].m_bytecode->GetBufferPointer(), shaders[TessVS].m_bytecode->GetBufferSize(), nullptr, &_tessVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateHullShader(shaders[TessHS].m_bytecode->GetBufferPointer(), shaders[TessHS].m_bytecode->GetBufferSize(), nullptr, &_tessHullShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateDomainShader(shaders[TessDS].m_bytecode->GetBufferPointer(), shaders[TessDS].m_bytecode->GetBufferSize(), nullptr, &_tessDomainShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateVertexShader(shaders[TerrainPatchVS].m_bytecode->GetBufferPointer(), shaders[TerrainPatchVS].m_bytecode->GetBufferSize(), nullptr, &_terrainPatchVertexShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateHullShader(shaders[TerrainHS].m_bytecode->GetBufferPointer(), shaders[TerrainHS].m_bytecode->GetBufferSize(), nullptr, &_terrainHullShader);
+    if (SUCCEEDED(hr)) hr = _device->CreateDomainShader(shaders[TerrainDS].m_bytecode->GetBufferPointer(), shaders[TerrainDS].m_bytecode->GetBufferSize(), nullptr, &_terrainDomainShader);
 
-    if (FAILED(hr)) return hr;
-    
     // VVV IMPORTANT
     D3D11_INPUT_ELEMENT_DESC inputElementDesc[] =
     {
@@ -211,105 +269,27 @@ HRESULT DX11Framework::InitShadersAndInputLayout()
         { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA,   0 }
     };
 
-    hr = _device->CreateInputLayout(inputElementDesc, ARRAYSIZE(inputElementDesc), vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), &_inputLayout);
-    if (FAILED(hr)) return hr;
-
-    ID3DBlob* psBlob;
-
-    hr = D3DCompileFromFile(L"SimpleShaders.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PS_main", "ps_5_0", dwShaderFlags, 0, &psBlob, &errorBlob);
-    if (FAILED(hr))
-    {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr, &_pixelShader);
-
-    vsBlob->Release();
-    psBlob->Release();
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    hr = D3DCompileFromFile(L"SkyboxShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VS_main", "vs_5_0", dwShaderFlags, 0, &vsBlob, &errorBlob);
-    if (FAILED(hr))
-    {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, &_skyboxVertexShader);
-
-    if (FAILED(hr)) return hr;
-
-    hr = D3DCompileFromFile(L"SkyboxShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PS_main", "ps_5_0", dwShaderFlags, 0, &psBlob, &errorBlob);
-    if (FAILED(hr))
-    {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr, &_skyboxPixelShader);
-
-    vsBlob->Release();
-    psBlob->Release();
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    hr = D3DCompileFromFile(L"BillboardShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VS_main", "vs_5_0", dwShaderFlags, 0, &vsBlob, &errorBlob);
-    if (FAILED(hr))
-    {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, &_billboardVertexShader);
-
-    if (FAILED(hr)) return hr;
-
-    hr = D3DCompileFromFile(L"BillboardShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PS_main", "ps_5_0", dwShaderFlags, 0, &psBlob, &errorBlob);
-    if (FAILED(hr))
-    {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr, &_billboardPixelShader);
-
-    vsBlob->Release();
-    psBlob->Release();
+    if (SUCCEEDED(hr)) hr = _device->CreateInputLayout(inputElementDesc, ARRAYSIZE(inputElementDesc), shaders[SimpleVS].m_bytecode->GetBufferPointer(), shaders[SimpleVS].m_bytecode->GetBufferSize(), &_inputLayout);
 
-    ////////////////////////////////////////////////////////////////////////////////////////////////
-
-    hr = D3DCompileFromFile(L"TerrainShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "VS_main", "vs_5_0", dwShaderFlags, 0, &vsBlob, &errorBlob);
-    if (FAILED(hr))
+    D3D11_INPUT_ELEMENT_DESC instanceElementDesc[] =
     {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
-    }
-
-    hr = _device->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(), nullptr, &_terrainVertexShader);
+        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA,   0 },
+        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA,   0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA,   0 },
+        { "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA,   0 },
+        { "INSTANCEWORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCEWORLD", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCEWORLD", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCEWORLD", 3, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 }
+    };
 
-    if (FAILED(hr)) return hr;
+    if (SUCCEEDED(hr)) hr = _device->CreateInputLayout(instanceElementDesc, ARRAYSIZE(instanceElementDesc), shaders[InstancedVS].m_bytecode->GetBufferPointer(), shaders[InstancedVS].m_bytecode->GetBufferSize(), &_instanceInputLayout);
 
-    hr = D3DCompileFromFile(L"TerrainShader.hlsl", nullptr, D3D_COMPILE_STANDARD_FILE_INCLUDE, "PS_main", "ps_5_0", dwShaderFlags, 0, &psBlob, &errorBlob);
-    if (FAILED(hr))
+    for (UINT i = 0; i < ShaderCount; i++)
     {
-        MessageBoxA(_windowHandle, (char*)errorBlob->GetBufferPointer(), nullptr, ERROR);
-        errorBlob->Release();
-        return hr;
+        if (shaders[i].m_bytecode) shaders[i].m_bytecode->Release();
     }
 
-    hr = _device->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(), nullptr, &_terrainPixelShader);
-
-    vsBlob->Release();
-    psBlob->Release();
-
     return hr;
 }
 
@@ -378,48 +358,6 @@ HRESULT DX11Framework::InitVertexIndexBuffers()
     hr = _device->CreateBuffer(&pyramidIndexBufferDesc, &pyramidindexData, &_pyramidIndexBuffer);
     if (FAILED(hr)) return hr;
 
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-
-    SimpleVertex billboardVertexData[] =  // maybe modify to account for sides being at angle
-    {
-        //Position                     //normal             
-        { XMFLOAT3(-1.00f,  -1.00f, 0.0f), XMFLOAT3(0.0f,  0.0f, -1.0f), XMFLOAT2(0.0f, 1.0f)},
-        { XMFLOAT3(1.00f,  -1.00f, 0.0f),  XMFLOAT3(0.0f,  0.0f, -1.0f), XMFLOAT2(1.0f, 1.0f)},
-        { XMFLOAT3(-1.00f, 1.00f, 0.0f), XMFLOAT3(0.0f,  0.0f, -1.0f), XMFLOAT2(0.0f, 0.0f)},
-        { XMFLOAT3(1.00f, 1.00f, 0.0f),  XMFLOAT3(0.0f,  0.0f, -1.0f), XMFLOAT2(1.0f, 0.0f)},
-    };
-
-    D3D11_BUFFER_DESC billboardVertexBufferDesc = {};
-    billboardVertexBufferDesc.ByteWidth = sizeof(billboardVertexData);
-    billboardVertexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE; // data wont change
-    billboardVertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
-    D3D11_SUBRESOURCE_DATA billboardvData = { billboardVertexData };
-    // ^^^ DX API pointing to some memory - can handle 2-dimensional data - use to identify data being stored
-
-    hr = _device->CreateBuffer(&billboardVertexBufferDesc, &billboardvData, &_billboardVertexBuffer);
-    if (FAILED(hr)) return hr;
-
-    ///////////////////////////////////////////////////////////////////////////////////////////////
-
-    WORD billboardIndexData[] = // WORD - unsigned short
-    {
-        //Indices
-        0, 2, 3,
-        0, 3, 1
-    };
-
-    D3D11_BUFFER_DESC billboardIndexBufferDesc = {};
-    billboardIndexBufferDesc.ByteWidth = sizeof(billboardIndexData); // the amount of indices in bytes, use for size of buffer in bytes
-    billboardIndexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
-    billboardIndexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-
-    D3D11_SUBRESOURCE_DATA billboardiData = { billboardIndexData };
-
-    hr = _device->CreateBuffer(&billboardIndexBufferDesc, &billboardiData, &_billboardIndexBuffer);
-    if (FAILED(hr)) return hr;
-
-
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
     //SimpleVertex lineVertexData[] = {
@@ -440,9 +378,32 @@ HRESULT DX11Framework::InitVertexIndexBuffers()
 
     _terrain = new Terrain();
 
-    _terrain->LoadHeightMap(513, 513, "RAW Files\\Heightmap 513x513.raw");
-    _terrain->GenGrid(513, 513, 513, 513);
-    _terrain->BuildBuffers(_device);
+    UINT size = 513;
+    if (_proceduralTerrain) {
+        NoiseSettings noise;
+        noise.m_type = NoiseType::DomainWarped;
+        _terrain->GenerateHeightMap(size, size, noise);
+    }
+    else {
+        size = _terrainSize;
+        _terrain->LoadHeightMap(size, size, _terrainFile, _terrainFormat); // larger than 513 is streamed a window at a time around the camera
+    }
+    _terrain->SetDeformable(_terrainDeformation); // the crater key needs the heights kept, otherwise they are freed after upload
+    _terrain->GenGrid((float)size, (float)size, (float)size, (float)size);
+
+    // bake the blend map unless the one on disk was baked from this heightmap and these settings, procedural maps are never saved
+    SplatSettings splat;
+    if (_proceduralTerrain || !_terrain->IsSplatMapCurrent(splat)) {
+        _terrain->BakeSplatMap(splat);
+        // read back on later runs, a failed write just means baking again. a streamed window is rebaked whenever it moves
+        if (!_proceduralTerrain && !_terrain->IsStreaming()) _terrain->SaveSplatMap();
+    }
+
+    // built before BuildBuffers can free the heights, tessellated displacement can drop the drawn surface by half its scale
+    _terrain->BuildOccluder(OCCLUDER_PATCH_CELLS, _tessellationSettings.m_displacementScale * 0.5f);
+
+    hr = _terrain->BuildBuffers(_device);
+    if (FAILED(hr)) return hr;
 
     return S_OK;
 }
@@ -452,10 +413,6 @@ HRESULT DX11Framework::InitPipelineVariables()
     // creates constant buffer and sets def options
     HRESULT hr = S_OK;
 
-    //Input Assembler
-    _immediateContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    _immediateContext->IASetInputLayout(_inputLayout);
-
     //Rasterizer fill
     D3D11_RASTERIZER_DESC rasterizerDesc = {};
     rasterizerDesc.FillMode = D3D11_FILL_SOLID;
@@ -464,8 +421,6 @@ HRESULT DX11Framework::InitPipelineVariables()
     hr = _device->CreateRasterizerState(&rasterizerDesc, &_fillState);
     if (FAILED(hr)) return hr;
 
-    _immediateContext->RSSetState(_fillState);
-
     //Rasterizer wireframe
     D3D11_RASTERIZER_DESC wireframeDesc = {};
     wireframeDesc.FillMode = D3D11_FILL_WIREFRAME;
@@ -504,19 +459,35 @@ HRESULT DX11Framework::InitPipelineVariables()
         _WindowWidth, _WindowHeight, 0, 1, _windowHandle));
     
     _immediateContext->RSSetViewports(1, _cameras[0]->GetViewport());
+    UpdateViews(0.0f);
+
+    //Constant Buffers, split by update frequency
+    hr = _frameBuffer.Create(_device);
+    if (FAILED(hr)) { return hr; }
 
-    //Constant Buffer
-    D3D11_BUFFER_DESC constantBufferDesc = {};
-    constantBufferDesc.ByteWidth = sizeof(ConstantBuffer);
-    constantBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    constantBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    constantBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    // material and object buffers belong to each recorder
+    hr = InitRecorders();
+    if (FAILED(hr)) { return hr; }
+
+    // only written while tessellation is on, see Draw
+    D3D11_BUFFER_DESC tessellationBufferDesc = {};
+    tessellationBufferDesc.ByteWidth = sizeof(TessellationBuffer);
+    tessellationBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    tessellationBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+    hr = _device->CreateBuffer(&tessellationBufferDesc, nullptr, &_tessellationBuffer);
+    if (FAILED(hr)) { return hr; }
+
+    // only written when the facing mode changes, see UpdateBillboardSettings
+    D3D11_BUFFER_DESC billboardBufferDesc = {};
+    billboardBufferDesc.ByteWidth = sizeof(BillboardBuffer);
+    billboardBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    billboardBufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
 
-    hr = _device->CreateBuffer(&constantBufferDesc, nullptr, &_constantBuffer);
+    hr = _device->CreateBuffer(&billboardBufferDesc, nullptr, &_billboardSettingsBuffer);
     if (FAILED(hr)) { return hr; }
 
-    _immediateContext->VSSetConstantBuffers(0, 1, &_constantBuffer);
-    _immediateContext->PSSetConstantBuffers(0, 1, &_constantBuffer);
+    UpdateBillboardSettings();
 
     ////////////////////////////
 
@@ -531,8 +502,6 @@ HRESULT DX11Framework::InitPipelineVariables()
     hr = _device->CreateSamplerState(&bilinearSamplerDesc, &_bilinearSamplerState);
     if (FAILED(hr)) { return hr; }
 
-    _immediateContext->PSSetSamplers(0, 1, &_bilinearSamplerState);
-
     ////////////////////////////
 
     D3D11_BLEND_DESC blendDesc = {};
@@ -576,7 +545,7 @@ HRESULT DX11Framework::InitRunTimeData()
     _fog.m_range = 100.0f;
     _fog.m_start = 20.0f;
 
-    _cbData.FogW = _fog;
+    _frameBuffer.m_data.FogW = _fog;
 
     _jsonLoader.JSONSample("test.json", _gameObjects, _lightsInfo);
 
@@ -617,6 +586,8 @@ HRESULT DX11Framework::InitRunTimeData()
         if (_gameObjects[i].m_hasSpec == 1) hr = CreateDDSTextureFromFile(_device, _gameObjects[i].m_textureSpecular.c_str(), nullptr, _gameObjects[i].GetShaderResourceS()); if (FAILED(hr)) { return hr; }
 
         if (_gameObjects[i].m_hasNorm == 1) hr = CreateDDSTextureFromFile(_device, _gameObjects[i].m_textureNormal.c_str(), nullptr, _gameObjects[i].GetShaderResourceN()); if (FAILED(hr)) { return hr; }
+
+        if (_gameObjects[i].m_hasDisp == 1) hr = CreateDDSTextureFromFile(_device, _gameObjects[i].m_textureDisplacement.c_str(), nullptr, _gameObjects[i].GetShaderResourceD()); if (FAILED(hr)) { return hr; }
     }
 
     std::string name = "Textures\\Pine_Tree.dds";
@@ -627,14 +598,24 @@ HRESULT DX11Framework::InitRunTimeData()
         hr = CreateDDSTextureFromFile(_device, _terrain->GetFileName(i).c_str(), nullptr, _terrain->GetShaderResource(i)); if (FAILED(hr)) { return hr; }
     }
 
-    hr = CreateDDSTextureFromFile(_device, _terrain->GetBlendName().c_str(), nullptr, _terrain->GetShaderResourceBlend()); if (FAILED(hr)) { return hr; }
+    if (_terrain->HasSplatMap()) {
+        hr = _terrain->CreateSplatTexture(_device); if (FAILED(hr)) { return hr; }
+    }
+    else {
+        hr = CreateDDSTextureFromFile(_device, _terrain->GetBlendName().c_str(), nullptr, _terrain->GetShaderResourceBlend()); if (FAILED(hr)) { return hr; }
+    }
+
+    hr = CreateDDSTextureFromFile(_device, _terrain->GetDetailName().c_str(), nullptr, _terrain->GetShaderResourceDetail()); if (FAILED(hr)) { return hr; }
 
     //World - asteroids
     srand(time(0));
 
-    for (UINT i = 0; i < sizeof(_asteroids) / sizeof(_asteroids[0]); i++)
+    _asteroids.resize(_asteroidCount);
+    _trees.resize(_treeCount);
+
+    for (UINT i = 0; i < _asteroidCount; i++)
     {
-        if (i < (sizeof(_asteroids) / sizeof(_asteroids[0])) / 4) {
+        if (i < _asteroidCount / 4) {
             XMMATRIX position = XMMatrixScaling(0.15f, 0.15f, 0.15f) *
                 XMMatrixTranslation(
                     ((rand() % 500) / 100) + 7.0f,     // x
@@ -643,7 +624,7 @@ HRESULT DX11Framework::InitRunTimeData()
             * XMMatrixRotationY(rand() % 90);
             XMStoreFloat4x4(&_asteroids[i], position);
         }
-        else if (i < (sizeof(_asteroids) / sizeof(_asteroids[0])) / 2) {
+        else if (i < _asteroidCount / 2) {
             XMMATRIX position = XMMatrixScaling(0.15f, 0.15f, 0.15f) *
                 XMMatrixTranslation(
                     ((rand() % 500) / 100) - 14.0f,     // x
@@ -652,7 +633,7 @@ HRESULT DX11Framework::InitRunTimeData()
                 * XMMatrixRotationY(rand() % 90);
             XMStoreFloat4x4(&_asteroids[i], position);
         }
-        else if (i < ((sizeof(_asteroids) / sizeof(_asteroids[0])) / 4) * 3) {
+        else if (i < (_asteroidCount / 4) * 3) {
             XMMATRIX position = XMMatrixScaling(0.15f, 0.15f, 0.15f) *
                 XMMatrixTranslation(
                     ((rand() % 1000) / 100) - 5.0f,     // x
@@ -672,35 +653,36 @@ HRESULT DX11Framework::InitRunTimeData()
         }
     }
 
-    for (UINT i = 0; i < sizeof(_trees) / sizeof(_trees[0]); i++)
+    for (UINT i = 0; i < _treeCount; i++)
     {
-        XMMATRIX position = XMMatrixScaling(10.0f, 10.0f, 10.0f) *
-            XMMatrixTranslation(
-                ((rand() % 10000) / 100),     // x
-                (((rand() % 1000) / 100)) + 30,     // y
-                ((rand() % 1000) / 100) + 50.0f);   // z
-        XMStoreFloat4x4(&_trees[i], position);
+        _trees[i].Position = XMFLOAT3(
+            (float)((rand() % 10000) / 100),     // x
+            (float)(((rand() % 1000) / 100) + 30),     // y
+            ((rand() % 1000) / 100) + 50.0f);   // z
+        _trees[i].AtlasIndex = 0; // single tree texture, an atlas only needs more cells in BillboardBuffer
+        _trees[i].Size = XMFLOAT2(20.0f, 20.0f);
+        _trees[i].padding = XMFLOAT2(0.0f, 0.0f);
     }
 
     bool changed = false;
 
     do {
         changed = false;
-        for (UINT i = 0; i < sizeof(_trees) / sizeof(_trees[0]); i++)
+        for (UINT i = 0; i < _treeCount; i++)
         {
-            for (UINT j = 0; j < sizeof(_trees) / sizeof(_trees[0]); j++)
+            for (UINT j = 0; j < _treeCount; j++)
             {
                 if (j != i) {
-                    if (_trees[i]._41 == _trees[j]._41 && 
-                        (_trees[i]._43 > (_trees[j]._43 - 10) && _trees[i]._43 < (_trees[j]._43 + 10))) // x
+                    if (_trees[i].Position.x == _trees[j].Position.x && 
+                        (_trees[i].Position.z > (_trees[j].Position.z - 10) && _trees[i].Position.z < (_trees[j].Position.z + 10))) // x
                     {
-                        _trees[i]._41 += 1.0f;
+                        _trees[i].Position.x += 1.0f;
                         changed = true;
                     }
-                    if (_trees[i]._43 == _trees[j]._43 && 
-                        (_trees[i]._41 > (_trees[j]._41 - 10) && _trees[i]._41 < (_trees[j]._41 + 10))) // z
+                    if (_trees[i].Position.z == _trees[j].Position.z && 
+                        (_trees[i].Position.x > (_trees[j].Position.x - 10) && _trees[i].Position.x < (_trees[j].Position.x + 10))) // z
                     {
-                        _trees[i]._43 += 1.0f;
+                        _trees[i].Position.z += 1.0f;
                         changed = true;
                     }
                 }
@@ -708,19 +690,555 @@ HRESULT DX11Framework::InitRunTimeData()
         }
     } while (changed);
 
+    // positions never change after this, the buffers are only reordered by view depth
+    hr = CreateInstanceBuffer(_asteroids, &_asteroidInstanceBuffer); if (FAILED(hr)) { return hr; }
+    hr = CreateBillboardBuffer(_trees, &_treeBillboardBuffer, &_treeBillboardView); if (FAILED(hr)) { return hr; }
+
     XMStoreFloat4x4(_terrain->getPosition(), XMMatrixIdentity() * XMMatrixTranslation(0.0f, 0.0f, 0.0f));
 
+    InitRenderTables();
+    InitSceneBVH();
+    InitOccluders();
+
+    // the scene's materials compile together so their misses run in parallel, fog variants wait for the first toggle
+    std::vector<UINT> permutations;
+    for (const RenderMaterial& material : _materials) permutations.push_back(GetPixelPermutation(material));
+
+    hr = CompilePixelPermutations(permutations);
+    if (FAILED(hr)) { return hr; }
+
     return S_OK;
 }
 
+/// <summary>
+/// PS_main variant for a material under the current fog setting, bit 0 texture, 1 spec map, 2 normal map, 3 fog
+/// </summary>
+/// <param name="material"></param>
+/// <returns></returns>
+UINT DX11Framework::GetPixelPermutation(const RenderMaterial& material) {
+    return (material.m_hasTexture == 1 ? 1u : 0u)
+        | (material.m_specMap == 1 ? 2u : 0u)
+        | (material.m_normMap == 1 ? 4u : 0u)
+        | (_frameBuffer.m_data.FogEnabled ? 8u : 0u);
+}
+
+/// <summary>
+/// the material's variant, or when that failed to compile the nearest one that did, dropping fog first, then the
+/// normal map, spec map and texture. startup compiles every material's variant without fog, so one is always found
+/// </summary>
+/// <param name="material"></param>
+/// <returns></returns>
+ID3D11PixelShader* DX11Framework::GetPixelShader(const RenderMaterial& material) {
+    UINT permutation = GetPixelPermutation(material);
+    for (UINT bit = PIXEL_PERMUTATION_COUNT >> 1; !_pixelPermutations[permutation] && bit; bit >>= 1)
+    {
+        permutation &= ~bit;
+    }
+    return _pixelPermutations[permutation];
+}
+
+/// <summary>
+/// compile and create whichever of the permutations do not exist yet, through the shader cache so warm starts skip
+/// the compiler. only called on the main thread, recording threads just read _pixelPermutations
+/// </summary>
+/// <param name="permutations">may repeat and may include ones already compiled or failed, a failure is reported once and never retried</param>
+/// <returns></returns>
+HRESULT DX11Framework::CompilePixelPermutations(const std::vector<UINT>& permutations) {
+    static const char* defineNames[] = { "HAS_TEXTURE", "SPEC_MAP", "NORM_MAP", "FOG_ENABLED" };
+
+    std::vector<UINT> missing;
+    std::vector<ShaderSource> shaders;
+    for (UINT permutation : permutations)
+    {
+        permutation &= PIXEL_PERMUTATION_COUNT - 1;
+        if (_pixelPermutations[permutation] || _pixelPermutationFailed[permutation] || std::find(missing.begin(), missing.end(), permutation) != missing.end()) continue;
+
+        ShaderSource source = { L"SimpleShaders.hlsl", "PS_main", "ps_5_0" };
+        for (UINT bit = 0; bit < ARRAYSIZE(defineNames); bit++)
+        {
+            source.m_defines.push_back({ defineNames[bit], (permutation & (1u << bit)) ? "1" : "0" });
+        }
+
+        missing.push_back(permutation);
+        shaders.push_back(source);
+    }
+
+    if (missing.empty()) return S_OK;
+
+    ShaderCache cache;
+    HRESULT hr = cache.Compile(shaders.data(), (UINT)shaders.size(), _shaderFlags);
+
+    for (UINT i = 0; i < shaders.size(); i++)
+    {
+        if (FAILED(shaders[i].m_result) && !shaders[i].m_errors.empty()) {
+            MessageBoxA(_windowHandle, shaders[i].m_errors.c_str(), nullptr, ERROR);
+        }
+
+        if (SUCCEEDED(shaders[i].m_result)) {
+            HRESULT created = _device->CreatePixelShader(shaders[i].m_bytecode->GetBufferPointer(), shaders[i].m_bytecode->GetBufferSize(), nullptr, &_pixelPermutations[missing[i]]);
+            if (SUCCEEDED(hr)) hr = created;
+        }
+
+        if (!_pixelPermutations[missing[i]]) _pixelPermutationFailed[missing[i]] = true;
+
+        if (shaders[i].m_bytecode) shaders[i].m_bytecode->Release();
+    }
+
+    return hr;
+}
+
+/// <summary>
+/// create a deferred context for every recording thread and each recorder's material and object buffers
+/// </summary>
+/// <returns></returns>
+HRESULT DX11Framework::InitRecorders() {
+    HRESULT hr = S_OK;
+
+    // deferred contexts always work, without driver command lists the runtime emulates them and scales worse
+    D3D11_FEATURE_DATA_THREADING threading = {};
+    if (SUCCEEDED(_device->CheckFeatureSupport(D3D11_FEATURE_THREADING, &threading, sizeof(threading)))) {
+        _driverCommandLists = threading.DriverCommandLists == TRUE;
+    }
+
+    // offsets need 11.1 hardware or a driver that exposes them on 10.x/11.0, without them every draw maps its buffers
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    if (SUCCEEDED(_device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options)))) {
+        _constantBufferOffsets = options.ConstantBufferOffsetting == TRUE;
+    }
+
+    if (_recordThreads == 0) _recordThreads = max(1u, std::thread::hardware_concurrency());
+    _recordThreads = min(_recordThreads, MAX_RECORD_THREADS);
+
+    for (UINT i = 0; i <= MAX_RECORD_THREADS; i++)
+    {
+        if (i > 0) {
+            ID3D11DeviceContext* deferredContext;
+            hr = _device->CreateDeferredContext(0, &deferredContext);
+            if (FAILED(hr)) { return hr; }
+
+            hr = deferredContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&_recorders[i].m_context));
+            deferredContext->Release();
+            if (FAILED(hr)) { return hr; }
+
+            _recorders[i].m_stateCache.SetContext(_recorders[i].m_context);
+        }
+
+        hr = _recorders[i].m_materialBuffer.Create(_device);
+        if (FAILED(hr)) { return hr; }
+
+        hr = _recorders[i].m_objectBuffer.Create(_device);
+        if (FAILED(hr)) { return hr; }
+    }
+
+    return S_OK;
+}
+
+/// <summary>
+/// copy a set of world matrices into a dynamic vertex buffer read once per instance, UploadSortedInstances reorders it each frame
+/// </summary>
+/// <param name="instances"></param>
+/// <param name="buffer"></param>
+/// <returns></returns>
+HRESULT DX11Framework::CreateInstanceBuffer(const std::vector<XMFLOAT4X4>& instances, ID3D11Buffer** buffer) {
+    if (instances.empty()) return S_OK; // nothing to draw, DrawInstanced skips a null buffer
+
+    D3D11_BUFFER_DESC instanceBufferDesc = {};
+    instanceBufferDesc.ByteWidth = (UINT)(instances.size() * sizeof(XMFLOAT4X4));
+    instanceBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    instanceBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    instanceBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+    D3D11_SUBRESOURCE_DATA instanceData = { instances.data() };
+
+    return _device->CreateBuffer(&instanceBufferDesc, &instanceData, buffer);
+}
+
+/// <summary>
+/// copy billboard points into a dynamic structured buffer the billboard vertex shader reads through view
+/// </summary>
+/// <param name="points"></param>
+/// <param name="buffer"></param>
+/// <param name="view"></param>
+/// <returns></returns>
+HRESULT DX11Framework::CreateBillboardBuffer(const std::vector<BillboardPoint>& points, ID3D11Buffer** buffer, ID3D11ShaderResourceView** view) {
+    if (points.empty()) return S_OK; // nothing to draw, SubmitScene skips a null view
+
+    D3D11_BUFFER_DESC pointBufferDesc = {};
+    pointBufferDesc.ByteWidth = (UINT)(points.size() * sizeof(BillboardPoint));
+    pointBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    pointBufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    pointBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    pointBufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    pointBufferDesc.StructureByteStride = sizeof(BillboardPoint);
+
+    D3D11_SUBRESOURCE_DATA pointData = { points.data() };
+
+    HRESULT hr = _device->CreateBuffer(&pointBufferDesc, &pointData, buffer);
+    if (FAILED(hr)) return hr;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc = {};
+    viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+    viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    viewDesc.Buffer.FirstElement = 0;
+    viewDesc.Buffer.NumElements = (UINT)points.size();
+
+    return _device->CreateShaderResourceView(*buffer, &viewDesc, view);
+}
+
+/// <summary>
+/// write the facing mode and atlas layout to the billboard constant buffer
+/// </summary>
+void DX11Framework::UpdateBillboardSettings() {
+    BillboardBuffer billboardData;
+    billboardData.Facing = (UINT)_billboardFacing;
+    billboardData.AtlasColumns = 1;
+    billboardData.AtlasRows = 1;
+    billboardData.padding = 0.0f;
+
+    _immediateContext->UpdateSubresource(_billboardSettingsBuffer, 0, nullptr, &billboardData, 0, 0);
+}
+
+static const XMFLOAT3* InstancePositions(const std::vector<XMFLOAT4X4>& instances) { return (const XMFLOAT3*)&instances[0]._41; }
+static const XMFLOAT3* InstancePositions(const std::vector<BillboardPoint>& instances) { return &instances[0].Position; }
+
+/// <summary>
+/// rewrite an instance buffer with its instances in view depth order for the view's camera. one draw
+/// covers every instance in buffer order, so the queue's per item depth sort cannot order them on its own.
+/// with culling on, only the instances CullViews found inside the view frustum are sorted and written
+/// </summary>
+/// <param name="instances">unsorted matrices or points the buffer was created from</param>
+/// <param name="buffer"></param>
+/// <param name="order"></param>
+/// <param name="visible">indices into instances, every instance is drawn when null</param>
+/// <returns>instances written to the front of buffer, the count to draw</returns>
+template<typename T>
+UINT DX11Framework::UploadSortedInstances(const std::vector<T>& instances, ID3D11Buffer* buffer, DepthOrder order, const std::vector<UINT>* visible) {
+    if (!buffer || instances.empty()) return 0;
+
+    const XMFLOAT4X4& view = *_cameras[_viewCamera]->GetView();
+    UINT count = (UINT)instances.size();
+
+    if (_frustumCulling && visible) {
+        count = (UINT)visible->size();
+        if (count == 0) return 0;
+        _instanceSorter.Sort(InstancePositions(instances), sizeof(T), visible->data(), count, view, order);
+    }
+    else {
+        _instanceSorter.Sort(InstancePositions(instances), sizeof(T), count, view, order);
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(_immediateContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return 0;
+
+    _instanceSorter.Gather(instances.data(), (T*)mapped.pData);
+    _immediateContext->Unmap(buffer, 0);
+    return count;
+}
+
+/// <summary>
+/// one BVH over everything culled one by one: asteroids, then trees, then the objects Update moves. the instanced
+/// sets never move after creation, so only the moving objects' boxes are refitted each frame
+/// </summary>
+void DX11Framework::InitSceneBVH() {
+    std::vector<AABB> bounds;
+
+    // asteroids are drawn with the crate mesh, without bounds on it they are never culled
+    const XMFLOAT4& asteroidSphere = _meshes[2].m_boundingSphere;
+    _bvhAsteroids = asteroidSphere.w > 0.0f ? (UINT)_asteroids.size() : 0;
+    for (UINT i = 0; i < _bvhAsteroids; i++) bounds.push_back(SphereToAABB(TransformBoundingSphere(asteroidSphere, _asteroids[i])));
+
+    // a billboard turns about its centre, so its corners stay on the sphere through them
+    _bvhTrees = (UINT)_trees.size();
+    for (const BillboardPoint& tree : _trees) {
+        float radius = 0.5f * sqrtf(tree.Size.x * tree.Size.x + tree.Size.y * tree.Size.y);
+        bounds.push_back(SphereToAABB(XMFLOAT4(tree.Position.x, tree.Position.y, tree.Position.z, radius)));
+    }
+
+    // in SubmitScene's order, which hands each Submit its moving object id
+    UINT fence = (UINT)_gameObjects.size() - 2;
+    _movingObjects.clear();
+    _movingObjects.push_back({ &_cubes[0], 2 });
+    _movingObjects.push_back({ &_specCrate, 3 });
+    for (UINT i = 1; i < sizeof(_cubes) / sizeof(_cubes[0]); i++) _movingObjects.push_back({ &_cubes[i], fence });
+    for (UINT i = 0; i < sizeof(_pyramids) / sizeof(_pyramids[0]); i++) _movingObjects.push_back({ &_pyramids[i], _pyramidMesh });
+
+    // Update has not placed them yet, they go in as points at the origin and are refitted before the first frame
+    AABB unplaced = { XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f) };
+    bounds.resize(bounds.size() + _movingObjects.size(), unplaced);
+
+    _sceneBVH.Build(bounds.data(), (UINT)bounds.size());
+    _sceneSlots.assign(bounds.size(), (UINT)VisibilityCache::NOT_VISIBLE);
+    for (VisibilityCache& cache : _visibilityCaches) cache.Reset();
+}
+
+/// <summary>
+/// world box of a moving object's mesh, a mesh without bounds gets a point at its translation as it is never culled
+/// </summary>
+/// <param name="object"></param>
+/// <returns></returns>
+AABB DX11Framework::GetMovingObjectBounds(const MovingObject& object) {
+    const XMFLOAT4& sphere = _meshes[object.m_mesh].m_boundingSphere;
+    if (sphere.w <= 0.0f) {
+        XMFLOAT3 position(object.m_world->_41, object.m_world->_42, object.m_world->_43);
+        return { position, position };
+    }
+    return SphereToAABB(TransformBoundingSphere(sphere, *object.m_world));
+}
+
+/// <summary>
+/// refit the objects whose boxes changed since the last frame, every view's cached result for them is stale
+/// </summary>
+void DX11Framework::RefitMovingObjects() {
+    UINT first = _bvhAsteroids + _bvhTrees;
+    for (UINT i = 0; i < (UINT)_movingObjects.size(); i++) {
+        AABB bounds = GetMovingObjectBounds(_movingObjects[i]);
+        if (memcmp(&bounds, &_sceneBVH.GetBounds(first + i), sizeof(AABB)) == 0) continue;
+
+        _sceneBVH.UpdateBounds(first + i, bounds);
+        for (VisibilityCache& cache : _visibilityCaches) cache.Invalidate(first + i);
+    }
+}
+
+/// <summary>
+/// one traversal of the scene BVH for every view at once, sorting what each view sees into the visible asteroids and
+/// trees UploadSortedInstances draws and the flags Submit checks for moving objects. with visibility caching on,
+/// each view's cache keeps its frustum results between frames instead and the traversal is skipped. with occlusion
+/// culling on, each view draws the occluders from its own camera and objects they cover are dropped from that view only
+/// </summary>
+void DX11Framework::CullViews() {
+    UINT viewCount = (UINT)_views.size();
+    for (UINT v = 0; v < viewCount; v++) {
+        _viewFrusta[v] = ExtractFrustum(*_cameras[_views[v].m_camera]->GetViewProjection());
+
+        ViewVisibility& visibility = _viewVisibility[v];
+        visibility.m_asteroids.clear();
+        visibility.m_trees.clear();
+        visibility.m_moving.assign(_movingObjects.size(), 0);
+    }
+
+    // a cache that is not updated every frame would miss refits, it starts over when it is next used
+    for (UINT v = 0; v < SceneBVH::MAX_VIEWS; v++) {
+        if (!_frustumCulling || !_visibilityCaching || v >= viewCount) _visibilityCaches[v].Reset();
+    }
+    if (!_frustumCulling) return;
+
+    if (_visibilityCaching) {
+        _sceneVisible.clear();
+        _sceneViewMasks.clear();
+
+        for (UINT v = 0; v < viewCount; v++) {
+            _visibilityCaches[v].Update(_sceneBVH, _viewFrusta[v], *_cameras[_views[v].m_camera]->GetView());
+
+            for (UINT object : _visibilityCaches[v].GetVisible()) {
+                UINT& slot = _sceneSlots[object];
+                if (slot == VisibilityCache::NOT_VISIBLE) {
+                    slot = (UINT)_sceneVisible.size();
+                    _sceneVisible.push_back(object);
+                    _sceneViewMasks.push_back(0);
+                }
+                _sceneViewMasks[slot] |= 1 << v;
+            }
+        }
+
+        for (UINT object : _sceneVisible) _sceneSlots[object] = VisibilityCache::NOT_VISIBLE;
+    }
+    else {
+        _sceneBVH.CullFrusta(_viewFrusta, viewCount, _sceneVisible, _sceneViewMasks);
+    }
+
+    // the software depth buffer holds one camera at a time
+    if (_occlusionCulling) {
+        for (UINT v = 0; v < viewCount; v++) {
+            RenderOccluders(_views[v].m_camera);
+
+            for (UINT i = 0; i < (UINT)_sceneVisible.size(); i++) {
+                if (!(_sceneViewMasks[i] & (1 << v))) continue;
+
+                const AABB& bounds = _sceneBVH.GetBounds(_sceneVisible[i]);
+                if (!_occlusionCuller.IsVisible(bounds.m_min, bounds.m_max)) _sceneViewMasks[i] &= ~(1 << v);
+            }
+        }
+    }
+
+    UINT firstMoving = _bvhAsteroids + _bvhTrees;
+    for (UINT i = 0; i < (UINT)_sceneVisible.size(); i++) {
+        UINT object = _sceneVisible[i];
+
+        for (UINT v = 0, views = _sceneViewMasks[i]; views; v++, views >>= 1) {
+            if (!(views & 1)) continue;
+
+            ViewVisibility& visibility = _viewVisibility[v];
+            if (object < _bvhAsteroids) visibility.m_asteroids.push_back(object);
+            else if (object < firstMoving) visibility.m_trees.push_back(object - _bvhAsteroids);
+            else visibility.m_moving[object - firstMoving] = 1;
+        }
+    }
+}
+
+/// <summary>
+/// box proxies that follow the crates, the terrain builds its own coarse patches with its buffers and updates them
+/// after a crater
+/// </summary>
+void DX11Framework::InitOccluders() {
+    // the crates are solid cubes, so their mesh bounds pulled in a little fit inside the displaced surface too
+    const XMFLOAT4X4* crateWorlds[2] = { &_cubes[0], &_specCrate };
+    _occluderProxies.clear();
+    for (UINT i = 0; i < 2; i++) {
+        const MeshData* mesh = _gameObjects[2 + i].GetMeshData();
+        if (mesh->m_boundingSphere.w <= 0.0f) continue; // no bounds were computed
+
+        XMVECTOR centre = XMVectorScale(XMVectorAdd(XMLoadFloat3(&mesh->m_boundsMin), XMLoadFloat3(&mesh->m_boundsMax)), 0.5f);
+        XMVECTOR halfExtent = XMVectorScale(XMVectorSubtract(XMLoadFloat3(&mesh->m_boundsMax), XMLoadFloat3(&mesh->m_boundsMin)), 0.45f);
+
+        OccluderProxy proxy;
+        proxy.m_world = crateWorlds[i];
+        XMStoreFloat3(&proxy.m_min, XMVectorSubtract(centre, halfExtent));
+        XMStoreFloat3(&proxy.m_max, XMVectorAdd(centre, halfExtent));
+        _occluderProxies.push_back(proxy);
+    }
+}
+
+/// <summary>
+/// draws this frame's occluders into the software depth buffer for a camera
+/// </summary>
+/// <param name="camera">index into _cameras</param>
+void DX11Framework::RenderOccluders(UINT camera) {
+    _occlusionCuller.Begin(*_cameras[camera]->GetViewProjection());
+
+    const std::vector<XMFLOAT3>& terrainVertices = _terrain->GetOccluderVertices();
+    const std::vector<UINT>& terrainIndices = _terrain->GetOccluderIndices();
+    if (!terrainIndices.empty()) {
+        _occlusionCuller.AddOccluder(terrainVertices.data(), (UINT)terrainVertices.size(), terrainIndices.data(), (UINT)terrainIndices.size(), *_terrain->getPosition());
+    }
+
+    for (const OccluderProxy& proxy : _occluderProxies) _occlusionCuller.AddBoxOccluder(proxy.m_min, proxy.m_max, *proxy.m_world);
+
+    _occlusionCuller.Rasterize(_recordThreads);
+}
+
+/// <summary>
+/// fill the program, material and mesh tables draw items index into. programs carry every piece of state
+/// the old hand ordered Draw set between sections, so the queue can run them in any order
+/// </summary>
+void DX11Framework::InitRenderTables() {
+    FLOAT blendFactor[4] = { 0.75f, 0.75f, 0.75f, 1.0f };
+
+    RenderProgram& lit = _programs[(UINT)DrawProgram::Lit];
+    lit.m_vertexShader = _vertexShader;
+    lit.m_pixelPermutations = true;
+    lit.m_inputLayout = _inputLayout;
+    lit.m_rasterizer = _fillState;
+
+    // chain link fence is seen from both sides
+    RenderProgram& litNoCull = _programs[(UINT)DrawProgram::LitNoCull];
+    litNoCull = lit;
+    litNoCull.m_rasterizer = _cullnoneState;
+
+    RenderProgram& litTessellated = _programs[(UINT)DrawProgram::LitTessellated];
+    litTessellated = lit;
+    litTessellated.m_vertexShader = _tessVertexShader;
+    litTessellated.m_hullShader = _tessHullShader;
+    litTessellated.m_domainShader = _tessDomainShader;
+    litTessellated.m_topology = D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST;
+
+    RenderProgram& billboard = _programs[(UINT)DrawProgram::Billboard];
+    billboard = lit;
+    billboard.m_vertexShader = _billboardVertexShader;
+    billboard.m_pixelShader = _billboardPixelShader;
+    billboard.m_pixelPermutations = false;
+    billboard.m_inputLayout = nullptr; // every tree's quad comes from the point buffer and SV_VertexID
+
+    // no input layout, the vertex shader builds the grid from SV_VertexID
+    RenderProgram& terrain = _programs[(UINT)DrawProgram::Terrain];
+    terrain.m_vertexShader = _terrainVertexShader;
+    terrain.m_pixelShader = _terrainPixelShader;
+    terrain.m_rasterizer = _fillState;
+
+    RenderProgram& terrainTessellated = _programs[(UINT)DrawProgram::TerrainTessellated];
+    terrainTessellated = terrain;
+    terrainTessellated.m_vertexShader = _terrainPatchVertexShader;
+    terrainTessellated.m_hullShader = _terrainHullShader;
+    terrainTessellated.m_domainShader = _terrainDomainShader;
+    terrainTessellated.m_topology = D3D11_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST;
+
+    RenderProgram& skybox = _programs[(UINT)DrawProgram::Skybox];
+    skybox.m_vertexShader = _skyboxVertexShader;
+    skybox.m_pixelShader = _skyboxPixelShader;
+    skybox.m_inputLayout = _inputLayout;
+    skybox.m_rasterizer = _cullnoneState;
+    skybox.m_depthStencil = _depthStencilSkybox;
+    skybox.m_stencilRef = 1;
+
+    RenderProgram& asteroid = _programs[(UINT)DrawProgram::AsteroidBlend];
+    asteroid = lit;
+    asteroid.m_vertexShader = _instanceVertexShader;
+    asteroid.m_inputLayout = _instanceInputLayout;
+    asteroid.m_blendState = _blendState;
+    memcpy(asteroid.m_blendFactor, blendFactor, sizeof(blendFactor));
+
+    _materials.clear();
+    _meshes.clear();
+
+    for (UINT i = 0; i < _gameObjects.size(); i++)
+    {
+        _materials.push_back(_gameObjects[i].GetMaterial());
+        _meshes.push_back(_gameObjects[i].GetMesh());
+    }
+
+    // pyramid reuses the crate textures without its normal map
+    RenderMaterial pyramidMaterial = _gameObjects[2].GetMaterial();
+    pyramidMaterial.m_hasTexture = 1;
+    pyramidMaterial.m_specMap = 1;
+    pyramidMaterial.m_normMap = 0;
+    _pyramidMaterial = (UINT)_materials.size();
+    _materials.push_back(pyramidMaterial);
+
+    RenderMaterial billboardMaterial;
+    billboardMaterial.m_pixelResources[0] = _billboardTexture;
+    billboardMaterial.m_pixelResourceCount = 1;
+    billboardMaterial.m_hasTexture = 1;
+    billboardMaterial.m_vertexResource = _treeBillboardView;
+    billboardMaterial.m_vertexConstants = _billboardSettingsBuffer;
+    _billboardMaterial = (UINT)_materials.size();
+    _materials.push_back(billboardMaterial);
+
+    _terrainMaterial = (UINT)_materials.size();
+    _materials.push_back(_terrain->GetMaterial());
+
+    RenderMesh pyramidMesh;
+    pyramidMesh.m_vertexBuffer = _pyramidVertexBuffer;
+    pyramidMesh.m_indexBuffer = _pyramidIndexBuffer;
+    pyramidMesh.m_stride = sizeof(SimpleVertex);
+    pyramidMesh.m_count = 18;
+    pyramidMesh.m_boundingSphere = XMFLOAT4(0.0f, 0.0f, 0.0f, sqrtf(3.0f)); // base corners are the farthest vertices from the origin
+    _pyramidMesh = (UINT)_meshes.size();
+    _meshes.push_back(pyramidMesh);
+
+    RenderMesh billboardMesh;
+    billboardMesh.m_count = _treeCount * BILLBOARD_VERTICES;
+    billboardMesh.m_indexed = false;
+    _billboardMesh = (UINT)_meshes.size();
+    _meshes.push_back(billboardMesh);
+
+    _terrainMesh = (UINT)_meshes.size();
+    _meshes.push_back(_terrain->GetMesh());
+}
+
 DX11Framework::~DX11Framework()
 {
+    for (UINT i = 1; i <= MAX_RECORD_THREADS; i++)
+    {
+        if (_recorders[i].m_commandList) _recorders[i].m_commandList->Release();
+        if (_recorders[i].m_context) _recorders[i].m_context->Release();
+    }
+
     if (_immediateContext)_immediateContext->Release();
     if (_device)_device->Release();
     if (_dxgiDevice)_dxgiDevice->Release();
     if (_dxgiFactory)_dxgiFactory->Release();
     if (_frameBufferView)_frameBufferView->Release();
     if (_swapChain)_swapChain->Release();
+    if (_frameLatencyWaitable) CloseHandle(_frameLatencyWaitable);
 
     if (_fillState)_fillState->Release();
     if (_wireframeState)_wireframeState->Release();
@@ -728,8 +1246,10 @@ DX11Framework::~DX11Framework()
 
     if (_vertexShader)_vertexShader->Release();
     if (_inputLayout)_inputLayout->Release();
-    if (_pixelShader)_pixelShader->Release();
-    if (_constantBuffer)_constantBuffer->Release();
+    for (ID3D11PixelShader* permutation : _pixelPermutations)
+    {
+        if (permutation) permutation->Release();
+    }
     if (_pyramidVertexBuffer)_pyramidVertexBuffer->Release();
     if (_pyramidIndexBuffer)_pyramidIndexBuffer->Release();
     if (_lineVertexBuffer)_lineVertexBuffer->Release();
@@ -741,14 +1261,26 @@ DX11Framework::~DX11Framework()
     if (_skyboxPixelShader) _skyboxPixelShader->Release();
     if (_depthStencilSkybox) _depthStencilSkybox->Release();
 
+    if (_instanceVertexShader) _instanceVertexShader->Release();
+    if (_instanceInputLayout) _instanceInputLayout->Release();
+    if (_asteroidInstanceBuffer) _asteroidInstanceBuffer->Release();
+    if (_treeBillboardBuffer) _treeBillboardBuffer->Release();
+    if (_treeBillboardView) _treeBillboardView->Release();
+    if (_billboardSettingsBuffer) _billboardSettingsBuffer->Release();
+
     if (_billboardVertexShader) _billboardVertexShader->Release();
     if (_billboardPixelShader) _billboardPixelShader->Release();
 
     if (_terrainVertexShader) _terrainVertexShader->Release();
     if (_terrainPixelShader) _terrainPixelShader->Release();
 
-    if (_billboardVertexBuffer) _billboardVertexBuffer->Release();
-    if (_billboardIndexBuffer) _billboardIndexBuffer->Release();
+    if (_tessVertexShader) _tessVertexShader->Release();
+    if (_tessHullShader) _tessHullShader->Release();
+    if (_tessDomainShader) _tessDomainShader->Release();
+    if (_terrainPatchVertexShader) _terrainPatchVertexShader->Release();
+    if (_terrainHullShader) _terrainHullShader->Release();
+    if (_terrainDomainShader) _terrainDomainShader->Release();
+    if (_tessellationBuffer) _tessellationBuffer->Release();
 
     if (_billboardTexture) _billboardTexture->Release();
 
@@ -760,12 +1292,14 @@ DX11Framework::~DX11Framework()
 
 void DX11Framework::Update()
 {
-    //Static initializes this value only once    
-    static ULONGLONG frameStart = GetTickCount64();
+    _telemetry.BeginFrame();
+
+    // waits for the swap chain and the frame rate cap first, so the input read below is as late as it can be
+    _telemetry.BeginPhase(FramePhase::Wait);
+    float deltaTime = (float)_framePacer.BeginFrame();
+    _telemetry.EndPhase(FramePhase::Wait);
 
-    ULONGLONG frameNow = GetTickCount64();
-    float deltaTime = (frameNow - frameStart) / 1000.0f;
-    frameStart = frameNow;
+    _telemetry.BeginPhase(FramePhase::Update);
 
     static float simpleCount = 0.0f;
     simpleCount += deltaTime;
@@ -783,14 +1317,43 @@ void DX11Framework::Update()
         if (GetAsyncKeyState(VK_SUBTRACT) & 0x0001) {
             if (_fogToggle == false) {
                 _fogToggle = true;
-                _cbData.FogEnabled = 1;
+                _frameBuffer.m_data.FogEnabled = 1;
             }
             else {
                 _fogToggle = false;
-                _cbData.FogEnabled = 0;
+                _frameBuffer.m_data.FogEnabled = 0;
             }
         }
 
+        if (GetAsyncKeyState(84) & 0x0001) { // t - distance adaptive tessellation
+            _tessellation = !_tessellation;
+        }
+
+        if (GetAsyncKeyState(66) & 0x0001) { // b - cylindrical or spherical billboards
+            _billboardFacing = _billboardFacing == BillboardFacing::Cylindrical ? BillboardFacing::Spherical : BillboardFacing::Cylindrical;
+            UpdateBillboardSettings();
+        }
+
+        if (GetAsyncKeyState(70) & 0x0001) { // f - frustum culling
+            _frustumCulling = !_frustumCulling;
+        }
+
+        if (GetAsyncKeyState(79) & 0x0001) { // o - software occlusion culling
+            _occlusionCulling = !_occlusionCulling;
+        }
+
+        if (GetAsyncKeyState(75) & 0x0001) { // k - keep frustum results between frames
+            _visibilityCaching = !_visibilityCaching;
+        }
+
+        if (GetAsyncKeyState(86) & 0x0001) { // v - single view, split screen or picture in picture
+            _viewLayout = (ViewLayout)(((UINT)_viewLayout + 1) % (UINT)ViewLayout::Count);
+        }
+
+        if (GetAsyncKeyState(67) & 0x0001) { // c - crater below the camera, does nothing unless started with -deform
+            _terrain->Deform(_immediateContext, _cameras[currentCam]->GetPosition(), 8.0f, 4.0f, TerrainBrush::Crater);
+        }
+
         if (GetAsyncKeyState(48) & 0x0001) { // 0
             if (currentCam != 0) {
                 currentCam = 0;
@@ -825,16 +1388,21 @@ void DX11Framework::Update()
     }
 
     _cameras[currentCam]->Update(deltaTime);
+    UpdateViews(deltaTime);
+
+    _terrain->UpdateStreaming(_immediateContext, _cameras[currentCam]->GetPosition()); // no-op unless the heightmap is streamed
 
     MouseDetection(_windowHandle);
 
-    _cbData.DiffuseMaterial = _diffuseMaterial;
-    _cbData.AmbientMaterial = _ambientMaterial;
-    _cbData.SpecularMaterial = _specularMaterial;
-    _cbData.SpecularPower = 10.0f;
-    _cbData.PointLight = _pointLight;
-    _cbData.DirectionalLight = _directionalLight;
-    _cbData.EyePosW = _cameras[currentCam]->GetPosition();
+    for (DrawRecorder& recorder : _recorders)
+    {
+        recorder.m_materialBuffer.m_data.DiffuseMaterial = _diffuseMaterial;
+        recorder.m_materialBuffer.m_data.AmbientMaterial = _ambientMaterial;
+        recorder.m_materialBuffer.m_data.SpecularMaterial = _specularMaterial;
+        recorder.m_materialBuffer.m_data.SpecularPower = 10.0f;
+    }
+    _frameBuffer.m_data.PointLight = _pointLight;
+    _frameBuffer.m_data.DirectionalLight = _directionalLight;
 
     XMStoreFloat4x4(&_cubes[0], XMMatrixIdentity() * XMMatrixTranslation(0, 30, 0) * XMMatrixRotationY(simpleCount)); // axis rotation
     //XMStoreFloat4x4(&_cubes[0], XMMatrixIdentity());
@@ -849,263 +1417,621 @@ void DX11Framework::Update()
     XMStoreFloat4x4(&_pyramids[0], XMMatrixScaling(0.25f, 0.25f, 0.25f) * XMMatrixTranslation(1.5, 0, 4) * XMMatrixRotationY(-simpleCount) * XMLoadFloat4x4(&_cubes[1]));
     //XMStoreFloat4x4(&_pyramids[0], XMMatrixScaling(0.25f, 0.25f, 0.25f) * XMMatrixTranslation(1.5, 0, 4) * XMLoadFloat4x4(&_cubes[1]));
 
-    for (UINT i = 0; i < sizeof(_asteroids) / sizeof(_asteroids[0]); i++)
-    {
-        XMMATRIX position = XMLoadFloat4x4(&_asteroids[i]);
-        //position *= XMMatrixRotationY(1 * deltaTime);
-        XMStoreFloat4x4(&_asteroids[i], position);
-    }
+    // non norm mapped cube - show working spec map and specular lighting
+    // needed as when using norm map, specular light can slightly bleed onto back
+    XMStoreFloat4x4(&_specCrate, XMMatrixTranslation(0, 10.0f, 0) * XMLoadFloat4x4(&_cubes[0]));
 
-    XMFLOAT3 camPos = _cameras[currentCam]->GetPosition();
-    XMStoreFloat4x4(&_skybox, XMMatrixScaling(100.0f, 100.0f, 100.0f) * XMMatrixTranslation(camPos.x, camPos.y, camPos.z));
+    RefitMovingObjects();
+
+    _telemetry.EndPhase(FramePhase::Update);
 }
 
 void DX11Framework::Draw()
 {    
-    //Present unbinds render target, so rebind and clear at start of each frame
+    _telemetry.BeginPhase(FramePhase::Build);
+
+    for (DrawRecorder& recorder : _recorders) recorder.m_stateCache.BeginFrame();
+
+    //Present unbinds render target, so rebind and clear at start of each frame. the viewport and the rest of the
+    //frame state are bound per view by BeginView
     float backgroundColor[4] = { 0.025f, 0.025f, 0.025f, 1.0f };  
     _immediateContext->OMSetRenderTargets(1, &_frameBufferView, _depthStencilView);
     _immediateContext->ClearRenderTargetView(_frameBufferView, backgroundColor);
-    _immediateContext->ClearDepthStencilView(_depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0); // bind as secondary render target then clear
-    //Store this frames data in constant buffer struct
-    _cbData.World = XMMatrixTranspose(XMLoadFloat4x4(&_cubes[0]));
-    _cbData.View = XMMatrixTranspose(XMLoadFloat4x4(_cameras[currentCam]->GetView()));
-    _cbData.Projection = XMMatrixTranspose(XMLoadFloat4x4(_cameras[currentCam]->GetProjection()));
 
-    //Write constant buffer data onto GPU
-    D3D11_MAPPED_SUBRESOURCE mappedSubresource;
-    _immediateContext->Map(_constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedSubresource);
-    memcpy(mappedSubresource.pData, &_cbData, sizeof(_cbData));
-    _immediateContext->Unmap(_constantBuffer, 0);
+    // all views are culled together, then each is submitted and drawn in turn
+    CullViews();
 
-    //Set object variables and draw
-    UINT stride = {sizeof(SimpleVertex)};
-    UINT offset =  0 ;
+    for (UINT view = 0; view < (UINT)_views.size(); view++) {
+        BeginView(view);
 
-    // set shaders
-    SetShaders(_vertexShader, _pixelShader);
+        // the views before this one are finished with the depth buffer, a clear lets an inset draw over the view under it
+        _immediateContext->ClearDepthStencilView(_depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
 
-    FLOAT blendFactor[4] = {0.75f, 0.75f, 0.75f, 1.0f};
-    _immediateContext->OMSetBlendState(0, 0, 0xffffffff); // no blend
+        // every system submits into the queue, sorting groups state changes and orders the passes
+        SubmitScene();
+        ExecuteRenderQueue();
+    }
 
-    /////////////////////////
-    // DRAW OPAQUE OBJECTS //
-    /////////////////////////
+    _recorders[0].m_stateCache.SetBlendState(0, 0, 0xffffffff);
+    _telemetry.EndPhase(FramePhase::Build);
 
-    SetShaderResources(_gameObjects[2].GetShaderResourceC(), _gameObjects[2].GetShaderResourceS(), _gameObjects[2].GetShaderResourceN());
+    //Present Backbuffer to screen
+    _telemetry.BeginPhase(FramePhase::Present);
+    _swapChain->Present(_framePacer.GetSyncInterval(), 0);
+    _telemetry.EndPhase(FramePhase::Present);
+
+    // every recorder filters its own context, deferred ones included
+    for (DrawRecorder& recorder : _recorders) {
+        _telemetry.AddCount(FrameCounter::StateCallsIssued, recorder.m_stateCache.GetIssuedCalls());
+        _telemetry.AddCount(FrameCounter::StateCallsElided, recorder.m_stateCache.GetElidedCalls());
+    }
 
-    SetRS(_fillState);
+    _telemetry.EndFrame();
+}
 
-    _gameObjects[2].Draw(_immediateContext, &_cbData);
+/// <summary>
+/// lay out this frame's views for _viewLayout, the active camera's first and the cameras after it in the others.
+/// only the active camera reads input, the others just have their view matrices refreshed
+/// </summary>
+/// <param name="deltaTime"></param>
+void DX11Framework::UpdateViews(float deltaTime) {
+    float width = (float)_WindowWidth;
+    float height = (float)_WindowHeight;
+    UINT cameraCount = (UINT)_cameras.size();
+
+    // a layout with fewer views than the last would leave _currentView past the end
+    _views.clear();
+    _currentView = 0;
+    switch (_viewLayout) {
+    case ViewLayout::SplitScreen:
+        // quarters keep the window's aspect, so every camera's projection still fits
+        for (UINT i = 0; i < 4; i++) {
+            _views.push_back({ (currentCam + i) % cameraCount, { (i % 2) * width * 0.5f, (i / 2) * height * 0.5f, width * 0.5f, height * 0.5f, 0.0f, 1.0f } });
+        }
+        break;
+    case ViewLayout::PictureInPicture:
+        _views.push_back({ (UINT)currentCam, { 0.0f, 0.0f, width, height, 0.0f, 1.0f } });
+        _views.push_back({ (currentCam + 1) % cameraCount, { width * 0.75f - PIP_MARGIN, (float)PIP_MARGIN, width * 0.25f, height * 0.25f, 0.0f, 1.0f } });
+        break;
+    default:
+        _views.push_back({ (UINT)currentCam, { 0.0f, 0.0f, width, height, 0.0f, 1.0f } });
+        break;
+    }
 
-    _gameObjects[2].SetPosition(_cubes[0]);
+    for (const RenderView& view : _views) {
+        if (view.m_camera != (UINT)currentCam) _cameras[view.m_camera]->Camera::Update(deltaTime);
+    }
+}
 
-    DrawObjects(_gameObjects[2].GetMeshData()->m_indexCount, _gameObjects[2].getPosition(), &mappedSubresource);
+/// <summary>
+/// point the frame constants, skybox and viewport at a view's camera before its scene is submitted
+/// </summary>
+/// <param name="view">index into _views</param>
+void DX11Framework::BeginView(UINT view) {
+    _currentView = view;
+    _viewCamera = _views[view].m_camera;
+    _viewFrustum = _viewFrusta[view];
+
+    Camera* camera = _cameras[_viewCamera];
+    XMFLOAT3 camPos = camera->GetPosition();
+    XMStoreFloat4x4(&_skybox, XMMatrixScaling(100.0f, 100.0f, 100.0f) * XMMatrixTranslation(camPos.x, camPos.y, camPos.z));
 
-    ////////    non norm mapped cube - show working spec map and specular lighting
-    // needed as when using norm map, specular light can slightly bleed onto back
+    //Store this view's data in constant buffer struct, material and object buffers follow per draw
+    _frameBuffer.m_data.View = XMMatrixTranspose(XMLoadFloat4x4(camera->GetView()));
+    _frameBuffer.m_data.Projection = XMMatrixTranspose(XMLoadFloat4x4(camera->GetProjection()));
+    _frameBuffer.m_data.EyePosW = camPos;
 
-    SetShaderResources(_gameObjects[3].GetShaderResourceC(), _gameObjects[3].GetShaderResourceS(), _gameObjects[3].GetShaderResourceN());
+    //Write constant buffer data onto GPU
+    _frameBuffer.Upload(_immediateContext);
+
+    if (_tessellation) {
+        // pixel scale follows the view's camera and viewport
+        TessellationBuffer tessData;
+        tessData.NearDistance = _tessellationSettings.m_nearDistance;
+        tessData.FarDistance = _tessellationSettings.m_farDistance;
+        tessData.MaxFactor = _tessellationSettings.m_maxFactor;
+        tessData.TargetEdgePixels = _tessellationSettings.m_targetEdgePixels;
+        tessData.PixelsPerUnit = GetPixelsPerUnit(*camera->GetProjection(), _views[view].m_viewport.Height);
+        tessData.DisplacementScale = _tessellationSettings.m_displacementScale;
+        tessData.padding = XMFLOAT2(0.0f, 0.0f);
+
+        _immediateContext->UpdateSubresource(_tessellationBuffer, 0, nullptr, &tessData, 0, 0);
+    }
 
-    _gameObjects[3].Draw(_immediateContext, &_cbData);
+    BindFrameState(_recorders[0]);
+}
 
-    XMFLOAT4X4 nonNormMap;
-    XMStoreFloat4x4(&nonNormMap, XMMatrixTranslation(0, 10.0f, 0) * XMLoadFloat4x4(&_cubes[0]));
+/// <summary>
+/// writes the rolling frame time percentiles, JSON when the name ends in .json and CSV otherwise
+/// </summary>
+/// <param name="fileName"></param>
+/// <returns></returns>
+HRESULT DX11Framework::ExportTelemetry(const std::wstring& fileName) {
+    std::ofstream file(fileName);
+    if (!file) return E_FAIL;
 
-    _gameObjects[3].SetPosition(nonNormMap);
+    bool json = fileName.size() >= 5 && _wcsicmp(fileName.c_str() + fileName.size() - 5, L".json") == 0;
+    if (json) _telemetry.WriteJson(file);
+    else _telemetry.WriteCsv(file);
 
-    DrawObjects(_gameObjects[3].GetMeshData()->m_indexCount, _gameObjects[3].getPosition(), &mappedSubresource);
+    return file ? S_OK : E_FAIL;
+}
 
-    /////////
+/// <summary>
+/// build this frame's draw items, anything that wants drawing adds an item here rather than drawing directly
+/// </summary>
+void DX11Framework::SubmitScene() {
+    _renderQueue.Clear();
 
-    SetShaderResources(_gameObjects[_gameObjects.size() - 2].GetShaderResourceC(), _gameObjects[_gameObjects.size() - 2].GetShaderResourceS(), _gameObjects[_gameObjects.size() - 2].GetShaderResourceN());
-    
-    SetRS(_cullnoneState);
+    XMFLOAT4X4 identity;
+    XMStoreFloat4x4(&identity, XMMatrixIdentity());
+    const ViewVisibility& visibility = _viewVisibility[_currentView];
 
-    _gameObjects[_gameObjects.size() - 2].Draw(_immediateContext, &_cbData);
+    // moving objects in InitSceneBVH's order
+    UINT moving = 0;
+    Submit(RenderPass::Opaque, DrawProgram::Lit, 2, 2, _cubes[0], nullptr, 0, moving++);
 
+    bool tessellateCube = _tessellation && _gameObjects[3].m_hasDisp == 1;
+    Submit(RenderPass::Opaque, tessellateCube ? DrawProgram::LitTessellated : DrawProgram::Lit, 3, 3, _specCrate, nullptr, 0, moving++);
+
+    UINT fence = (UINT)_gameObjects.size() - 2;
     for (UINT i = 1; i < sizeof(_cubes) / sizeof(_cubes[0]); i++)
     {
-        _gameObjects[4].SetPosition(_cubes[i]);
+        Submit(RenderPass::Opaque, DrawProgram::LitNoCull, fence, fence, _cubes[i], nullptr, 0, moving++);
+    }
 
-        DrawObjects(_gameObjects[_gameObjects.size() - 2].GetMeshData()->m_indexCount, _gameObjects[_gameObjects.size() - 2].getPosition(), &mappedSubresource);
+    for (UINT i = 0; i < sizeof(_pyramids) / sizeof(_pyramids[0]); i++)
+    {
+        Submit(RenderPass::Opaque, DrawProgram::Lit, _pyramidMaterial, _pyramidMesh, _pyramids[i], nullptr, 0, moving++);
     }
 
-    //////////////////////////////////////////////////////////////////
+    // the whole forest is one draw, nearest trees first so their depth rejects the billboards behind them
+    UINT visibleTrees = UploadSortedInstances(_trees, _treeBillboardBuffer, DepthOrder::FrontToBack, &visibility.m_trees);
+    _meshes[_billboardMesh].m_count = visibleTrees * BILLBOARD_VERTICES;
+    if (_treeBillboardView && visibleTrees > 0) Submit(RenderPass::Opaque, DrawProgram::Billboard, _billboardMaterial, _billboardMesh, identity);
 
-    SetRS(_fillState);
+    Submit(RenderPass::Opaque, _tessellation ? DrawProgram::TerrainTessellated : DrawProgram::Terrain, _terrainMaterial, _terrainMesh, *_terrain->getPosition());
 
-    SetShaderResources(_gameObjects[2].GetShaderResourceC(), _gameObjects[2].GetShaderResourceS(), _gameObjects[2].GetShaderResourceN());
+    UINT skybox = (UINT)_gameObjects.size() - 1;
+    Submit(RenderPass::Skybox, DrawProgram::Skybox, skybox, skybox, _skybox);
 
-    SetBuffers(_pyramidVertexBuffer, _pyramidIndexBuffer, &stride, &offset, DXGI_FORMAT_R16_UINT);
+    // blended, so farthest asteroid first
+    UINT visibleAsteroids = UploadSortedInstances(_asteroids, _asteroidInstanceBuffer, DepthOrder::BackToFront, _bvhAsteroids ? &visibility.m_asteroids : nullptr);
+    if (_asteroidInstanceBuffer && visibleAsteroids > 0) Submit(RenderPass::Transparent, DrawProgram::AsteroidBlend, 2, 2, identity, _asteroidInstanceBuffer, visibleAsteroids);
+}
 
-    _cbData.HasTexture = 1;
-    _cbData.SpecMap = 1;
-    _cbData.NormMap = 0;
+/// <summary>
+/// queue a draw, the key's depth is the world translation's view depth over the camera far plane
+/// </summary>
+/// <param name="pass"></param>
+/// <param name="program"></param>
+/// <param name="material"></param>
+/// <param name="mesh"></param>
+/// <param name="world"></param>
+/// <param name="instanceBuffer">per instance world matrices, world only feeds the sort depth when set</param>
+/// <param name="instanceCount"></param>
+/// <param name="movingObject">index into _movingObjects, whose visibility CullViews already found</param>
+void DX11Framework::Submit(
+    RenderPass pass,
+    DrawProgram program,
+    UINT material,
+    UINT mesh,
+    const XMFLOAT4X4& world,
+    ID3D11Buffer* instanceBuffer,
+    UINT instanceCount,
+    UINT movingObject) {
+    // instanced draws are culled per instance before they get here
+    const XMFLOAT4& bounds = _meshes[mesh].m_boundingSphere;
+    if (_frustumCulling && !instanceBuffer && bounds.w > 0.0f) {
+        if (movingObject != NO_MOVING_OBJECT) {
+            if (!_viewVisibility[_currentView].m_moving[movingObject]) return;
+        }
+        else {
+            XMFLOAT4 sphere = TransformBoundingSphere(bounds, world);
+            if (!SphereInFrustum(_viewFrustum, XMFLOAT3(sphere.x, sphere.y, sphere.z), sphere.w)) return;
+        }
+    }
 
-    for (UINT i = 0; i < sizeof(_pyramids) / sizeof(_pyramids[0]); i++)
-    {
-        DrawObjects(18, &_pyramids[i], &mappedSubresource);
+    // a variant this frame needs for the first time (a new material, fog just toggled) compiles here on the main thread,
+    // one that failed is skipped and the draw uses GetPixelShader's fallback
+    if (_programs[(UINT)program].m_pixelPermutations) {
+        UINT permutation = GetPixelPermutation(_materials[material]);
+        if (!_pixelPermutations[permutation] && !_pixelPermutationFailed[permutation]) CompilePixelPermutations(std::vector<UINT>(1, permutation));
     }
 
-    ///////////////////////////////////////////////////////////////////////////////////////
+    XMVECTOR viewPos = XMVector3Transform(XMVectorSet(world._41, world._42, world._43, 1.0f), XMLoadFloat4x4(_cameras[_viewCamera]->GetView()));
+    float depth01 = XMVectorGetZ(viewPos) / _cameras[_viewCamera]->GetFarDepth();
 
-    // billboards
+    DrawItem item;
+    item.m_key = MakeDrawKey(pass, (UINT)program, material, mesh, depth01);
+    item.m_program = (UINT)program;
+    item.m_material = material;
+    item.m_mesh = mesh;
+    item.m_world = world;
+    item.m_instanceBuffer = instanceBuffer;
+    item.m_instanceCount = instanceCount;
 
-    SetShaders(_billboardVertexShader, _billboardPixelShader);
+    _renderQueue.Submit(item);
+}
 
-    _immediateContext->PSSetShaderResources(0, 1, &_billboardTexture);
+/// <summary>
+/// sort the queue and draw it. small queues record straight onto the immediate context, larger ones are split
+/// into contiguous bands of the sorted order, each recorded on its own worker thread and deferred context
+/// </summary>
+void DX11Framework::ExecuteRenderQueue() {
+    _renderQueue.Sort();
 
-    SetBuffers(_billboardVertexBuffer, _billboardIndexBuffer, &stride, &offset, DXGI_FORMAT_R16_UINT);
+    UINT count = _renderQueue.GetCount();
+    UINT threadCount = min(_recordThreads, count / MIN_ITEMS_PER_RECORD_THREAD);
 
-    _cbData.HasTexture = 1;
-    _cbData.SpecMap = 0;
-    _cbData.NormMap = 0;
+    if (threadCount <= 1) {
+        RecordRange(_recorders[0], 0, count);
+        return;
+    }
+
+    // bands keep each thread's items grouped by state, the main thread takes the last band. the workers persist
+    // between frames, each recording into the same deferred context every time
+    UINT band = (count + threadCount - 1) / threadCount;
+    _recordWorkers.Run(threadCount, [this, band, count](UINT t) { RecordDeferred(_recorders[t + 1], t * band, min((t + 1) * band, count)); });
+
+    // the phases accumulate, so Build pauses here and picks up again after the command lists are executed
+    _telemetry.EndPhase(FramePhase::Build);
+    _telemetry.BeginPhase(FramePhase::Submit);
+
+    // executed in band order so the sorted order survives the split
+    for (UINT t = 1; t <= threadCount; ++t) {
+        if (!_recorders[t].m_commandList) continue;
+
+        _immediateContext->ExecuteCommandList(_recorders[t].m_commandList, FALSE);
+        _recorders[t].m_commandList->Release();
+        _recorders[t].m_commandList = nullptr;
+    }
+
+    _telemetry.EndPhase(FramePhase::Submit);
+    _telemetry.BeginPhase(FramePhase::Build);
 
-    for (UINT i = 0; i < sizeof(_trees) / sizeof(_trees[0]); i++)
+    // executing without restoring leaves the immediate context in its default state
+    _recorders[0].m_stateCache.Invalidate();
+}
+
+/// <summary>
+/// draw sorted items [begin, end), program, material and mesh are only rebound when they differ from the previous item
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="begin"></param>
+/// <param name="end"></param>
+void DX11Framework::RecordRange(DrawRecorder& recorder, UINT begin, UINT end) {
+    // one map for the whole range when offsets work, otherwise each draw maps its own constants
+    const bool slices = _constantBufferOffsets && WriteConstantSlices(recorder, begin, end);
+
+    UINT program = UINT_MAX;
+    UINT material = UINT_MAX;
+    UINT mesh = UINT_MAX;
+
+    for (UINT i = begin; i < end; i++)
     {
-        DrawObjects(6, &_trees[i], &mappedSubresource);
+        const DrawItem& item = _renderQueue.GetSorted(i);
+
+        if (item.m_program != program) {
+            BindProgram(recorder, _programs[item.m_program]);
+            program = item.m_program;
+        }
+        if (item.m_material != material) {
+            BindMaterial(recorder, _materials[item.m_material]);
+            material = item.m_material;
+        }
+        if (item.m_mesh != mesh) {
+            BindMesh(recorder, _meshes[item.m_mesh]);
+            mesh = item.m_mesh;
+        }
+
+        // the state cache drops this while neither the program nor the material changed the variant
+        if (_programs[item.m_program].m_pixelPermutations) {
+            recorder.m_stateCache.SetPixelShader(GetPixelShader(_materials[item.m_material]));
+        }
+
+        if (slices) {
+            BindConstantSlices(recorder, _programs[item.m_program], recorder.m_materialSlices[i - begin], recorder.m_objectSlices[i - begin]);
+        }
+
+        const RenderMesh& drawMesh = _meshes[item.m_mesh];
+        if (item.m_instanceBuffer) {
+            DrawInstanced(recorder, drawMesh.m_count, item.m_instanceBuffer, item.m_instanceCount, !slices);
+        }
+        else {
+            DrawObjects(recorder, drawMesh.m_count, &item.m_world, drawMesh.m_indexed, !slices);
+        }
     }
+}
 
-    //terrain
-    SetShaders(_terrainVertexShader, _terrainPixelShader);
+/// <summary>
+/// write the material and object constants of sorted items [begin, end) into the recorder's ring in a single map.
+/// consecutive items with the same material share a slice, so material binds stay as rare as BindMaterial calls
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="begin"></param>
+/// <param name="end"></param>
+/// <returns>false if the ring could not be mapped, the range then falls back to per draw uploads</returns>
+bool DX11Framework::WriteConstantSlices(DrawRecorder& recorder, UINT begin, UINT end) {
+    UINT count = end - begin;
+    if (count == 0) return false;
 
-    _terrain->Draw(_immediateContext, &_cbData);
+    // worst case every item changes material
+    if (!recorder.m_constantRing.Begin(_device, recorder.m_context, count * 2)) return false;
 
-    DrawObjects(_terrain->GetIndexCount(), _terrain->getPosition(), &mappedSubresource);
+    recorder.m_materialSlices.resize(count);
+    recorder.m_objectSlices.resize(count);
 
-    /////////////////////////
-    //     DRAW SKYBOX     //
-    /////////////////////////
+    MaterialBuffer materialData = recorder.m_materialBuffer.m_data; // colours and power are shared, flags come per material
+    ObjectBuffer objectData;
 
-    SetRS(_cullnoneState);
+    UINT material = UINT_MAX;
+    UINT materialSlice = 0;
 
-    // set shaders to skybox ver
-    SetShaders(_skyboxVertexShader, _skyboxPixelShader);
+    for (UINT i = begin; i < end; i++)
+    {
+        const DrawItem& item = _renderQueue.GetSorted(i);
 
-    // set stencil state to new one
-    _immediateContext->OMSetDepthStencilState(_depthStencilSkybox, 1);
+        if (item.m_material != material) {
+            const RenderMaterial& drawMaterial = _materials[item.m_material];
+            materialData.HasTexture = drawMaterial.m_hasTexture;
+            materialData.SpecMap = drawMaterial.m_specMap;
+            materialData.NormMap = drawMaterial.m_normMap;
 
-    // call draw to set buffers
-    _gameObjects[_gameObjects.size() - 1].Draw(_immediateContext, &_cbData);
+            materialSlice = recorder.m_constantRing.Write(&materialData, sizeof(materialData));
+            material = item.m_material;
+        }
 
-    // set position (will update with cam) 
-    _gameObjects[_gameObjects.size() - 1].SetPosition(_skybox);
+        // instanced shaders output world space normals, identity keeps the pixel shader's World transform a no-op
+        objectData.World = item.m_instanceBuffer ? XMMatrixIdentity() : XMMatrixTranspose(XMLoadFloat4x4(&item.m_world));
 
-    // set shader resource to the texture for skybox
-    _immediateContext->PSSetShaderResources(0, 1, _gameObjects[_gameObjects.size() - 1].GetShaderResourceC());
+        recorder.m_materialSlices[i - begin] = materialSlice;
+        recorder.m_objectSlices[i - begin] = recorder.m_constantRing.Write(&objectData, sizeof(objectData));
+    }
 
-    DrawObjects(_gameObjects[_gameObjects.size() - 1].GetMeshData()->m_indexCount, _gameObjects[_gameObjects.size() - 1].getPosition(), &mappedSubresource);
+    recorder.m_constantRing.End(recorder.m_context);
+    return true;
+}
 
-    //////////////////////////////
-    // DRAW TRANSPARENT OBJECTS //
-    //////////////////////////////
+/// <summary>
+/// point b1 and b2 at an item's slices of the ring. the hull and domain stages only get them when the program tessellates,
+/// the state cache drops the material bind while the slice stays the same
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="program"></param>
+/// <param name="materialSlice">first constant of the material slice</param>
+/// <param name="objectSlice">first constant of the object slice</param>
+void DX11Framework::BindConstantSlices(DrawRecorder& recorder, const RenderProgram& program, UINT materialSlice, UINT objectSlice) {
+    ID3D11Buffer* ring = recorder.m_constantRing.Get();
+    const UINT constants = ConstantRingBuffer::SLICE_CONSTANTS;
+
+    for (UINT stage = 0; stage < (UINT)ShaderStage::Count; stage++) {
+        if (!program.m_hullShader && ((ShaderStage)stage == ShaderStage::Hull || (ShaderStage)stage == ShaderStage::Domain)) continue;
+
+        recorder.m_stateCache.SetConstantBufferRange((ShaderStage)stage, 1, ring, materialSlice, constants);
+        recorder.m_stateCache.SetConstantBufferRange((ShaderStage)stage, 2, ring, objectSlice, constants);
+    }
+}
 
-    SetRS(_fillState);
+/// <summary>
+/// record a band on a deferred context into the recorder's command list. a command list starts from default state
+/// and has to discard dynamic buffers before it reads them, so the recorder forgets what it had bound
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="begin"></param>
+/// <param name="end"></param>
+void DX11Framework::RecordDeferred(DrawRecorder& recorder, UINT begin, UINT end) {
+    recorder.m_stateCache.Invalidate();
+    recorder.m_materialBuffer.Invalidate();
+    recorder.m_objectBuffer.Invalidate();
+
+    BindFrameState(recorder);
+    RecordRange(recorder, begin, end);
+
+    recorder.m_context->FinishCommandList(FALSE, &recorder.m_commandList);
+}
 
-    SetShaders(_vertexShader, _pixelShader);
+/// <summary>
+/// time SubmitScene's work at drawCount cube draws for every thread count up to MAX_RECORD_THREADS and write
+/// the CPU milliseconds per frame and speedup over one thread to RecordBenchmark.txt
+/// </summary>
+/// <param name="drawCount"></param>
+/// <param name="frames"></param>
+void DX11Framework::BenchmarkRecording(UINT drawCount, UINT frames) {
+    UINT savedThreads = _recordThreads;
+    bool savedCulling = _frustumCulling;
+    _frustumCulling = false; // every draw is recorded whatever the camera sees
 
-    SetShaderResources(_gameObjects[2].GetShaderResourceC(), _gameObjects[2].GetShaderResourceS(), _gameObjects[2].GetShaderResourceN());
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
 
-    _immediateContext->OMSetBlendState(_blendState, blendFactor, 0xffffffff); // blending / transparency
+    std::ofstream file("RecordBenchmark.txt");
+    file << "draws " << drawCount << ", frames " << frames << ", driver command lists " << (_driverCommandLists ? "yes" : "no") << "\n";
 
-    _gameObjects[2].Draw(_immediateContext, &_cbData);
+    double singleThreadMs = 0.0;
 
-    for (UINT i = 0; i < sizeof(_asteroids) / sizeof(_asteroids[0]); i++)
+    for (UINT threads = 1; threads <= MAX_RECORD_THREADS; threads++)
     {
-        _gameObjects[2].SetPosition(_asteroids[i]);
-        DrawObjects(_gameObjects[2].GetMeshData()->m_indexCount, _gameObjects[2].getPosition(), &mappedSubresource);
-    }
+        _recordThreads = threads;
 
-    _immediateContext->OMSetBlendState(0, 0, 0xffffffff);
+        LONGLONG ticks = 0;
+        for (UINT frame = 0; frame < frames; frame++)
+        {
+            _renderQueue.Clear();
+            srand(frame);
+            for (UINT i = 0; i < drawCount; i++)
+            {
+                XMFLOAT4X4 world;
+                XMStoreFloat4x4(&world, XMMatrixScaling(0.25f, 0.25f, 0.25f) * XMMatrixTranslation((rand() % 4000) / 100.0f - 20.0f, 25.0f + (rand() % 1000) / 100.0f, (rand() % 4000) / 100.0f));
+                Submit(RenderPass::Opaque, i % 2 ? DrawProgram::Lit : DrawProgram::LitNoCull, 2 + i % 3, 2, world);
+            }
 
-    //Present Backbuffer to screen
-    _swapChain->Present(0, 0);
+            BindFrameState(_recorders[0]);
+
+            QueryPerformanceCounter(&start);
+            ExecuteRenderQueue();
+            QueryPerformanceCounter(&end);
+            ticks += end.QuadPart - start.QuadPart;
+
+            _swapChain->Present(0, 0);
+        }
+
+        double ms = ticks * 1000.0 / ((double)frequency.QuadPart * frames);
+        if (threads == 1) singleThreadMs = ms;
+
+        char line[128];
+        sprintf_s(line, "threads %u: %.3f ms, speedup %.2fx\n", threads, ms, singleThreadMs / ms);
+        OutputDebugStringA(line);
+        file << line;
+    }
+
+    _recordThreads = savedThreads;
+    _frustumCulling = savedCulling;
 }
 
 /// <summary>
-/// set buffers using specified format
+/// per frame bindings every context needs before drawing, recorders start from default state on deferred contexts
 /// </summary>
-/// <param name="vBuffer"></param>
-/// <param name="pBuffer"></param>
-/// <param name="stride"></param>
-/// <param name="offset"></param>
-/// <param name="format"></param>
-void DX11Framework::SetBuffers(
-    ID3D11Buffer* vBuffer,
-    ID3D11Buffer* pBuffer,
-    UINT* stride,
-    UINT* offset,
-    DXGI_FORMAT format) {
-    _immediateContext->IASetVertexBuffers(0, 1, &vBuffer, stride, offset);
-    _immediateContext->IASetIndexBuffer(pBuffer, format, 0);
+/// <param name="recorder"></param>
+void DX11Framework::BindFrameState(DrawRecorder& recorder) {
+    recorder.m_context->OMSetRenderTargets(1, &_frameBufferView, _depthStencilView);
+    recorder.m_context->RSSetViewports(1, &_views[_currentView].m_viewport);
+
+    // every stage sees the same three, the HLSL only declares what it reads
+    for (UINT stage = 0; stage < (UINT)ShaderStage::Count; stage++) {
+        recorder.m_stateCache.SetConstantBuffer((ShaderStage)stage, 0, _frameBuffer.Get());
+        recorder.m_stateCache.SetConstantBuffer((ShaderStage)stage, 1, recorder.m_materialBuffer.Get());
+        recorder.m_stateCache.SetConstantBuffer((ShaderStage)stage, 2, recorder.m_objectBuffer.Get());
+    }
+
+    // only written while tessellation is on, see Draw
+    recorder.m_stateCache.SetConstantBuffer(ShaderStage::Hull, 4, _tessellationBuffer);
+    recorder.m_stateCache.SetConstantBuffer(ShaderStage::Domain, 4, _tessellationBuffer);
+
+    recorder.m_stateCache.SetSampler(ShaderStage::Pixel, 0, _bilinearSamplerState);
+    recorder.m_stateCache.SetSampler(ShaderStage::Domain, 0, _bilinearSamplerState);
 }
 
 /// <summary>
-/// set shaders using specified shaders
+/// shaders, input layout, topology and output merger state for a program
 /// </summary>
-/// <param name="vShader"></param>
-/// <param name="pShader"></param>
-void DX11Framework::SetShaders(
-    ID3D11VertexShader* vShader,
-    ID3D11PixelShader* pShader) {
-    _immediateContext->VSSetShader(vShader, nullptr, 0);
-    _immediateContext->PSSetShader(pShader, nullptr, 0);
+/// <param name="recorder"></param>
+/// <param name="program"></param>
+void DX11Framework::BindProgram(DrawRecorder& recorder, const RenderProgram& program) {
+    recorder.m_stateCache.SetVertexShader(program.m_vertexShader);
+    recorder.m_stateCache.SetHullShader(program.m_hullShader);
+    recorder.m_stateCache.SetDomainShader(program.m_domainShader);
+    if (!program.m_pixelPermutations) recorder.m_stateCache.SetPixelShader(program.m_pixelShader);
+    recorder.m_stateCache.SetInputLayout(program.m_inputLayout);
+    recorder.m_stateCache.SetPrimitiveTopology(program.m_topology);
+    SetRS(recorder, program.m_rasterizer);
+    recorder.m_stateCache.SetBlendState(program.m_blendState, program.m_blendFactor, 0xffffffff);
+    recorder.m_stateCache.SetDepthStencilState(program.m_depthStencil, program.m_stencilRef);
 }
 
 /// <summary>
-/// set shader resources using specified SRVs
+/// textures for every stage and the material flags, which upload with the next draw
 /// </summary>
-/// <param name="C"></param>
-/// <param name="S"></param>
-/// <param name="N"></param>
-void DX11Framework::SetShaderResources(
-    ID3D11ShaderResourceView** C,
-    ID3D11ShaderResourceView** S,
-    ID3D11ShaderResourceView** N) {
-    if (C != nullptr) {
-        _immediateContext->PSSetShaderResources(0, 1, C);
-    }
-    if (S != nullptr) {
-        _immediateContext->PSSetShaderResources(1, 1, S);
-    }
-    if (N != nullptr) {
-        _immediateContext->PSSetShaderResources(2, 1, N);
+/// <param name="recorder"></param>
+/// <param name="material"></param>
+void DX11Framework::BindMaterial(DrawRecorder& recorder, const RenderMaterial& material) {
+    for (UINT i = 0; i < material.m_pixelResourceCount; i++)
+    {
+        recorder.m_stateCache.SetShaderResource(ShaderStage::Pixel, i, material.m_pixelResources[i]);
     }
+    recorder.m_stateCache.SetShaderResource(ShaderStage::Vertex, 0, material.m_vertexResource);
+    recorder.m_stateCache.SetConstantBuffer(ShaderStage::Vertex, 3, material.m_vertexConstants);
+    recorder.m_stateCache.SetShaderResource(ShaderStage::Domain, 0, material.m_domainResource);
+
+    recorder.m_materialBuffer.m_data.HasTexture = material.m_hasTexture;
+    recorder.m_materialBuffer.m_data.SpecMap = material.m_specMap;
+    recorder.m_materialBuffer.m_data.NormMap = material.m_normMap;
+}
+
+/// <summary>
+/// vertex and index buffers, meshes without a vertex buffer leave the input assembler alone
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="mesh"></param>
+void DX11Framework::BindMesh(DrawRecorder& recorder, const RenderMesh& mesh) {
+    if (!mesh.m_vertexBuffer) return;
+
+    recorder.m_stateCache.SetVertexBuffer(0, mesh.m_vertexBuffer, mesh.m_stride, mesh.m_offset);
+    recorder.m_stateCache.SetIndexBuffer(mesh.m_indexBuffer, DXGI_FORMAT_R16_UINT, 0);
 }
 
 /// <summary>
 /// set rasterizer state when not using wireframe mode
 /// </summary>
+/// <param name="recorder"></param>
 /// <param name="state"></param>
-void DX11Framework::SetRS(ID3D11RasterizerState* state) {
+void DX11Framework::SetRS(DrawRecorder& recorder, ID3D11RasterizerState* state) {
     if (!_wireframe) {
-        _immediateContext->RSSetState(state);
+        recorder.m_stateCache.SetRasterizerState(state);
     }
     else {
-        _immediateContext->RSSetState(_wireframeState);
+        recorder.m_stateCache.SetRasterizerState(_wireframeState);
     }
 }
 
 /// <summary>
 /// draw objects at specified position
 /// </summary>
+/// <param name="recorder"></param>
 /// <param name="indices"></param>
 /// <param name="position"></param>
-/// <param name="mSubRes"></param>
+/// <param name="indexed">false draws indices as a vertex count with no index buffer</param>
+/// <param name="uploadConstants">false when BindConstantSlices already pointed b1 and b2 at this draw's ring slices</param>
 void DX11Framework::DrawObjects(
+    DrawRecorder& recorder,
     UINT indices,
-    XMFLOAT4X4* position,
-    D3D11_MAPPED_SUBRESOURCE* mSubRes) {
-    // remap - update data
-    _immediateContext->Map(_constantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, mSubRes);
-    // load new world info
-    _cbData.World = XMMatrixTranspose(XMLoadFloat4x4(position));
+    const XMFLOAT4X4* position,
+    bool indexed,
+    bool uploadConstants) {
+    if (uploadConstants) {
+        // material only uploads when a Draw/flag change touched it, object is just the 64 byte world matrix
+        recorder.m_materialBuffer.Upload(recorder.m_context);
+
+        recorder.m_objectBuffer.m_data.World = XMMatrixTranspose(XMLoadFloat4x4(position));
+        recorder.m_objectBuffer.Upload(recorder.m_context);
+    }
+
+    if (indexed) {
+        recorder.m_context->DrawIndexed(indices, 0, 0);
+    }
+    else {
+        recorder.m_context->Draw(indices, 0);
+    }
+}
+
+/// <summary>
+/// draw every instance of the bound mesh in one call, world matrices come from instanceBuffer rather than the object buffer.
+/// the bound program must use an instanced vertex shader and _instanceInputLayout
+/// </summary>
+/// <param name="recorder"></param>
+/// <param name="indices"></param>
+/// <param name="instanceBuffer"></param>
+/// <param name="instanceCount"></param>
+/// <param name="uploadConstants">false when BindConstantSlices already pointed b1 and b2 at this draw's ring slices</param>
+void DX11Framework::DrawInstanced(
+    DrawRecorder& recorder,
+    UINT indices,
+    ID3D11Buffer* instanceBuffer,
+    UINT instanceCount,
+    bool uploadConstants) {
+    if (!instanceBuffer || instanceCount == 0) return;
+
+    if (uploadConstants) {
+        recorder.m_materialBuffer.Upload(recorder.m_context);
+
+        // instanced shaders output world space normals, identity keeps the pixel shader's World transform a no-op
+        recorder.m_objectBuffer.m_data.World = XMMatrixIdentity();
+        recorder.m_objectBuffer.Upload(recorder.m_context);
+    }
 
-    memcpy(mSubRes->pData, &_cbData, sizeof(_cbData));
-    _immediateContext->Unmap(_constantBuffer, 0);
+    recorder.m_stateCache.SetVertexBuffer(1, instanceBuffer, sizeof(XMFLOAT4X4), 0);
 
-    _immediateContext->DrawIndexed(indices, 0, 0);
+    recorder.m_context->DrawIndexedInstanced(indices, instanceCount, 0, 0, 0);
 }
 
 /// <summary>
@@ -6,21 +6,109 @@
 #include "JSONLoad.h"
 #include "FreeCamera.h"
 #include "Terrain.h"
+#include "Tessellation.h"
+#include "ConstantBuffers.h"
+#include "StateCache.h"
+#include "RenderQueue.h"
+#include "DepthSort.h"
+#include "Billboard.h"
+#include "ShaderCache.h"
+#include "FramePacer.h"
+#include "FrameTelemetry.h"
+#include "FrustumCuller.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "VisibilityCache.h"
+#include "WorkerPool.h"
+#include <thread>
 //#include <wrl.h>
 
 //using Microsoft::WRL::ComPtr;
 
+// indices into the framework's program table, new ones go before Count
+enum class DrawProgram : UINT
+{
+	Lit,
+	LitNoCull,
+	LitTessellated,
+	Billboard,
+	Terrain,
+	TerrainTessellated,
+	Skybox,
+	AsteroidBlend,
+	Count
+};
+
+// one thread's recording state. recorder 0 wraps the immediate context, the rest wrap deferred contexts
+// and own their material/object buffers so no two threads ever map the same resource
+struct DrawRecorder
+{
+	ID3D11DeviceContext1* m_context = nullptr;
+	StateCache m_stateCache; // pipeline state goes through here so repeated binds are dropped
+	DynamicConstantBuffer<MaterialBuffer> m_materialBuffer; // per draw uploads when constant buffer offsets are unsupported
+	DynamicConstantBuffer<ObjectBuffer> m_objectBuffer;
+	ConstantRingBuffer m_constantRing; // every material and object slice of a recording pass, one map
+	std::vector<UINT> m_materialSlices; // first constant per item of the pass
+	std::vector<UINT> m_objectSlices;
+	ID3D11CommandList* m_commandList = nullptr;
+};
+
+// a single draw that moves every frame, its bounds are refit into the scene BVH at the end of Update
+struct MovingObject
+{
+	const XMFLOAT4X4* m_world;
+	UINT m_mesh;
+};
+
+// how the window is shared between cameras, v cycles through them
+enum class ViewLayout : UINT
+{
+	Single,
+	SplitScreen, // four quarters
+	PictureInPicture, // an inset in the top right corner
+	Count
+};
+
+// one camera drawn into one part of the back buffer
+struct RenderView
+{
+	UINT m_camera;
+	D3D11_VIEWPORT m_viewport;
+};
+
+// what CullViews kept for one view
+struct ViewVisibility
+{
+	std::vector<UINT> m_asteroids; // instance indices
+	std::vector<UINT> m_trees;
+	std::vector<BYTE> m_moving; // a flag per _movingObjects entry
+};
+
+// box drawn into the software depth buffer for a solid mesh, local space and small enough to sit inside it
+struct OccluderProxy
+{
+	const XMFLOAT4X4* m_world;
+	XMFLOAT3 m_min;
+	XMFLOAT3 m_max;
+};
+
 class DX11Framework
 {
 	int _WindowWidth = 1280;
 	int _WindowHeight = 768;
 
-	ID3D11DeviceContext* _immediateContext = nullptr;
+	ID3D11DeviceContext1* _immediateContext = nullptr;
 	ID3D11Device* _device;
 	IDXGIDevice* _dxgiDevice = nullptr;
 	IDXGIFactory2* _dxgiFactory = nullptr;
 	ID3D11RenderTargetView* _frameBufferView = nullptr;
 	IDXGISwapChain1* _swapChain;
+	HANDLE _frameLatencyWaitable = nullptr; // signalled when the swap chain can queue another frame
+
+	SystemClock _clock;
+	FramePacer _framePacer{ &_clock };
+	FrameTelemetry _telemetry{ &_clock };
+
 	D3D11_VIEWPORT _viewport;
 
 	ID3D11RasterizerState* _fillState;
@@ -31,37 +119,95 @@ class DX11Framework
 
 	ID3D11VertexShader* _vertexShader;
 	ID3D11InputLayout* _inputLayout;
-	ID3D11PixelShader* _pixelShader;
+	// SimpleShaders PS_main, one variant per HAS_TEXTURE/SPEC_MAP/NORM_MAP/FOG_ENABLED combination, compiled on first use
+	static const UINT PIXEL_PERMUTATION_COUNT = 16;
+	ID3D11PixelShader* _pixelPermutations[PIXEL_PERMUTATION_COUNT] = {};
+	bool _pixelPermutationFailed[PIXEL_PERMUTATION_COUNT] = {}; // never retried, draws fall back, see GetPixelShader
+	DWORD _shaderFlags = 0;
+
+	ID3D11VertexShader* _instanceVertexShader = nullptr;
+	ID3D11InputLayout* _instanceInputLayout = nullptr; // _inputLayout plus a per instance world matrix in slot 1
 
 	ID3D11VertexShader* _skyboxVertexShader;
 	ID3D11PixelShader* _skyboxPixelShader;
 
-	ID3D11VertexShader* _billboardVertexShader;
+	ID3D11VertexShader* _billboardVertexShader; // expands BillboardPoints from SV_VertexID, no input layout
 	ID3D11PixelShader* _billboardPixelShader;
 
 	ID3D11VertexShader* _terrainVertexShader;
 	ID3D11PixelShader* _terrainPixelShader;
 
-	ID3D11Buffer* _constantBuffer;
+	ID3D11VertexShader* _tessVertexShader = nullptr;
+	ID3D11HullShader* _tessHullShader = nullptr;
+	ID3D11DomainShader* _tessDomainShader = nullptr;
+
+	ID3D11VertexShader* _terrainPatchVertexShader = nullptr;
+	ID3D11HullShader* _terrainHullShader = nullptr;
+	ID3D11DomainShader* _terrainDomainShader = nullptr;
+
+	ID3D11Buffer* _tessellationBuffer = nullptr;
+	TessellationSettings _tessellationSettings;
+	bool _tessellation = false;
+
+	DynamicConstantBuffer<FrameBuffer> _frameBuffer;
+
+	static const UINT MAX_RECORD_THREADS = 8;
+	static const UINT MIN_ITEMS_PER_RECORD_THREAD = 128; // below this a deferred context costs more than it saves
+	DrawRecorder _recorders[MAX_RECORD_THREADS + 1]; // immediate, then one deferred context per thread
+	UINT _recordThreads = 0; // 0 picks from the hardware thread count
+	WorkerPool _recordWorkers; // worker t records band t into _recorders[t + 1] every frame
+	bool _driverCommandLists = false; // false means the runtime emulates command lists
+	bool _constantBufferOffsets = false; // 11.1 *SetConstantBuffers1 offsets, false maps the material/object buffers per draw
 
 	ID3D11Buffer* _pyramidVertexBuffer;
 	ID3D11Buffer* _pyramidIndexBuffer;
 	ID3D11Buffer* _lineVertexBuffer;
 
-	ID3D11Buffer* _billboardVertexBuffer;
-	ID3D11Buffer* _billboardIndexBuffer;
 	ID3D11ShaderResourceView* _billboardTexture;
+	ID3D11Buffer* _billboardSettingsBuffer = nullptr; // b3 BillboardBuffer
+	BillboardFacing _billboardFacing = BillboardFacing::Cylindrical;
 
 	HWND _windowHandle;
 
 	XMFLOAT4X4 _cubes[2];
+	XMFLOAT4X4 _specCrate; // follows _cubes[0] 10 units up
 	XMFLOAT4X4 _pyramids[1];
 	XMFLOAT4X4 _Line;
 
 	XMFLOAT4X4 _skybox;
 
-	XMFLOAT4X4 _asteroids[50];
-	XMFLOAT4X4 _trees[20];
+	UINT _asteroidCount = 50;
+	UINT _treeCount = 20;
+	std::vector<XMFLOAT4X4> _asteroids;
+	std::vector<BillboardPoint> _trees;
+	ID3D11Buffer* _asteroidInstanceBuffer = nullptr; // dynamic, rewritten in view depth order every frame
+	ID3D11Buffer* _treeBillboardBuffer = nullptr; // dynamic structured buffer of _trees, same
+	ID3D11ShaderResourceView* _treeBillboardView = nullptr;
+	DepthSorter _instanceSorter;
+
+	bool _frustumCulling = true;
+	Frustum _viewFrustum; // the view being submitted's, set by BeginView
+
+	// one BVH over every culled object, asteroid instances first, then trees, then _movingObjects.
+	// the instances never move after InitSceneBVH, the moving objects are refit every frame
+	static const UINT NO_MOVING_OBJECT = 0xffffffff;
+	SceneBVH _sceneBVH;
+	UINT _bvhAsteroids = 0; // 0 when the asteroid mesh has no bounds, they are then always drawn
+	UINT _bvhTrees = 0;
+	std::vector<MovingObject> _movingObjects; // in the order SubmitScene submits them
+	std::vector<UINT> _sceneVisible; // object ids any view kept in the last CullViews
+	std::vector<BYTE> _sceneViewMasks; // bit v set for each of _sceneVisible that view v sees
+	std::vector<UINT> _sceneSlots; // by object id, index in _sceneVisible while CullViews merges the views' caches
+
+	// each view's frustum results carried between frames, only what the camera's motion or a refit can change is retested
+	bool _visibilityCaching = true;
+	VisibilityCache _visibilityCaches[SceneBVH::MAX_VIEWS];
+
+	// terrain patches and proxies drawn on the CPU each frame, whatever the BVH keeps is then tested against them
+	static const UINT OCCLUDER_PATCH_CELLS = 8;
+	bool _occlusionCulling = true;
+	OcclusionCuller _occlusionCuller;
+	std::vector<OccluderProxy> _occluderProxies;
 
 	XMFLOAT4 _diffuseMaterial;
 	XMFLOAT4 _ambientMaterial;
@@ -70,7 +216,6 @@ class DX11Framework
 	PointLight _pointLight;
 	Fog _fog;
 
-	ConstantBuffer _cbData;
 
 	ID3D11Texture2D* _depthStencilBuffer;
 	ID3D11DepthStencilView* _depthStencilView;
@@ -87,9 +232,34 @@ class DX11Framework
 	std::vector<Camera*> _cameras;
 	int currentCam = 0;
 
+	// every view is culled in one pass, then submitted and drawn in order with the depth buffer cleared between them
+	static const UINT PIP_MARGIN = 16;
+	ViewLayout _viewLayout = ViewLayout::Single;
+	std::vector<RenderView> _views; // laid out by UpdateViews, the active camera's comes first
+	UINT _currentView = 0; // the one SubmitScene is building, see BeginView
+	UINT _viewCamera = 0;
+	Frustum _viewFrusta[SceneBVH::MAX_VIEWS];
+	ViewVisibility _viewVisibility[SceneBVH::MAX_VIEWS];
+
 	ID3D11BlendState* _blendState;
 
+	RenderQueue _renderQueue; // rebuilt every frame by SubmitScene
+	RenderProgram _programs[(UINT)DrawProgram::Count];
+	std::vector<RenderMaterial> _materials; // one per game object, then the framework owned ones below
+	std::vector<RenderMesh> _meshes; // same layout as _materials
+	UINT _pyramidMesh = 0;
+	UINT _billboardMesh = 0;
+	UINT _terrainMesh = 0;
+	UINT _pyramidMaterial = 0;
+	UINT _billboardMaterial = 0;
+	UINT _terrainMaterial = 0;
+
 	Terrain* _terrain = nullptr;
+	bool _proceduralTerrain = false; // generate from noise rather than the RAW file
+	bool _terrainDeformation = false; // keeps the CPU heights for the crater key
+	std::string _terrainFile = "RAW Files\\Heightmap 513x513.raw";
+	UINT _terrainSize = 513; // samples along each side of the square heightmap
+	HeightMapFormat _terrainFormat = HeightMapFormat::R8;
 public:
 	HRESULT Initialise(HINSTANCE hInstance, int nCmdShow);
 	HRESULT CreateWindowHandle(HINSTANCE hInstance, int nCmdShow);
@@ -99,33 +269,76 @@ public:
 	HRESULT InitVertexIndexBuffers();
 	HRESULT InitPipelineVariables();
 	HRESULT InitRunTimeData();
+	HRESULT InitRecorders();
+	HRESULT CreateInstanceBuffer(const std::vector<XMFLOAT4X4>& instances, ID3D11Buffer** buffer);
+	HRESULT CreateBillboardBuffer(const std::vector<BillboardPoint>& points, ID3D11Buffer** buffer, ID3D11ShaderResourceView** view);
+	void UpdateBillboardSettings();
+
+	UINT GetPixelPermutation(const RenderMaterial& material);
+	ID3D11PixelShader* GetPixelShader(const RenderMaterial& material);
+	HRESULT CompilePixelPermutations(const std::vector<UINT>& permutations);
+
+	template<typename T>
+	UINT UploadSortedInstances(const std::vector<T>& instances, ID3D11Buffer* buffer, DepthOrder order, const std::vector<UINT>* visible);
+	void InitSceneBVH();
+	AABB GetMovingObjectBounds(const MovingObject& object);
+	void RefitMovingObjects();
+	void CullViews();
+	void InitOccluders();
+	void RenderOccluders(UINT camera);
+	void UpdateViews(float deltaTime);
+	void BeginView(UINT view);
+	void InitRenderTables();
 	~DX11Framework();
+	void SetAsteroidCount(UINT count) { _asteroidCount = count; }
+	void SetRecordThreads(UINT count) { _recordThreads = count; }
+	void SetTerrainDeformation(bool deformation) { _terrainDeformation = deformation; } // before Initialise
+	void SetTerrainHeightMap(const std::string& fileName, UINT size, HeightMapFormat format) { _terrainFile = fileName; _terrainSize = size; _terrainFormat = format; } // before Initialise
+	void SetFramePacing(const FramePacingSettings& settings) { _framePacer.SetSettings(settings); } // before Initialise
+	FrameTelemetry& GetTelemetry() { return _telemetry; }
+	HRESULT ExportTelemetry(const std::wstring& fileName);
 	void Update();
 	void Draw();
 
-	void SetBuffers(
-		ID3D11Buffer* vBuffer,
-		ID3D11Buffer* pBuffer,
-		UINT* stride,
-		UINT* offset,
-		DXGI_FORMAT format);
+	void SubmitScene();
+
+	void Submit(
+		RenderPass pass,
+		DrawProgram program,
+		UINT material,
+		UINT mesh,
+		const XMFLOAT4X4& world,
+		ID3D11Buffer* instanceBuffer = nullptr,
+		UINT instanceCount = 0,
+		UINT movingObject = NO_MOVING_OBJECT);
 
-	void SetShaders(
-		ID3D11VertexShader* vShader,
-		ID3D11PixelShader* pShader);
+	void ExecuteRenderQueue();
+	void RecordRange(DrawRecorder& recorder, UINT begin, UINT end);
+	void RecordDeferred(DrawRecorder& recorder, UINT begin, UINT end);
+	bool WriteConstantSlices(DrawRecorder& recorder, UINT begin, UINT end);
+	void BindConstantSlices(DrawRecorder& recorder, const RenderProgram& program, UINT materialSlice, UINT objectSlice);
+	void BenchmarkRecording(UINT drawCount, UINT frames);
 
-	void SetShaderResources(
-		ID3D11ShaderResourceView** C,
-		ID3D11ShaderResourceView** S,
-		ID3D11ShaderResourceView** N
-	);
+	void BindFrameState(DrawRecorder& recorder);
+	void BindProgram(DrawRecorder& recorder, const RenderProgram& program);
+	void BindMaterial(DrawRecorder& recorder, const RenderMaterial& material);
+	void BindMesh(DrawRecorder& recorder, const RenderMesh& mesh);
 
-	void SetRS(ID3D11RasterizerState* state);
+	void SetRS(DrawRecorder& recorder, ID3D11RasterizerState* state);
 
 	void DrawObjects(
+		DrawRecorder& recorder,
+		UINT indices,
+		const XMFLOAT4X4* position,
+		bool indexed = true,
+		bool uploadConstants = true);
+
+	void DrawInstanced(
+		DrawRecorder& recorder,
 		UINT indices,
-		XMFLOAT4X4* position,
-		D3D11_MAPPED_SUBRESOURCE* mSubRes);
+		ID3D11Buffer* instanceBuffer,
+		UINT instanceCount,
+		bool uploadConstants = true);
 
 	void MouseDetection(HWND hWnd);
 	void OnMouseMove(int x, int y);
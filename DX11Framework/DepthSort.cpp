@@ -0,0 +1,205 @@
+#include "DepthSort.h"
+#include <random>
+
+/// <summary>
+/// view space z of each position, four at a time so the view row is loaded once per batch
+/// </summary>
+/// <param name="positions">first position, a world matrix's translation is &amp;world._41</param>
+/// <param name="stride">bytes from one position to the next</param>
+/// <param name="count"></param>
+/// <param name="view"></param>
+/// <param name="depths">count floats</param>
+void DepthSorter::ComputeViewDepths(const XMFLOAT3* positions, UINT stride, UINT count, const XMFLOAT4X4& view, float* depths) {
+	// z = x * view._13 + y * view._23 + z * view._33 + view._43 for a row vector times the view matrix
+	const XMVECTOR viewX = XMVectorReplicate(view._13);
+	const XMVECTOR viewY = XMVectorReplicate(view._23);
+	const XMVECTOR viewZ = XMVectorReplicate(view._33);
+	const XMVECTOR viewW = XMVectorReplicate(view._43);
+
+	const BYTE* base = (const BYTE*)positions;
+	UINT i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const XMFLOAT3& p0 = *(const XMFLOAT3*)(base + (size_t)(i + 0) * stride);
+		const XMFLOAT3& p1 = *(const XMFLOAT3*)(base + (size_t)(i + 1) * stride);
+		const XMFLOAT3& p2 = *(const XMFLOAT3*)(base + (size_t)(i + 2) * stride);
+		const XMFLOAT3& p3 = *(const XMFLOAT3*)(base + (size_t)(i + 3) * stride);
+		XMVECTOR x = XMVectorSet(p0.x, p1.x, p2.x, p3.x);
+		XMVECTOR y = XMVectorSet(p0.y, p1.y, p2.y, p3.y);
+		XMVECTOR z = XMVectorSet(p0.z, p1.z, p2.z, p3.z);
+
+		XMVECTOR depth = XMVectorMultiplyAdd(x, viewX, viewW);
+		depth = XMVectorMultiplyAdd(y, viewY, depth);
+		depth = XMVectorMultiplyAdd(z, viewZ, depth);
+
+		XMStoreFloat4((XMFLOAT4*)(depths + i), depth);
+	}
+
+	for (; i < count; i++)
+	{
+		const XMFLOAT3& p = *(const XMFLOAT3*)(base + (size_t)i * stride);
+		depths[i] = p.x * view._13 + p.y * view._23 + p.z * view._33 + view._43;
+	}
+}
+
+/// <summary>
+/// instance indices in depth order, valid until the next Sort
+/// </summary>
+/// <param name="positions"></param>
+/// <param name="stride"></param>
+/// <param name="count"></param>
+/// <param name="view"></param>
+/// <param name="order"></param>
+/// <returns></returns>
+const std::vector<UINT>& DepthSorter::Sort(const XMFLOAT3* positions, UINT stride, UINT count, const XMFLOAT4X4& view, DepthOrder order) {
+	m_depths.resize(count);
+	ComputeViewDepths(positions, stride, count, view, m_depths.data());
+
+	SortDepths(count, order, nullptr);
+	return m_order;
+}
+
+/// <summary>
+/// sorts only the listed instances, such as the ones a culling pass kept. the order still holds instance
+/// indices, so Gather writes count instances
+/// </summary>
+/// <param name="positions"></param>
+/// <param name="stride"></param>
+/// <param name="indices">count instance indices</param>
+/// <param name="count"></param>
+/// <param name="view"></param>
+/// <param name="order"></param>
+/// <returns></returns>
+const std::vector<UINT>& DepthSorter::Sort(const XMFLOAT3* positions, UINT stride, const UINT* indices, UINT count, const XMFLOAT4X4& view, DepthOrder order) {
+	m_gathered.resize(count);
+
+	const BYTE* base = (const BYTE*)positions;
+	for (UINT i = 0; i < count; i++)
+	{
+		m_gathered[i] = *(const XMFLOAT3*)(base + (size_t)indices[i] * stride);
+	}
+
+	m_depths.resize(count);
+	ComputeViewDepths(m_gathered.data(), sizeof(XMFLOAT3), count, view, m_depths.data());
+
+	SortDepths(count, order, indices);
+	return m_order;
+}
+
+/// <summary>
+/// radix sorts m_depths into m_order, mapping each sorted slot through indices when there are any
+/// </summary>
+/// <param name="count"></param>
+/// <param name="order"></param>
+/// <param name="indices"></param>
+void DepthSorter::SortDepths(UINT count, DepthOrder order, const UINT* indices) {
+	m_entries.resize(count);
+	m_scratch.resize(count);
+	m_order.resize(count);
+
+	// flipping the sign bit of positives and every bit of negatives makes the float bits sort as unsigned ints,
+	// inverting the whole key turns ascending into back to front
+	const UINT invert = order == DepthOrder::BackToFront ? 0xffffffffu : 0u;
+	for (UINT i = 0; i < count; i++)
+	{
+		UINT bits;
+		memcpy(&bits, &m_depths[i], sizeof(bits));
+		UINT key = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+		m_entries[i] = ((UINT64)(key ^ invert) << 32) | i;
+	}
+
+	RadixSort(m_entries.data(), m_scratch.data(), count);
+
+	for (UINT i = 0; i < count; i++)
+	{
+		m_order[i] = indices ? indices[(UINT)m_entries[i]] : (UINT)m_entries[i];
+	}
+}
+
+/// <summary>
+/// stable LSD radix sort on the upper 32 bits, three 11 bit digits. the low half is never compared,
+/// so equal depths keep their instance order
+/// </summary>
+/// <param name="entries">sorted in place</param>
+/// <param name="scratch">at least count entries</param>
+/// <param name="count"></param>
+void DepthSorter::RadixSort(UINT64* entries, UINT64* scratch, UINT count) {
+	if (count < 2) return;
+
+	const UINT RADIX_BITS = 11;
+	const UINT RADIX = 1 << RADIX_BITS;
+	const UINT PASSES = 3;
+
+	UINT histograms[PASSES][RADIX] = {};
+	for (UINT i = 0; i < count; i++)
+	{
+		UINT key = (UINT)(entries[i] >> 32);
+		histograms[0][key & (RADIX - 1)]++;
+		histograms[1][(key >> RADIX_BITS) & (RADIX - 1)]++;
+		histograms[2][key >> (RADIX_BITS * 2)]++;
+	}
+
+	UINT64* src = entries;
+	UINT64* dst = scratch;
+
+	for (UINT pass = 0; pass < PASSES; pass++)
+	{
+		UINT shift = 32 + pass * RADIX_BITS;
+		UINT* histogram = histograms[pass];
+
+		if (histogram[(src[0] >> shift) & (RADIX - 1)] == count) continue;
+
+		UINT total = 0;
+		for (UINT i = 0; i < RADIX; i++)
+		{
+			UINT bucket = histogram[i];
+			histogram[i] = total;
+			total += bucket;
+		}
+
+		for (UINT i = 0; i < count; i++)
+		{
+			dst[histogram[(src[i] >> shift) & (RADIX - 1)]++] = src[i];
+		}
+
+		UINT64* swap = src; src = dst; dst = swap;
+	}
+
+	if (src != entries) memcpy(entries, src, sizeof(UINT64) * count);
+}
+
+/// <summary>
+/// average milliseconds for a full back to front Sort of count random instances, depth computation included
+/// </summary>
+/// <param name="count"></param>
+/// <param name="iterations"></param>
+/// <returns></returns>
+double DepthSorter::BenchmarkSort(UINT count, UINT iterations) {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+
+	std::vector<XMFLOAT4X4> worlds(count);
+	for (UINT i = 0; i < count; i++)
+	{
+		XMStoreFloat4x4(&worlds[i], XMMatrixTranslation(position(random), position(random), position(random)));
+	}
+
+	XMFLOAT4X4 view;
+	XMStoreFloat4x4(&view, XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, -600.0f, 1.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+
+	DepthSorter sorter;
+	const XMFLOAT3* positions = (const XMFLOAT3*)&worlds[0]._41;
+	sorter.Sort(positions, sizeof(XMFLOAT4X4), count, view, DepthOrder::BackToFront); // sizes the vectors outside the timing
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	QueryPerformanceCounter(&start);
+	for (UINT i = 0; i < iterations; i++)
+	{
+		sorter.Sort(positions, sizeof(XMFLOAT4X4), count, view, DepthOrder::BackToFront);
+	}
+	QueryPerformanceCounter(&end);
+
+	return (end.QuadPart - start.QuadPart) * 1000.0 / ((double)frequency.QuadPart * (iterations > 0 ? iterations : 1));
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+enum class DepthOrder
+{
+	FrontToBack, // opaque, nearest first so early-Z rejects what is behind
+	BackToFront // blended, farthest first so each layer blends over the ones behind it
+};
+
+/// orders instances by the view depth of their positions. positions are read with a byte stride so world matrix
+/// translations and point records sort the same way. depths are computed four instances at a time,
+/// then radix sorted on a 32 bit key in three 11 bit passes with the instance index riding in the low half
+class DepthSorter
+{
+private:
+	std::vector<float> m_depths;
+	std::vector<UINT64> m_entries;
+	std::vector<UINT64> m_scratch;
+	std::vector<UINT> m_order;
+	std::vector<XMFLOAT3> m_gathered;
+
+	void SortDepths(UINT count, DepthOrder order, const UINT* indices);
+
+public:
+	const std::vector<UINT>& Sort(const XMFLOAT3* positions, UINT stride, UINT count, const XMFLOAT4X4& view, DepthOrder order);
+	const std::vector<UINT>& Sort(const XMFLOAT3* positions, UINT stride, const UINT* indices, UINT count, const XMFLOAT4X4& view, DepthOrder order);
+
+	// copies source into sorted in the order of the last Sort
+	template<typename T>
+	void Gather(const T* source, T* sorted) {
+		for (size_t i = 0; i < m_order.size(); i++) sorted[i] = source[m_order[i]];
+	}
+
+	static void ComputeViewDepths(const XMFLOAT3* positions, UINT stride, UINT count, const XMFLOAT4X4& view, float* depths);
+	static void RadixSort(UINT64* entries, UINT64* scratch, UINT count);
+	static double BenchmarkSort(UINT count, UINT iterations);
+};
@@ -0,0 +1,129 @@
+#include "FramePacer.h"
+#include <cmath>
+
+SystemClock::SystemClock() {
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	m_frequency = (UINT64)frequency.QuadPart;
+}
+
+UINT64 SystemClock::Now() {
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return (UINT64)now.QuadPart;
+}
+
+/// <summary>
+/// Sleep can overshoot by a scheduler tick, so it only covers the time beyond 2ms and the rest is spun
+/// </summary>
+/// <param name="ticks"></param>
+void SystemClock::SleepUntil(UINT64 ticks) {
+	const UINT64 spinTicks = m_frequency / 500;
+
+	UINT64 now = Now();
+	while (now < ticks)
+	{
+		UINT64 remaining = ticks - now;
+		if (remaining > spinTicks) {
+			Sleep((DWORD)((remaining - spinTicks) * 1000 / m_frequency));
+		}
+		else {
+			YieldProcessor();
+		}
+		now = Now();
+	}
+}
+
+/// <summary>
+/// apply new settings, the cap restarts from the next frame
+/// </summary>
+/// <param name="settings"></param>
+void FramePacer::SetSettings(const FramePacingSettings& settings) {
+	m_settings = settings;
+	m_settings.m_maxFrameLatency = max(1u, min(m_settings.m_maxFrameLatency, 16u));
+
+	m_frameInterval = m_settings.m_enabled && m_settings.m_frameRateCap > 0.0f
+		? (UINT64)(m_clock->Frequency() / m_settings.m_frameRateCap)
+		: 0;
+	m_nextFrame = 0;
+}
+
+/// <summary>
+/// block until the next frame may start
+/// </summary>
+/// <returns>seconds since the previous BeginFrame returned, 0 on the first frame</returns>
+double FramePacer::BeginFrame() {
+	if (m_settings.m_enabled) {
+		// the swap chain signals once fewer than m_maxFrameLatency frames are queued, waiting here instead of in Present
+		// keeps the CPU from running ahead of what the GPU shows
+		if (m_frameLatencyWaitable) WaitForSingleObjectEx(m_frameLatencyWaitable, 1000, TRUE);
+
+		if (m_frameInterval > 0) {
+			UINT64 now = m_clock->Now();
+
+			// deadlines advance by whole intervals so the average rate holds, a frame that falls more than one
+			// interval behind starts a new schedule rather than rushing to catch up
+			if (m_nextFrame == 0 || now > m_nextFrame + m_frameInterval) m_nextFrame = now;
+
+			m_clock->SleepUntil(m_nextFrame);
+			m_nextFrame += m_frameInterval;
+		}
+	}
+
+	UINT64 frameStart = m_clock->Now();
+	double delta = m_started ? (double)(frameStart - m_lastFrameStart) / m_clock->Frequency() : 0.0;
+
+	m_lastFrameStart = frameStart;
+	m_started = true;
+	return delta;
+}
+
+/// <summary>
+/// frame starts worked by hand for a 60 fps cap on a FakeClock at a million ticks a second, each frame doing the
+/// given work before asking for the next. short frames wait for deadlines a whole interval apart, a frame late by
+/// less than an interval starts at once and the next is back on the schedule, one later than that starts a new one
+/// </summary>
+/// <param name="frameCount">worked frames checked</param>
+/// <returns>true when every frame starts on its tick and reports the time since the previous start</returns>
+bool CheckFramePacing(UINT& frameCount) {
+	struct PacedFrame
+	{
+		UINT64 m_work; // ticks spent before BeginFrame
+		UINT64 m_start;
+	};
+
+	const UINT64 interval = 16666; // 1000000 / 60, truncated
+	const PacedFrame frames[] = {
+		{ 0, 0 }, // the first frame starts a schedule
+		{ 5000, interval },
+		{ 5000, 2 * interval },
+		{ 20000, 2 * interval + 20000 }, // past the deadline, but by less than an interval
+		{ 1000, 4 * interval },
+		{ 40000, 4 * interval + 40000 }, // more than an interval behind, restarts from here
+		{ 1000, 5 * interval + 40000 },
+	};
+
+	FakeClock clock;
+	FramePacer pacer(&clock);
+
+	FramePacingSettings settings;
+	settings.m_frameRateCap = 60.0f;
+	pacer.SetSettings(settings);
+
+	bool matches = true;
+	UINT64 previousStart = 0;
+
+	for (UINT i = 0; i < sizeof(frames) / sizeof(frames[0]); i++)
+	{
+		clock.Advance(frames[i].m_work);
+		double delta = pacer.BeginFrame();
+
+		double expectedDelta = i > 0 ? (double)(frames[i].m_start - previousStart) / clock.Frequency() : 0.0;
+		if (clock.Now() != frames[i].m_start || fabs(delta - expectedDelta) > 1e-9) matches = false;
+
+		previousStart = frames[i].m_start;
+	}
+
+	frameCount = sizeof(frames) / sizeof(frames[0]);
+	return matches;
+}
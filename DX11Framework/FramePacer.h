@@ -0,0 +1,81 @@
+#pragma once
+#include <windows.h>
+
+/// time source for frame pacing, ticks at Frequency per second. FramePacer only ever reads time through this,
+/// so swapping in FakeClock makes its waits and deltas fully deterministic
+class IClock
+{
+public:
+	virtual ~IClock() {}
+	virtual UINT64 Now() = 0;
+	virtual UINT64 Frequency() = 0;
+	virtual void SleepUntil(UINT64 ticks) = 0; // returns at or after ticks
+};
+
+/// QueryPerformanceCounter time, sleeps coarsely with Sleep then spins out the last couple of milliseconds
+class SystemClock : public IClock
+{
+private:
+	UINT64 m_frequency;
+
+public:
+	SystemClock();
+
+	UINT64 Now() override;
+	UINT64 Frequency() override { return m_frequency; }
+	void SleepUntil(UINT64 ticks) override;
+};
+
+/// time only moves when told to, sleeping jumps straight to the deadline
+class FakeClock : public IClock
+{
+private:
+	UINT64 m_now = 0;
+	UINT64 m_frequency;
+
+public:
+	FakeClock(UINT64 frequency = 1000000) : m_frequency(frequency) {}
+
+	UINT64 Now() override { return m_now; }
+	UINT64 Frequency() override { return m_frequency; }
+	void SleepUntil(UINT64 ticks) override { if (ticks > m_now) m_now = ticks; }
+
+	void Advance(UINT64 ticks) { m_now += ticks; }
+};
+
+struct FramePacingSettings
+{
+	bool m_enabled = true; // false is the old uncapped loop, no latency waits and Present(0, 0)
+	UINT m_maxFrameLatency = 1; // frames the CPU may queue ahead of the GPU, 1-16
+	float m_frameRateCap = 0.0f; // frames per second, 0 for none
+	bool m_vsync = false;
+};
+
+/// decides when the next frame may start. BeginFrame waits for the swap chain to accept another frame, then for the
+/// frame rate cap, and only then returns, so input read right after it is as fresh as the frame can show
+class FramePacer
+{
+private:
+	IClock* m_clock;
+	FramePacingSettings m_settings;
+	HANDLE m_frameLatencyWaitable = nullptr;
+
+	UINT64 m_frameInterval = 0; // ticks between frame starts, 0 uncapped
+	UINT64 m_nextFrame = 0;
+	UINT64 m_lastFrameStart = 0;
+	bool m_started = false;
+
+public:
+	FramePacer(IClock* clock) : m_clock(clock) {}
+
+	void SetSettings(const FramePacingSettings& settings);
+	const FramePacingSettings& GetSettings() { return m_settings; }
+
+	void SetFrameLatencyWaitable(HANDLE waitable) { m_frameLatencyWaitable = waitable; }
+
+	double BeginFrame();
+
+	UINT GetSyncInterval() { return m_settings.m_enabled && m_settings.m_vsync ? 1 : 0; }
+};
+
+bool CheckFramePacing(UINT& frameCount);
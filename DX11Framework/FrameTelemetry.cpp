@@ -0,0 +1,152 @@
+#include "FrameTelemetry.h"
+#include <algorithm>
+#include <cmath>
+
+const char* GetFramePhaseName(FramePhase phase) {
+	switch (phase) {
+	case FramePhase::Wait: return "wait";
+	case FramePhase::Update: return "update";
+	case FramePhase::Build: return "build";
+	case FramePhase::Submit: return "submit";
+	case FramePhase::Present: return "present";
+	default: return "frame";
+	}
+}
+
+const char* GetFrameCounterName(FrameCounter counter) {
+	switch (counter) {
+	case FrameCounter::StateCallsIssued: return "state_calls_issued";
+	default: return "state_calls_elided";
+	}
+}
+
+FrameTelemetry::FrameTelemetry(IClock* clock, UINT capacity) : m_clock(clock), m_capacity(max(capacity, 1u)) {
+	for (UINT i = 0; i < PHASE_COUNT; ++i) m_samples[i].resize(m_capacity);
+	for (UINT i = 0; i < COUNTER_COUNT; ++i) m_counterSamples[i].resize(m_capacity);
+	m_scratch.reserve(m_capacity);
+}
+
+/// <summary>
+/// starts timing a frame, phase times from the previous frame that was never ended are dropped
+/// </summary>
+void FrameTelemetry::BeginFrame() {
+	for (UINT i = 0; i < PHASE_COUNT; ++i) m_current[i] = 0;
+	for (UINT i = 0; i < COUNTER_COUNT; ++i) m_currentCounters[i] = 0;
+	m_frameStart = m_clock->Now();
+	m_inFrame = true;
+}
+
+/// <summary>
+/// writes this frame's phase times and counters into the ring, overwriting the oldest frame once it is full
+/// </summary>
+void FrameTelemetry::EndFrame() {
+	if (!m_inFrame) return;
+	m_inFrame = false;
+
+	m_current[(UINT)FramePhase::Frame] = m_clock->Now() - m_frameStart;
+
+	double msPerTick = 1000.0 / (double)m_clock->Frequency();
+	for (UINT i = 0; i < PHASE_COUNT; ++i) {
+		m_samples[i][m_next] = (float)(m_current[i] * msPerTick);
+	}
+	for (UINT i = 0; i < COUNTER_COUNT; ++i) {
+		m_counterSamples[i][m_next] = (float)m_currentCounters[i];
+	}
+
+	m_next = (m_next + 1) % m_capacity;
+	m_count = min(m_count + 1, m_capacity);
+	++m_totalFrames;
+}
+
+/// <summary>
+/// milliseconds the phase took in the most recently ended frame
+/// </summary>
+/// <param name="phase"></param>
+/// <returns></returns>
+float FrameTelemetry::GetLastFrameTime(FramePhase phase) {
+	if (m_count == 0) return 0.0f;
+	return m_samples[(UINT)phase][(m_next + m_capacity - 1) % m_capacity];
+}
+
+FramePhaseStats FrameTelemetry::ComputeStats(FramePhase phase) {
+	return ComputeStats(m_samples[(UINT)phase]);
+}
+
+FramePhaseStats FrameTelemetry::ComputeStats(FrameCounter counter) {
+	return ComputeStats(m_counterSamples[(UINT)counter]);
+}
+
+/// <summary>
+/// mean, percentiles and max of the frames currently in the ring, sorts a copy so it is meant for reporting rather than every frame
+/// </summary>
+/// <param name="samples">one phase's or counter's ring</param>
+/// <returns>all zero when no frame has ended yet</returns>
+FramePhaseStats FrameTelemetry::ComputeStats(const std::vector<float>& samples) {
+	FramePhaseStats stats;
+	if (m_count == 0) return stats;
+
+	// the ring is unordered once it wraps, which does not matter for order statistics
+	m_scratch.assign(samples.begin(), samples.begin() + m_count);
+	std::sort(m_scratch.begin(), m_scratch.end());
+
+	double sum = 0.0;
+	for (float sample : m_scratch) sum += sample;
+
+	// nearest rank, the smallest sample with at least p percent of samples at or below it
+	auto percentile = [this](double p) {
+		UINT rank = (UINT)ceil(p / 100.0 * m_count);
+		return (double)m_scratch[min(max(rank, 1u), m_count) - 1];
+	};
+
+	stats.m_frames = m_count;
+	stats.m_mean = sum / m_count;
+	stats.m_p50 = percentile(50.0);
+	stats.m_p95 = percentile(95.0);
+	stats.m_p99 = percentile(99.0);
+	stats.m_max = m_scratch.back();
+	return stats;
+}
+
+/// <summary>
+/// one row per phase with a header row, times in milliseconds, then a second table of counters after a blank line
+/// </summary>
+/// <param name="stream"></param>
+void FrameTelemetry::WriteCsv(std::ostream& stream) {
+	stream << "phase,frames,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+	for (UINT i = 0; i < PHASE_COUNT; ++i) {
+		FramePhaseStats stats = ComputeStats((FramePhase)i);
+		stream << GetFramePhaseName((FramePhase)i) << ',' << stats.m_frames << ',' << stats.m_mean << ','
+			<< stats.m_p50 << ',' << stats.m_p95 << ',' << stats.m_p99 << ',' << stats.m_max << '\n';
+	}
+
+	stream << "\ncounter,frames,mean,p50,p95,p99,max\n";
+	for (UINT i = 0; i < COUNTER_COUNT; ++i) {
+		FramePhaseStats stats = ComputeStats((FrameCounter)i);
+		stream << GetFrameCounterName((FrameCounter)i) << ',' << stats.m_frames << ',' << stats.m_mean << ','
+			<< stats.m_p50 << ',' << stats.m_p95 << ',' << stats.m_p99 << ',' << stats.m_max << '\n';
+	}
+}
+
+/// <summary>
+/// objects keyed by phase and counter name, each holding the same fields as the CSV columns
+/// </summary>
+/// <param name="stream"></param>
+void FrameTelemetry::WriteJson(std::ostream& stream) {
+	stream << "{\n  \"totalFrames\": " << m_totalFrames << ",\n  \"phases\": {\n";
+	for (UINT i = 0; i < PHASE_COUNT; ++i) {
+		FramePhaseStats stats = ComputeStats((FramePhase)i);
+		stream << "    \"" << GetFramePhaseName((FramePhase)i) << "\": { \"frames\": " << stats.m_frames
+			<< ", \"mean_ms\": " << stats.m_mean << ", \"p50_ms\": " << stats.m_p50 << ", \"p95_ms\": " << stats.m_p95
+			<< ", \"p99_ms\": " << stats.m_p99 << ", \"max_ms\": " << stats.m_max << " }"
+			<< (i + 1 < PHASE_COUNT ? ",\n" : "\n");
+	}
+	stream << "  },\n  \"counters\": {\n";
+	for (UINT i = 0; i < COUNTER_COUNT; ++i) {
+		FramePhaseStats stats = ComputeStats((FrameCounter)i);
+		stream << "    \"" << GetFrameCounterName((FrameCounter)i) << "\": { \"frames\": " << stats.m_frames
+			<< ", \"mean\": " << stats.m_mean << ", \"p50\": " << stats.m_p50 << ", \"p95\": " << stats.m_p95
+			<< ", \"p99\": " << stats.m_p99 << ", \"max\": " << stats.m_max << " }"
+			<< (i + 1 < COUNTER_COUNT ? ",\n" : "\n");
+	}
+	stream << "  }\n}\n";
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <ostream>
+#include "FramePacer.h"
+
+// CPU side phases of one frame, Frame is the whole frame from BeginFrame to EndFrame
+enum class FramePhase
+{
+	Wait, // frame pacing, swap chain latency and frame rate cap
+	Update,
+	Build, // scene submission, queue sort and draw recording
+	Submit, // executing recorded command lists on the immediate context
+	Present,
+	Frame,
+	Count
+};
+
+const char* GetFramePhaseName(FramePhase phase);
+
+// per frame counts kept alongside the phase times
+enum class FrameCounter
+{
+	StateCallsIssued, // pipeline state calls the state caches passed on to a context
+	StateCallsElided, // ones they dropped as already bound
+	Count
+};
+
+const char* GetFrameCounterName(FrameCounter counter);
+
+struct FramePhaseStats
+{
+	UINT m_frames = 0;
+	double m_mean = 0.0; // milliseconds, or a plain count for a FrameCounter
+	double m_p50 = 0.0;
+	double m_p95 = 0.0;
+	double m_p99 = 0.0;
+	double m_max = 0.0;
+};
+
+/// per phase CPU times and per frame counters of the last m_capacity frames in a ring buffer. times are read through
+/// an IClock, so FakeClock gives exact, repeatable samples. percentiles are nearest rank over the frames in the ring
+class FrameTelemetry
+{
+private:
+	static const UINT PHASE_COUNT = (UINT)FramePhase::Count;
+	static const UINT COUNTER_COUNT = (UINT)FrameCounter::Count;
+
+	IClock* m_clock;
+	UINT m_capacity;
+	UINT m_next = 0;
+	UINT m_count = 0;
+	UINT64 m_totalFrames = 0;
+
+	std::vector<float> m_samples[PHASE_COUNT]; // milliseconds, m_capacity each
+	std::vector<float> m_counterSamples[COUNTER_COUNT];
+	std::vector<float> m_scratch;
+
+	UINT64 m_frameStart = 0;
+	UINT64 m_phaseStart[PHASE_COUNT] = {};
+	UINT64 m_current[PHASE_COUNT] = {}; // ticks accumulated this frame
+	UINT m_currentCounters[COUNTER_COUNT] = {};
+	bool m_inFrame = false;
+
+	FramePhaseStats ComputeStats(const std::vector<float>& samples);
+
+public:
+	FrameTelemetry(IClock* clock, UINT capacity = 1024);
+
+	void BeginFrame();
+	void EndFrame();
+
+	// a phase can be begun and ended several times in a frame, its times add up
+	void BeginPhase(FramePhase phase) { m_phaseStart[(UINT)phase] = m_clock->Now(); }
+	void EndPhase(FramePhase phase) { m_current[(UINT)phase] += m_clock->Now() - m_phaseStart[(UINT)phase]; }
+
+	// counters start each frame at 0, and are written into the ring with the phase times by EndFrame
+	void AddCount(FrameCounter counter, UINT count) { m_currentCounters[(UINT)counter] += count; }
+
+	UINT GetFrameCount() { return m_count; }
+	UINT64 GetTotalFrames() { return m_totalFrames; }
+	float GetLastFrameTime(FramePhase phase);
+
+	FramePhaseStats ComputeStats(FramePhase phase);
+	FramePhaseStats ComputeStats(FrameCounter counter);
+
+	void WriteCsv(std::ostream& stream);
+	void WriteJson(std::ostream& stream);
+};
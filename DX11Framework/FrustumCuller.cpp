@@ -0,0 +1,186 @@
+#include "FrustumCuller.h"
+#include <cfloat>
+#include <random>
+#include <thread>
+
+/// <summary>
+/// planes of a row vector view projection matrix, the clip space tests -w &lt;= x, y &lt;= w and 0 &lt;= z &lt;= w are
+/// each a dot product of the point with a sum or difference of the matrix columns
+/// </summary>
+/// <param name="viewProjection"></param>
+/// <returns>normalised planes, so plane distances are world units</returns>
+Frustum ExtractFrustum(const XMFLOAT4X4& viewProjection) {
+	const XMFLOAT4X4& m = viewProjection;
+	XMVECTOR column0 = XMVectorSet(m._11, m._21, m._31, m._41);
+	XMVECTOR column1 = XMVectorSet(m._12, m._22, m._32, m._42);
+	XMVECTOR column2 = XMVectorSet(m._13, m._23, m._33, m._43);
+	XMVECTOR column3 = XMVectorSet(m._14, m._24, m._34, m._44);
+
+	XMVECTOR planes[6] = {
+		column3 + column0, // left
+		column3 - column0, // right
+		column3 + column1, // bottom
+		column3 - column1, // top
+		column2, // near, d3d clip z starts at 0
+		column3 - column2 // far
+	};
+
+	Frustum frustum;
+	for (UINT i = 0; i < 6; i++) XMStoreFloat4(&frustum.m_planes[i], XMPlaneNormalize(planes[i]));
+	return frustum;
+}
+
+bool SphereInFrustum(const Frustum& frustum, const XMFLOAT3& centre, float radius) {
+	for (UINT i = 0; i < 6; i++) {
+		const XMFLOAT4& plane = frustum.m_planes[i];
+		if (plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w < -radius) return false;
+	}
+	return true;
+}
+
+XMFLOAT4 TransformBoundingSphere(const XMFLOAT4& sphere, const XMFLOAT4X4& world) {
+	XMMATRIX matrix = XMLoadFloat4x4(&world);
+	XMVECTOR centre = XMVector3TransformCoord(XMVectorSet(sphere.x, sphere.y, sphere.z, 1.0f), matrix);
+
+	float scaleSq = max(XMVectorGetX(XMVector3LengthSq(matrix.r[0])), max(XMVectorGetX(XMVector3LengthSq(matrix.r[1])), XMVectorGetX(XMVector3LengthSq(matrix.r[2]))));
+
+	XMFLOAT4 result;
+	XMStoreFloat4(&result, centre);
+	result.w = sphere.w * sqrtf(scaleSq);
+	return result;
+}
+
+/// <summary>
+/// sets the sphere count, existing spheres below count are kept and new ones must be set before the next Cull
+/// </summary>
+/// <param name="count"></param>
+void FrustumCuller::Resize(UINT count) {
+	UINT padded = (count + 3) & ~3u;
+	m_count = count;
+	m_x.resize(padded);
+	m_y.resize(padded);
+	m_z.resize(padded);
+	m_radius.resize(padded);
+	m_visible.resize(padded);
+	m_visibleCount = 0;
+
+	// a radius of -FLT_MAX fails the first plane whatever the centre
+	for (UINT i = count; i < padded; i++) SetSphere(i, XMFLOAT3(0.0f, 0.0f, 0.0f), -FLT_MAX);
+}
+
+/// <summary>
+/// tests every sphere against frustum, small sets stay on the calling thread
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="maxThreads">upper bound on threads including the calling one</param>
+/// <returns>visible sphere count</returns>
+UINT FrustumCuller::Cull(const Frustum& frustum, UINT maxThreads) {
+	UINT padded = (UINT)m_x.size();
+	UINT threadCount = max(1u, min(maxThreads, padded / MIN_SPHERES_PER_THREAD));
+
+	if (threadCount <= 1) {
+		m_visibleCount = CullRange(frustum, m_x.data(), m_y.data(), m_z.data(), m_radius.data(), 0, padded, m_visible.data());
+		return m_visibleCount;
+	}
+
+	// bands are whole blocks of four, each writes its indices from the start of its own band
+	UINT band = ((padded / 4 + threadCount - 1) / threadCount) * 4;
+	std::vector<UINT> counts(threadCount, 0);
+	std::vector<std::thread> workers;
+
+	auto cullBand = [this, &frustum, &counts, band, padded](UINT t) {
+		UINT begin = min(t * band, padded);
+		UINT end = min(begin + band, padded);
+		counts[t] = CullRange(frustum, m_x.data(), m_y.data(), m_z.data(), m_radius.data(), begin, end, m_visible.data() + begin);
+	};
+
+	for (UINT t = 0; t + 1 < threadCount; t++) workers.emplace_back(cullBand, t);
+	cullBand(threadCount - 1);
+
+	for (std::thread& worker : workers) worker.join();
+
+	// close the gaps between bands, in band order so the indices stay ascending
+	m_visibleCount = counts[0];
+	for (UINT t = 1; t < threadCount; t++) {
+		memmove(m_visible.data() + m_visibleCount, m_visible.data() + min(t * band, padded), counts[t] * sizeof(UINT));
+		m_visibleCount += counts[t];
+	}
+	return m_visibleCount;
+}
+
+/// <summary>
+/// four spheres per step against all six planes, the kept indices are written without branching, so visible
+/// needs room for end - begin indices even though fewer are counted
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="x">sphere centres and radii, read from begin to end</param>
+/// <param name="y"></param>
+/// <param name="z"></param>
+/// <param name="radius"></param>
+/// <param name="begin">multiple of four</param>
+/// <param name="end">multiple of four</param>
+/// <param name="visible"></param>
+/// <returns>indices written</returns>
+UINT FrustumCuller::CullRange(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius, UINT begin, UINT end, UINT* visible) {
+	XMVECTOR planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (UINT p = 0; p < 6; p++) {
+		planeX[p] = XMVectorReplicate(frustum.m_planes[p].x);
+		planeY[p] = XMVectorReplicate(frustum.m_planes[p].y);
+		planeZ[p] = XMVectorReplicate(frustum.m_planes[p].z);
+		planeW[p] = XMVectorReplicate(frustum.m_planes[p].w);
+	}
+
+	UINT written = 0;
+	for (UINT i = begin; i < end; i += 4) {
+		XMVECTOR sphereX = XMLoadFloat4((const XMFLOAT4*)(x + i));
+		XMVECTOR sphereY = XMLoadFloat4((const XMFLOAT4*)(y + i));
+		XMVECTOR sphereZ = XMLoadFloat4((const XMFLOAT4*)(z + i));
+		XMVECTOR negRadius = XMVectorNegate(XMLoadFloat4((const XMFLOAT4*)(radius + i)));
+
+		XMVECTOR inside = XMVectorTrueInt();
+		for (UINT p = 0; p < 6; p++) {
+			XMVECTOR distance = XMVectorMultiplyAdd(sphereX, planeX[p], planeW[p]);
+			distance = XMVectorMultiplyAdd(sphereY, planeY[p], distance);
+			distance = XMVectorMultiplyAdd(sphereZ, planeZ[p], distance);
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(distance, negRadius));
+		}
+
+		XMUINT4 mask;
+		XMStoreUInt4(&mask, inside);
+		visible[written] = i; written += mask.x & 1;
+		visible[written] = i + 1; written += mask.y & 1;
+		visible[written] = i + 2; written += mask.z & 1;
+		visible[written] = i + 3; written += mask.w & 1;
+	}
+	return written;
+}
+
+/// <summary>
+/// average milliseconds to cull count random spheres around a camera at the origin, about a fifth of them visible
+/// </summary>
+/// <param name="count"></param>
+/// <param name="iterations"></param>
+/// <param name="threads"></param>
+/// <returns></returns>
+double FrustumCuller::BenchmarkCull(UINT count, UINT iterations, UINT threads) {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 2.0f);
+
+	FrustumCuller culler;
+	culler.Resize(count);
+	for (UINT i = 0; i < count; i++) culler.SetSphere(i, XMFLOAT3(position(random), position(random), position(random)), size(random));
+
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixLookToLH(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))
+		* XMMatrixPerspectiveFovLH(XMConvertToRadians(90), 16.0f / 9.0f, 0.01f, 1000.0f));
+	Frustum frustum = ExtractFrustum(viewProjection);
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	QueryPerformanceCounter(&start);
+	for (UINT i = 0; i < iterations; i++) culler.Cull(frustum, threads);
+	QueryPerformanceCounter(&end);
+
+	return (end.QuadPart - start.QuadPart) * 1000.0 / ((double)frequency.QuadPart * (iterations > 0 ? iterations : 1));
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+/// left, right, bottom, top, near, far planes facing inwards, xyz the unit normal and w the distance,
+/// a point p is inside a plane when dot(n, p) + w >= 0
+struct Frustum
+{
+	XMFLOAT4 m_planes[6];
+};
+
+Frustum ExtractFrustum(const XMFLOAT4X4& viewProjection);
+
+// true when the sphere touches the frustum, conservative near the corners where it can pass spheres just outside
+bool SphereInFrustum(const Frustum& frustum, const XMFLOAT3& centre, float radius);
+
+// world space sphere around a local one, the radius grows by the largest axis scale of world
+XMFLOAT4 TransformBoundingSphere(const XMFLOAT4& sphere, const XMFLOAT4X4& world);
+
+/// bounding spheres kept as separate x, y, z and radius arrays so four are tested against a plane in one go.
+/// the arrays are padded to a multiple of four with spheres that are always outside, so there is no scalar tail.
+/// Cull writes the indices of the spheres that touch the frustum in ascending order, threads take contiguous
+/// blocks and write straight into their part of the output, which is then closed up
+class FrustumCuller
+{
+private:
+	static const UINT MIN_SPHERES_PER_THREAD = 16384;
+
+	UINT m_count = 0;
+	std::vector<float> m_x;
+	std::vector<float> m_y;
+	std::vector<float> m_z;
+	std::vector<float> m_radius;
+	std::vector<UINT> m_visible;
+	UINT m_visibleCount = 0;
+
+public:
+	void Resize(UINT count);
+	UINT GetCount() { return m_count; }
+
+	void SetSphere(UINT index, const XMFLOAT3& centre, float radius) {
+		m_x[index] = centre.x;
+		m_y[index] = centre.y;
+		m_z[index] = centre.z;
+		m_radius[index] = radius;
+	}
+
+	UINT Cull(const Frustum& frustum, UINT maxThreads = 1);
+
+	// indices of the spheres the last Cull kept, GetVisibleCount of them
+	const UINT* GetVisible() { return m_visible.data(); }
+	UINT GetVisibleCount() { return m_visibleCount; }
+
+	static UINT CullRange(const Frustum& frustum, const float* x, const float* y, const float* z, const float* radius, UINT begin, UINT end, UINT* visible);
+	static double BenchmarkCull(UINT count, UINT iterations, UINT threads);
+};
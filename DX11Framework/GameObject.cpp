@@ -9,18 +9,37 @@ GameObject::~GameObject() {
 	if (m_textureC) m_textureC->Release();
 	if (m_textureS) m_textureS->Release();
 	if (m_textureN) m_textureN->Release();
+	if (m_textureD) m_textureD->Release();
 }
 
 /// <summary>
-/// Takes in all required parameters to complete all draw functionality within the game object
+/// colour, specular and normal maps in t0-t2, displacement for the domain stage when tessellated
 /// </summary>
-/// <param name="deviceContext"></param>
-/// <param name="cbData"></param>
-void GameObject::Draw(ID3D11DeviceContext* deviceContext, ConstantBuffer* cbData) {
-	deviceContext->IASetVertexBuffers(0, 1, &GetMeshData()->m_vertexBuffer, &GetMeshData()->m_vBStride, &GetMeshData()->m_vBOffset);
-	deviceContext->IASetIndexBuffer(GetMeshData()->m_indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+/// <returns></returns>
+RenderMaterial GameObject::GetMaterial() {
+	RenderMaterial material;
+	material.m_pixelResources[0] = m_textureC;
+	material.m_pixelResources[1] = m_textureS;
+	material.m_pixelResources[2] = m_textureN;
+	material.m_pixelResourceCount = 3;
+	material.m_domainResource = m_textureD;
+	material.m_hasTexture = m_hasTex;
+	material.m_specMap = m_hasSpec;
+	material.m_normMap = m_hasNorm;
+	return material;
+}
 
-	cbData->HasTexture = m_hasTex;
-	cbData->SpecMap = m_hasSpec;
-	cbData->NormMap = m_hasNorm;
+/// <summary>
+/// the loaded OBJ buffers as an indexed draw
+/// </summary>
+/// <returns></returns>
+RenderMesh GameObject::GetMesh() {
+	RenderMesh mesh;
+	mesh.m_vertexBuffer = m_meshData.m_vertexBuffer;
+	mesh.m_indexBuffer = m_meshData.m_indexBuffer;
+	mesh.m_stride = m_meshData.m_vBStride;
+	mesh.m_offset = m_meshData.m_vBOffset;
+	mesh.m_count = m_meshData.m_indexCount;
+	mesh.m_boundingSphere = m_meshData.m_boundingSphere;
+	return mesh;
 }
\ No newline at end of file
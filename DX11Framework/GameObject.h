@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Structures.h"
+#include "RenderQueue.h"
 
 class GameObject
 {
@@ -8,6 +9,7 @@ private:
 	ID3D11ShaderResourceView* m_textureC = nullptr;
 	ID3D11ShaderResourceView* m_textureS = nullptr;
 	ID3D11ShaderResourceView* m_textureN = nullptr;
+	ID3D11ShaderResourceView* m_textureD = nullptr;
 	MeshData m_meshData;
 	XMFLOAT4X4 m_world;
 
@@ -20,20 +22,24 @@ public:
 	UINT m_hasTex;
 	UINT m_hasSpec;
 	UINT m_hasNorm;
+	UINT m_hasDisp = 0;
 	std::wstring m_textureColor;
 	std::wstring m_textureSpecular;
 	std::wstring m_textureNormal;
+	std::wstring m_textureDisplacement;
 
 	void SetMeshData(MeshData in) { m_meshData = in; }
 
 	ID3D11ShaderResourceView** GetShaderResourceC() { return &m_textureC; }
 	ID3D11ShaderResourceView** GetShaderResourceS() { return &m_textureS; }
 	ID3D11ShaderResourceView** GetShaderResourceN() { return &m_textureN; }
+	ID3D11ShaderResourceView** GetShaderResourceD() { return &m_textureD; }
 	MeshData* GetMeshData() { return &m_meshData; }
 
 	void SetPosition(XMFLOAT4X4 newWorld) { m_world = newWorld; }
 	XMFLOAT4X4* getPosition() { return &m_world; }
 
-	void Draw(ID3D11DeviceContext* deviceContext, ConstantBuffer* cbData);
+	RenderMaterial GetMaterial();
+	RenderMesh GetMesh();
 };
 
@@ -0,0 +1,312 @@
+#include "HeightMapGenerator.h"
+#include <thread>
+
+// skew factors for 2D simplex
+static const float F2 = 0.366025403f; // 0.5 * (sqrt(3) - 1)
+static const float G2 = 0.211324865f; // (3 - sqrt(3)) / 6
+
+static const float GradX[12] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0 };
+static const float GradZ[12] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1 };
+
+/// <summary>
+/// xorshift, used instead of std::shuffle so a seed gives the same map on every compiler
+/// </summary>
+/// <param name="state"></param>
+/// <returns></returns>
+static UINT NextRandom(UINT& state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+HeightMapGenerator::HeightMapGenerator(const NoiseSettings& settings) {
+	m_settings = settings;
+	m_settings.m_octaves = max(1u, min(m_settings.m_octaves, 16u));
+
+	UINT state = settings.m_seed * 747796405u + 2891336453u;
+	if (state == 0) state = 1;
+
+	unsigned char p[256];
+	for (UINT i = 0; i < 256; ++i) p[i] = (unsigned char)i;
+
+	// fisher-yates
+	for (UINT i = 255; i > 0; --i) {
+		UINT j = NextRandom(state) % (i + 1);
+		unsigned char temp = p[i];
+		p[i] = p[j];
+		p[j] = temp;
+	}
+
+	for (UINT i = 0; i < 512; ++i) m_perm[i] = p[i & 255];
+
+	for (UINT i = 0; i < 16; ++i) {
+		m_octaveOffsets[i].x = (NextRandom(state) % 100000) * 0.01f;
+		m_octaveOffsets[i].y = (NextRandom(state) % 100000) * 0.01f;
+	}
+}
+
+/// <summary>
+/// 2D simplex noise for 4 points at once, only the permutation lookup is per lane
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+/// <returns>noise in roughly -1 to 1</returns>
+XMVECTOR XM_CALLCONV HeightMapGenerator::Simplex4(FXMVECTOR x, FXMVECTOR z) const {
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR g2 = XMVectorReplicate(G2);
+
+	// skew into simplex cell space
+	XMVECTOR s = XMVectorScale(XMVectorAdd(x, z), F2);
+	XMVECTOR i = XMVectorFloor(XMVectorAdd(x, s));
+	XMVECTOR j = XMVectorFloor(XMVectorAdd(z, s));
+	XMVECTOR t = XMVectorMultiply(XMVectorAdd(i, j), g2);
+
+	XMVECTOR x0 = XMVectorSubtract(x, XMVectorSubtract(i, t));
+	XMVECTOR z0 = XMVectorSubtract(z, XMVectorSubtract(j, t));
+
+	// which triangle of the cell
+	XMVECTOR upper = XMVectorGreater(x0, z0);
+	XMVECTOR i1 = XMVectorSelect(zero, one, upper);
+	XMVECTOR j1 = XMVectorSubtract(one, i1);
+
+	XMVECTOR x1 = XMVectorAdd(XMVectorSubtract(x0, i1), g2);
+	XMVECTOR z1 = XMVectorAdd(XMVectorSubtract(z0, j1), g2);
+	XMVECTOR x2 = XMVectorAdd(XMVectorSubtract(x0, one), XMVectorAdd(g2, g2));
+	XMVECTOR z2 = XMVectorAdd(XMVectorSubtract(z0, one), XMVectorAdd(g2, g2));
+
+	XMINT4 ci, cj, ci1;
+	XMStoreSInt4(&ci, XMConvertVectorFloatToInt(i, 0));
+	XMStoreSInt4(&cj, XMConvertVectorFloatToInt(j, 0));
+	XMStoreSInt4(&ci1, XMConvertVectorFloatToInt(i1, 0));
+
+	const int* pi = &ci.x;
+	const int* pj = &cj.x;
+	const int* pi1 = &ci1.x;
+
+	XMFLOAT4A gx[3], gz[3];
+	float* gxp[3] = { &gx[0].x, &gx[1].x, &gx[2].x };
+	float* gzp[3] = { &gz[0].x, &gz[1].x, &gz[2].x };
+
+	for (UINT lane = 0; lane < 4; ++lane) {
+		int ii = pi[lane] & 255;
+		int jj = pj[lane] & 255;
+		int di = pi1[lane];
+		int dj = 1 - di;
+
+		UINT g0 = m_perm[ii + m_perm[jj]] % 12;
+		UINT g1 = m_perm[ii + di + m_perm[jj + dj]] % 12;
+		UINT g2i = m_perm[ii + 1 + m_perm[jj + 1]] % 12;
+
+		gxp[0][lane] = GradX[g0]; gzp[0][lane] = GradZ[g0];
+		gxp[1][lane] = GradX[g1]; gzp[1][lane] = GradZ[g1];
+		gxp[2][lane] = GradX[g2i]; gzp[2][lane] = GradZ[g2i];
+	}
+
+	const XMVECTOR half = XMVectorReplicate(0.5f);
+	XMVECTOR xs[3] = { x0, x1, x2 };
+	XMVECTOR zs[3] = { z0, z1, z2 };
+	XMVECTOR n = zero;
+
+	for (UINT c = 0; c < 3; ++c) {
+		XMVECTOR falloff = XMVectorSubtract(half, XMVectorMultiplyAdd(xs[c], xs[c], XMVectorMultiply(zs[c], zs[c])));
+		falloff = XMVectorMax(falloff, zero);
+		falloff = XMVectorMultiply(falloff, falloff);
+		falloff = XMVectorMultiply(falloff, falloff);
+
+		XMVECTOR grad = XMVectorMultiplyAdd(XMLoadFloat4A(&gx[c]), xs[c], XMVectorMultiply(XMLoadFloat4A(&gz[c]), zs[c]));
+		n = XMVectorMultiplyAdd(falloff, grad, n);
+	}
+
+	return XMVectorScale(n, 70.0f);
+}
+
+/// <summary>
+/// fractal sum of octaves, normalised back to -1 to 1
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+/// <returns></returns>
+XMVECTOR XM_CALLCONV HeightMapGenerator::Fbm4(FXMVECTOR x, FXMVECTOR z) const {
+	XMVECTOR sum = XMVectorZero();
+	float amplitude = 1.0f;
+	float frequency = m_settings.m_frequency;
+	float total = 0.0f;
+
+	for (UINT o = 0; o < m_settings.m_octaves; ++o) {
+		XMVECTOR ox = XMVectorAdd(XMVectorScale(x, frequency), XMVectorReplicate(m_octaveOffsets[o].x));
+		XMVECTOR oz = XMVectorAdd(XMVectorScale(z, frequency), XMVectorReplicate(m_octaveOffsets[o].y));
+
+		sum = XMVectorAdd(sum, XMVectorScale(Simplex4(ox, oz), amplitude));
+
+		total += amplitude;
+		amplitude *= m_settings.m_gain;
+		frequency *= m_settings.m_lacunarity;
+	}
+
+	return XMVectorScale(sum, 1.0f / total);
+}
+
+/// <summary>
+/// ridged multifractal, each octave is weighted by the one before so ridges stay sharp and valleys smooth
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+/// <returns>0 to 1</returns>
+XMVECTOR XM_CALLCONV HeightMapGenerator::Ridged4(FXMVECTOR x, FXMVECTOR z) const {
+	const XMVECTOR one = XMVectorSplatOne();
+	XMVECTOR sum = XMVectorZero();
+	XMVECTOR weight = one;
+	float amplitude = 1.0f;
+	float frequency = m_settings.m_frequency;
+	float total = 0.0f;
+
+	for (UINT o = 0; o < m_settings.m_octaves; ++o) {
+		XMVECTOR ox = XMVectorAdd(XMVectorScale(x, frequency), XMVectorReplicate(m_octaveOffsets[o].x));
+		XMVECTOR oz = XMVectorAdd(XMVectorScale(z, frequency), XMVectorReplicate(m_octaveOffsets[o].y));
+
+		XMVECTOR signal = XMVectorSubtract(one, XMVectorAbs(Simplex4(ox, oz)));
+		signal = XMVectorMultiply(signal, signal);
+		signal = XMVectorMultiply(signal, weight);
+
+		weight = XMVectorSaturate(XMVectorScale(signal, 2.0f * m_settings.m_gain));
+
+		sum = XMVectorAdd(sum, XMVectorScale(signal, amplitude));
+
+		total += amplitude;
+		amplitude *= m_settings.m_gain;
+		frequency *= m_settings.m_lacunarity;
+	}
+
+	return XMVectorScale(sum, 1.0f / total);
+}
+
+/// <summary>
+/// height in 0 to 1 for the configured noise type
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+/// <returns></returns>
+XMVECTOR XM_CALLCONV HeightMapGenerator::Height4(FXMVECTOR x, FXMVECTOR z) const {
+	const XMVECTOR half = XMVectorReplicate(0.5f);
+
+	switch (m_settings.m_type) {
+	case NoiseType::Ridged:
+		return XMVectorSaturate(Ridged4(x, z));
+	case NoiseType::DomainWarped:
+	{
+		// offset the lookup by two further fbm fields
+		XMVECTOR qx = Fbm4(XMVectorAdd(x, XMVectorReplicate(5.2f / m_settings.m_frequency)), z);
+		XMVECTOR qz = Fbm4(x, XMVectorAdd(z, XMVectorReplicate(1.3f / m_settings.m_frequency)));
+
+		XMVECTOR wx = XMVectorMultiplyAdd(qx, XMVectorReplicate(m_settings.m_warpStrength), x);
+		XMVECTOR wz = XMVectorMultiplyAdd(qz, XMVectorReplicate(m_settings.m_warpStrength), z);
+
+		return XMVectorSaturate(XMVectorMultiplyAdd(Fbm4(wx, wz), half, half));
+	}
+	default:
+		return XMVectorSaturate(XMVectorMultiplyAdd(Fbm4(x, z), half, half));
+	}
+}
+
+/// <summary>
+/// fills rows [firstRow, lastRow) of a region, 4 columns at a time
+/// </summary>
+/// <param name="originX"></param>
+/// <param name="originZ"></param>
+/// <param name="width"></param>
+/// <param name="firstRow"></param>
+/// <param name="lastRow"></param>
+/// <param name="heightScale"></param>
+/// <param name="dst"></param>
+void HeightMapGenerator::GenerateRows(int originX, int originZ, UINT width, UINT firstRow, UINT lastRow, float heightScale, float* dst) const {
+	const XMVECTOR laneOffsets = XMVectorSet(0.0f, 1.0f, 2.0f, 3.0f);
+	XMFLOAT4A tail;
+
+	for (UINT row = firstRow; row < lastRow; ++row) {
+		XMVECTOR z = XMVectorReplicate((float)(originZ + (int)row));
+		float* out = dst + (size_t)row * width;
+
+		UINT col = 0;
+		for (; col + 4 <= width; col += 4) {
+			XMVECTOR x = XMVectorAdd(XMVectorReplicate((float)(originX + (int)col)), laneOffsets);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(out + col), XMVectorScale(Height4(x, z), heightScale));
+		}
+
+		if (col < width) {
+			XMVECTOR x = XMVectorAdd(XMVectorReplicate((float)(originX + (int)col)), laneOffsets);
+			XMStoreFloat4A(&tail, XMVectorScale(Height4(x, z), heightScale));
+			memcpy(out + col, &tail, sizeof(float) * (width - col));
+		}
+	}
+}
+
+/// <summary>
+/// generates a width x height block of heights starting at a global sample coordinate
+/// </summary>
+/// <param name="originX"></param>
+/// <param name="originZ"></param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="heightScale"></param>
+/// <param name="dst">width * height floats</param>
+/// <param name="threadCount">0 uses every hardware thread</param>
+void HeightMapGenerator::GenerateRegion(int originX, int originZ, UINT width, UINT height, float heightScale, float* dst, UINT threadCount) const {
+	if (threadCount == 0) threadCount = max(1u, std::thread::hardware_concurrency());
+	threadCount = min(threadCount, height);
+
+	if (threadCount <= 1) {
+		GenerateRows(originX, originZ, width, 0, height, heightScale, dst);
+		return;
+	}
+
+	// contiguous bands of rows, the main thread takes the last band
+	std::vector<std::thread> workers;
+	UINT band = (height + threadCount - 1) / threadCount;
+
+	for (UINT t = 0; t + 1 < threadCount; ++t) {
+		UINT first = t * band;
+		UINT last = min(first + band, height);
+		workers.emplace_back(&HeightMapGenerator::GenerateRows, this, originX, originZ, width, first, last, heightScale, dst);
+	}
+
+	GenerateRows(originX, originZ, width, min((threadCount - 1) * band, height), height, heightScale, dst);
+
+	for (std::thread& worker : workers) worker.join();
+}
+
+/// <summary>
+/// single height in 0 to 1, same result as the region path
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+/// <returns></returns>
+float HeightMapGenerator::Sample(float x, float z) const {
+	return XMVectorGetX(Height4(XMVectorReplicate(x), XMVectorReplicate(z)));
+}
+
+/// <summary>
+/// time generating a size x size map with default settings
+/// </summary>
+/// <param name="size"></param>
+/// <param name="type"></param>
+/// <param name="iterations"></param>
+/// <param name="threadCount">0 uses every hardware thread</param>
+/// <returns>milliseconds per map</returns>
+double HeightMapGenerator::Benchmark(UINT size, NoiseType type, UINT iterations, UINT threadCount) {
+	NoiseSettings settings;
+	settings.m_type = type;
+	HeightMapGenerator generator(settings);
+
+	std::vector<float> heights((size_t)size * size);
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	QueryPerformanceCounter(&start);
+	for (UINT i = 0; i < iterations; i++) generator.GenerateRegion(0, 0, size, size, 1.0f, heights.data(), threadCount);
+	QueryPerformanceCounter(&end);
+
+	return (end.QuadPart - start.QuadPart) * 1000.0 / ((double)frequency.QuadPart * (iterations > 0 ? iterations : 1));
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+enum class NoiseType
+{
+	FBM,
+	Ridged,
+	DomainWarped
+};
+
+struct NoiseSettings
+{
+	NoiseType m_type = NoiseType::FBM;
+	UINT m_seed = 1337;
+	UINT m_octaves = 6;
+	float m_frequency = 1.0f / 256.0f; // per sample
+	float m_lacunarity = 2.0f;
+	float m_gain = 0.5f;
+	float m_warpStrength = 80.0f; // in samples, domain warped only
+};
+
+/// simplex noise heightmap generator, 4 columns per SIMD lane group and rows split across threads.
+/// regions are addressed in global sample coordinates so separately generated chunks line up exactly
+class HeightMapGenerator
+{
+private:
+	NoiseSettings m_settings;
+	unsigned char m_perm[512];
+	XMFLOAT2 m_octaveOffsets[16]; // decorrelates octaves, derived from the seed
+
+	XMVECTOR XM_CALLCONV Simplex4(FXMVECTOR x, FXMVECTOR z) const;
+	XMVECTOR XM_CALLCONV Fbm4(FXMVECTOR x, FXMVECTOR z) const;
+	XMVECTOR XM_CALLCONV Ridged4(FXMVECTOR x, FXMVECTOR z) const;
+	XMVECTOR XM_CALLCONV Height4(FXMVECTOR x, FXMVECTOR z) const;
+
+	void GenerateRows(int originX, int originZ, UINT width, UINT firstRow, UINT lastRow, float heightScale, float* dst) const;
+
+public:
+	HeightMapGenerator(const NoiseSettings& settings);
+
+	void GenerateRegion(int originX, int originZ, UINT width, UINT height, float heightScale, float* dst, UINT threadCount = 0) const;
+	float Sample(float x, float z) const;
+
+	static double Benchmark(UINT size, NoiseType type, UINT iterations, UINT threadCount);
+};
@@ -0,0 +1,215 @@
+#include "HeightMapStream.h"
+
+UINT GetHeightMapSampleSize(HeightMapFormat format) {
+	switch (format) {
+	case HeightMapFormat::R16:
+		return sizeof(unsigned short);
+	case HeightMapFormat::R32F:
+		return sizeof(float);
+	default:
+		return sizeof(unsigned char);
+	}
+}
+
+/// <summary>
+/// converts raw samples to floats, integer formats are normalised to 0-1 first, float samples are taken as already normalised
+/// </summary>
+/// <param name="src"></param>
+/// <param name="count"></param>
+/// <param name="format"></param>
+/// <param name="scale"></param>
+/// <param name="dst"></param>
+void DecodeHeightSamples(const unsigned char* src, UINT count, HeightMapFormat format, float scale, float* dst) {
+	switch (format) {
+	case HeightMapFormat::R16:
+	{
+		const float norm = scale / 65535.0f;
+		for (UINT i = 0; i < count; ++i) {
+			unsigned short value;
+			memcpy(&value, src + i * sizeof(unsigned short), sizeof(unsigned short)); // RAW rows are not guaranteed aligned
+			dst[i] = value * norm;
+		}
+		break;
+	}
+	case HeightMapFormat::R32F:
+	{
+		for (UINT i = 0; i < count; ++i) {
+			float value;
+			memcpy(&value, src + i * sizeof(float), sizeof(float));
+			dst[i] = value * scale;
+		}
+		break;
+	}
+	default:
+	{
+		const float norm = scale / 255.0f;
+		for (UINT i = 0; i < count; ++i) {
+			dst[i] = src[i] * norm;
+		}
+		break;
+	}
+	}
+}
+
+/// <summary>
+/// converts heights back to raw samples so baked maps can be written out as RAW files
+/// </summary>
+/// <param name="src"></param>
+/// <param name="count"></param>
+/// <param name="format"></param>
+/// <param name="scale">the height scale the samples were decoded with</param>
+/// <param name="dst"></param>
+void EncodeHeightSamples(const float* src, UINT count, HeightMapFormat format, float scale, unsigned char* dst) {
+	const float invScale = scale != 0.0f ? 1.0f / scale : 0.0f;
+
+	switch (format) {
+	case HeightMapFormat::R16:
+	{
+		for (UINT i = 0; i < count; ++i) {
+			float n = min(1.0f, max(0.0f, src[i] * invScale));
+			unsigned short value = (unsigned short)(n * 65535.0f + 0.5f);
+			memcpy(dst + i * sizeof(unsigned short), &value, sizeof(unsigned short));
+		}
+		break;
+	}
+	case HeightMapFormat::R32F:
+	{
+		for (UINT i = 0; i < count; ++i) {
+			float value = src[i] * invScale;
+			memcpy(dst + i * sizeof(float), &value, sizeof(float));
+		}
+		break;
+	}
+	default:
+	{
+		for (UINT i = 0; i < count; ++i) {
+			float n = min(1.0f, max(0.0f, src[i] * invScale));
+			dst[i] = (unsigned char)(n * 255.0f + 0.5f);
+		}
+		break;
+	}
+	}
+}
+
+HeightMapStream::HeightMapStream() {
+
+}
+
+HeightMapStream::~HeightMapStream() {
+	Close();
+}
+
+/// <summary>
+/// opens and maps the RAW file, nothing is decoded until rows are read
+/// </summary>
+/// <param name="fileName"></param>
+/// <param name="width">samples per row</param>
+/// <param name="height">rows</param>
+/// <param name="format"></param>
+/// <param name="heightScale"></param>
+/// <returns></returns>
+HRESULT HeightMapStream::Open(const std::string& fileName, UINT width, UINT height, HeightMapFormat format, float heightScale) {
+	Close();
+
+	if (width < 2 || height < 2) return E_INVALIDARG;
+
+	m_file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) return HRESULT_FROM_WIN32(GetLastError());
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size)) {
+		Close();
+		return E_FAIL;
+	}
+
+	m_fileSize = (UINT64)size.QuadPart;
+	if (m_fileSize < (UINT64)width * height * GetHeightMapSampleSize(format)) {
+		Close();
+		return E_FAIL; // file smaller than the stated dimensions
+	}
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping) {
+		Close();
+		return HRESULT_FROM_WIN32(GetLastError());
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_allocationGranularity = info.dwAllocationGranularity;
+
+	m_width = width;
+	m_height = height;
+	m_format = format;
+	m_heightScale = heightScale;
+
+	return S_OK;
+}
+
+void HeightMapStream::Close() {
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+
+	m_fileSize = 0;
+}
+
+/// <summary>
+/// maps just the rows requested and decodes them into dst, views are aligned down to the allocation granularity
+/// </summary>
+/// <param name="firstRow"></param>
+/// <param name="rowCount"></param>
+/// <param name="dst">rowCount * width floats</param>
+/// <returns></returns>
+bool HeightMapStream::ReadRows(UINT firstRow, UINT rowCount, float* dst) {
+	if (!m_mapping || firstRow + rowCount > m_height) return false;
+
+	UINT64 rowBytes = (UINT64)m_width * GetHeightMapSampleSize(m_format);
+	UINT64 offset = firstRow * rowBytes;
+	UINT64 alignedOffset = offset - (offset % m_allocationGranularity);
+	SIZE_T viewSize = (SIZE_T)((offset - alignedOffset) + rowCount * rowBytes);
+
+	const unsigned char* view = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), viewSize);
+	if (!view) return false;
+
+	DecodeHeightSamples(view + (offset - alignedOffset), m_width * rowCount, m_format, m_heightScale, dst);
+
+	UnmapViewOfFile(view);
+	return true;
+}
+
+/// <summary>
+/// decodes a rectangle of samples, mapping only from its first sample to its last so a tile does not pull in whole rows
+/// </summary>
+/// <param name="column0"></param>
+/// <param name="row0"></param>
+/// <param name="columnCount"></param>
+/// <param name="rowCount"></param>
+/// <param name="dst">rowCount rows of dstPitch floats, only the first columnCount of each are written</param>
+/// <param name="dstPitch"></param>
+/// <returns></returns>
+bool HeightMapStream::ReadRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, float* dst, UINT dstPitch) {
+	if (!m_mapping || columnCount == 0 || rowCount == 0 || column0 + columnCount > m_width || row0 + rowCount > m_height) return false;
+
+	UINT sampleSize = GetHeightMapSampleSize(m_format);
+	UINT64 rowBytes = (UINT64)m_width * sampleSize;
+	UINT64 offset = row0 * rowBytes + (UINT64)column0 * sampleSize;
+	UINT64 alignedOffset = offset - (offset % m_allocationGranularity);
+	SIZE_T viewSize = (SIZE_T)((offset - alignedOffset) + (rowCount - 1) * rowBytes + (UINT64)columnCount * sampleSize);
+
+	const unsigned char* view = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), viewSize);
+	if (!view) return false;
+
+	const unsigned char* first = view + (offset - alignedOffset);
+	for (UINT row = 0; row < rowCount; ++row) {
+		DecodeHeightSamples(first + row * rowBytes, columnCount, m_format, m_heightScale, dst + (size_t)row * dstPitch);
+	}
+
+	UnmapViewOfFile(view);
+	return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include "Structures.h"
+
+// bytes per sample for each supported RAW layout
+UINT GetHeightMapSampleSize(HeightMapFormat format);
+
+// converts count raw samples into normalised heights multiplied by scale
+void DecodeHeightSamples(const unsigned char* src, UINT count, HeightMapFormat format, float scale, float* dst);
+
+// inverse of DecodeHeightSamples, integer formats are clamped to the 0-1 range
+void EncodeHeightSamples(const float* src, UINT count, HeightMapFormat format, float scale, unsigned char* dst);
+
+/// memory maps a RAW heightmap so rows can be decoded straight from the file a band at a time,
+/// without first copying the whole file into memory
+class HeightMapStream
+{
+private:
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+	UINT64 m_fileSize = 0;
+	DWORD m_allocationGranularity = 0;
+
+	UINT m_width = 0;
+	UINT m_height = 0;
+	HeightMapFormat m_format = HeightMapFormat::R8;
+	float m_heightScale = 1.0f;
+
+public:
+	HeightMapStream();
+	~HeightMapStream();
+
+	HRESULT Open(const std::string& fileName, UINT width, UINT height, HeightMapFormat format, float heightScale);
+	void Close();
+
+	bool IsOpen() { return m_mapping != nullptr; }
+
+	UINT GetWidth() { return m_width; }
+	UINT GetHeight() { return m_height; }
+
+	bool ReadRows(UINT firstRow, UINT rowCount, float* dst);
+	bool ReadRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, float* dst, UINT dstPitch);
+};
@@ -0,0 +1,153 @@
+#include "HeightTileCache.h"
+
+/// <summary>
+/// maps the RAW file and sets aside capacity tile slots, nothing is decoded until a tile is asked for
+/// </summary>
+/// <param name="fileName"></param>
+/// <param name="width">samples per row</param>
+/// <param name="height">rows</param>
+/// <param name="format"></param>
+/// <param name="heightScale"></param>
+/// <param name="capacity">most tiles held at once, at (TILE_CELLS + 1)^2 floats each</param>
+/// <returns></returns>
+HRESULT HeightTileCache::Open(const std::string& fileName, UINT width, UINT height, HeightMapFormat format, float heightScale, UINT capacity) {
+	Close();
+
+	if (capacity == 0) return E_INVALIDARG;
+
+	HRESULT hr = m_stream.Open(fileName, width, height, format, heightScale);
+	if (FAILED(hr)) return hr;
+
+	m_tiles.resize(capacity);
+	for (HeightTile& tile : m_tiles) {
+		tile.m_heights.resize((TILE_CELLS + 1) * (TILE_CELLS + 1));
+	}
+
+	return S_OK;
+}
+
+void HeightTileCache::Close() {
+	m_stream.Close();
+	m_tiles.clear();
+	m_lookup.clear();
+	m_useCount = 0;
+}
+
+/// <summary>
+/// returns a free slot, or evicts the least recently used tile once every slot is taken
+/// </summary>
+/// <returns></returns>
+UINT HeightTileCache::AcquireSlot() {
+	UINT slot = 0;
+	UINT64 oldest = ~0ull;
+
+	for (UINT i = 0; i < m_tiles.size(); ++i) {
+		if (m_tiles[i].m_tileX < 0) return i;
+		if (m_tiles[i].m_lastUsed < oldest) {
+			oldest = m_tiles[i].m_lastUsed;
+			slot = i;
+		}
+	}
+
+	m_lookup.erase(TileKey(m_tiles[slot].m_tileX, m_tiles[slot].m_tileZ));
+	m_tiles[slot].m_tileX = -1;
+	m_tiles[slot].m_tileZ = -1;
+	return slot;
+}
+
+/// <summary>
+/// gets a tile's heights, decoding them from the mapping if the tile is not resident
+/// </summary>
+/// <param name="tileX"></param>
+/// <param name="tileZ"></param>
+/// <returns>TILE_CELLS + 1 floats per row, nullptr if out of range or the read failed</returns>
+const float* HeightTileCache::GetTile(UINT tileX, UINT tileZ) {
+	if (!IsOpen() || tileX >= GetTilesX() || tileZ >= GetTilesZ()) return nullptr;
+
+	auto it = m_lookup.find(TileKey(tileX, tileZ));
+	if (it != m_lookup.end()) {
+		m_tiles[it->second].m_lastUsed = ++m_useCount;
+		return m_tiles[it->second].m_heights.data();
+	}
+
+	UINT slot = AcquireSlot();
+	HeightTile& tile = m_tiles[slot];
+
+	UINT column0 = tileX * TILE_CELLS;
+	UINT row0 = tileZ * TILE_CELLS;
+	UINT columns = min(TILE_CELLS + 1, m_stream.GetWidth() - column0);
+	UINT rows = min(TILE_CELLS + 1, m_stream.GetHeight() - row0);
+	if (!m_stream.ReadRegion(column0, row0, columns, rows, tile.m_heights.data(), TILE_CELLS + 1)) return nullptr;
+
+	tile.m_tileX = tileX;
+	tile.m_tileZ = tileZ;
+	tile.m_lastUsed = ++m_useCount;
+	m_lookup[TileKey(tileX, tileZ)] = slot;
+	return tile.m_heights.data();
+}
+
+/// <summary>
+/// copies a rectangle of map samples out of the tiles covering it, decoding any that are not resident.
+/// samples in a tile that cannot be read are left at zero, the same as a missing file
+/// </summary>
+/// <param name="column0"></param>
+/// <param name="row0"></param>
+/// <param name="columnCount"></param>
+/// <param name="rowCount"></param>
+/// <param name="dst"></param>
+/// <param name="dstPitch"></param>
+void HeightTileCache::ReadRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, float* dst, UINT dstPitch) {
+	UINT column1 = column0 + columnCount - 1;
+	UINT row1 = row0 + rowCount - 1;
+
+	for (UINT tileZ = min(row0 / TILE_CELLS, GetTilesZ() - 1); tileZ <= min(row1 / TILE_CELLS, GetTilesZ() - 1); ++tileZ) {
+		for (UINT tileX = min(column0 / TILE_CELLS, GetTilesX() - 1); tileX <= min(column1 / TILE_CELLS, GetTilesX() - 1); ++tileX) {
+			const float* tile = GetTile(tileX, tileZ);
+
+			UINT c0 = max(column0, tileX * TILE_CELLS);
+			UINT c1 = min(column1, tileX * TILE_CELLS + TILE_CELLS);
+			UINT r0 = max(row0, tileZ * TILE_CELLS);
+			UINT r1 = min(row1, tileZ * TILE_CELLS + TILE_CELLS);
+
+			for (UINT row = r0; row <= r1; ++row) {
+				float* out = dst + (size_t)(row - row0) * dstPitch + (c0 - column0);
+				if (tile) memcpy(out, tile + (row - tileZ * TILE_CELLS) * (TILE_CELLS + 1) + (c0 - tileX * TILE_CELLS), sizeof(float) * (c1 - c0 + 1));
+				else memset(out, 0, sizeof(float) * (c1 - c0 + 1));
+			}
+		}
+	}
+}
+
+/// <summary>
+/// stores edited samples back into whichever resident tiles hold them, border samples go to the tiles either side.
+/// nothing is decoded, and an edit is lost once its tile is evicted as the file is never written
+/// </summary>
+/// <param name="column0"></param>
+/// <param name="row0"></param>
+/// <param name="columnCount"></param>
+/// <param name="rowCount"></param>
+/// <param name="src"></param>
+/// <param name="srcPitch"></param>
+void HeightTileCache::WriteRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, const float* src, UINT srcPitch) {
+	UINT column1 = column0 + columnCount - 1;
+	UINT row1 = row0 + rowCount - 1;
+
+	for (UINT tileZ = row0 > 0 ? (row0 - 1) / TILE_CELLS : 0; tileZ <= min(row1 / TILE_CELLS, GetTilesZ() - 1); ++tileZ) {
+		for (UINT tileX = column0 > 0 ? (column0 - 1) / TILE_CELLS : 0; tileX <= min(column1 / TILE_CELLS, GetTilesX() - 1); ++tileX) {
+			auto it = m_lookup.find(TileKey(tileX, tileZ));
+			if (it == m_lookup.end()) continue;
+
+			float* tile = m_tiles[it->second].m_heights.data();
+
+			UINT c0 = max(column0, tileX * TILE_CELLS);
+			UINT c1 = min(column1, tileX * TILE_CELLS + TILE_CELLS);
+			UINT r0 = max(row0, tileZ * TILE_CELLS);
+			UINT r1 = min(row1, tileZ * TILE_CELLS + TILE_CELLS);
+			if (c0 > c1 || r0 > r1) continue;
+
+			for (UINT row = r0; row <= r1; ++row) {
+				memcpy(tile + (row - tileZ * TILE_CELLS) * (TILE_CELLS + 1) + (c0 - tileX * TILE_CELLS), src + (size_t)(row - row0) * srcPitch + (c0 - column0), sizeof(float) * (c1 - c0 + 1));
+			}
+		}
+	}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "HeightMapStream.h"
+
+struct HeightTile
+{
+	int m_tileX = -1; // -1 while the slot is free
+	int m_tileZ = -1;
+	UINT64 m_lastUsed = 0;
+	std::vector<float> m_heights; // (TILE_CELLS + 1)^2, shares its last row and column with the next tile
+};
+
+/// decodes square tiles of a memory mapped RAW heightmap on demand and keeps a fixed number of them as floats,
+/// evicting the least recently used, so memory is set by the capacity and not the map size
+class HeightTileCache
+{
+public:
+	static const UINT TILE_CELLS = 128; // quads along a tile edge
+
+private:
+	HeightMapStream m_stream;
+	UINT64 m_useCount = 0;
+
+	std::vector<HeightTile> m_tiles; // fixed capacity slots
+	std::unordered_map<UINT64, UINT> m_lookup; // packed tile coord -> slot
+
+	static UINT64 TileKey(int tileX, int tileZ) { return ((UINT64)(UINT)tileX << 32) | (UINT)tileZ; }
+
+	UINT AcquireSlot();
+
+public:
+	HRESULT Open(const std::string& fileName, UINT width, UINT height, HeightMapFormat format, float heightScale, UINT capacity);
+	void Close();
+
+	bool IsOpen() { return m_stream.IsOpen(); }
+
+	UINT GetTilesX() { return (m_stream.GetWidth() - 2) / TILE_CELLS + 1; } // the last tile can be narrower
+	UINT GetTilesZ() { return (m_stream.GetHeight() - 2) / TILE_CELLS + 1; }
+	UINT GetResidentTileCount() { return (UINT)m_lookup.size(); }
+	size_t GetResidentBytes() { return m_tiles.size() * sizeof(float) * (TILE_CELLS + 1) * (TILE_CELLS + 1); }
+
+	const float* GetTile(UINT tileX, UINT tileZ);
+	void ReadRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, float* dst, UINT dstPitch);
+	void WriteRegion(UINT column0, UINT row0, UINT columnCount, UINT rowCount, const float* src, UINT srcPitch);
+};
@@ -27,6 +27,7 @@ void JSONLoad::JSONSample(std::string path, std::vector<GameObject>& gameobjects
 		g.m_hasTex = objectDesc["HasTex"];
 		g.m_hasSpec = objectDesc["HasSpec"];
 		g.m_hasNorm = objectDesc["HasNorm"];
+		if (objectDesc.contains("HasDisp")) g.m_hasDisp = objectDesc["HasDisp"]; // optional, only used when tessellating
 
 		if (g.m_hasTex == 1) {
 			std::string in = objectDesc["TextureC"];
@@ -43,6 +44,11 @@ void JSONLoad::JSONSample(std::string path, std::vector<GameObject>& gameobjects
 			std::wstring temp(in.begin(), in.end());
 			g.m_textureNormal = temp;
 		}
+		if (g.m_hasDisp == 1) {
+			std::string in = objectDesc["TextureD"];
+			std::wstring temp(in.begin(), in.end());
+			g.m_textureDisplacement = temp;
+		}
 
 		gameobjects.push_back(g);
 	}
@@ -6,15 +6,230 @@
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
 	UNREFERENCED_PARAMETER(hPrevInstance);
-	UNREFERENCED_PARAMETER(lpCmdLine);
 
-	DX11Framework application = DX11Framework();
+	// -benchmark times the render queue and instance depth sorts at 100k items, frustum culling at 1M spheres, the
+	// scene BVH's build, refit and cull at 10k to 1M objects, its shared cull of 2 to 8 views at 1M, the visibility
+	// cache against culling every frame at 1M, the occlusion rasterizer and generating a 4096x4096 domain warped heightmap,
+	// checks the CPU tessellation factors, billboard expansion, frame pacing and state cache elision against worked cases,
+	// then exits without opening a window
+	if (wcsstr(lpCmdLine, L"-benchmark"))
+	{
+		double radixMs = 0.0, stdSortMs = 0.0;
+		RenderQueue::BenchmarkSort(100000, 100, radixMs, stdSortMs);
+
+		char result[2048];
+		double depthSortMs = DepthSorter::BenchmarkSort(100000, 100);
+
+		UINT threads = max(1u, std::thread::hardware_concurrency());
+		double cullMs = FrustumCuller::BenchmarkCull(1000000, 20, 1);
+		double threadedCullMs = FrustumCuller::BenchmarkCull(1000000, 20, threads);
+
+		sprintf_s(result, "render queue sort, 100000 items: radix %.3f ms, std::stable_sort %.3f ms\ninstance depth sort, 100000 instances: %.3f ms\n"
+			"frustum cull, 1000000 spheres: 1 thread %.3f ms, %u threads %.3f ms\n", radixMs, stdSortMs, depthSortMs, cullMs, threads, threadedCullMs);
+
+		const UINT bvhCounts[] = { 10000, 100000, 1000000 };
+		for (UINT count : bvhCounts)
+		{
+			double buildMs = 0.0, refitMs = 0.0, bvhCullMs = 0.0;
+			SceneBVH::Benchmark(count, buildMs, refitMs, bvhCullMs);
+
+			char line[128];
+			sprintf_s(line, "scene BVH, %u objects: build %.3f ms, refit %.3f ms, frustum cull %.3f ms\n", count, buildMs, refitMs, bvhCullMs);
+			strcat_s(result, line);
+		}
+
+		const UINT viewCounts[] = { 2, 4, 8 };
+		for (UINT viewCount : viewCounts)
+		{
+			double sharedMs = 0.0, separateMs = 0.0;
+			SceneBVH::BenchmarkViews(1000000, viewCount, sharedMs, separateMs);
+
+			char line[128];
+			sprintf_s(line, "scene BVH, 1000000 objects, %u views: shared cull %.3f ms, cull per view %.3f ms\n", viewCount, sharedMs, separateMs);
+			strcat_s(result, line);
+		}
+
+		// walking, then walking while turning slowly
+		const float cacheTurns[] = { 0.0f, 0.1f };
+		for (float turn : cacheTurns)
+		{
+			double fullMs = 0.0, cachedMs = 0.0;
+			float testedFraction = 0.0f;
+			bool matches = false;
+			VisibilityCache::Benchmark(1000000, 200, 0.02f, turn, fullMs, cachedMs, testedFraction, matches);
+
+			char line[192];
+			sprintf_s(line, "visibility cache, 1000000 objects, 0.02 units and %.1f degrees a frame: cull %.3f ms, cached %.3f ms, %.2f%% retested, %s\n",
+				turn, fullMs, cachedMs, testedFraction * 100.0f, matches ? "matches" : "DIFFERENT");
+			strcat_s(result, line);
+		}
+
+		double occlusionMs = 0.0, threadedOcclusionMs = 0.0;
+		float occludedFraction = 0.0f;
+		bool identical = false;
+		OcclusionCuller::Benchmark(threads, occlusionMs, threadedOcclusionMs, occludedFraction, identical);
+
+		char line[192];
+		sprintf_s(line, "occlusion raster, 8192 triangles at %ux%u: 1 thread %.3f ms, %u threads %.3f ms, %s depth, %.0f%% of boxes on screen occluded\n",
+			OcclusionCuller::WIDTH, OcclusionCuller::HEIGHT, occlusionMs, threads, threadedOcclusionMs, identical ? "identical" : "DIFFERENT", occludedFraction * 100.0f);
+		strcat_s(result, line);
+
+		double noiseMs = HeightMapGenerator::Benchmark(4096, NoiseType::DomainWarped, 1, 1);
+		double threadedNoiseMs = HeightMapGenerator::Benchmark(4096, NoiseType::DomainWarped, 1, threads);
+		sprintf_s(line, "domain warped heightmap, 4096x4096: 1 thread %.3f ms, %u threads %.3f ms\n", noiseMs, threads, threadedNoiseMs);
+		strcat_s(result, line);
+
+		UINT tessCases = 0;
+		bool tessMatches = CheckEdgeTessFactors(tessCases);
+		sprintf_s(line, "tessellation edge factors, %u worked cases: %s\n", tessCases, tessMatches ? "matches" : "DIFFERENT");
+		strcat_s(result, line);
+
+		UINT billboardCases = 0;
+		bool billboardMatches = CheckBillboardExpansion(billboardCases);
+		sprintf_s(line, "billboard expansion, %u worked cases: %s\n", billboardCases, billboardMatches ? "matches" : "DIFFERENT");
+		strcat_s(result, line);
+
+		UINT pacedFrames = 0;
+		bool pacingMatches = CheckFramePacing(pacedFrames);
+		sprintf_s(line, "frame pacing at a 60 fps cap, %u worked frames: %s\n", pacedFrames, pacingMatches ? "matches" : "DIFFERENT");
+		strcat_s(result, line);
+
+		UINT stateSteps = 0;
+		bool stateMatches = CheckStateCache(stateSteps);
+		sprintf_s(line, "state cache elision on a mock context, %u worked steps: %s\n", stateSteps, stateMatches ? "matches" : "DIFFERENT");
+		strcat_s(result, line);
+		OutputDebugStringA(result);
+
+		std::ofstream file("RenderQueueBenchmark.txt");
+		file << result;
+		return 0;
+	}
+
+	// -hmsize N is the side of the square map given to -erode or -terrain (default 513), -hmformat r8, r16 or r32f its samples
+	UINT size = 513;
+	const wchar_t* sizeArg = wcsstr(lpCmdLine, L"-hmsize ");
+	if (sizeArg)
+	{
+		int side = _wtoi(sizeArg + wcslen(L"-hmsize "));
+		if (side > 1) size = (UINT)side;
+	}
+
+	HeightMapFormat format = HeightMapFormat::R8;
+	if (wcsstr(lpCmdLine, L"-hmformat r16")) format = HeightMapFormat::R16;
+	else if (wcsstr(lpCmdLine, L"-hmformat r32f")) format = HeightMapFormat::R32F;
+
+	// -erode in out runs the hydraulic and thermal erosion bake over a RAW heightmap and writes the result, without
+	// opening a window
+	const wchar_t* erodeArg = wcsstr(lpCmdLine, L"-erode ");
+	if (erodeArg)
+	{
+		std::wstring args = erodeArg + wcslen(L"-erode ");
+		size_t split = args.find(L' ');
+		if (split == std::wstring::npos) return -1;
+
+		std::wstring input = args.substr(0, split);
+		std::wstring output = args.substr(split + 1);
+		output = output.substr(0, output.find(L' '));
+
+		// the heightmap file APIs take ANSI names
+		char inputName[MAX_PATH], outputName[MAX_PATH];
+		if (!WideCharToMultiByte(CP_ACP, 0, input.c_str(), -1, inputName, MAX_PATH, nullptr, nullptr)) return -1;
+		if (!WideCharToMultiByte(CP_ACP, 0, output.c_str(), -1, outputName, MAX_PATH, nullptr, nullptr)) return -1;
+
+		Terrain terrain;
+		terrain.SetStreamWindow(0); // erosion needs every height at once
+		if (FAILED(terrain.LoadHeightMap(size, size, inputName, format))) return -1;
+
+		LARGE_INTEGER frequency, start, end;
+		QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&start);
+		terrain.Erode(ErosionSettings());
+		QueryPerformanceCounter(&end);
+
+		char line[128];
+		sprintf_s(line, "erosion bake, %ux%u: %.3f ms\n", size, size, (end.QuadPart - start.QuadPart) * 1000.0 / frequency.QuadPart);
+		OutputDebugStringA(line);
+
+		return FAILED(terrain.SaveHeightMap(outputName, format)) ? -1 : 0;
+	}
+
+	DX11Framework application; // not copyable, its worker threads cannot be
+
+	// -asteroids N sets the size of the instanced asteroid field
+	const wchar_t* asteroidArg = wcsstr(lpCmdLine, L"-asteroids ");
+	if (asteroidArg)
+	{
+		int count = _wtoi(asteroidArg + wcslen(L"-asteroids "));
+		if (count > 0) application.SetAsteroidCount((UINT)count);
+	}
+
+	// -threads N caps the draw recording threads, otherwise every hardware thread up to the recorder limit
+	const wchar_t* threadArg = wcsstr(lpCmdLine, L"-threads ");
+	if (threadArg)
+	{
+		int count = _wtoi(threadArg + wcslen(L"-threads "));
+		if (count > 0) application.SetRecordThreads((UINT)count);
+	}
+
+	// -terrain file draws a RAW heightmap other than the bundled one, sized by -hmsize and -hmformat. maps larger than
+	// 513 samples are streamed in tiles, only a window around the camera is decoded
+	const wchar_t* terrainArg = wcsstr(lpCmdLine, L"-terrain ");
+	if (terrainArg)
+	{
+		std::wstring terrainFile = terrainArg + wcslen(L"-terrain ");
+		terrainFile = terrainFile.substr(0, terrainFile.find(L' '));
+
+		char terrainName[MAX_PATH]; // the heightmap file APIs take ANSI names
+		if (!WideCharToMultiByte(CP_ACP, 0, terrainFile.c_str(), -1, terrainName, MAX_PATH, nullptr, nullptr)) return -1;
+		application.SetTerrainHeightMap(terrainName, size, format);
+	}
+
+	// -deform keeps the terrain heights on the CPU so the crater key can edit them, 4 bytes per vertex
+	application.SetTerrainDeformation(wcsstr(lpCmdLine, L"-deform") != nullptr);
+
+	// -nopacing runs uncapped as fast as possible, otherwise -latency N frames may queue (default 1),
+	// -fpscap N limits the frame rate and -vsync presents on vertical blank
+	FramePacingSettings pacing;
+	pacing.m_enabled = wcsstr(lpCmdLine, L"-nopacing") == nullptr;
+	pacing.m_vsync = wcsstr(lpCmdLine, L"-vsync") != nullptr;
+
+	const wchar_t* latencyArg = wcsstr(lpCmdLine, L"-latency ");
+	if (latencyArg)
+	{
+		int frames = _wtoi(latencyArg + wcslen(L"-latency "));
+		if (frames > 0) pacing.m_maxFrameLatency = (UINT)frames;
+	}
+
+	const wchar_t* capArg = wcsstr(lpCmdLine, L"-fpscap ");
+	if (capArg)
+	{
+		int fps = _wtoi(capArg + wcslen(L"-fpscap "));
+		if (fps > 0) pacing.m_frameRateCap = (float)fps;
+	}
+
+	application.SetFramePacing(pacing);
 
 	if (FAILED(application.Initialise(hInstance, nCmdShow)))
 	{
 		return -1;
 	}
 
+	// -recordbenchmark times draw recording at every thread count and exits
+	if (wcsstr(lpCmdLine, L"-recordbenchmark"))
+	{
+		application.BenchmarkRecording(4096, 200);
+		return 0;
+	}
+
+	// -telemetry file writes frame time percentiles on exit, JSON for a .json file and CSV otherwise
+	std::wstring telemetryFile;
+	const wchar_t* telemetryArg = wcsstr(lpCmdLine, L"-telemetry ");
+	if (telemetryArg)
+	{
+		telemetryFile = telemetryArg + wcslen(L"-telemetry ");
+		telemetryFile = telemetryFile.substr(0, telemetryFile.find(L' '));
+	}
+
 	// Main message loop
 	MSG msg = { 0 };
 
@@ -33,5 +248,7 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 		}
 	}
 
+	if (!telemetryFile.empty()) application.ExportTelemetry(telemetryFile);
+
 	return (int)msg.wParam;
 }
\ No newline at end of file
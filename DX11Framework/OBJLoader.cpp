@@ -63,6 +63,96 @@ void OBJLoader::CreateIndices(const std::vector<XMFLOAT3>& inVertices,
 	}
 }
 
+//AABB in one pass, then Ritter's sphere: the farthest vertex from any start, the farthest from that, and the sphere
+//through those two grown just enough to take in every vertex left outside it. Ritter's diagonal guess can miss the
+//longest span on box like meshes, so the sphere around the AABB centre is kept instead whenever it is smaller
+void OBJLoader::ComputeBounds(const SimpleVertex* vertices, unsigned int numVertices, MeshData& meshData)
+{
+	if(numVertices == 0)
+	{
+		meshData.m_boundsMin = meshData.m_boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		meshData.m_boundingSphere = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	XMVECTOR boundsMin = XMLoadFloat3(&vertices[0].m_position);
+	XMVECTOR boundsMax = boundsMin;
+	for(unsigned int i = 1; i < numVertices; ++i)
+	{
+		XMVECTOR position = XMLoadFloat3(&vertices[i].m_position);
+		boundsMin = XMVectorMin(boundsMin, position);
+		boundsMax = XMVectorMax(boundsMax, position);
+	}
+	XMStoreFloat3(&meshData.m_boundsMin, boundsMin);
+	XMStoreFloat3(&meshData.m_boundsMax, boundsMax);
+
+	auto distance = [](XMVECTOR a, XMVECTOR b) { return XMVectorGetX(XMVector3Length(a - b)); };
+	auto farthestFrom = [&](XMVECTOR from) {
+		XMVECTOR farthest = from;
+		float farthestDistance = 0.0f;
+		for(unsigned int i = 0; i < numVertices; ++i)
+		{
+			XMVECTOR position = XMLoadFloat3(&vertices[i].m_position);
+			float d = distance(position, from);
+			if(d > farthestDistance)
+			{
+				farthest = position;
+				farthestDistance = d;
+			}
+		}
+		return farthest;
+	};
+
+	XMVECTOR a = farthestFrom(XMLoadFloat3(&vertices[0].m_position));
+	XMVECTOR b = farthestFrom(a);
+	XMVECTOR centre = (a + b) * 0.5f;
+	float radius = distance(a, b) * 0.5f;
+
+	for(unsigned int i = 0; i < numVertices; ++i)
+	{
+		XMVECTOR position = XMLoadFloat3(&vertices[i].m_position);
+		float d = distance(position, centre);
+		if(d > radius) //Move the centre towards the vertex so the far side of the old sphere stays on the new one
+		{
+			float grownRadius = (radius + d) * 0.5f;
+			centre += (position - centre) * ((grownRadius - radius) / d);
+			radius = grownRadius;
+		}
+	}
+
+	XMVECTOR boxCentre = (boundsMin + boundsMax) * 0.5f;
+	float boxRadius = 0.0f;
+	for(unsigned int i = 0; i < numVertices; ++i)
+	{
+		boxRadius = max(boxRadius, distance(XMLoadFloat3(&vertices[i].m_position), boxCentre));
+	}
+
+	if(boxRadius < radius)
+	{
+		centre = boxCentre;
+		radius = boxRadius;
+	}
+
+	//Nudged out a little so rounding never leaves a vertex just outside, a point mesh still gets a cullable radius
+	XMStoreFloat4(&meshData.m_boundingSphere, centre);
+	meshData.m_boundingSphere.w = max(radius * 1.0001f, 1e-6f);
+}
+
+void OBJLoader::WriteBinary(const std::string& filename, const SimpleVertex* vertices, unsigned int numVertices, const unsigned short* indices, unsigned int numIndices, const MeshData& meshData)
+{
+	std::ofstream outbin(filename.c_str(), std::ios::out | std::ios::binary);
+	outbin.write((char*)&BINARY_MAGIC, sizeof(unsigned int));
+	outbin.write((char*)&BINARY_VERSION, sizeof(unsigned int));
+	outbin.write((char*)&numVertices, sizeof(unsigned int));
+	outbin.write((char*)&numIndices, sizeof(unsigned int));
+	outbin.write((char*)&meshData.m_boundsMin, sizeof(XMFLOAT3));
+	outbin.write((char*)&meshData.m_boundsMax, sizeof(XMFLOAT3));
+	outbin.write((char*)&meshData.m_boundingSphere, sizeof(XMFLOAT4));
+	outbin.write((char*)vertices, sizeof(SimpleVertex) * numVertices);
+	outbin.write((char*)indices, sizeof(unsigned short) * numIndices);
+	outbin.close();
+}
+
 //WARNING: This code makes a big assumption -- that your models have texture coordinates AND normals which they should have anyway (else you can't do texturing and lighting!)
 //If your .obj file has no lines beginning with "vt" or "vn", then you'll need to change the Export settings in your modelling software so that it exports the texture coordinates 
 //and normals. If you still have no "vt" lines, you'll need to do some texture unwrapping, also known as UV unwrapping.
@@ -73,7 +163,28 @@ MeshData OBJLoader::Load(const char* filename, ID3D11Device* _pd3dDevice, bool i
 	std::ifstream binaryInFile;
 	binaryInFile.open(binaryFilename, std::ios::in | std::ios::binary);
 
-	if(!binaryInFile.good())
+	//Binary files from before the header have no bounds, they are computed on load and the file rewritten
+	bool hasHeader = false;
+	if(binaryInFile.good())
+	{
+		unsigned int magic = 0;
+		binaryInFile.read((char*)&magic, sizeof(unsigned int));
+
+		if(magic == BINARY_MAGIC)
+		{
+			unsigned int version = 0;
+			binaryInFile.read((char*)&version, sizeof(unsigned int));
+			hasHeader = true;
+
+			if(version != BINARY_VERSION) binaryInFile.close(); //A layout this code doesn't know, rebuild it from the .obj
+		}
+		else
+		{
+			binaryInFile.seekg(0);
+		}
+	}
+
+	if(!binaryInFile.is_open() || !binaryInFile.good())
 	{
 		std::ifstream inFile;
 		inFile.open(filename);
@@ -234,13 +345,10 @@ MeshData OBJLoader::Load(const char* filename, ID3D11Device* _pd3dDevice, bool i
 				indicesArray[i] = meshIndices[i];
 			}
 
+			ComputeBounds(finalVerts, numMeshVertices, meshData);
+
 			//Output data into binary file, the next time you run this function, the binary file will exist and will load that instead which is much quicker than parsing into vectors
-			std::ofstream outbin(binaryFilename.c_str(), std::ios::out | std::ios::binary);
-			outbin.write((char*)&numMeshVertices, sizeof(unsigned int));
-			outbin.write((char*)&numMeshIndices, sizeof(unsigned int));
-			outbin.write((char*)finalVerts, sizeof(SimpleVertex) * numMeshVertices);
-			outbin.write((char*)indicesArray, sizeof(unsigned short) * numMeshIndices);
-			outbin.close();
+			WriteBinary(binaryFilename, finalVerts, numMeshVertices, indicesArray, numMeshIndices, meshData);
 
 			ID3D11Buffer* indexBuffer;
 
@@ -273,6 +381,13 @@ MeshData OBJLoader::Load(const char* filename, ID3D11Device* _pd3dDevice, bool i
 		//Read in array sizes
 		binaryInFile.read((char*)&numVertices, sizeof(unsigned int));
 		binaryInFile.read((char*)&numIndices, sizeof(unsigned int));
+
+		if(hasHeader)
+		{
+			binaryInFile.read((char*)&meshData.m_boundsMin, sizeof(XMFLOAT3));
+			binaryInFile.read((char*)&meshData.m_boundsMax, sizeof(XMFLOAT3));
+			binaryInFile.read((char*)&meshData.m_boundingSphere, sizeof(XMFLOAT4));
+		}
 		
 		//Read in data from binary file
 		SimpleVertex* finalVerts = new SimpleVertex[numVertices];
@@ -280,6 +395,13 @@ MeshData OBJLoader::Load(const char* filename, ID3D11Device* _pd3dDevice, bool i
 		binaryInFile.read((char*)finalVerts, sizeof(SimpleVertex) * numVertices);
 		binaryInFile.read((char*)indices, sizeof(unsigned short) * numIndices);
 
+		if(!hasHeader)
+		{
+			ComputeBounds(finalVerts, numVertices, meshData);
+			binaryInFile.close();
+			WriteBinary(binaryFilename, finalVerts, numVertices, indices, numIndices, meshData); //Upgraded in place, so this only happens once
+		}
+
 		//Put data into vertex and index buffers, then pass the relevant data to the MeshData object.
 		//The rest of the code will hopefully look familiar to you, as it's similar to whats in your InitVertexBuffer and InitIndexBuffer methods
 		ID3D11Buffer* vertexBuffer;
@@ -9,6 +9,11 @@
 
 namespace OBJLoader
 {
+	//Binary files start with this and a version, files from before the header start with the vertex count instead,
+	//which is always below 65536 as the indices are 16 bit so the two can't be confused
+	const unsigned int BINARY_MAGIC = 0x424A424F; // "OBJB"
+	const unsigned int BINARY_VERSION = 1;
+
 	//The only method you'll need to call
 	MeshData Load(const char* filename, ID3D11Device* _pd3dDevice, bool invertTexCoords = true);
 
@@ -18,4 +23,10 @@ namespace OBJLoader
 
 	//Re-creates a single index buffer from the 3 given in the OBJ file
 	void CreateIndices(const std::vector<XMFLOAT3>& inVertices, const std::vector<XMFLOAT2>& inTexCoords, const std::vector<XMFLOAT3>& inNormals, std::vector<unsigned short>& outIndices, std::vector<XMFLOAT3>& outVertices, std::vector<XMFLOAT2>& outTexCoords, std::vector<XMFLOAT3>& outNormals, std::vector<XMFLOAT3>& outTangents);
+
+	//Fills the AABB and bounding sphere of meshData from the vertex positions
+	void ComputeBounds(const SimpleVertex* vertices, unsigned int numVertices, MeshData& meshData);
+
+	//Writes the binary file, header and bounds go before the vertices so a load never has to recompute them
+	void WriteBinary(const std::string& filename, const SimpleVertex* vertices, unsigned int numVertices, const unsigned short* indices, unsigned int numIndices, const MeshData& meshData);
 };
\ No newline at end of file
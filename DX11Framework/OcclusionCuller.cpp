@@ -0,0 +1,399 @@
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+// triangles are clipped this many half screens out, far enough that clipping is rare and close enough that pixel
+// coordinates keep their precision in the edge functions
+static const float GUARD_BAND = 4.0f;
+
+OcclusionCuller::OcclusionCuller() {
+	for (UINT level = 0; level < LEVEL_COUNT; level++) m_levels[level].assign((WIDTH >> level) * (HEIGHT >> level), 1.0f);
+	XMStoreFloat4x4(&m_viewProjection, XMMatrixIdentity());
+}
+
+/// <summary>
+/// starts a new frame, the depth buffer is cleared to the far plane and the occluders of the last one dropped
+/// </summary>
+/// <param name="viewProjection"></param>
+void OcclusionCuller::Begin(const XMFLOAT4X4& viewProjection) {
+	m_viewProjection = viewProjection;
+	m_triangles.clear();
+	for (std::vector<UINT>& bin : m_bins) bin.clear();
+	std::fill(m_levels[0].begin(), m_levels[0].end(), 1.0f);
+}
+
+/// <summary>
+/// transforms an indexed triangle list to clip space and bins what survives clipping, nothing is drawn until Rasterize.
+/// the mesh must lie inside the surface it stands in for, faces of either winding are drawn
+/// </summary>
+/// <param name="vertices"></param>
+/// <param name="vertexCount"></param>
+/// <param name="indices">three per triangle</param>
+/// <param name="indexCount"></param>
+/// <param name="world"></param>
+void OcclusionCuller::AddOccluder(const XMFLOAT3* vertices, UINT vertexCount, const UINT* indices, UINT indexCount, const XMFLOAT4X4& world) {
+	XMMATRIX worldViewProjection = XMMatrixMultiply(XMLoadFloat4x4(&world), XMLoadFloat4x4(&m_viewProjection));
+
+	m_clipVertices.resize(vertexCount);
+	for (UINT i = 0; i < vertexCount; i++) {
+		XMStoreFloat4(&m_clipVertices[i], XMVector4Transform(XMVectorSet(vertices[i].x, vertices[i].y, vertices[i].z, 1.0f), worldViewProjection));
+	}
+
+	for (UINT i = 0; i + 2 < indexCount; i += 3) {
+		AddClipTriangle(m_clipVertices[indices[i]], m_clipVertices[indices[i + 1]], m_clipVertices[indices[i + 2]]);
+	}
+}
+
+/// <summary>
+/// a solid box, for proxies of meshes too detailed to draw here
+/// </summary>
+/// <param name="boxMin">local space corners, the box must fit inside the mesh</param>
+/// <param name="boxMax"></param>
+/// <param name="world"></param>
+void OcclusionCuller::AddBoxOccluder(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, const XMFLOAT4X4& world) {
+	XMFLOAT3 corners[8];
+	for (UINT i = 0; i < 8; i++) {
+		corners[i] = XMFLOAT3(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z);
+	}
+
+	static const UINT faces[36] = {
+		0, 2, 3, 0, 3, 1, // -z
+		4, 5, 7, 4, 7, 6, // +z
+		0, 4, 6, 0, 6, 2, // -x
+		1, 3, 7, 1, 7, 5, // +x
+		0, 1, 5, 0, 5, 4, // -y
+		2, 6, 7, 2, 7, 3 // +y
+	};
+	AddOccluder(corners, 8, faces, 36, world);
+}
+
+/// <summary>
+/// clips against the near plane and the guard band, then fans what is left into screen triangles
+/// </summary>
+/// <param name="a"></param>
+/// <param name="b"></param>
+/// <param name="c"></param>
+void OcclusionCuller::AddClipTriangle(const XMFLOAT4& a, const XMFLOAT4& b, const XMFLOAT4& c) {
+	const XMFLOAT4* triangle[3] = { &a, &b, &c };
+
+	// all three past one frustum plane, including the far plane, leaves nothing to draw
+	UINT outside = 0x3f;
+	bool clip = false;
+	for (const XMFLOAT4* v : triangle) {
+		UINT planes = (v->x < -v->w ? 1 : 0) | (v->x > v->w ? 2 : 0) | (v->y < -v->w ? 4 : 0) | (v->y > v->w ? 8 : 0) | (v->z < 0.0f ? 16 : 0) | (v->z > v->w ? 32 : 0);
+		outside &= planes;
+		clip |= v->z < 0.0f || fabsf(v->x) > GUARD_BAND * v->w || fabsf(v->y) > GUARD_BAND * v->w;
+	}
+	if (outside) return;
+
+	XMFLOAT4 polygon[2][9];
+	UINT count = 3;
+	for (UINT i = 0; i < 3; i++) polygon[0][i] = *triangle[i];
+
+	// z >= 0 is d3d's near plane, past it w is positive for the divide
+	UINT current = 0;
+	if (clip) {
+		for (UINT plane = 0; plane < 5 && count > 0; plane++) {
+			auto distance = [plane](const XMFLOAT4& v) {
+				switch (plane) {
+				case 0: return v.z;
+				case 1: return GUARD_BAND * v.w + v.x;
+				case 2: return GUARD_BAND * v.w - v.x;
+				case 3: return GUARD_BAND * v.w + v.y;
+				default: return GUARD_BAND * v.w - v.y;
+				}
+			};
+
+			const XMFLOAT4* input = polygon[current];
+			XMFLOAT4* output = polygon[current ^ 1];
+			UINT written = 0;
+			for (UINT i = 0; i < count; i++) {
+				const XMFLOAT4& p = input[i];
+				const XMFLOAT4& q = input[(i + 1) % count];
+				float dp = distance(p), dq = distance(q);
+
+				if (dp >= 0.0f) output[written++] = p;
+				if ((dp >= 0.0f) != (dq >= 0.0f)) {
+					float t = dp / (dp - dq);
+					XMStoreFloat4(&output[written++], XMVectorLerp(XMLoadFloat4(&p), XMLoadFloat4(&q), t));
+				}
+			}
+			count = written;
+			current ^= 1;
+		}
+	}
+
+	XMFLOAT3 screen[9];
+	for (UINT i = 0; i < count; i++) {
+		const XMFLOAT4& v = polygon[current][i];
+		float invW = 1.0f / v.w;
+		screen[i] = XMFLOAT3((v.x * invW * 0.5f + 0.5f) * WIDTH, (0.5f - v.y * invW * 0.5f) * HEIGHT, v.z * invW);
+	}
+
+	for (UINT i = 1; i + 1 < count; i++) AddScreenTriangle(screen[0], screen[i], screen[i + 1]);
+}
+
+/// <summary>
+/// edge and depth setup, then the triangle goes into the bin of every tile its bounds touch
+/// </summary>
+/// <param name="a">x and y in pixels, z the depth</param>
+/// <param name="b"></param>
+/// <param name="c"></param>
+void OcclusionCuller::AddScreenTriangle(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c) {
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (!(fabsf(area) > 1e-6f)) return; // edge on or not a number
+
+	// either winding, ordered so the inside is positive
+	const XMFLOAT3* v[3] = { &a, &b, &c };
+	if (area < 0.0f) {
+		v[1] = &c;
+		v[2] = &b;
+		area = -area;
+	}
+
+	ScreenTriangle triangle;
+	triangle.m_minX = max(0, (int)ceilf(min(a.x, min(b.x, c.x)) - 0.5f));
+	triangle.m_maxX = min((int)WIDTH - 1, (int)floorf(max(a.x, max(b.x, c.x)) - 0.5f));
+	triangle.m_minY = max(0, (int)ceilf(min(a.y, min(b.y, c.y)) - 0.5f));
+	triangle.m_maxY = min((int)HEIGHT - 1, (int)floorf(max(a.y, max(b.y, c.y)) - 0.5f));
+	if (triangle.m_minX > triangle.m_maxX || triangle.m_minY > triangle.m_maxY) return; // between pixel centres
+
+	for (UINT i = 0; i < 3; i++) {
+		const XMFLOAT3& p = *v[i];
+		const XMFLOAT3& q = *v[(i + 1) % 3];
+		triangle.m_edges[i] = XMFLOAT3(p.y - q.y, q.x - p.x, (q.y - p.y) * p.x - (q.x - p.x) * p.y);
+	}
+
+	const XMFLOAT3& p0 = *v[0];
+	const XMFLOAT3& p1 = *v[1];
+	const XMFLOAT3& p2 = *v[2];
+	float dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / area;
+	float dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / area;
+
+	// the plane at a pixel centre plus half a pixel of slope each way is the farthest the triangle gets in that pixel
+	triangle.m_depthPlane = XMFLOAT3(dzdx, dzdy, p0.z - dzdx * p0.x - dzdy * p0.y + 0.5f * (fabsf(dzdx) + fabsf(dzdy)));
+	triangle.m_maxDepth = max(p0.z, max(p1.z, p2.z));
+
+	UINT index = (UINT)m_triangles.size();
+	m_triangles.push_back(triangle);
+
+	for (UINT tileY = triangle.m_minY / TILE_HEIGHT; tileY <= triangle.m_maxY / TILE_HEIGHT; tileY++) {
+		for (UINT tileX = triangle.m_minX / TILE_WIDTH; tileX <= triangle.m_maxX / TILE_WIDTH; tileX++) {
+			m_bins[tileY * TILE_COLUMNS + tileX].push_back(index);
+		}
+	}
+}
+
+/// <summary>
+/// draws the occluders and builds the depth pyramid. tiles are dealt out to the culler's workers in turn and each is
+/// only ever written by one of them, small frames stay on the calling thread
+/// </summary>
+/// <param name="maxThreads">upper bound on threads including the calling one</param>
+void OcclusionCuller::Rasterize(UINT maxThreads) {
+	const UINT tileCount = TILE_COLUMNS * TILE_ROWS;
+	UINT threadCount = max(1u, min(min(maxThreads, tileCount), (UINT)m_triangles.size() / MIN_TRIANGLES_PER_THREAD));
+
+	if (threadCount <= 1) {
+		for (UINT tile = 0; tile < tileCount; tile++) RasterizeTile(tile);
+	}
+	else {
+		// interleaved, so the busy middle of the screen is shared rather than landing on one thread
+		m_workers.Run(threadCount, [this, threadCount, tileCount](UINT t) {
+			for (UINT tile = t; tile < tileCount; tile += threadCount) RasterizeTile(tile);
+		});
+	}
+
+	BuildHierarchy();
+}
+
+/// <summary>
+/// every binned triangle clipped to the tile, four pixel centres of a row per step. uncovered lanes keep their depth
+/// through a select, so there is no per pixel branch
+/// </summary>
+/// <param name="tile"></param>
+void OcclusionCuller::RasterizeTile(UINT tile) {
+	int tileX0 = (int)((tile % TILE_COLUMNS) * TILE_WIDTH);
+	int tileY0 = (int)((tile / TILE_COLUMNS) * TILE_HEIGHT);
+	float* depth = m_levels[0].data();
+
+	const XMVECTOR laneOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+
+	for (UINT index : m_bins[tile]) {
+		const ScreenTriangle& triangle = m_triangles[index];
+
+		// tiles start on a multiple of four, so aligning down stays inside this one
+		int x0 = max(triangle.m_minX, tileX0) & ~3;
+		int x1 = min(triangle.m_maxX, tileX0 + (int)TILE_WIDTH - 1);
+		int y0 = max(triangle.m_minY, tileY0);
+		int y1 = min(triangle.m_maxY, tileY0 + (int)TILE_HEIGHT - 1);
+
+		XMVECTOR edgeX[3];
+		for (UINT i = 0; i < 3; i++) edgeX[i] = XMVectorReplicate(triangle.m_edges[i].x);
+		XMVECTOR depthX = XMVectorReplicate(triangle.m_depthPlane.x);
+		XMVECTOR maxDepth = XMVectorReplicate(triangle.m_maxDepth);
+
+		for (int y = y0; y <= y1; y++) {
+			float centreY = y + 0.5f;
+			XMVECTOR edgeRow[3];
+			for (UINT i = 0; i < 3; i++) edgeRow[i] = XMVectorReplicate(triangle.m_edges[i].y * centreY + triangle.m_edges[i].z);
+			XMVECTOR depthRow = XMVectorReplicate(triangle.m_depthPlane.y * centreY + triangle.m_depthPlane.z);
+
+			float* row = depth + y * WIDTH;
+			for (int x = x0; x <= x1; x += 4) {
+				XMVECTOR centreX = XMVectorAdd(XMVectorReplicate((float)x), laneOffsets);
+
+				XMVECTOR inside = XMVectorGreaterOrEqual(XMVectorMultiplyAdd(centreX, edgeX[0], edgeRow[0]), zero);
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(centreX, edgeX[1], edgeRow[1]), zero));
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(centreX, edgeX[2], edgeRow[2]), zero));
+
+				XMVECTOR z = XMVectorMin(XMVectorMultiplyAdd(centreX, depthX, depthRow), maxDepth);
+				XMVECTOR old = XMLoadFloat4((const XMFLOAT4*)(row + x));
+				XMStoreFloat4((XMFLOAT4*)(row + x), XMVectorSelect(old, XMVectorMin(old, z), inside));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::BuildHierarchy() {
+	for (UINT level = 1; level < LEVEL_COUNT; level++) {
+		UINT width = WIDTH >> level;
+		UINT height = HEIGHT >> level;
+		const float* source = m_levels[level - 1].data();
+		float* destination = m_levels[level].data();
+
+		for (UINT y = 0; y < height; y++) {
+			const float* top = source + (y * 2) * (width * 2);
+			const float* bottom = top + width * 2;
+			for (UINT x = 0; x < width; x++) {
+				destination[y * width + x] = max(max(top[x * 2], top[x * 2 + 1]), max(bottom[x * 2], bottom[x * 2 + 1]));
+			}
+		}
+	}
+}
+
+/// <summary>
+/// tests a world box against the depth pyramid at the finest level where its screen bounds span at most 4 x 4 texels.
+/// boxes through the near plane or off screen are left to the frustum test and count as visible
+/// </summary>
+/// <param name="boundsMin"></param>
+/// <param name="boundsMax"></param>
+/// <returns>false only when every texel under the box has an occluder in front of its nearest corner</returns>
+bool OcclusionCuller::IsVisible(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax) {
+	if (m_triangles.empty()) return true;
+
+	XMMATRIX viewProjection = XMLoadFloat4x4(&m_viewProjection);
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minDepth = FLT_MAX;
+
+	for (UINT i = 0; i < 8; i++) {
+		XMVECTOR corner = XMVectorSet(i & 1 ? boundsMax.x : boundsMin.x, i & 2 ? boundsMax.y : boundsMin.y, i & 4 ? boundsMax.z : boundsMin.z, 1.0f);
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector4Transform(corner, viewProjection));
+		if (clip.z < 0.0f || clip.w <= 0.0f) return true;
+
+		float invW = 1.0f / clip.w;
+		minX = min(minX, clip.x * invW);
+		maxX = max(maxX, clip.x * invW);
+		minY = min(minY, clip.y * invW);
+		maxY = max(maxY, clip.y * invW);
+		minDepth = min(minDepth, clip.z * invW);
+	}
+
+	if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f) return true;
+
+	// every pixel the box touches, rows run down the screen
+	int x0 = max(0, (int)floorf((max(minX, -1.0f) * 0.5f + 0.5f) * WIDTH));
+	int x1 = min((int)WIDTH - 1, (int)floorf((min(maxX, 1.0f) * 0.5f + 0.5f) * WIDTH));
+	int y0 = max(0, (int)floorf((0.5f - min(maxY, 1.0f) * 0.5f) * HEIGHT));
+	int y1 = min((int)HEIGHT - 1, (int)floorf((0.5f - max(minY, -1.0f) * 0.5f) * HEIGHT));
+
+	UINT level = 0;
+	while (level + 1 < LEVEL_COUNT && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4)) level++;
+
+	UINT width = WIDTH >> level;
+	const float* depth = m_levels[level].data();
+	for (int y = y0 >> level; y <= y1 >> level; y++) {
+		for (int x = x0 >> level; x <= x1 >> level; x++) {
+			if (depth[y * width + x] >= minDepth) return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// a 64 x 64 quad hilly heightfield seen from just above it, rasterized on one thread and on threads. the two depth
+/// buffers are compared bit for bit, then a grid of boxes over the field is tested against the result
+/// </summary>
+/// <param name="threads"></param>
+/// <param name="singleMs">average Begin, AddOccluder and Rasterize time on one thread</param>
+/// <param name="threadedMs"></param>
+/// <param name="occludedFraction">of the boxes that are on screen</param>
+/// <param name="identical"></param>
+void OcclusionCuller::Benchmark(UINT threads, double& singleMs, double& threadedMs, float& occludedFraction, bool& identical) {
+	const UINT quads = 64;
+	const float size = 512.0f;
+	const UINT iterations = 100;
+
+	std::vector<XMFLOAT3> vertices;
+	std::vector<UINT> indices;
+	for (UINT row = 0; row <= quads; row++) {
+		for (UINT column = 0; column <= quads; column++) {
+			float x = column * size / quads - size * 0.5f;
+			float z = row * size / quads - size * 0.5f;
+			vertices.push_back(XMFLOAT3(x, 12.0f * sinf(x * 0.03f) * cosf(z * 0.025f) + 6.0f * sinf(z * 0.07f), z));
+		}
+	}
+	for (UINT row = 0; row < quads; row++) {
+		for (UINT column = 0; column < quads; column++) {
+			UINT corner = row * (quads + 1) + column;
+			UINT quad[6] = { corner, corner + quads + 1, corner + 1, corner + 1, corner + quads + 1, corner + quads + 2 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+
+	XMFLOAT4X4 world, viewProjection;
+	XMStoreFloat4x4(&world, XMMatrixIdentity());
+	XMStoreFloat4x4(&viewProjection, XMMatrixLookAtLH(XMVectorSet(0.0f, 14.0f, -240.0f, 1.0f), XMVectorSet(0.0f, 4.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))
+		* XMMatrixPerspectiveFovLH(XMConvertToRadians(90), 16.0f / 9.0f, 0.01f, 1000.0f));
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	OcclusionCuller single, threaded;
+	double* times[2] = { &singleMs, &threadedMs };
+	OcclusionCuller* cullers[2] = { &single, &threaded };
+	UINT threadCounts[2] = { 1, threads };
+
+	for (UINT run = 0; run < 2; run++) {
+		QueryPerformanceCounter(&start);
+		for (UINT i = 0; i < iterations; i++) {
+			cullers[run]->Begin(viewProjection);
+			cullers[run]->AddOccluder(vertices.data(), (UINT)vertices.size(), indices.data(), (UINT)indices.size(), world);
+			cullers[run]->Rasterize(threadCounts[run]);
+		}
+		QueryPerformanceCounter(&end);
+		*times[run] = (end.QuadPart - start.QuadPart) * 1000.0 / ((double)frequency.QuadPart * iterations);
+	}
+
+	identical = memcmp(single.GetDepth(0), threaded.GetDepth(0), WIDTH * HEIGHT * sizeof(float)) == 0;
+
+	// one small box on the ground every 8 units, a frustum test would drop the ones behind the camera first
+	UINT onScreen = 0, occluded = 0;
+	XMMATRIX matrix = XMLoadFloat4x4(&viewProjection);
+	for (float z = -size * 0.5f; z < size * 0.5f; z += 8.0f) {
+		for (float x = -size * 0.5f; x < size * 0.5f; x += 8.0f) {
+			float ground = 12.0f * sinf(x * 0.03f) * cosf(z * 0.025f) + 6.0f * sinf(z * 0.07f);
+			XMFLOAT3 boxMin(x - 1.0f, ground, z - 1.0f), boxMax(x + 1.0f, ground + 2.0f, z + 1.0f);
+
+			XMFLOAT4 centre;
+			XMStoreFloat4(&centre, XMVector4Transform(XMVectorSet(x, ground + 1.0f, z, 1.0f), matrix));
+			if (centre.w <= 0.0f || fabsf(centre.x) > centre.w || fabsf(centre.y) > centre.w) continue;
+
+			onScreen++;
+			if (!single.IsVisible(boxMin, boxMax)) occluded++;
+		}
+	}
+	occludedFraction = onScreen > 0 ? (float)occluded / onScreen : 0.0f;
+}
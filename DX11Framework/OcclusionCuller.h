@@ -0,0 +1,66 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "WorkerPool.h"
+
+using namespace DirectX;
+
+/// software occlusion culling against a small depth buffer the CPU draws occluders into.
+/// occluders are clipped to the near plane and binned into screen tiles as they are added, Rasterize then fills each
+/// tile four pixels at a time on its own thread and builds a max depth pyramid, IsVisible tests boxes against that.
+/// each pixel keeps the nearest occluder depth whatever order triangles arrive in, so the buffer is the same for any
+/// thread count. coverage is sampled at pixel centres and the stored depth is the farthest point of the triangle
+/// inside the pixel, so occluders never hide anything in front of them, only their silhouettes can be half a pixel out
+class OcclusionCuller
+{
+public:
+	static const UINT WIDTH = 256;
+	static const UINT HEIGHT = 128;
+	static const UINT TILE_WIDTH = 64; // multiple of four
+	static const UINT TILE_HEIGHT = 32;
+	static const UINT TILE_COLUMNS = WIDTH / TILE_WIDTH;
+	static const UINT TILE_ROWS = HEIGHT / TILE_HEIGHT;
+	static const UINT LEVEL_COUNT = 8; // down to 2 x 1
+
+private:
+	static const UINT MIN_TRIANGLES_PER_THREAD = 256;
+
+	// edge functions and depth plane in pixels, a pixel centre is inside when all three edges are >= 0
+	struct ScreenTriangle
+	{
+		XMFLOAT3 m_edges[3]; // a * x + b * y + c
+		XMFLOAT3 m_depthPlane; // z = a * x + b * y + c, pushed back to the farthest point in the pixel
+		float m_maxDepth;
+		int m_minX, m_minY, m_maxX, m_maxY; // pixels whose centres can be covered
+	};
+
+	XMFLOAT4X4 m_viewProjection;
+	std::vector<XMFLOAT4> m_clipVertices; // scratch for AddOccluder
+	std::vector<ScreenTriangle> m_triangles;
+	std::vector<UINT> m_bins[TILE_COLUMNS * TILE_ROWS]; // triangle indices per tile, in the order they were added
+	std::vector<float> m_levels[LEVEL_COUNT]; // level 0 is the depth buffer, each level after is the max of 2 x 2
+	WorkerPool m_workers; // kept from frame to frame, Rasterize only wakes them
+
+	void AddClipTriangle(const XMFLOAT4& a, const XMFLOAT4& b, const XMFLOAT4& c);
+	void AddScreenTriangle(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c);
+	void RasterizeTile(UINT tile);
+	void BuildHierarchy();
+
+public:
+	OcclusionCuller();
+
+	void Begin(const XMFLOAT4X4& viewProjection);
+
+	void AddOccluder(const XMFLOAT3* vertices, UINT vertexCount, const UINT* indices, UINT indexCount, const XMFLOAT4X4& world);
+	void AddBoxOccluder(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, const XMFLOAT4X4& world);
+
+	void Rasterize(UINT maxThreads = 1);
+
+	bool IsVisible(const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+
+	UINT GetTriangleCount() { return (UINT)m_triangles.size(); }
+	const float* GetDepth(UINT level) { return m_levels[level].data(); }
+
+	static void Benchmark(UINT threads, double& singleMs, double& threadedMs, float& occludedFraction, bool& identical);
+};
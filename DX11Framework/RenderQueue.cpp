@@ -0,0 +1,144 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <random>
+
+/// <summary>
+/// packs a draw into a sortable key, fields wider than their bit range are masked. depth01 is view depth over the far plane
+/// </summary>
+/// <param name="pass"></param>
+/// <param name="program"></param>
+/// <param name="material"></param>
+/// <param name="mesh"></param>
+/// <param name="depth01"></param>
+/// <returns></returns>
+UINT64 MakeDrawKey(RenderPass pass, UINT program, UINT material, UINT mesh, float depth01) {
+	const UINT64 depthMax = (1ull << DRAW_KEY_DEPTH_BITS) - 1;
+	float clamped = depth01 < 0.0f ? 0.0f : (depth01 > 1.0f ? 1.0f : depth01);
+	UINT64 depth = (UINT64)(clamped * (float)depthMax);
+
+	UINT64 state = ((UINT64)(program & ((1u << DRAW_KEY_PROGRAM_BITS) - 1)) << (DRAW_KEY_MATERIAL_BITS + DRAW_KEY_MESH_BITS))
+		| ((UINT64)(material & ((1u << DRAW_KEY_MATERIAL_BITS) - 1)) << DRAW_KEY_MESH_BITS)
+		| (UINT64)(mesh & ((1u << DRAW_KEY_MESH_BITS) - 1));
+
+	UINT64 key = (UINT64)pass << 60;
+	if (pass == RenderPass::Transparent) {
+		key |= (depthMax - depth) << 32; // far first
+		key |= state;
+	}
+	else {
+		key |= state << DRAW_KEY_DEPTH_BITS;
+		key |= depth;
+	}
+	return key;
+}
+
+/// <summary>
+/// drops last frame's items, capacity is kept so steady state frames do not allocate
+/// </summary>
+void RenderQueue::Clear() {
+	m_items.clear();
+	m_entries.clear();
+}
+
+/// <summary>
+/// orders the submitted items by key, items with equal keys keep their submission order
+/// </summary>
+void RenderQueue::Sort() {
+	UINT count = (UINT)m_items.size();
+	m_entries.resize(count);
+	m_scratch.resize(count);
+
+	for (UINT i = 0; i < count; i++) {
+		m_entries[i].m_key = m_items[i].m_key;
+		m_entries[i].m_item = i;
+	}
+
+	RadixSort(m_entries.data(), m_scratch.data(), count);
+}
+
+/// <summary>
+/// stable LSD radix sort over the 8 key bytes. a byte that is the same in every key is skipped,
+/// so unused key fields cost one histogram pass rather than a scatter
+/// </summary>
+/// <param name="entries">sorted in place</param>
+/// <param name="scratch">at least count entries</param>
+/// <param name="count"></param>
+void RenderQueue::RadixSort(SortEntry* entries, SortEntry* scratch, UINT count) {
+	if (count < 2) return;
+
+	// all 8 histograms in one read of the keys
+	UINT histograms[8][256] = {};
+	for (UINT i = 0; i < count; i++) {
+		UINT64 key = entries[i].m_key;
+		for (UINT b = 0; b < 8; b++) {
+			histograms[b][(key >> (b * 8)) & 0xff]++;
+		}
+	}
+
+	SortEntry* src = entries;
+	SortEntry* dst = scratch;
+
+	for (UINT b = 0; b < 8; b++) {
+		UINT* histogram = histograms[b];
+
+		if (histogram[(src[0].m_key >> (b * 8)) & 0xff] == count) continue;
+
+		UINT offsets[256];
+		UINT total = 0;
+		for (UINT i = 0; i < 256; i++) {
+			offsets[i] = total;
+			total += histogram[i];
+		}
+
+		for (UINT i = 0; i < count; i++) {
+			dst[offsets[(src[i].m_key >> (b * 8)) & 0xff]++] = src[i];
+		}
+
+		SortEntry* swap = src; src = dst; dst = swap;
+	}
+
+	if (src != entries) memcpy(entries, src, sizeof(SortEntry) * count);
+}
+
+/// <summary>
+/// times RadixSort and std::stable_sort on the same random keys, results are the average milliseconds per sort
+/// </summary>
+/// <param name="itemCount"></param>
+/// <param name="iterations"></param>
+/// <param name="radixMs"></param>
+/// <param name="stdSortMs"></param>
+void RenderQueue::BenchmarkSort(UINT itemCount, UINT iterations, double& radixMs, double& stdSortMs) {
+	std::mt19937 random(1);
+	std::uniform_int_distribution<UINT> program(0, 15), material(0, 255), mesh(0, 1023), pass(0, (UINT)RenderPass::Count - 1);
+	std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+
+	std::vector<SortEntry> source(itemCount);
+	for (UINT i = 0; i < itemCount; i++) {
+		source[i].m_key = MakeDrawKey((RenderPass)pass(random), program(random), material(random), mesh(random), depth(random));
+		source[i].m_item = i;
+	}
+
+	std::vector<SortEntry> entries(itemCount), scratch(itemCount);
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	LONGLONG radixTicks = 0, stdTicks = 0;
+	for (UINT i = 0; i < iterations; i++) {
+		entries = source;
+		QueryPerformanceCounter(&start);
+		RadixSort(entries.data(), scratch.data(), itemCount);
+		QueryPerformanceCounter(&end);
+		radixTicks += end.QuadPart - start.QuadPart;
+
+		entries = source;
+		QueryPerformanceCounter(&start);
+		std::stable_sort(entries.begin(), entries.end(), [](const SortEntry& a, const SortEntry& b) { return a.m_key < b.m_key; });
+		QueryPerformanceCounter(&end);
+		stdTicks += end.QuadPart - start.QuadPart;
+	}
+
+	double divisor = (double)frequency.QuadPart * (iterations > 0 ? iterations : 1) / 1000.0;
+	radixMs = radixTicks / divisor;
+	stdSortMs = stdTicks / divisor;
+}
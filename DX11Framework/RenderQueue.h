@@ -0,0 +1,108 @@
+#pragma once
+#include <windows.h>
+#include <d3d11_1.h>
+#include <DirectXMath.h>
+#include <vector>
+
+using namespace DirectX;
+
+enum class RenderPass : UINT
+{
+	Opaque,
+	Skybox,
+	Transparent,
+	Count
+};
+
+// 64 bit draw key, sorted ascending. the pass always leads, after that
+// opaque passes group by state and go front to back inside a group:
+//   63-60 pass | 59-52 program | 51-40 material | 39-28 mesh | 27-0 depth
+// transparent passes go back to front first and group by state between equal depths:
+//   63-60 pass | 59-32 inverted depth | 31-24 program | 23-12 material | 11-0 mesh
+static const UINT DRAW_KEY_PROGRAM_BITS = 8;
+static const UINT DRAW_KEY_MATERIAL_BITS = 12;
+static const UINT DRAW_KEY_MESH_BITS = 12;
+static const UINT DRAW_KEY_DEPTH_BITS = 28;
+
+UINT64 MakeDrawKey(RenderPass pass, UINT program, UINT material, UINT mesh, float depth01);
+
+/// shaders and fixed function state a draw needs, referenced by index from a draw item
+struct RenderProgram
+{
+	ID3D11VertexShader* m_vertexShader = nullptr;
+	ID3D11HullShader* m_hullShader = nullptr;
+	ID3D11DomainShader* m_domainShader = nullptr;
+	ID3D11PixelShader* m_pixelShader = nullptr;
+	bool m_pixelPermutations = false; // pixel shader is picked per material from DX11Framework's permutations instead
+	ID3D11InputLayout* m_inputLayout = nullptr;
+	D3D11_PRIMITIVE_TOPOLOGY m_topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	ID3D11RasterizerState* m_rasterizer = nullptr;
+	ID3D11BlendState* m_blendState = nullptr;
+	FLOAT m_blendFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	ID3D11DepthStencilState* m_depthStencil = nullptr;
+	UINT m_stencilRef = 0;
+};
+
+static const UINT MAX_MATERIAL_PIXEL_RESOURCES = 6;
+
+/// textures and material flags, pixel resources fill t0 upwards, the rest go to t0 of their stage
+struct RenderMaterial
+{
+	ID3D11ShaderResourceView* m_pixelResources[MAX_MATERIAL_PIXEL_RESOURCES] = {};
+	UINT m_pixelResourceCount = 0;
+	ID3D11ShaderResourceView* m_vertexResource = nullptr;
+	ID3D11Buffer* m_vertexConstants = nullptr; // b3
+	ID3D11ShaderResourceView* m_domainResource = nullptr;
+	UINT m_hasTexture = 0;
+	UINT m_specMap = 0;
+	UINT m_normMap = 0;
+};
+
+/// geometry for a draw, a null vertex buffer means the vertex shader generates it and m_count is a vertex count
+struct RenderMesh
+{
+	ID3D11Buffer* m_vertexBuffer = nullptr;
+	ID3D11Buffer* m_indexBuffer = nullptr;
+	UINT m_stride = 0;
+	UINT m_offset = 0;
+	UINT m_count = 0;
+	bool m_indexed = true;
+	XMFLOAT4 m_boundingSphere = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f); // local space centre and radius, a radius of 0 is never culled
+};
+
+struct DrawItem
+{
+	UINT64 m_key = 0;
+	UINT m_program = 0;
+	UINT m_material = 0;
+	UINT m_mesh = 0;
+	XMFLOAT4X4 m_world;
+	ID3D11Buffer* m_instanceBuffer = nullptr; // per instance world matrices, m_world is ignored when set
+	UINT m_instanceCount = 0;
+};
+
+struct SortEntry
+{
+	UINT64 m_key;
+	UINT m_item;
+};
+
+/// draw items submitted in any order during a frame, radix sorted on their keys before execution
+class RenderQueue
+{
+private:
+	std::vector<DrawItem> m_items;
+	std::vector<SortEntry> m_entries;
+	std::vector<SortEntry> m_scratch;
+
+public:
+	void Clear();
+	void Submit(const DrawItem& item) { m_items.push_back(item); }
+	void Sort();
+
+	UINT GetCount() { return (UINT)m_entries.size(); }
+	const DrawItem& GetSorted(UINT index) { return m_items[m_entries[index].m_item]; }
+
+	static void RadixSort(SortEntry* entries, SortEntry* scratch, UINT count);
+	static void BenchmarkSort(UINT itemCount, UINT iterations, double& radixMs, double& stdSortMs);
+};
@@ -0,0 +1,707 @@
+#include "SceneBVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <random>
+
+AABB SphereToAABB(const XMFLOAT4& sphere) {
+	AABB box;
+	box.m_min = XMFLOAT3(sphere.x - sphere.w, sphere.y - sphere.w, sphere.z - sphere.w);
+	box.m_max = XMFLOAT3(sphere.x + sphere.w, sphere.y + sphere.w, sphere.z + sphere.w);
+	return box;
+}
+
+static AABB EmptyAABB() {
+	AABB box;
+	box.m_min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	box.m_max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return box;
+}
+
+static void Grow(AABB& box, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax) {
+	box.m_min = XMFLOAT3(min(box.m_min.x, boxMin.x), min(box.m_min.y, boxMin.y), min(box.m_min.z, boxMin.z));
+	box.m_max = XMFLOAT3(max(box.m_max.x, boxMax.x), max(box.m_max.y, boxMax.y), max(box.m_max.z, boxMax.z));
+}
+
+// half the surface area, the factor cancels out of every comparison
+static float HalfArea(const AABB& box) {
+	float x = box.m_max.x - box.m_min.x, y = box.m_max.y - box.m_min.y, z = box.m_max.z - box.m_min.z;
+	return x * y + y * z + z * x;
+}
+
+static float Axis(const XMFLOAT3& v, UINT axis) { return axis == 0 ? v.x : (axis == 1 ? v.y : v.z); }
+
+/// <summary>
+/// tests a box against the frustum planes still set in planeMask, clearing the planes it is fully inside
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="boxMin"></param>
+/// <param name="boxMax"></param>
+/// <param name="planeMask"></param>
+/// <returns>false when the box is outside one of the planes</returns>
+static bool ClassifyBox(const Frustum& frustum, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, UINT& planeMask) {
+	XMFLOAT3 centre((boxMin.x + boxMax.x) * 0.5f, (boxMin.y + boxMax.y) * 0.5f, (boxMin.z + boxMax.z) * 0.5f);
+	XMFLOAT3 extent(boxMax.x - centre.x, boxMax.y - centre.y, boxMax.z - centre.z);
+
+	for (UINT p = 0; p < 6; p++) {
+		if (!(planeMask & (1u << p))) continue;
+
+		const XMFLOAT4& plane = frustum.m_planes[p];
+		float distance = plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w;
+		float reach = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+
+		if (distance + reach < 0.0f) return false;
+		if (distance - reach >= 0.0f) planeMask &= ~(1u << p);
+	}
+	return true;
+}
+
+/// <summary>
+/// the test ClassifyBox makes against all six planes, measured rather than passed or failed
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="eye">camera position the reach is measured from</param>
+/// <param name="boxMin"></param>
+/// <param name="boxMax"></param>
+/// <param name="inside">how far the box is inside every plane, negative when it crosses one</param>
+/// <returns>visible when no plane has the box outside it, the margin is then the least any plane has of the box
+/// inside it, otherwise how far the box is outside</returns>
+static ObjectVisibility MeasureBox(const Frustum& frustum, const XMFLOAT3& eye, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, float& inside) {
+	XMFLOAT3 centre((boxMin.x + boxMax.x) * 0.5f, (boxMin.y + boxMax.y) * 0.5f, (boxMin.z + boxMax.z) * 0.5f);
+	XMFLOAT3 extent(boxMax.x - centre.x, boxMax.y - centre.y, boxMax.z - centre.z);
+
+	float outside = -FLT_MAX;
+	float touching = FLT_MAX;
+	inside = FLT_MAX;
+	for (UINT p = 0; p < 6; p++) {
+		const XMFLOAT4& plane = frustum.m_planes[p];
+		float distance = plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w;
+		float reach = fabsf(plane.x) * extent.x + fabsf(plane.y) * extent.y + fabsf(plane.z) * extent.z;
+
+		outside = max(outside, -(distance + reach));
+		touching = min(touching, distance + reach);
+		inside = min(inside, distance - reach);
+	}
+
+	XMFLOAT3 offset(centre.x - eye.x, centre.y - eye.y, centre.z - eye.z);
+
+	ObjectVisibility result;
+	result.m_visible = outside <= 0.0f;
+	result.m_margin = result.m_visible ? touching : outside;
+	result.m_reach = sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z) + sqrtf(extent.x * extent.x + extent.y * extent.y + extent.z * extent.z);
+	return result;
+}
+
+/// <summary>
+/// slab test, entry is clamped to 0 so a ray starting inside the box enters it at once
+/// </summary>
+/// <param name="origin"></param>
+/// <param name="inverseDirection"></param>
+/// <param name="boxMin"></param>
+/// <param name="boxMax"></param>
+/// <param name="maxDistance"></param>
+/// <param name="entry"></param>
+/// <returns></returns>
+static bool RayBox(const XMFLOAT3& origin, const XMFLOAT3& inverseDirection, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, float maxDistance, float& entry) {
+	float x0 = (boxMin.x - origin.x) * inverseDirection.x, x1 = (boxMax.x - origin.x) * inverseDirection.x;
+	float y0 = (boxMin.y - origin.y) * inverseDirection.y, y1 = (boxMax.y - origin.y) * inverseDirection.y;
+	float z0 = (boxMin.z - origin.z) * inverseDirection.z, z1 = (boxMax.z - origin.z) * inverseDirection.z;
+
+	float enter = max(max(min(x0, x1), min(y0, y1)), max(min(z0, z1), 0.0f));
+	float exit = min(min(max(x0, x1), max(y0, y1)), min(max(z0, z1), maxDistance));
+
+	entry = enter;
+	return enter <= exit;
+}
+
+/// <summary>
+/// recomputes a node's box, a leaf from its objects and anything else from its two children
+/// </summary>
+/// <param name="node"></param>
+void SceneBVH::FitNode(UINT node) {
+	BVHNode& fitted = m_nodes[node];
+	AABB box = EmptyAABB();
+
+	if (fitted.m_left == 0) {
+		for (UINT i = fitted.m_first; i < fitted.m_first + fitted.m_count; i++) {
+			const AABB& bounds = m_bounds[m_objects[i]];
+			Grow(box, bounds.m_min, bounds.m_max);
+		}
+	}
+	else {
+		Grow(box, m_nodes[fitted.m_left].m_min, m_nodes[fitted.m_left].m_max);
+		Grow(box, m_nodes[fitted.m_left + 1].m_min, m_nodes[fitted.m_left + 1].m_max);
+	}
+
+	fitted.m_min = box.m_min;
+	fitted.m_max = box.m_max;
+}
+
+/// <summary>
+/// splits a node with more than MAX_LEAF_OBJECTS objects in two. candidate planes are the SAH_BINS bin boundaries of
+/// the object centroids on each axis, the one with the least summed child area times object count wins. leaves the
+/// node alone when every centroid is in the same place
+/// </summary>
+/// <param name="node"></param>
+/// <param name="centroids">by object id</param>
+void SceneBVH::Split(UINT node, std::vector<XMFLOAT3>& centroids) {
+	const UINT first = m_nodes[node].m_first;
+	const UINT count = m_nodes[node].m_count;
+	if (count <= MAX_LEAF_OBJECTS) return;
+
+	AABB centroidBounds = EmptyAABB();
+	for (UINT i = first; i < first + count; i++) Grow(centroidBounds, centroids[m_objects[i]], centroids[m_objects[i]]);
+
+	struct Bin
+	{
+		AABB m_box;
+		UINT m_count;
+	};
+
+	float bestCost = FLT_MAX;
+	UINT bestAxis = 0;
+	UINT bestBin = 0;
+
+	for (UINT axis = 0; axis < 3; axis++) {
+		float low = Axis(centroidBounds.m_min, axis);
+		float extent = Axis(centroidBounds.m_max, axis) - low;
+		if (extent <= 0.0f) continue;
+
+		Bin bins[SAH_BINS];
+		for (UINT b = 0; b < SAH_BINS; b++) {
+			bins[b].m_box = EmptyAABB();
+			bins[b].m_count = 0;
+		}
+
+		float scale = SAH_BINS / extent;
+		for (UINT i = first; i < first + count; i++) {
+			UINT object = m_objects[i];
+			UINT b = min((UINT)((Axis(centroids[object], axis) - low) * scale), SAH_BINS - 1);
+			bins[b].m_count++;
+			Grow(bins[b].m_box, m_bounds[object].m_min, m_bounds[object].m_max);
+		}
+
+		// left sweep stores the cost of everything up to each boundary, the right sweep adds the rest
+		float leftCost[SAH_BINS - 1];
+		AABB side = EmptyAABB();
+		UINT sideCount = 0;
+		for (UINT b = 0; b + 1 < SAH_BINS; b++) {
+			Grow(side, bins[b].m_box.m_min, bins[b].m_box.m_max);
+			sideCount += bins[b].m_count;
+			leftCost[b] = sideCount ? sideCount * HalfArea(side) : FLT_MAX;
+		}
+
+		side = EmptyAABB();
+		sideCount = 0;
+		for (UINT b = SAH_BINS - 1; b > 0; b--) {
+			Grow(side, bins[b].m_box.m_min, bins[b].m_box.m_max);
+			sideCount += bins[b].m_count;
+			if (!sideCount || leftCost[b - 1] == FLT_MAX) continue;
+
+			float cost = leftCost[b - 1] + sideCount * HalfArea(side);
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = b - 1;
+			}
+		}
+	}
+
+	if (bestCost == FLT_MAX) return;
+
+	float low = Axis(centroidBounds.m_min, bestAxis);
+	float scale = SAH_BINS / (Axis(centroidBounds.m_max, bestAxis) - low);
+	UINT* begin = m_objects.data() + first;
+	UINT* middle = std::partition(begin, begin + count, [&](UINT object) {
+		return min((UINT)((Axis(centroids[object], bestAxis) - low) * scale), SAH_BINS - 1) <= bestBin;
+	});
+
+	UINT leftCount = (UINT)(middle - begin);
+	if (leftCount == 0 || leftCount == count) return; // only rounding can get here, the chosen boundary had objects both sides
+
+	UINT left = (UINT)m_nodes.size();
+	BVHNode child = {};
+	child.m_first = first;
+	child.m_count = leftCount;
+	m_nodes.push_back(child);
+	child.m_first = first + leftCount;
+	child.m_count = count - leftCount;
+	m_nodes.push_back(child);
+	m_parents.push_back(node);
+	m_parents.push_back(node);
+
+	m_nodes[node].m_left = left;
+	FitNode(left);
+	FitNode(left + 1);
+}
+
+/// <summary>
+/// builds the tree over count object boxes, object ids are indices into bounds
+/// </summary>
+/// <param name="bounds"></param>
+/// <param name="count"></param>
+void SceneBVH::Build(const AABB* bounds, UINT count) {
+	m_bounds.assign(bounds, bounds + count);
+	m_objects.resize(count);
+	m_objectLeaf.resize(count);
+	m_nodes.clear();
+	m_parents.clear();
+	if (count == 0) return;
+
+	std::vector<XMFLOAT3> centroids(count);
+	for (UINT i = 0; i < count; i++) {
+		m_objects[i] = i;
+		centroids[i] = XMFLOAT3((bounds[i].m_min.x + bounds[i].m_max.x) * 0.5f, (bounds[i].m_min.y + bounds[i].m_max.y) * 0.5f, (bounds[i].m_min.z + bounds[i].m_max.z) * 0.5f);
+	}
+
+	m_nodes.reserve(2 * (count / MAX_LEAF_OBJECTS + 1));
+	m_parents.reserve(m_nodes.capacity());
+
+	BVHNode root = {};
+	root.m_count = count;
+	m_nodes.push_back(root);
+	m_parents.push_back(0);
+	FitNode(0);
+
+	// nodes are split in the order they were created, so children are always appended after their parent
+	for (UINT node = 0; node < m_nodes.size(); node++) {
+		Split(node, centroids);
+	}
+
+	for (UINT node = 0; node < m_nodes.size(); node++) {
+		const BVHNode& leaf = m_nodes[node];
+		if (leaf.m_left != 0) continue;
+		for (UINT i = leaf.m_first; i < leaf.m_first + leaf.m_count; i++) m_objectLeaf[m_objects[i]] = node;
+	}
+}
+
+/// <summary>
+/// moves one object, its leaf and ancestors are refit until one of them comes out unchanged
+/// </summary>
+/// <param name="object"></param>
+/// <param name="bounds"></param>
+void SceneBVH::UpdateBounds(UINT object, const AABB& bounds) {
+	m_bounds[object] = bounds;
+
+	UINT node = m_objectLeaf[object];
+	while (true) {
+		XMFLOAT3 oldMin = m_nodes[node].m_min;
+		XMFLOAT3 oldMax = m_nodes[node].m_max;
+		FitNode(node);
+
+		const BVHNode& fitted = m_nodes[node];
+		if (fitted.m_min.x == oldMin.x && fitted.m_min.y == oldMin.y && fitted.m_min.z == oldMin.z &&
+			fitted.m_max.x == oldMax.x && fitted.m_max.y == oldMax.y && fitted.m_max.z == oldMax.z) break;
+
+		if (node == 0) break;
+		node = m_parents[node];
+	}
+}
+
+/// <summary>
+/// refits every node from the current object bounds, children come after parents so a reverse walk is bottom up
+/// </summary>
+void SceneBVH::Refit() {
+	for (UINT node = (UINT)m_nodes.size(); node-- > 0;) FitNode(node);
+}
+
+/// <summary>
+/// object ids whose boxes touch the frustum. planes a node is fully inside are not tested again below it, and a
+/// node inside all six adds its whole object run without testing anything
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="visible">cleared first, ids in traversal order</param>
+void SceneBVH::CullFrustum(const Frustum& frustum, std::vector<UINT>& visible) {
+	visible.clear();
+	if (m_nodes.empty()) return;
+
+	m_stack.clear();
+	m_stack.push_back({ 0, 0x3f, 0.0f });
+
+	while (!m_stack.empty()) {
+		StackEntry entry = m_stack.back();
+		m_stack.pop_back();
+
+		const BVHNode& node = m_nodes[entry.m_node];
+		UINT planeMask = entry.m_planeMask;
+		if (!ClassifyBox(frustum, node.m_min, node.m_max, planeMask)) continue;
+
+		if (planeMask == 0) {
+			visible.insert(visible.end(), m_objects.begin() + node.m_first, m_objects.begin() + node.m_first + node.m_count);
+		}
+		else if (node.m_left == 0) {
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) {
+				UINT objectMask = planeMask;
+				const AABB& bounds = m_bounds[m_objects[i]];
+				if (ClassifyBox(frustum, bounds.m_min, bounds.m_max, objectMask)) visible.push_back(m_objects[i]);
+			}
+		}
+		else {
+			m_stack.push_back({ node.m_left + 1, planeMask, 0.0f });
+			m_stack.push_back({ node.m_left, planeMask, 0.0f });
+		}
+	}
+}
+
+/// <summary>
+/// a box against every view still in viewMask and not in insideMask, four views per step. views the box is outside
+/// are cleared from viewMask, views it is fully inside are added to insideMask
+/// </summary>
+/// <param name="planes"></param>
+/// <param name="boxMin"></param>
+/// <param name="boxMax"></param>
+/// <param name="viewMask"></param>
+/// <param name="insideMask"></param>
+void SceneBVH::ClassifyBoxViews(const ViewPlanes& planes, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, UINT& viewMask, UINT& insideMask) {
+	XMVECTOR centreX = XMVectorReplicate((boxMin.x + boxMax.x) * 0.5f);
+	XMVECTOR centreY = XMVectorReplicate((boxMin.y + boxMax.y) * 0.5f);
+	XMVECTOR centreZ = XMVectorReplicate((boxMin.z + boxMax.z) * 0.5f);
+	XMVECTOR extentX = XMVectorReplicate((boxMax.x - boxMin.x) * 0.5f);
+	XMVECTOR extentY = XMVectorReplicate((boxMax.y - boxMin.y) * 0.5f);
+	XMVECTOR extentZ = XMVectorReplicate((boxMax.z - boxMin.z) * 0.5f);
+
+	for (UINT group = 0; group < planes.m_groups; group++) {
+		if (!((viewMask & ~insideMask) >> (group * 4) & 0xf)) continue;
+
+		XMVECTOR outside = XMVectorFalseInt();
+		XMVECTOR inside = XMVectorTrueInt();
+		for (UINT p = 0; p < 6; p++) {
+			XMVECTOR distance = XMVectorMultiplyAdd(centreX, planes.m_x[group][p], planes.m_w[group][p]);
+			distance = XMVectorMultiplyAdd(centreY, planes.m_y[group][p], distance);
+			distance = XMVectorMultiplyAdd(centreZ, planes.m_z[group][p], distance);
+
+			XMVECTOR reach = XMVectorMultiply(extentX, planes.m_absX[group][p]);
+			reach = XMVectorMultiplyAdd(extentY, planes.m_absY[group][p], reach);
+			reach = XMVectorMultiplyAdd(extentZ, planes.m_absZ[group][p], reach);
+
+			outside = XMVectorOrInt(outside, XMVectorLess(XMVectorAdd(distance, reach), XMVectorZero()));
+			inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorSubtract(distance, reach), XMVectorZero()));
+		}
+
+		XMUINT4 out, in;
+		XMStoreUInt4(&out, outside);
+		XMStoreUInt4(&in, inside);
+		UINT outBits = ((out.x & 1) | (out.y & 2) | (out.z & 4) | (out.w & 8)) << (group * 4);
+		UINT inBits = ((in.x & 1) | (in.y & 2) | (in.z & 4) | (in.w & 8)) << (group * 4);
+
+		// a view the parent was inside cannot have the child outside, float rounding aside
+		viewMask &= ~(outBits & ~insideMask);
+		insideMask |= inBits & viewMask;
+	}
+}
+
+/// <summary>
+/// CullFrustum for several views in one traversal. each node is read once and tested against every view that has
+/// neither rejected nor fully accepted it, four views to a SIMD step, so up to four views cost about what one does
+/// </summary>
+/// <param name="frusta"></param>
+/// <param name="viewCount">up to MAX_VIEWS</param>
+/// <param name="visible">objects at least one view sees</param>
+/// <param name="viewMasks">for each of visible, bit v set when frusta[v] sees it</param>
+void SceneBVH::CullFrusta(const Frustum* frusta, UINT viewCount, std::vector<UINT>& visible, std::vector<BYTE>& viewMasks) {
+	visible.clear();
+	viewMasks.clear();
+	viewCount = min(viewCount, MAX_VIEWS);
+	if (m_nodes.empty() || viewCount == 0) return;
+
+	// lanes past viewCount repeat the last view, they are never in a mask
+	ViewPlanes planes;
+	planes.m_groups = (viewCount + 3) / 4;
+	for (UINT group = 0; group < planes.m_groups; group++) {
+		const Frustum* lanes[4];
+		for (UINT lane = 0; lane < 4; lane++) lanes[lane] = &frusta[min(group * 4 + lane, viewCount - 1)];
+
+		for (UINT p = 0; p < 6; p++) {
+			planes.m_x[group][p] = XMVectorSet(lanes[0]->m_planes[p].x, lanes[1]->m_planes[p].x, lanes[2]->m_planes[p].x, lanes[3]->m_planes[p].x);
+			planes.m_y[group][p] = XMVectorSet(lanes[0]->m_planes[p].y, lanes[1]->m_planes[p].y, lanes[2]->m_planes[p].y, lanes[3]->m_planes[p].y);
+			planes.m_z[group][p] = XMVectorSet(lanes[0]->m_planes[p].z, lanes[1]->m_planes[p].z, lanes[2]->m_planes[p].z, lanes[3]->m_planes[p].z);
+			planes.m_w[group][p] = XMVectorSet(lanes[0]->m_planes[p].w, lanes[1]->m_planes[p].w, lanes[2]->m_planes[p].w, lanes[3]->m_planes[p].w);
+			planes.m_absX[group][p] = XMVectorAbs(planes.m_x[group][p]);
+			planes.m_absY[group][p] = XMVectorAbs(planes.m_y[group][p]);
+			planes.m_absZ[group][p] = XMVectorAbs(planes.m_z[group][p]);
+		}
+	}
+
+	m_viewStack.clear();
+	m_viewStack.push_back({ 0, (1u << viewCount) - 1, 0 });
+
+	while (!m_viewStack.empty()) {
+		ViewStackEntry entry = m_viewStack.back();
+		m_viewStack.pop_back();
+
+		const BVHNode& node = m_nodes[entry.m_node];
+		ClassifyBoxViews(planes, node.m_min, node.m_max, entry.m_viewMask, entry.m_insideMask);
+		if (entry.m_viewMask == 0) continue;
+
+		if (entry.m_viewMask == entry.m_insideMask) {
+			visible.insert(visible.end(), m_objects.begin() + node.m_first, m_objects.begin() + node.m_first + node.m_count);
+			viewMasks.insert(viewMasks.end(), node.m_count, (BYTE)entry.m_viewMask);
+		}
+		else if (node.m_left == 0) {
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) {
+				UINT objectViews = entry.m_viewMask;
+				UINT objectInside = entry.m_insideMask;
+				const AABB& bounds = m_bounds[m_objects[i]];
+				ClassifyBoxViews(planes, bounds.m_min, bounds.m_max, objectViews, objectInside);
+
+				if (objectViews) {
+					visible.push_back(m_objects[i]);
+					viewMasks.push_back((BYTE)objectViews);
+				}
+			}
+		}
+		else {
+			m_viewStack.push_back({ node.m_left + 1, entry.m_viewMask, entry.m_insideMask });
+			m_viewStack.push_back({ node.m_left, entry.m_viewMask, entry.m_insideMask });
+		}
+	}
+}
+
+/// <summary>
+/// every object's CullFrustum result with the margins VisibilityCache keeps. a node outside the frustum or fully
+/// inside it hands its own margin and reach to all its objects, which can only understate how long theirs hold,
+/// so only objects in leaves that cross a plane are measured one by one
+/// </summary>
+/// <param name="frustum"></param>
+/// <param name="eye"></param>
+/// <param name="objects">by object id</param>
+void SceneBVH::ClassifyObjects(const Frustum& frustum, const XMFLOAT3& eye, std::vector<ObjectVisibility>& objects) {
+	objects.resize(m_bounds.size());
+	if (m_nodes.empty()) return;
+
+	m_stack.clear();
+	m_stack.push_back({ 0, 0, 0.0f });
+
+	while (!m_stack.empty()) {
+		const BVHNode& node = m_nodes[m_stack.back().m_node];
+		m_stack.pop_back();
+
+		float inside;
+		ObjectVisibility nodeVisibility = MeasureBox(frustum, eye, node.m_min, node.m_max, inside);
+
+		if (!nodeVisibility.m_visible || inside >= 0.0f) {
+			// an object inside the node is visible at least until a plane reaches the node's box
+			if (nodeVisibility.m_visible) nodeVisibility.m_margin = inside;
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) objects[m_objects[i]] = nodeVisibility;
+		}
+		else if (node.m_left == 0) {
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) {
+				const AABB& bounds = m_bounds[m_objects[i]];
+				objects[m_objects[i]] = MeasureBox(frustum, eye, bounds.m_min, bounds.m_max, inside);
+			}
+		}
+		else {
+			m_stack.push_back({ node.m_left + 1, 0, 0.0f });
+			m_stack.push_back({ node.m_left, 0, 0.0f });
+		}
+	}
+}
+
+ObjectVisibility SceneBVH::ClassifyObject(const Frustum& frustum, const XMFLOAT3& eye, UINT object) {
+	float inside;
+	return MeasureBox(frustum, eye, m_bounds[object].m_min, m_bounds[object].m_max, inside);
+}
+
+/// <summary>
+/// nearest object box along a ray, children are visited nearest first and skipped once they start past the best hit
+/// </summary>
+/// <param name="origin"></param>
+/// <param name="direction">need not be normalised, distances are in multiples of it</param>
+/// <param name="maxDistance"></param>
+/// <param name="object">the hit object's id</param>
+/// <param name="distance">where the ray enters its box, 0 when it starts inside</param>
+/// <returns>false when nothing is hit within maxDistance</returns>
+bool SceneBVH::Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, UINT& object, float& distance) {
+	if (m_nodes.empty()) return false;
+
+	// a zero component gives a huge inverse, so that slab is either everything or nothing as it should be
+	auto inverse = [](float d) { return d != 0.0f ? 1.0f / d : (d < 0.0f ? -1e30f : 1e30f); };
+	XMFLOAT3 inverseDirection(inverse(direction.x), inverse(direction.y), inverse(direction.z));
+
+	float best = maxDistance;
+	bool hit = false;
+
+	float entryDistance;
+	if (!RayBox(origin, inverseDirection, m_nodes[0].m_min, m_nodes[0].m_max, best, entryDistance)) return false;
+
+	m_stack.clear();
+	m_stack.push_back({ 0, 0, entryDistance });
+
+	while (!m_stack.empty()) {
+		StackEntry entry = m_stack.back();
+		m_stack.pop_back();
+		if (entry.m_distance > best) continue;
+
+		const BVHNode& node = m_nodes[entry.m_node];
+		if (node.m_left == 0) {
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) {
+				const AABB& bounds = m_bounds[m_objects[i]];
+				if (RayBox(origin, inverseDirection, bounds.m_min, bounds.m_max, best, entryDistance) && (!hit || entryDistance < best)) {
+					best = entryDistance;
+					object = m_objects[i];
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		float leftDistance, rightDistance;
+		const BVHNode& left = m_nodes[node.m_left];
+		const BVHNode& right = m_nodes[node.m_left + 1];
+		bool hitLeft = RayBox(origin, inverseDirection, left.m_min, left.m_max, best, leftDistance);
+		bool hitRight = RayBox(origin, inverseDirection, right.m_min, right.m_max, best, rightDistance);
+
+		// the nearer child goes on top so it is visited first
+		if (hitLeft && hitRight && leftDistance > rightDistance) {
+			m_stack.push_back({ node.m_left, 0, leftDistance });
+			m_stack.push_back({ node.m_left + 1, 0, rightDistance });
+		}
+		else {
+			if (hitRight) m_stack.push_back({ node.m_left + 1, 0, rightDistance });
+			if (hitLeft) m_stack.push_back({ node.m_left, 0, leftDistance });
+		}
+	}
+
+	distance = best;
+	return hit;
+}
+
+/// <summary>
+/// object ids whose boxes come within radius of centre
+/// </summary>
+/// <param name="centre"></param>
+/// <param name="radius"></param>
+/// <param name="objects">cleared first</param>
+void SceneBVH::QuerySphere(const XMFLOAT3& centre, float radius, std::vector<UINT>& objects) {
+	objects.clear();
+	if (m_nodes.empty()) return;
+
+	float radiusSq = radius * radius;
+	auto touches = [&](const XMFLOAT3& boxMin, const XMFLOAT3& boxMax) {
+		float dx = max(max(boxMin.x - centre.x, 0.0f), centre.x - boxMax.x);
+		float dy = max(max(boxMin.y - centre.y, 0.0f), centre.y - boxMax.y);
+		float dz = max(max(boxMin.z - centre.z, 0.0f), centre.z - boxMax.z);
+		return dx * dx + dy * dy + dz * dz <= radiusSq;
+	};
+
+	m_stack.clear();
+	m_stack.push_back({ 0, 0, 0.0f });
+
+	while (!m_stack.empty()) {
+		const BVHNode& node = m_nodes[m_stack.back().m_node];
+		m_stack.pop_back();
+		if (!touches(node.m_min, node.m_max)) continue;
+
+		if (node.m_left == 0) {
+			for (UINT i = node.m_first; i < node.m_first + node.m_count; i++) {
+				const AABB& bounds = m_bounds[m_objects[i]];
+				if (touches(bounds.m_min, bounds.m_max)) objects.push_back(m_objects[i]);
+			}
+		}
+		else {
+			m_stack.push_back({ node.m_left + 1, 0, 0.0f });
+			m_stack.push_back({ node.m_left, 0, 0.0f });
+		}
+	}
+}
+
+/// <summary>
+/// milliseconds to build over count random boxes, refit after moving every one of them, and cull from the origin
+/// </summary>
+/// <param name="count"></param>
+/// <param name="buildMs"></param>
+/// <param name="refitMs"></param>
+/// <param name="cullMs"></param>
+void SceneBVH::Benchmark(UINT count, double& buildMs, double& refitMs, double& cullMs) {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 2.0f), jitter(-1.0f, 1.0f);
+
+	std::vector<AABB> bounds(count);
+	for (UINT i = 0; i < count; i++) bounds[i] = SphereToAABB(XMFLOAT4(position(random), position(random), position(random), size(random)));
+
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixLookToLH(XMVectorZero(), XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))
+		* XMMatrixPerspectiveFovLH(XMConvertToRadians(90), 16.0f / 9.0f, 0.01f, 1000.0f));
+	Frustum frustum = ExtractFrustum(viewProjection);
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	double msPerTick = 1000.0 / (double)frequency.QuadPart;
+
+	SceneBVH bvh;
+	QueryPerformanceCounter(&start);
+	bvh.Build(bounds.data(), count);
+	QueryPerformanceCounter(&end);
+	buildMs = (end.QuadPart - start.QuadPart) * msPerTick;
+
+	for (UINT i = 0; i < count; i++) {
+		float dx = jitter(random), dy = jitter(random), dz = jitter(random);
+		AABB moved = bounds[i];
+		moved.m_min = XMFLOAT3(moved.m_min.x + dx, moved.m_min.y + dy, moved.m_min.z + dz);
+		moved.m_max = XMFLOAT3(moved.m_max.x + dx, moved.m_max.y + dy, moved.m_max.z + dz);
+		bvh.SetBounds(i, moved);
+	}
+
+	QueryPerformanceCounter(&start);
+	bvh.Refit();
+	QueryPerformanceCounter(&end);
+	refitMs = (end.QuadPart - start.QuadPart) * msPerTick;
+
+	std::vector<UINT> visible;
+	visible.reserve(count);
+	QueryPerformanceCounter(&start);
+	bvh.CullFrustum(frustum, visible);
+	QueryPerformanceCounter(&end);
+	cullMs = (end.QuadPart - start.QuadPart) * msPerTick;
+}
+
+/// <summary>
+/// milliseconds to cull count random boxes for viewCount cameras side by side looking the same way, as split screen
+/// players or monitors over one area would, once with CullFrusta and once with a CullFrustum per view
+/// </summary>
+/// <param name="count"></param>
+/// <param name="viewCount"></param>
+/// <param name="sharedMs"></param>
+/// <param name="separateMs"></param>
+void SceneBVH::BenchmarkViews(UINT count, UINT viewCount, double& sharedMs, double& separateMs) {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 2.0f);
+
+	std::vector<AABB> bounds(count);
+	for (UINT i = 0; i < count; i++) bounds[i] = SphereToAABB(XMFLOAT4(position(random), position(random), position(random), size(random)));
+
+	SceneBVH bvh;
+	bvh.Build(bounds.data(), count);
+
+	viewCount = min(viewCount, MAX_VIEWS);
+	std::vector<Frustum> frusta(viewCount);
+	for (UINT v = 0; v < viewCount; v++) {
+		float offset = v * 20.0f - (viewCount - 1) * 10.0f;
+		float yaw = XMConvertToRadians(offset * 0.5f);
+		XMFLOAT4X4 viewProjection;
+		XMStoreFloat4x4(&viewProjection, XMMatrixLookToLH(XMVectorSet(offset, 0.0f, 0.0f, 1.0f), XMVectorSet(sinf(yaw), 0.0f, cosf(yaw), 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f))
+			* XMMatrixPerspectiveFovLH(XMConvertToRadians(90), 16.0f / 9.0f, 0.01f, 1000.0f));
+		frusta[v] = ExtractFrustum(viewProjection);
+	}
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	double msPerTick = 1000.0 / (double)frequency.QuadPart;
+
+	std::vector<UINT> visible;
+	std::vector<BYTE> viewMasks;
+	visible.reserve(count);
+	viewMasks.reserve(count);
+
+	// one untimed pass so neither timing pays for the first walk over the nodes
+	bvh.CullFrusta(frusta.data(), viewCount, visible, viewMasks);
+
+	QueryPerformanceCounter(&start);
+	bvh.CullFrusta(frusta.data(), viewCount, visible, viewMasks);
+	QueryPerformanceCounter(&end);
+	sharedMs = (end.QuadPart - start.QuadPart) * msPerTick;
+
+	QueryPerformanceCounter(&start);
+	for (UINT v = 0; v < viewCount; v++) bvh.CullFrustum(frusta[v], visible);
+	QueryPerformanceCounter(&end);
+	separateMs = (end.QuadPart - start.QuadPart) * msPerTick;
+}
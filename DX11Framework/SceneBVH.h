@@ -0,0 +1,110 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "FrustumCuller.h"
+
+using namespace DirectX;
+
+struct AABB
+{
+	XMFLOAT3 m_min;
+	XMFLOAT3 m_max;
+};
+
+// box around a sphere given as centre and radius
+AABB SphereToAABB(const XMFLOAT4& sphere);
+
+/// one node of SceneBVH. every node covers m_count objects from m_first in the BVH's object order, so a subtree's
+/// objects are one contiguous run. a leaf has no children, otherwise the children are m_left and m_left + 1
+struct BVHNode
+{
+	XMFLOAT3 m_min;
+	UINT m_first;
+	XMFLOAT3 m_max;
+	UINT m_count;
+	UINT m_left; // 0 for a leaf, the root is never anyone's child
+};
+
+// an object's frustum test and how long it holds, see ClassifyObjects
+struct ObjectVisibility
+{
+	float m_margin; // how far the planes can move towards or away from the box before the result can change
+	float m_reach; // distance from the eye to the farthest point of the box
+	bool m_visible;
+};
+
+/// bounding volume hierarchy over object boxes. Build splits with a binned surface area heuristic, objects that move
+/// afterwards go through UpdateBounds, which refits the boxes from the object's leaf up to where they stop changing.
+/// the tree's shape is kept, so it suits a mostly static scene with a few objects moving about their build position.
+/// queries keep their traversal stack in the BVH, so they run one at a time
+class SceneBVH
+{
+public:
+	static const UINT MAX_VIEWS = 8; // views are bits of a BYTE mask in CullFrusta
+
+private:
+	static const UINT MAX_LEAF_OBJECTS = 4;
+	static const UINT SAH_BINS = 16;
+
+	std::vector<BVHNode> m_nodes; // children always come after their parent
+	std::vector<UINT> m_parents;
+	std::vector<UINT> m_objects; // object ids in leaf order
+	std::vector<UINT> m_objectLeaf; // leaf node of each object id
+	std::vector<AABB> m_bounds; // by object id
+
+	struct StackEntry
+	{
+		UINT m_node;
+		UINT m_planeMask; // frustum planes the node is not yet known to be inside
+		float m_distance; // ray entry distance
+	};
+	std::vector<StackEntry> m_stack;
+
+	struct ViewStackEntry
+	{
+		UINT m_node;
+		UINT m_viewMask; // views that may still see the node
+		UINT m_insideMask; // views the node is known to be fully inside
+	};
+	std::vector<ViewStackEntry> m_viewStack;
+
+	// the same plane of four views in each vector, so one step tests a box against that plane in all four
+	struct ViewPlanes
+	{
+		XMVECTOR m_x[MAX_VIEWS / 4][6];
+		XMVECTOR m_y[MAX_VIEWS / 4][6];
+		XMVECTOR m_z[MAX_VIEWS / 4][6];
+		XMVECTOR m_w[MAX_VIEWS / 4][6];
+		XMVECTOR m_absX[MAX_VIEWS / 4][6]; // normal magnitudes, how far a box's extent reaches along each normal
+		XMVECTOR m_absY[MAX_VIEWS / 4][6];
+		XMVECTOR m_absZ[MAX_VIEWS / 4][6];
+		UINT m_groups;
+	};
+	static void ClassifyBoxViews(const ViewPlanes& planes, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, UINT& viewMask, UINT& insideMask);
+
+	void FitNode(UINT node);
+	void Split(UINT node, std::vector<XMFLOAT3>& centroids);
+
+public:
+	void Build(const AABB* bounds, UINT count);
+	void UpdateBounds(UINT object, const AABB& bounds);
+
+	// for moving many objects at once, set each one's bounds and then Refit the whole tree in one pass
+	void SetBounds(UINT object, const AABB& bounds) { m_bounds[object] = bounds; }
+	void Refit();
+
+	UINT GetObjectCount() { return (UINT)m_bounds.size(); }
+	UINT GetNodeCount() { return (UINT)m_nodes.size(); }
+	const AABB& GetBounds(UINT object) { return m_bounds[object]; }
+
+	void CullFrustum(const Frustum& frustum, std::vector<UINT>& visible);
+	void CullFrusta(const Frustum* frusta, UINT viewCount, std::vector<UINT>& visible, std::vector<BYTE>& viewMasks);
+	void ClassifyObjects(const Frustum& frustum, const XMFLOAT3& eye, std::vector<ObjectVisibility>& objects);
+	ObjectVisibility ClassifyObject(const Frustum& frustum, const XMFLOAT3& eye, UINT object);
+	bool Raycast(const XMFLOAT3& origin, const XMFLOAT3& direction, float maxDistance, UINT& object, float& distance);
+	void QuerySphere(const XMFLOAT3& centre, float radius, std::vector<UINT>& objects);
+
+	static void Benchmark(UINT count, double& buildMs, double& refitMs, double& cullMs);
+	static void BenchmarkViews(UINT count, UINT viewCount, double& sharedMs, double& separateMs);
+};
@@ -0,0 +1,246 @@
+#include "ShaderCache.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+/// <summary>
+/// 64 bit FNV-1a over size bytes
+/// </summary>
+/// <param name="data"></param>
+/// <param name="size"></param>
+/// <param name="hash">FNV_OFFSET_BASIS to start, or a previous result to continue</param>
+/// <returns></returns>
+UINT64 HashFnv1a(const void* data, size_t size, UINT64 hash) {
+	const BYTE* bytes = (const BYTE*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/// <summary>
+/// hash a file's bytes, then every file it includes, resolved against the including file's folder the way
+/// D3D_COMPILE_STANDARD_FILE_INCLUDE does. a missing file still changes the hash so it never matches a good build
+/// </summary>
+/// <param name="file"></param>
+/// <param name="hash"></param>
+/// <param name="visited">files already hashed, include guards mean a file only counts once</param>
+/// <returns></returns>
+UINT64 ShaderCache::HashFileAndIncludes(const std::wstring& file, UINT64 hash, std::vector<std::wstring>& visited) {
+	for (const std::wstring& seen : visited)
+	{
+		if (seen == file) return hash;
+	}
+	visited.push_back(file);
+
+	hash = HashFnv1a(file.data(), file.size() * sizeof(wchar_t), hash);
+
+	std::ifstream stream(file, std::ios::binary);
+	if (!stream) {
+		const char missing[] = "missing";
+		return HashFnv1a(missing, sizeof(missing), hash);
+	}
+
+	std::stringstream contents;
+	contents << stream.rdbuf();
+	std::string source = contents.str();
+	hash = HashFnv1a(source.data(), source.size(), hash);
+
+	std::wstring folder;
+	size_t slash = file.find_last_of(L"\\/");
+	if (slash != std::wstring::npos) folder = file.substr(0, slash + 1);
+
+	std::istringstream lines(source);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		size_t directive = line.find("#include");
+		if (directive == std::string::npos) continue;
+
+		size_t open = line.find_first_of("\"<", directive);
+		if (open == std::string::npos) continue;
+		size_t close = line.find_first_of("\">", open + 1);
+		if (close == std::string::npos) continue;
+
+		std::string name = line.substr(open + 1, close - open - 1);
+		hash = HashFileAndIncludes(folder + std::wstring(name.begin(), name.end()), hash, visited);
+	}
+
+	return hash;
+}
+
+/// <summary>
+/// name=value pairs in order, the terminator after each keeps "AB"="" and "A"="B" apart
+/// </summary>
+/// <param name="source"></param>
+/// <param name="hash"></param>
+/// <returns></returns>
+UINT64 ShaderCache::HashDefines(const ShaderSource& source, UINT64 hash) {
+	for (const std::pair<std::string, std::string>& define : source.m_defines)
+	{
+		hash = HashFnv1a(define.first.c_str(), define.first.size() + 1, hash);
+		hash = HashFnv1a(define.second.c_str(), define.second.size() + 1, hash);
+	}
+	return hash;
+}
+
+/// <summary>
+/// everything that changes the bytecode, source and includes, entry point, profile, defines, flags and compiler version
+/// </summary>
+/// <param name="source"></param>
+/// <param name="flags"></param>
+/// <returns></returns>
+UINT64 ShaderCache::ComputeKey(const ShaderSource& source, UINT flags) {
+	std::vector<std::wstring> visited;
+	UINT64 key = HashFileAndIncludes(source.m_file, FNV_OFFSET_BASIS, visited);
+
+	key = HashFnv1a(source.m_entryPoint.data(), source.m_entryPoint.size(), key);
+	key = HashFnv1a(source.m_profile.data(), source.m_profile.size(), key);
+	key = HashDefines(source, key);
+	key = HashFnv1a(&flags, sizeof(flags), key);
+
+	UINT compilerVersion = D3D_COMPILER_VERSION;
+	return HashFnv1a(&compilerVersion, sizeof(compilerVersion), key);
+}
+
+std::wstring ShaderCache::GetCachePath(const ShaderSource& source) {
+	std::wstring name = source.m_file;
+	size_t slash = name.find_last_of(L"\\/");
+	if (slash != std::wstring::npos) name = name.substr(slash + 1);
+
+	name = m_directory + L"\\" + name + L"." + std::wstring(source.m_entryPoint.begin(), source.m_entryPoint.end())
+		+ L"." + std::wstring(source.m_profile.begin(), source.m_profile.end());
+
+	// permutations of one entry point need their own files or they would keep evicting each other
+	if (!source.m_defines.empty()) {
+		wchar_t defines[20];
+		swprintf_s(defines, L".%016llx", HashDefines(source, FNV_OFFSET_BASIS));
+		name += defines;
+	}
+
+	return name + L".cso";
+}
+
+/// <summary>
+/// read a cache file, anything off about it (missing, old format, different key, bad length or hash) counts as stale
+/// </summary>
+/// <param name="path"></param>
+/// <param name="key"></param>
+/// <param name="bytecode"></param>
+/// <returns>true with bytecode set when the file is valid for key</returns>
+bool ShaderCache::Load(const std::wstring& path, UINT64 key, ID3DBlob** bytecode) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return false;
+
+	FileHeader header = {};
+	if (!file.read((char*)&header, sizeof(header))) return false;
+	if (header.m_magic != FILE_MAGIC || header.m_version != FILE_VERSION || header.m_key != key || header.m_bytecodeSize == 0) return false;
+
+	ID3DBlob* blob;
+	if (FAILED(D3DCreateBlob(header.m_bytecodeSize, &blob))) return false;
+
+	if (!file.read((char*)blob->GetBufferPointer(), header.m_bytecodeSize)
+		|| HashFnv1a(blob->GetBufferPointer(), header.m_bytecodeSize) != header.m_bytecodeHash) {
+		blob->Release();
+		return false;
+	}
+
+	*bytecode = blob;
+	return true;
+}
+
+/// <summary>
+/// write bytecode under key, through a temporary file so a crash mid write never leaves a file that looks valid
+/// </summary>
+/// <param name="path"></param>
+/// <param name="key"></param>
+/// <param name="bytecode"></param>
+void ShaderCache::Store(const std::wstring& path, UINT64 key, ID3DBlob* bytecode) {
+	FileHeader header = {};
+	header.m_magic = FILE_MAGIC;
+	header.m_version = FILE_VERSION;
+	header.m_key = key;
+	header.m_bytecodeSize = (UINT)bytecode->GetBufferSize();
+	header.m_bytecodeHash = HashFnv1a(bytecode->GetBufferPointer(), header.m_bytecodeSize);
+
+	std::wstring temporary = path + L".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file) return;
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)bytecode->GetBufferPointer(), header.m_bytecodeSize);
+		if (!file) return;
+	}
+
+	MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+/// <summary>
+/// fill in every source's bytecode, from the cache where its file is valid, otherwise compiled on as many threads
+/// as there are misses (up to the hardware thread count) and written back to the cache
+/// </summary>
+/// <param name="sources"></param>
+/// <param name="count"></param>
+/// <param name="flags">D3DCOMPILE_ flags, part of the key</param>
+/// <returns>the first failing source's result, S_OK when everything has bytecode</returns>
+HRESULT ShaderCache::Compile(ShaderSource* sources, UINT count, UINT flags) {
+	CreateDirectoryW(m_directory.c_str(), nullptr); // fails harmlessly when it already exists
+
+	std::vector<UINT64> keys(count);
+	std::vector<UINT> misses;
+
+	for (UINT i = 0; i < count; i++)
+	{
+		keys[i] = ComputeKey(sources[i], flags);
+
+		sources[i].m_fromCache = Load(GetCachePath(sources[i]), keys[i], &sources[i].m_bytecode);
+		if (sources[i].m_fromCache) sources[i].m_result = S_OK;
+		else misses.push_back(i);
+	}
+
+	if (!misses.empty()) {
+		// compile times vary a lot between entry points, so threads pull the next miss rather than taking a band
+		std::atomic<UINT> next(0);
+		auto compileMisses = [this, sources, flags, &keys, &misses, &next]() {
+			for (UINT m = next++; m < misses.size(); m = next++)
+			{
+				ShaderSource& source = sources[misses[m]];
+				ID3DBlob* errorBlob = nullptr;
+
+				std::vector<D3D_SHADER_MACRO> macros;
+				for (const std::pair<std::string, std::string>& define : source.m_defines)
+				{
+					macros.push_back({ define.first.c_str(), define.second.c_str() });
+				}
+				macros.push_back({ nullptr, nullptr });
+
+				source.m_result = D3DCompileFromFile(source.m_file.c_str(), macros.data(), D3D_COMPILE_STANDARD_FILE_INCLUDE,
+					source.m_entryPoint.c_str(), source.m_profile.c_str(), flags, 0, &source.m_bytecode, &errorBlob);
+
+				if (errorBlob) {
+					source.m_errors.assign((const char*)errorBlob->GetBufferPointer(), errorBlob->GetBufferSize());
+					errorBlob->Release();
+				}
+
+				if (SUCCEEDED(source.m_result)) Store(GetCachePath(source), keys[misses[m]], source.m_bytecode);
+			}
+		};
+
+		UINT threadCount = min((UINT)misses.size(), max(1u, std::thread::hardware_concurrency()));
+		std::vector<std::thread> workers;
+		for (UINT t = 0; t + 1 < threadCount; t++) workers.emplace_back(compileMisses);
+		compileMisses();
+
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	for (UINT i = 0; i < count; i++)
+	{
+		if (FAILED(sources[i].m_result)) return sources[i].m_result;
+	}
+	return S_OK;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <windows.h>
+#include <d3d11_4.h>
+#include <d3dcompiler.h>
+#include <string>
+#include <vector>
+
+// 64 bit FNV-1a, continue a hash by passing the previous result back in
+static const UINT64 FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+UINT64 HashFnv1a(const void* data, size_t size, UINT64 hash = FNV_OFFSET_BASIS);
+
+/// one entry point to compile, the cache fills in the result fields
+struct ShaderSource
+{
+	std::wstring m_file;
+	std::string m_entryPoint;
+	std::string m_profile;
+	std::vector<std::pair<std::string, std::string>> m_defines; // preprocessor name and value, one set per permutation
+
+	ID3DBlob* m_bytecode = nullptr; // caller releases
+	std::string m_errors;
+	HRESULT m_result = E_FAIL;
+	bool m_fromCache = false;
+};
+
+/// compiled bytecode on disk, one file per file/entry point/profile/define set. each file's header carries a key hashed from the
+/// source, every file it includes, the entry point, profile, defines, flags and compiler version, so an edit anywhere makes the
+/// file stale and it is recompiled and overwritten. misses compile in parallel, a warm start never calls the compiler
+class ShaderCache
+{
+private:
+	struct FileHeader
+	{
+		UINT m_magic;
+		UINT m_version;
+		UINT64 m_key;
+		UINT64 m_bytecodeHash; // catches truncated or corrupted files
+		UINT m_bytecodeSize;
+		UINT m_reserved;
+	};
+
+	static const UINT FILE_MAGIC = 0x43534844; // "DHSC"
+	static const UINT FILE_VERSION = 1;
+
+	std::wstring m_directory;
+
+	std::wstring GetCachePath(const ShaderSource& source);
+	bool Load(const std::wstring& path, UINT64 key, ID3DBlob** bytecode);
+	void Store(const std::wstring& path, UINT64 key, ID3DBlob* bytecode);
+
+	static UINT64 HashFileAndIncludes(const std::wstring& file, UINT64 hash, std::vector<std::wstring>& visited);
+	static UINT64 HashDefines(const ShaderSource& source, UINT64 hash);
+
+public:
+	ShaderCache(const std::wstring& directory = L"ShaderCache") : m_directory(directory) {}
+
+	HRESULT Compile(ShaderSource* sources, UINT count, UINT flags);
+
+	static UINT64 ComputeKey(const ShaderSource& source, UINT flags);
+};
@@ -30,23 +30,31 @@ struct Fog
     float m_range;
 };
 
-cbuffer ConstantBuffer : register(b0)
+cbuffer FrameBuffer : register(b0)
 {
     float4x4 Projection;
     float4x4 View;
-    float4x4 World;
-    float4 DiffuseMaterial;
-    float4 AmbientMaterial;
-    float4 SpecularMaterial;
     DirectionalLight DirLight;
     PointLight PtLight;
-    uint HasTexture;
     float3 EyePosW;
+    uint FogEnabled;
     Fog FogW;
+}
+
+cbuffer MaterialBuffer : register(b1)
+{
+    float4 DiffuseMaterial;
+    float4 AmbientMaterial;
+    float4 SpecularMaterial;
+    uint HasTexture;
     uint SpecMap;
     uint NormMap;
     float SpecularPower;
-    uint FogEnabled;
+}
+
+cbuffer ObjectBuffer : register(b2)
+{
+    float4x4 World;
 }
 
 struct VS_Out
@@ -85,18 +93,64 @@ VS_Out VS_main(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoo
     return output;
 }
 
+// per instance world matrix from input slot 1. normals leave in world space and World is set to identity for
+// instanced draws, so PS_main's transform by World leaves them alone
+VS_Out VS_instanced(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoord : TEXCOORD, float3 Tangent : TANGENT,
+    float4 InstanceRow0 : INSTANCEWORLD0, float4 InstanceRow1 : INSTANCEWORLD1, float4 InstanceRow2 : INSTANCEWORLD2, float4 InstanceRow3 : INSTANCEWORLD3)
+{
+    VS_Out output = (VS_Out) 0;
+    
+    float4x4 InstanceWorld = float4x4(InstanceRow0, InstanceRow1, InstanceRow2, InstanceRow3);
+    
+    output.texcoord = TexCoord;
+    
+    output.position = mul(float4(Position, 1.0f), InstanceWorld);
+    output.WorldPos = output.position;
+    
+    output.normal = normalize(mul(float4(Normal, 0), InstanceWorld).xyz);
+    output.Tangent = mul(float4(Tangent, 0), InstanceWorld).xyz;
+    
+    output.EyePos = EyePosW;
+    output.LightPosPoint = PtLight.m_position;
+    
+    output.position = mul(output.position, View);
+    output.position = mul(output.position, Projection);
+    
+    return output;
+}
+
+// PS_main is compiled per permutation, DX11Framework picks the variant from the material flags and fog state.
+// features that are off are compiled out, so they cost no samples and no branches
+#ifndef HAS_TEXTURE
+#define HAS_TEXTURE 0
+#endif
+#ifndef SPEC_MAP
+#define SPEC_MAP 0
+#endif
+#ifndef NORM_MAP
+#define NORM_MAP 0
+#endif
+#ifndef FOG_ENABLED
+#define FOG_ENABLED 0
+#endif
+
 float4 PS_main(VS_Out input) : SV_TARGET
 {
+#if HAS_TEXTURE
     float4 texColor = diffuseTex.Sample(bilinerSampler, input.texcoord); // replaces ambient and diffuse mat
-    float4 texSpec = specularTex.Sample(bilinerSampler, input.texcoord);
-    float3 texNorm = normalTex.Sample(bilinerSampler, input.texcoord);
     
     clip(texColor.a - 0.1f);
-    
-    texNorm = (texNorm * 2.0f) - 1.0f;
+#endif
+#if SPEC_MAP
+    float4 texSpec = specularTex.Sample(bilinerSampler, input.texcoord);
+#endif
     
     float3 WorldNorm = normalize(mul(float4(normalize(input.normal), 0), World));
     
+#if NORM_MAP
+    float3 texNorm = normalTex.Sample(bilinerSampler, input.texcoord);
+    texNorm = (texNorm * 2.0f) - 1.0f;
+    
     // use TBN to move from tangent space (normal map) into world space
     float3 Tangent = input.Tangent - dot(input.Tangent, WorldNorm) * WorldNorm;
     float3 biTangent = cross(WorldNorm, Tangent);
@@ -107,29 +161,19 @@ float4 PS_main(VS_Out input) : SV_TARGET
     float3 TexWorldNorm = normalize(mul(texNorm, TBN)); // tangent space -> model space
     TexWorldNorm = normalize(mul(float4(TexWorldNorm, 0), World)); // model space -> world space
     
+    float3 LightNorm = TexWorldNorm;
+#else
+    float3 LightNorm = WorldNorm;
+#endif
+    
     float4 diffuse = float4(0.0f, 0.0f, 0.0f, 0.0f);
     float4 ambient = float4(0.0f, 0.0f, 0.0f, 0.0f);
     float4 specular = float4(0.0f, 0.0f, 0.0f, 0.0f);
     
-    float DiffuseAmount;
-    float3 Reflect;
-    
     // normalize both vectors before dot
     // a dot b = cos angle between a and b
-    
-    if (NormMap == 1)
-    {
-        DiffuseAmount = saturate(dot(normalize(DirLight.m_direction), TexWorldNorm));
-
-        Reflect = reflect(normalize(-DirLight.m_direction), TexWorldNorm);
-    }
-    else
-    {
-        DiffuseAmount = saturate(dot(normalize(DirLight.m_direction), WorldNorm));
-
-        Reflect = reflect(normalize(-DirLight.m_direction), WorldNorm);
-    }
-    
+    float DiffuseAmount = saturate(dot(normalize(DirLight.m_direction), LightNorm));
+    float3 Reflect = reflect(normalize(-DirLight.m_direction), LightNorm);
     
     float3 ViewV = input.EyePos - input.WorldPos; // object to camera, 
     
@@ -140,26 +184,19 @@ float4 PS_main(VS_Out input) : SV_TARGET
     
     float dotViewReflect = dot(Reflect, ViewV);
     
-    if (HasTexture == 1)
-    {
-        diffuse = DiffuseAmount * (DirLight.m_diffuseColor * texColor);
-        ambient = DirLight.m_ambientColor * texColor;
-    }
-    else
-    {
-        diffuse = DiffuseAmount * (DirLight.m_diffuseColor * DiffuseMaterial);
-        ambient = DirLight.m_ambientColor * AmbientMaterial;
-    }
-    
+#if HAS_TEXTURE
+    diffuse = DiffuseAmount * (DirLight.m_diffuseColor * texColor);
+    ambient = DirLight.m_ambientColor * texColor;
+#else
+    diffuse = DiffuseAmount * (DirLight.m_diffuseColor * DiffuseMaterial);
+    ambient = DirLight.m_ambientColor * AmbientMaterial;
+#endif
     
-    if (SpecMap == 1)
-    {
-        specular = texSpec * SpecularMaterial * pow(saturate(dotViewReflect), SpecularPower);
-    }
-    else
-    {
-        specular = DirLight.m_specularColor * SpecularMaterial * pow(saturate(dotViewReflect), SpecularPower);
-    }
+#if SPEC_MAP
+    specular = texSpec * SpecularMaterial * pow(saturate(dotViewReflect), SpecularPower);
+#else
+    specular = DirLight.m_specularColor * SpecularMaterial * pow(saturate(dotViewReflect), SpecularPower);
+#endif
     
     // do point light in range check
     float3 lightVector = PtLight.m_position - input.WorldPos;
@@ -172,46 +209,26 @@ float4 PS_main(VS_Out input) : SV_TARGET
         float4 pDiffuse;
         float4 pSpecular;
         
-        float DiffuseAmountPt;
-        float3 Ref;
-        float SpecFactor;
+        float SpecFactor = 0.0f;
         
-        if (NormMap == 1)
+        float DiffuseAmountPt = saturate(dot(lightVector, LightNorm));
+        if (DiffuseAmountPt > 0.0f)
         {
-            DiffuseAmountPt = saturate(dot(lightVector, TexWorldNorm));
-            if (DiffuseAmountPt > 0.0f)
-            {
-                Ref = reflect(-lightVector, TexWorldNorm);
-                SpecFactor = pow(saturate(dot(Ref, ViewV)), SpecularPower);
-            }
-        }
-        else
-        {
-            DiffuseAmountPt = saturate(dot(lightVector, WorldNorm));
-            if (DiffuseAmountPt > 0.0f)
-            {
-                Ref = reflect(-lightVector, WorldNorm);
-                SpecFactor = pow(saturate(dot(Ref, ViewV)), SpecularPower);
-            }
+            float3 Ref = reflect(-lightVector, LightNorm);
+            SpecFactor = pow(saturate(dot(Ref, ViewV)), SpecularPower);
         }
         
-        if (HasTexture == 1)
-        {
-            pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * texColor);
-        }
-        else
-        {
-            pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * DiffuseMaterial);
-        }
+#if HAS_TEXTURE
+        pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * texColor);
+#else
+        pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * DiffuseMaterial);
+#endif
 
-        if (SpecMap == 1)
-        {
-            pSpecular = texSpec * SpecularMaterial * SpecFactor;
-        }
-        else
-        {
-            pSpecular = PtLight.m_specularColor * SpecularMaterial * SpecFactor;
-        }
+#if SPEC_MAP
+        pSpecular = texSpec * SpecularMaterial * SpecFactor;
+#else
+        pSpecular = PtLight.m_specularColor * SpecularMaterial * SpecFactor;
+#endif
         
         float attenuation = 1.0f / dot(PtLight.m_attenuation, float3(1.0f, dist, dist * dist));
         
@@ -224,13 +241,11 @@ float4 PS_main(VS_Out input) : SV_TARGET
     
     input.color = diffuse + ambient + specular;
     
-    if (FogEnabled)
-    {
-        float fogLerp = saturate((distToEye - FogW.m_start) / FogW.m_range);
-    
-        input.color = lerp(input.color, FogW.m_color, fogLerp);
-    }
+#if FOG_ENABLED
+    float fogLerp = saturate((distToEye - FogW.m_start) / FogW.m_range);
     
+    input.color = lerp(input.color, FogW.m_color, fogLerp);
+#endif
     
     return input.color;
-}
\ No newline at end of file
+}
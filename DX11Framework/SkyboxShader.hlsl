@@ -28,23 +28,31 @@ struct Fog
     float m_range;
 };
 
-cbuffer ConstantBuffer : register(b0)
+cbuffer FrameBuffer : register(b0)
 {
     float4x4 Projection;
     float4x4 View;
-    float4x4 World;
-    float4 DiffuseMaterial;
-    float4 AmbientMaterial;
-    float4 SpecularMaterial;
     DirectionalLight DirLight;
     PointLight PtLight;
-    uint HasTexture;
     float3 EyePosW;
+    uint FogEnabled;
     Fog FogW;
+}
+
+cbuffer MaterialBuffer : register(b1)
+{
+    float4 DiffuseMaterial;
+    float4 AmbientMaterial;
+    float4 SpecularMaterial;
+    uint HasTexture;
     uint SpecMap;
     uint NormMap;
     float SpecularPower;
-    uint FogEnabled;
+}
+
+cbuffer ObjectBuffer : register(b2)
+{
+    float4x4 World;
 }
 
 struct SkyboxVS_Out
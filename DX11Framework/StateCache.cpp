@@ -0,0 +1,71 @@
+#include "StateCache.h"
+
+/// stands in for a device context, counts the calls the cache passes on and never dereferences what it is given
+struct MockStateContext
+{
+	UINT m_calls = 0;
+
+	void VSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) { ++m_calls; }
+	void HSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) { ++m_calls; }
+	void DSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) { ++m_calls; }
+	void PSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) { ++m_calls; }
+	void OMSetBlendState(ID3D11BlendState*, const FLOAT*, UINT) { ++m_calls; }
+};
+
+/// <summary>
+/// binds through a StateCacheT over a mock context and checks, after every step, the calls that reached the context
+/// against the issued count and both counts against ones worked by hand: the same view twice is one issued and one
+/// elided, other stages and slots are shadowed apart, slots past the shadowed ones always go through, Invalidate
+/// forgets everything and a null blend factor matches an all ones one
+/// </summary>
+/// <param name="stepCount">worked steps checked</param>
+/// <returns>true when every step matches</returns>
+bool CheckStateCache(UINT& stepCount) {
+	ID3D11ShaderResourceView* first = (ID3D11ShaderResourceView*)(UINT_PTR)0x10;
+	ID3D11ShaderResourceView* second = (ID3D11ShaderResourceView*)(UINT_PTR)0x20;
+	ID3D11BlendState* blend = (ID3D11BlendState*)(UINT_PTR)0x30;
+	const FLOAT ones[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	MockStateContext context;
+	StateCacheT<MockStateContext> cache;
+	cache.SetContext(&context);
+	cache.BeginFrame();
+
+	bool matches = true;
+	UINT steps = 0;
+	auto expect = [&](UINT issued, UINT elided) {
+		if (cache.GetIssuedCalls() != issued || cache.GetElidedCalls() != elided || context.m_calls != issued) matches = false;
+		++steps;
+	};
+
+	cache.SetShaderResource(ShaderStage::Pixel, 0, first);
+	expect(1, 0);
+	cache.SetShaderResource(ShaderStage::Pixel, 0, first); // already bound
+	expect(1, 1);
+	cache.SetShaderResource(ShaderStage::Vertex, 0, first); // same slot, another stage
+	expect(2, 1);
+	cache.SetShaderResource(ShaderStage::Pixel, 0, second);
+	expect(3, 1);
+	cache.SetShaderResource(ShaderStage::Pixel, 0, nullptr); // unbinding is a change too
+	expect(4, 1);
+	cache.SetShaderResource(ShaderStage::Pixel, 20, first); // not shadowed, issued both times
+	cache.SetShaderResource(ShaderStage::Pixel, 20, first);
+	expect(6, 1);
+
+	cache.Invalidate();
+	cache.SetShaderResource(ShaderStage::Vertex, 0, first);
+	expect(7, 1);
+
+	cache.SetBlendState(blend, nullptr, 0xffffffff);
+	cache.SetBlendState(blend, ones, 0xffffffff); // what d3d does with a null factor
+	expect(8, 2);
+
+	// counts restart with the frame, the shadowed state carries over
+	cache.BeginFrame();
+	context.m_calls = 0;
+	cache.SetBlendState(blend, ones, 0xffffffff);
+	expect(0, 1);
+
+	stepCount = steps;
+	return matches;
+}
@@ -0,0 +1,244 @@
+#pragma once
+#include <windows.h>
+#include <d3d11_4.h>
+
+enum class ShaderStage
+{
+	Vertex,
+	Hull,
+	Domain,
+	Pixel,
+	Count
+};
+
+/// shadows the pipeline state bound through it and drops calls that would not change anything.
+/// templated on the context so a mock exposing the same methods can stand in for ID3D11DeviceContext1.
+/// anything bound straight on the context behind its back needs an Invalidate afterwards
+template<typename Context>
+class StateCacheT
+{
+private:
+	static const UINT MAX_SHADOWED_SRVS = 16; // higher slots are always issued
+	static const UINT MAX_SHADOWED_BUFFERS = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT;
+	static const UINT MAX_SHADOWED_SAMPLERS = D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT;
+	static const UINT STAGE_COUNT = (UINT)ShaderStage::Count;
+	static const UINT MAX_SHADOWED_VERTEX_BUFFERS = 4; // per vertex and per instance streams
+
+	template<typename T>
+	struct Shadow
+	{
+		bool m_known = false;
+		T m_value = {};
+
+		// true when value differs from what is bound, and records it as bound
+		bool Update(const T& value) {
+			if (m_known && m_value == value) return false;
+			m_known = true;
+			m_value = value;
+			return true;
+		}
+	};
+
+	struct VertexBufferBinding
+	{
+		ID3D11Buffer* m_buffer;
+		UINT m_stride;
+		UINT m_offset;
+		bool operator==(const VertexBufferBinding& other) const { return m_buffer == other.m_buffer && m_stride == other.m_stride && m_offset == other.m_offset; }
+	};
+
+	struct ConstantBufferBinding
+	{
+		ID3D11Buffer* m_buffer;
+		UINT m_firstConstant; // 0 and 0 is the whole buffer bound without offsets
+		UINT m_numConstants;
+		bool operator==(const ConstantBufferBinding& other) const { return m_buffer == other.m_buffer && m_firstConstant == other.m_firstConstant && m_numConstants == other.m_numConstants; }
+	};
+
+	struct IndexBufferBinding
+	{
+		ID3D11Buffer* m_buffer;
+		DXGI_FORMAT m_format;
+		UINT m_offset;
+		bool operator==(const IndexBufferBinding& other) const { return m_buffer == other.m_buffer && m_format == other.m_format && m_offset == other.m_offset; }
+	};
+
+	struct BlendBinding
+	{
+		ID3D11BlendState* m_state;
+		FLOAT m_factor[4];
+		UINT m_mask;
+		bool operator==(const BlendBinding& other) const { return m_state == other.m_state && memcmp(m_factor, other.m_factor, sizeof(m_factor)) == 0 && m_mask == other.m_mask; }
+	};
+
+	struct DepthBinding
+	{
+		ID3D11DepthStencilState* m_state;
+		UINT m_stencilRef;
+		bool operator==(const DepthBinding& other) const { return m_state == other.m_state && m_stencilRef == other.m_stencilRef; }
+	};
+
+	Context* m_context = nullptr;
+
+	Shadow<ID3D11VertexShader*> m_vertexShader;
+	Shadow<ID3D11HullShader*> m_hullShader;
+	Shadow<ID3D11DomainShader*> m_domainShader;
+	Shadow<ID3D11PixelShader*> m_pixelShader;
+
+	Shadow<ID3D11InputLayout*> m_inputLayout;
+	Shadow<D3D11_PRIMITIVE_TOPOLOGY> m_topology;
+	Shadow<VertexBufferBinding> m_vertexBuffers[MAX_SHADOWED_VERTEX_BUFFERS];
+	Shadow<IndexBufferBinding> m_indexBuffer;
+
+	Shadow<ID3D11ShaderResourceView*> m_srvs[STAGE_COUNT][MAX_SHADOWED_SRVS];
+	Shadow<ConstantBufferBinding> m_constantBuffers[STAGE_COUNT][MAX_SHADOWED_BUFFERS];
+	Shadow<ID3D11SamplerState*> m_samplers[STAGE_COUNT][MAX_SHADOWED_SAMPLERS];
+
+	Shadow<ID3D11RasterizerState*> m_rasterizer;
+	Shadow<BlendBinding> m_blend;
+	Shadow<DepthBinding> m_depth;
+
+	UINT m_issued = 0;
+	UINT m_elided = 0;
+
+	bool Count(bool changed) {
+		if (changed) ++m_issued; else ++m_elided;
+		return changed;
+	}
+
+public:
+	void SetContext(Context* context) { m_context = context; Invalidate(); }
+	Context* GetContext() { return m_context; }
+
+	/// <summary>
+	/// forgets everything, the next call for each piece of state is always issued
+	/// </summary>
+	void Invalidate() {
+		m_vertexShader.m_known = m_hullShader.m_known = m_domainShader.m_known = m_pixelShader.m_known = false;
+		m_inputLayout.m_known = m_topology.m_known = m_indexBuffer.m_known = false;
+		for (UINT i = 0; i < MAX_SHADOWED_VERTEX_BUFFERS; ++i) m_vertexBuffers[i].m_known = false;
+		m_rasterizer.m_known = m_blend.m_known = m_depth.m_known = false;
+
+		for (UINT stage = 0; stage < STAGE_COUNT; ++stage) {
+			for (UINT i = 0; i < MAX_SHADOWED_SRVS; ++i) m_srvs[stage][i].m_known = false;
+			for (UINT i = 0; i < MAX_SHADOWED_BUFFERS; ++i) m_constantBuffers[stage][i].m_known = false;
+			for (UINT i = 0; i < MAX_SHADOWED_SAMPLERS; ++i) m_samplers[stage][i].m_known = false;
+		}
+	}
+
+	/// <summary>
+	/// starts counting issued and elided calls again, Draw adds them to the frame telemetry
+	/// </summary>
+	void BeginFrame() {
+		m_issued = 0;
+		m_elided = 0;
+	}
+
+	UINT GetIssuedCalls() { return m_issued; }
+	UINT GetElidedCalls() { return m_elided; }
+
+	void SetVertexShader(ID3D11VertexShader* shader) {
+		if (Count(m_vertexShader.Update(shader))) m_context->VSSetShader(shader, nullptr, 0);
+	}
+
+	void SetHullShader(ID3D11HullShader* shader) {
+		if (Count(m_hullShader.Update(shader))) m_context->HSSetShader(shader, nullptr, 0);
+	}
+
+	void SetDomainShader(ID3D11DomainShader* shader) {
+		if (Count(m_domainShader.Update(shader))) m_context->DSSetShader(shader, nullptr, 0);
+	}
+
+	void SetPixelShader(ID3D11PixelShader* shader) {
+		if (Count(m_pixelShader.Update(shader))) m_context->PSSetShader(shader, nullptr, 0);
+	}
+
+	void SetInputLayout(ID3D11InputLayout* layout) {
+		if (Count(m_inputLayout.Update(layout))) m_context->IASetInputLayout(layout);
+	}
+
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) {
+		if (Count(m_topology.Update(topology))) m_context->IASetPrimitiveTopology(topology);
+	}
+
+	void SetVertexBuffer(UINT slot, ID3D11Buffer* buffer, UINT stride, UINT offset) {
+		VertexBufferBinding binding = { buffer, stride, offset };
+		if (slot < MAX_SHADOWED_VERTEX_BUFFERS && !Count(m_vertexBuffers[slot].Update(binding))) return;
+		if (slot >= MAX_SHADOWED_VERTEX_BUFFERS) ++m_issued;
+		m_context->IASetVertexBuffers(slot, 1, &buffer, &stride, &offset);
+	}
+
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) {
+		IndexBufferBinding binding = { buffer, format, offset };
+		if (Count(m_indexBuffer.Update(binding))) m_context->IASetIndexBuffer(buffer, format, offset);
+	}
+
+	void SetShaderResource(ShaderStage stage, UINT slot, ID3D11ShaderResourceView* view) {
+		if (slot < MAX_SHADOWED_SRVS && !Count(m_srvs[(UINT)stage][slot].Update(view))) return;
+		if (slot >= MAX_SHADOWED_SRVS) ++m_issued;
+
+		switch (stage) {
+		case ShaderStage::Vertex: m_context->VSSetShaderResources(slot, 1, &view); break;
+		case ShaderStage::Hull: m_context->HSSetShaderResources(slot, 1, &view); break;
+		case ShaderStage::Domain: m_context->DSSetShaderResources(slot, 1, &view); break;
+		default: m_context->PSSetShaderResources(slot, 1, &view); break;
+		}
+	}
+
+	void SetConstantBuffer(ShaderStage stage, UINT slot, ID3D11Buffer* buffer) {
+		ConstantBufferBinding binding = { buffer, 0, 0 };
+		if (slot >= MAX_SHADOWED_BUFFERS || !Count(m_constantBuffers[(UINT)stage][slot].Update(binding))) return;
+
+		switch (stage) {
+		case ShaderStage::Vertex: m_context->VSSetConstantBuffers(slot, 1, &buffer); break;
+		case ShaderStage::Hull: m_context->HSSetConstantBuffers(slot, 1, &buffer); break;
+		case ShaderStage::Domain: m_context->DSSetConstantBuffers(slot, 1, &buffer); break;
+		default: m_context->PSSetConstantBuffers(slot, 1, &buffer); break;
+		}
+	}
+
+	/// <summary>
+	/// binds numConstants constants of buffer from firstConstant, needs a context with the 11.1 offset binds
+	/// </summary>
+	void SetConstantBufferRange(ShaderStage stage, UINT slot, ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants) {
+		ConstantBufferBinding binding = { buffer, firstConstant, numConstants };
+		if (slot >= MAX_SHADOWED_BUFFERS || !Count(m_constantBuffers[(UINT)stage][slot].Update(binding))) return;
+
+		switch (stage) {
+		case ShaderStage::Vertex: m_context->VSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants); break;
+		case ShaderStage::Hull: m_context->HSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants); break;
+		case ShaderStage::Domain: m_context->DSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants); break;
+		default: m_context->PSSetConstantBuffers1(slot, 1, &buffer, &firstConstant, &numConstants); break;
+		}
+	}
+
+	void SetSampler(ShaderStage stage, UINT slot, ID3D11SamplerState* sampler) {
+		if (slot >= MAX_SHADOWED_SAMPLERS || !Count(m_samplers[(UINT)stage][slot].Update(sampler))) return;
+
+		switch (stage) {
+		case ShaderStage::Vertex: m_context->VSSetSamplers(slot, 1, &sampler); break;
+		case ShaderStage::Hull: m_context->HSSetSamplers(slot, 1, &sampler); break;
+		case ShaderStage::Domain: m_context->DSSetSamplers(slot, 1, &sampler); break;
+		default: m_context->PSSetSamplers(slot, 1, &sampler); break;
+		}
+	}
+
+	void SetRasterizerState(ID3D11RasterizerState* state) {
+		if (Count(m_rasterizer.Update(state))) m_context->RSSetState(state);
+	}
+
+	void SetBlendState(ID3D11BlendState* state, const FLOAT* factor, UINT mask) {
+		BlendBinding binding = { state, { 1.0f, 1.0f, 1.0f, 1.0f }, mask }; // d3d treats a null factor as all ones
+		if (factor) memcpy(binding.m_factor, factor, sizeof(binding.m_factor));
+		if (Count(m_blend.Update(binding))) m_context->OMSetBlendState(state, binding.m_factor, mask);
+	}
+
+	void SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) {
+		DepthBinding binding = { state, stencilRef };
+		if (Count(m_depth.Update(binding))) m_context->OMSetDepthStencilState(state, stencilRef);
+	}
+};
+
+typedef StateCacheT<ID3D11DeviceContext1> StateCache;
+
+bool CheckStateCache(UINT& stepCount);
@@ -29,6 +29,11 @@ struct MeshData
 	UINT m_vBOffset;
 	UINT m_indexCount;
 
+	// local space bounds of the vertex positions, a sphere radius of 0 means the mesh is unbounded
+	XMFLOAT3 m_boundsMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 m_boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	XMFLOAT4 m_boundingSphere = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f); // centre and radius
+
 	void Release() {
 		if(m_vertexBuffer) m_vertexBuffer->Release();
 		if(m_indexBuffer) m_indexBuffer->Release();
@@ -64,31 +69,99 @@ struct Fog {
 	float m_range;
 };
 
+// sample layout of a RAW heightmap file
+enum class HeightMapFormat
+{
+	R8,
+	R16,
+	R32F
+};
+
 struct TerrainInfo
 {
 	std::string m_heightMapFilename;
+	HeightMapFormat m_heightMapFormat = HeightMapFormat::R8;
 	std::string m_layerMapFilenames[5];
 	std::string m_blendMapFilename;
+	std::string m_detailMapFilename; // displacement used when the terrain is tessellated
 	float m_heightScale = 50.0f;
 	UINT m_heightMapWidth;
 	UINT m_heightMapHeight;
+	float m_cellSpacing = 1.0f; // world units between samples
+};
+
+// b3, terrain grid layout, lets the terrain vertex shader rebuild positions and uvs from SV_VertexID
+struct TerrainGridBuffer
+{
+	UINT GridColumns;
+	UINT GridRows;
+	XMFLOAT2 CellSize;
+	XMFLOAT2 Origin; // world x and z of the first vertex
+	float HeightOffset;
+	float HeightRange;
+	XMFLOAT2 TexcoordOffset;
+	XMFLOAT2 TexcoordScale;
+};
+
+// one billboard in the structured buffer BillboardShader.hlsl expands, matches BillboardPoint there
+struct BillboardPoint
+{
+	XMFLOAT3 Position; // quad centre
+	UINT AtlasIndex; // cell of the texture atlas, row major
+	XMFLOAT2 Size; // world width and height
+	XMFLOAT2 padding;
+};
+
+// b3, billboard facing mode and texture atlas layout
+struct BillboardBuffer
+{
+	UINT Facing; // BillboardFacing
+	UINT AtlasColumns;
+	UINT AtlasRows;
+	float padding;
+};
+
+// b4, hull/domain constants, see Tessellation.hlsli
+struct TessellationBuffer
+{
+	float NearDistance;
+	float FarDistance;
+	float MaxFactor;
+	float TargetEdgePixels;
+	float PixelsPerUnit;
+	float DisplacementScale;
+	XMFLOAT2 padding;
 };
 
-struct ConstantBuffer
+// constants split by how often they change, each is only uploaded when its contents differ from the last upload
+
+// b0, once per frame
+struct FrameBuffer
 {
 	XMMATRIX Projection;
 	XMMATRIX View;
-	XMMATRIX World;
-	XMFLOAT4 DiffuseMaterial;
-	XMFLOAT4 AmbientMaterial;
-	XMFLOAT4 SpecularMaterial;
 	DirectionalLight DirectionalLight;
 	PointLight PointLight;
-	u_int HasTexture;
 	XMFLOAT3 EyePosW;
+	UINT FogEnabled;
 	Fog FogW;
+	XMFLOAT2 padding;
+};
+
+// b1, when the surface changes
+struct MaterialBuffer
+{
+	XMFLOAT4 DiffuseMaterial;
+	XMFLOAT4 AmbientMaterial;
+	XMFLOAT4 SpecularMaterial;
+	UINT HasTexture;
 	UINT SpecMap;
 	UINT NormMap;
 	float SpecularPower;
-	UINT FogEnabled;
+};
+
+// b2, per draw
+struct ObjectBuffer
+{
+	XMMATRIX World;
 };
\ No newline at end of file
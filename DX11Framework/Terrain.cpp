@@ -1,4 +1,6 @@
 #include "Terrain.h"
+#include <cmath>
+#include <cfloat>
 
 Terrain::Terrain() {
 	m_terrainInfo.m_layerMapFilenames[0] = "Textures\\lightdirt.dds";
@@ -7,179 +9,701 @@ Terrain::Terrain() {
 	m_terrainInfo.m_layerMapFilenames[3] = "Textures\\stone.dds";
 	m_terrainInfo.m_layerMapFilenames[4] = "Textures\\snow.dds";
 	m_terrainInfo.m_blendMapFilename = "Textures\\Blend.dds";
+	m_terrainInfo.m_detailMapFilename = "Textures\\asphalt_DISP.dds";
 }
 
 Terrain::~Terrain() {
 	for (UINT i = 0; i < (sizeof(m_textures) / sizeof(m_textures[0])); i++) {
-		m_textures[i]->Release();
+		if (m_textures[i]) m_textures[i]->Release();
 	}
 
 	if (m_blend) m_blend->Release();
+	if (m_detail) m_detail->Release();
 
-	if (m_vertexBuffer) m_vertexBuffer->Release();
-	if (m_indexBuffer) m_indexBuffer->Release();
+	if (m_heightBuffer) m_heightBuffer->Release();
+	if (m_heightView) m_heightView->Release();
+	if (m_gridBuffer) m_gridBuffer->Release();
 }
 
 /// <summary>
-/// generates a grid of triangles based on passed in variables, storing in vectors
+/// lays out the grid and packs one height + normal per vertex, positions, uvs and indices are rebuilt in the vertex shader.
+/// a streamed map only lays out a window of it, starting over the middle of the map
 /// </summary>
 /// <param name="width"></param>
 /// <param name="depth"></param>
 /// <param name="columns"></param>
 /// <param name="rows"></param>
 void Terrain::GenGrid(float width, float depth, float columns, float rows) {
-	float halfWidth = width * 0.5f;
-	float halfdepth = depth * 0.5f;
-
-	float dx = width / (columns - 1); // x cell size
-	float dz = depth / (rows - 1); // z cell size
-
-	float du = 1.0f / (columns - 1);
-	float dv = 1.0f / (rows - 1);
-
-	for (UINT i = 0; i < rows; ++i) {
-		float z = halfdepth - (i * dz);
-		for (UINT j = 0; j < columns; ++j) {
-			float x = -halfWidth + (j * dx);
-			// pos, normal, texcoord
-			SimpleVertex vertex;
-			vertex.m_position = XMFLOAT3(x, 0.0f, z);
-			vertex.m_texcoord = XMFLOAT2(j * du, i * dv);
-			m_vertices.push_back(vertex);
-		}
+	m_mapColumns = (UINT)columns;
+	m_mapRows = (UINT)rows;
+	m_cellSizeX = width / (columns - 1); // x cell size
+	m_cellSizeZ = depth / (rows - 1); // z cell size
+	m_mapOriginX = -width * 0.5f;
+	m_mapOriginZ = depth * 0.5f;
+
+	// room for deformation below and above the loaded range
+	m_heightOffset = -m_terrainInfo.m_heightScale;
+	m_heightRange = m_terrainInfo.m_heightScale * 3.0f;
+
+	if (m_streaming) {
+		UINT window = m_streamWindowTiles * HeightTileCache::TILE_CELLS + 1;
+		m_columns = min(m_mapColumns, window);
+		m_rows = min(m_mapRows, window);
+		SetWindow(GetWindowStart((m_mapColumns - 1) * 0.5f, m_mapColumns, m_columns), GetWindowStart((m_mapRows - 1) * 0.5f, m_mapRows, m_rows));
 	}
-
-	for (UINT i = 0; i < m_vertices.size(); ++i) {
-		m_vertices[i].m_position.y = m_heightMapData[i];
+	else {
+		m_columns = m_mapColumns;
+		m_rows = m_mapRows;
+		SetWindow(0, 0);
 	}
 
-	// this is likely why holes appear
-	for (UINT i = 0; i < rows - 1; ++i) {
-		for (UINT j = 0; j < columns - 1; ++j) {
-			// top tri
-			m_indices.push_back(i * columns + j);
-			m_indices.push_back(i * columns + j + 1);
-			m_indices.push_back((i + 1) * columns + j);
+	PackWindow();
+}
+
+/// <summary>
+/// packs every vertex of the window into m_packedVertices
+/// </summary>
+void Terrain::PackWindow() {
+	m_packedVertices.resize(m_columns * m_rows);
 
-			// bottom tri
-			m_indices.push_back(i * columns + j + 1);
-			m_indices.push_back((i + 1) * columns + j + 1);
-			m_indices.push_back((i + 1) * columns + j);
+	for (UINT i = 0; i < m_rows; ++i) {
+		for (UINT j = 0; j < m_columns; ++j) {
+			m_packedVertices[i * m_columns + j] = PackVertex(i, j);
 		}
 	}
+}
 
-	for (UINT i = 0; i < m_indices.size(); i+=3) {
-		XMVECTOR vector1 = XMVectorSet(m_vertices[m_indices[i]].m_position.x, m_vertices[m_indices[i]].m_position.y, m_vertices[m_indices[i]].m_position.z, 0.0f);
-		XMVECTOR vector2 = XMVectorSet(m_vertices[m_indices[i+1]].m_position.x, m_vertices[m_indices[i + 1]].m_position.y, m_vertices[m_indices[i + 1]].m_position.z, 0.0f);
-		XMVECTOR vector3 = XMVectorSet(m_vertices[m_indices[i + 2]].m_position.x, m_vertices[m_indices[i + 2]].m_position.y, m_vertices[m_indices[i + 2]].m_position.z, 0.0f);
+/// <summary>
+/// places the window's first vertex on a map sample, a streamed map then reads the window's heights from its tiles
+/// </summary>
+/// <param name="column0"></param>
+/// <param name="row0"></param>
+void Terrain::SetWindow(UINT column0, UINT row0) {
+	m_windowColumn0 = column0;
+	m_windowRow0 = row0;
+	m_originX = m_mapOriginX + column0 * m_cellSizeX;
+	m_originZ = m_mapOriginZ - row0 * m_cellSizeZ; // rows run towards -z
+
+	if (!m_streaming) return;
+
+	m_heightMapData.assign(m_columns * m_rows, 0.0f); // flat if the file could not be opened, same as LoadHeightMap
+	if (m_tileCache.IsOpen()) m_tileCache.ReadRegion(column0, row0, m_columns, m_rows, m_heightMapData.data(), m_columns);
+}
 
-		// A1, B2, C3
-		XMVECTOR lineAB = XMVectorSubtract(vector2, vector1);
-		XMVECTOR lineAC = XMVectorSubtract(vector3, vector1);
+/// <summary>
+/// first map sample of a window centred as near as whole tiles allow on centre, kept inside the map
+/// </summary>
+/// <param name="centre">map column or row, can be off the map</param>
+/// <param name="mapSamples"></param>
+/// <param name="windowSamples"></param>
+/// <returns></returns>
+UINT Terrain::GetWindowStart(float centre, UINT mapSamples, UINT windowSamples) {
+	float tile = (centre - (windowSamples - 1) * 0.5f) / HeightTileCache::TILE_CELLS;
+	int start = (int)floorf(tile + 0.5f) * (int)HeightTileCache::TILE_CELLS;
+	return (UINT)min(max(start, 0), (int)(mapSamples - windowSamples));
+}
 
-		XMVECTOR lineBA = XMVectorSubtract(vector1, vector2);
-		XMVECTOR lineBC = XMVectorSubtract(vector3, vector2);
+/// <summary>
+/// 16 bit height in the low half, x and z of the normal as snorm bytes in the high half. y is rebuilt in the shader
+/// </summary>
+/// <param name="row"></param>
+/// <param name="column"></param>
+/// <returns></returns>
+UINT Terrain::PackVertex(UINT row, UINT column) {
+	float height = (m_heightMapData[row * m_columns + column] - m_heightOffset) / m_heightRange;
+	UINT h = (UINT)(min(1.0f, max(0.0f, height)) * 65535.0f + 0.5f);
 
-		XMVECTOR lineCA = XMVectorSubtract(vector1, vector3);
-		XMVECTOR lineCB = XMVectorSubtract(vector2, vector3);
+	XMFLOAT3 normal = ComputeNormal(row, column);
+	int nx = (int)(normal.x * 127.0f + (normal.x >= 0.0f ? 0.5f : -0.5f));
+	int nz = (int)(normal.z * 127.0f + (normal.z >= 0.0f ? 0.5f : -0.5f));
 
-		XMVECTOR crossA = XMVector3Normalize(XMVector3Cross(lineAB, lineAC));
-		XMVECTOR crossB = XMVector3Normalize(XMVector3Cross(lineBA, lineBC));
-		XMVECTOR crossC = XMVector3Normalize(XMVector3Cross(lineCA, lineCB));
+	return h | ((UINT)(nx & 0xFF) << 16) | ((UINT)(nz & 0xFF) << 24);
+}
 
-		XMStoreFloat3(&m_vertices[m_indices[i]].m_normal, crossA);
-		XMStoreFloat3(&m_vertices[m_indices[i+1]].m_normal, crossB);
-		XMStoreFloat3(&m_vertices[m_indices[i+2]].m_normal, crossC);
-	}
+/// <summary>
+/// central difference normal at a grid vertex, clamped at the edges
+/// </summary>
+/// <param name="row"></param>
+/// <param name="column"></param>
+/// <returns></returns>
+XMFLOAT3 Terrain::ComputeNormal(UINT row, UINT column) {
+	UINT left = column > 0 ? column - 1 : column;
+	UINT right = column + 1 < m_columns ? column + 1 : column;
+	UINT up = row > 0 ? row - 1 : row;
+	UINT down = row + 1 < m_rows ? row + 1 : row;
+
+	// rows run towards -z
+	float dhdx = (m_heightMapData[row * m_columns + right] - m_heightMapData[row * m_columns + left]) / ((right - left) * m_cellSizeX);
+	float dhdz = (m_heightMapData[up * m_columns + column] - m_heightMapData[down * m_columns + column]) / ((down - up) * m_cellSizeZ);
+
+	XMFLOAT3 normal;
+	XMStoreFloat3(&normal, XMVector3Normalize(XMVectorSet(-dhdx, 1.0f, -dhdz, 0.0f)));
+	return normal;
 }
 
 /// <summary>
-/// Builds Vertex and Index Buffers
+/// uploads the packed vertices and grid constants, then frees the CPU copies
 /// </summary>
 /// <param name="device"></param>
 /// <returns></returns>
 HRESULT Terrain::BuildBuffers(ID3D11Device* device) {
 	HRESULT hr = S_OK;
 
-	D3D11_BUFFER_DESC vbd;
-	vbd.Usage = D3D11_USAGE_IMMUTABLE;
-	vbd.ByteWidth = sizeof(SimpleVertex) * m_vertices.size();
-	vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	vbd.CPUAccessFlags = 0;
-	vbd.MiscFlags = 0;
-	vbd.StructureByteStride = 0;
-
-	D3D11_SUBRESOURCE_DATA vinitData;
-	vinitData.pSysMem = &m_vertices[0];
-	hr = device->CreateBuffer(&vbd, &vinitData, &m_vertexBuffer);
+	D3D11_BUFFER_DESC hbd = {};
+	hbd.Usage = D3D11_USAGE_DEFAULT; // deformation updates sub ranges
+	hbd.ByteWidth = sizeof(UINT) * m_packedVertices.size();
+	hbd.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA hinitData = { m_packedVertices.data() };
+	hr = device->CreateBuffer(&hbd, &hinitData, &m_heightBuffer);
+	if (FAILED(hr)) return hr;
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_R32_UINT;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = m_packedVertices.size();
+
+	hr = device->CreateShaderResourceView(m_heightBuffer, &srvDesc, &m_heightView);
 	if (FAILED(hr)) return hr;
 
-	D3D11_BUFFER_DESC ibd;
-	ibd.Usage = D3D11_USAGE_IMMUTABLE;
-	ibd.ByteWidth = sizeof(unsigned int) * m_indices.size();
-	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	ibd.CPUAccessFlags = 0;
-	ibd.MiscFlags = 0;
-	ibd.StructureByteStride = 0;
-
-	D3D11_SUBRESOURCE_DATA iinitData;
-	iinitData.pSysMem = &m_indices[0];
-	hr = device->CreateBuffer(&ibd, &iinitData, &m_indexBuffer);
+	TerrainGridBuffer grid = GetGridConstants();
+
+	D3D11_BUFFER_DESC gbd = {};
+	gbd.Usage = D3D11_USAGE_DEFAULT; // a streamed window moves its origin
+	gbd.ByteWidth = sizeof(TerrainGridBuffer);
+	gbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+
+	D3D11_SUBRESOURCE_DATA ginitData = { &grid };
+	hr = device->CreateBuffer(&gbd, &ginitData, &m_gridBuffer);
 	if (FAILED(hr)) return hr;
 
+	// GPU has everything now, heights are only kept if they will be edited
+	std::vector<UINT>().swap(m_packedVertices);
+	if (!m_deformable) std::vector<float>().swap(m_heightMapData);
+
 	return S_OK;
 }
 
 /// <summary>
-/// loads height map data into a vector, call before generating flat grid
+/// uvs follow the map sample rather than the window vertex, so they do not jump when a streamed window moves,
+/// and advance at one repeat per window so the layers are no more stretched on a large map than on one that fits
+/// </summary>
+/// <returns></returns>
+TerrainGridBuffer Terrain::GetGridConstants() {
+	TerrainGridBuffer grid;
+	grid.GridColumns = m_columns;
+	grid.GridRows = m_rows;
+	grid.CellSize = XMFLOAT2(m_cellSizeX, m_cellSizeZ);
+	grid.Origin = XMFLOAT2(m_originX, m_originZ);
+	grid.HeightOffset = m_heightOffset;
+	grid.HeightRange = m_heightRange;
+	grid.TexcoordScale = XMFLOAT2(1.0f / (m_columns - 1), 1.0f / (m_rows - 1));
+	grid.TexcoordOffset = XMFLOAT2(m_windowColumn0 * grid.TexcoordScale.x, m_windowRow0 * grid.TexcoordScale.y);
+	return grid;
+}
+
+/// <summary>
+/// edits heights inside a circle, then refreshes normals and the vertex buffer for just the touched rows and columns
+/// </summary>
+/// <param name="deviceContext"></param>
+/// <param name="centre">world position, only x and z are used</param>
+/// <param name="radius"></param>
+/// <param name="strength">height change for raise/crater, 0-1 blend for flatten/smooth</param>
+/// <param name="brush"></param>
+void Terrain::Deform(ID3D11DeviceContext* deviceContext, XMFLOAT3 centre, float radius, float strength, TerrainBrush brush) {
+	if (m_heightMapData.empty()) return; // released after upload, see SetDeformable
+
+	TerrainRect dirty;
+	if (!DeformHeights(centre, radius, strength, brush, dirty)) return;
+
+	// every tile under the window is resident, so the edit survives the window moving until one of them is evicted
+	if (m_streaming) {
+		m_tileCache.WriteRegion(m_windowColumn0 + dirty.m_column0, m_windowRow0 + dirty.m_row0, dirty.m_column1 - dirty.m_column0 + 1, dirty.m_row1 - dirty.m_row0 + 1,
+			&m_heightMapData[dirty.m_row0 * m_columns + dirty.m_column0], m_columns);
+	}
+
+	// normals depend on the neighbouring heights, so grow by one vertex
+	TerrainRect normals = dirty;
+	if (normals.m_column0 > 0) --normals.m_column0;
+	if (normals.m_row0 > 0) --normals.m_row0;
+	if (normals.m_column1 + 1 < m_columns) ++normals.m_column1;
+	if (normals.m_row1 + 1 < m_rows) ++normals.m_row1;
+
+	UploadRegion(deviceContext, normals);
+
+	UpdateOccluder(dirty);
+}
+
+/// <summary>
+/// applies a brush to the height data only
+/// </summary>
+/// <param name="centre"></param>
+/// <param name="radius"></param>
+/// <param name="strength"></param>
+/// <param name="brush"></param>
+/// <param name="dirty">inclusive vertex rectangle that changed</param>
+/// <returns>false if the brush is off the terrain</returns>
+bool Terrain::DeformHeights(XMFLOAT3 centre, float radius, float strength, TerrainBrush brush, TerrainRect& dirty) {
+	if (m_columns == 0 || m_rows == 0 || radius <= 0.0f) return false;
+
+	// crater rims reach past the radius
+	float reach = brush == TerrainBrush::Crater ? radius * 1.3f : radius;
+
+	float columnCentre = (centre.x - m_originX) / m_cellSizeX;
+	float rowCentre = (m_originZ - centre.z) / m_cellSizeZ;
+
+	int column0 = (int)floorf(columnCentre - reach / m_cellSizeX);
+	int column1 = (int)ceilf(columnCentre + reach / m_cellSizeX);
+	int row0 = (int)floorf(rowCentre - reach / m_cellSizeZ);
+	int row1 = (int)ceilf(rowCentre + reach / m_cellSizeZ);
+
+	if (column1 < 0 || row1 < 0 || column0 >= (int)m_columns || row0 >= (int)m_rows) return false;
+
+	dirty.m_column0 = (UINT)max(column0, 0);
+	dirty.m_row0 = (UINT)max(row0, 0);
+	dirty.m_column1 = (UINT)min(column1, (int)m_columns - 1);
+	dirty.m_row1 = (UINT)min(row1, (int)m_rows - 1);
+
+	UINT width = dirty.m_column1 - dirty.m_column0 + 1;
+
+	// smoothing reads neighbours, so work from a copy of the region plus a border
+	std::vector<float> source;
+	if (brush == TerrainBrush::Smooth) {
+		source.resize((width + 2) * (dirty.m_row1 - dirty.m_row0 + 3));
+		for (UINT row = 0; row < dirty.m_row1 - dirty.m_row0 + 3; ++row) {
+			for (UINT column = 0; column < width + 2; ++column) {
+				int r = min(max((int)(dirty.m_row0 + row) - 1, 0), (int)m_rows - 1);
+				int c = min(max((int)(dirty.m_column0 + column) - 1, 0), (int)m_columns - 1);
+				source[row * (width + 2) + column] = m_heightMapData[r * m_columns + c];
+			}
+		}
+	}
+
+	UINT centreColumn = (UINT)min(max((int)(columnCentre + 0.5f), 0), (int)m_columns - 1);
+	UINT centreRow = (UINT)min(max((int)(rowCentre + 0.5f), 0), (int)m_rows - 1);
+	float centreHeight = m_heightMapData[centreRow * m_columns + centreColumn];
+
+	for (UINT row = dirty.m_row0; row <= dirty.m_row1; ++row) {
+		for (UINT column = dirty.m_column0; column <= dirty.m_column1; ++column) {
+			float x = (column - columnCentre) * m_cellSizeX;
+			float z = (row - rowCentre) * m_cellSizeZ;
+			float d = sqrtf(x * x + z * z) / radius;
+			if (d >= reach / radius) continue;
+
+			float falloff = max(0.0f, 1.0f - d * d);
+			falloff *= falloff;
+
+			float& h = m_heightMapData[row * m_columns + column];
+
+			switch (brush) {
+			case TerrainBrush::Raise:
+				h += strength * falloff;
+				break;
+			case TerrainBrush::Crater:
+				if (d < 1.0f) h -= strength * (1.0f - d * d);
+				if (d > 0.8f) h += strength * 0.25f * max(0.0f, 1.0f - fabsf(d - 1.05f) / 0.25f); // rim
+				break;
+			case TerrainBrush::Flatten:
+				h += (centreHeight - h) * min(1.0f, strength) * falloff;
+				break;
+			case TerrainBrush::Smooth:
+			{
+				const float* s = &source[(row - dirty.m_row0 + 1) * (width + 2) + (column - dirty.m_column0 + 1)];
+				float average = (s[-1] + s[1] + s[-(int)(width + 2)] + s[width + 2] + s[0]) * 0.2f;
+				h += (average - h) * min(1.0f, strength) * falloff;
+				break;
+			}
+			}
+		}
+	}
+
+	return true;
+}
+
+/// <summary>
+/// repacks and uploads one box per row of the rectangle, rows are not contiguous in the buffer so this avoids sending the full width
+/// </summary>
+/// <param name="deviceContext"></param>
+/// <param name="region"></param>
+void Terrain::UploadRegion(ID3D11DeviceContext* deviceContext, const TerrainRect& region) {
+	if (!m_heightBuffer) return;
+
+	std::vector<UINT> packed(region.m_column1 - region.m_column0 + 1);
+
+	for (UINT row = region.m_row0; row <= region.m_row1; ++row) {
+		for (UINT column = region.m_column0; column <= region.m_column1; ++column) {
+			packed[column - region.m_column0] = PackVertex(row, column);
+		}
+
+		D3D11_BOX box = {};
+		box.left = (row * m_columns + region.m_column0) * sizeof(UINT);
+		box.right = (row * m_columns + region.m_column1 + 1) * sizeof(UINT);
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+
+		deviceContext->UpdateSubresource(m_heightBuffer, 0, &box, packed.data(), 0, 0);
+	}
+}
+
+/// <summary>
+/// grid of patchCells square patches for the software occlusion rasterizer, in the terrain's local space. each corner
+/// takes the lowest height of the patches around it, so every coarse triangle stays under the full grid's surface
+/// and hides nothing the drawn terrain does not. Deform updates the patches it touches while the heights are kept
+/// </summary>
+/// <param name="patchCells">grid cells along each side of a patch</param>
+/// <param name="sink">extra drop for anything that can lower the drawn surface, such as tessellated displacement</param>
+void Terrain::BuildOccluder(UINT patchCells, float sink) {
+	m_occluderPatchCells = patchCells;
+	m_occluderSink = sink;
+	m_occluderVertices.clear();
+	m_occluderIndices.clear();
+	m_occluderPatchMin.clear();
+	if (m_heightMapData.empty() || m_columns < 2 || m_rows < 2 || patchCells == 0) return;
+
+	// the last row and column of patches can be narrower
+	m_occluderPatchColumns = (m_columns - 2) / patchCells + 1;
+	m_occluderPatchRows = (m_rows - 2) / patchCells + 1;
+
+	m_occluderPatchMin.resize(m_occluderPatchColumns * m_occluderPatchRows);
+	for (UINT pr = 0; pr < m_occluderPatchRows; ++pr) {
+		for (UINT pc = 0; pc < m_occluderPatchColumns; ++pc) {
+			ComputeOccluderPatch(pr, pc);
+		}
+	}
+
+	// same layout as the vertex shader, rows run towards -z. heights are filled in by ComputeOccluderCorner
+	for (UINT cornerRow = 0; cornerRow <= m_occluderPatchRows; ++cornerRow) {
+		UINT row = min(cornerRow * patchCells, m_rows - 1);
+		for (UINT cornerColumn = 0; cornerColumn <= m_occluderPatchColumns; ++cornerColumn) {
+			UINT column = min(cornerColumn * patchCells, m_columns - 1);
+			m_occluderVertices.push_back(XMFLOAT3(m_originX + column * m_cellSizeX, 0.0f, m_originZ - row * m_cellSizeZ));
+			ComputeOccluderCorner(cornerRow, cornerColumn);
+		}
+	}
+
+	for (UINT pr = 0; pr < m_occluderPatchRows; ++pr) {
+		for (UINT pc = 0; pc < m_occluderPatchColumns; ++pc) {
+			UINT corner = pr * (m_occluderPatchColumns + 1) + pc;
+			UINT quad[6] = { corner, corner + 1, corner + m_occluderPatchColumns + 1, corner + 1, corner + m_occluderPatchColumns + 2, corner + m_occluderPatchColumns + 1 };
+			m_occluderIndices.insert(m_occluderIndices.end(), quad, quad + 6);
+		}
+	}
+}
+
+/// <summary>
+/// lowest height over a patch's vertices, its border rows and columns included as they are shared with the next patch
+/// </summary>
+/// <param name="patchRow"></param>
+/// <param name="patchColumn"></param>
+void Terrain::ComputeOccluderPatch(UINT patchRow, UINT patchColumn) {
+	UINT row0 = patchRow * m_occluderPatchCells;
+	UINT row1 = min(row0 + m_occluderPatchCells, m_rows - 1);
+	UINT column0 = patchColumn * m_occluderPatchCells;
+	UINT column1 = min(column0 + m_occluderPatchCells, m_columns - 1);
+
+	float lowest = FLT_MAX;
+	for (UINT row = row0; row <= row1; ++row) {
+		for (UINT column = column0; column <= column1; ++column) {
+			lowest = min(lowest, m_heightMapData[row * m_columns + column]);
+		}
+	}
+
+	m_occluderPatchMin[patchRow * m_occluderPatchColumns + patchColumn] = lowest;
+}
+
+/// <summary>
+/// drops a corner to the lowest of the up to four patches around it
+/// </summary>
+/// <param name="cornerRow"></param>
+/// <param name="cornerColumn"></param>
+void Terrain::ComputeOccluderCorner(UINT cornerRow, UINT cornerColumn) {
+	float lowest = FLT_MAX;
+	for (UINT pr = cornerRow > 0 ? cornerRow - 1 : 0; pr <= min(cornerRow, m_occluderPatchRows - 1); ++pr) {
+		for (UINT pc = cornerColumn > 0 ? cornerColumn - 1 : 0; pc <= min(cornerColumn, m_occluderPatchColumns - 1); ++pc) {
+			lowest = min(lowest, m_occluderPatchMin[pr * m_occluderPatchColumns + pc]);
+		}
+	}
+
+	// heights reach the GPU as 16 bit fractions of the range, so they can round down by half a step
+	float drop = m_occluderSink + m_heightRange / 65535.0f;
+	m_occluderVertices[cornerRow * (m_occluderPatchColumns + 1) + cornerColumn].y = lowest - drop;
+}
+
+/// <summary>
+/// recomputes the patches holding any edited vertex and the corners around them, the indices never change
+/// </summary>
+/// <param name="dirty">vertices whose heights changed</param>
+void Terrain::UpdateOccluder(const TerrainRect& dirty) {
+	if (m_occluderPatchMin.empty()) return;
+
+	// a vertex on a patch border belongs to the patches either side
+	UINT patchRow0 = dirty.m_row0 > 0 ? (dirty.m_row0 - 1) / m_occluderPatchCells : 0;
+	UINT patchRow1 = min(dirty.m_row1 / m_occluderPatchCells, m_occluderPatchRows - 1);
+	UINT patchColumn0 = dirty.m_column0 > 0 ? (dirty.m_column0 - 1) / m_occluderPatchCells : 0;
+	UINT patchColumn1 = min(dirty.m_column1 / m_occluderPatchCells, m_occluderPatchColumns - 1);
+
+	for (UINT pr = patchRow0; pr <= patchRow1; ++pr) {
+		for (UINT pc = patchColumn0; pc <= patchColumn1; ++pc) {
+			ComputeOccluderPatch(pr, pc);
+		}
+	}
+
+	for (UINT cornerRow = patchRow0; cornerRow <= patchRow1 + 1; ++cornerRow) {
+		for (UINT cornerColumn = patchColumn0; cornerColumn <= patchColumn1 + 1; ++cornerColumn) {
+			ComputeOccluderCorner(cornerRow, cornerColumn);
+		}
+	}
+}
+
+/// <summary>
+/// loads height map data into a vector, call before generating flat grid.
+/// the file is mapped and decoded a band of rows at a time so no full size byte copy is made. a map larger than the
+/// stream window is not read here at all, GenGrid and UpdateStreaming decode just the tiles under the window
 /// </summary>
 /// <param name="hmWidth"></param>
 /// <param name="hmHeight"></param>
 /// <param name="hmFileName"></param>
-void Terrain::LoadHeightMap(int hmWidth, int hmHeight, std::string hmFileName) {
+/// <param name="format">8 bit, 16 bit or float32 samples</param>
+/// <returns>failure leaves the terrain flat</returns>
+HRESULT Terrain::LoadHeightMap(int hmWidth, int hmHeight, std::string hmFileName, HeightMapFormat format) {
 	m_terrainInfo.m_heightMapWidth = hmWidth;
 	m_terrainInfo.m_heightMapHeight = hmHeight;
 	m_terrainInfo.m_heightMapFilename = hmFileName;
+	m_terrainInfo.m_heightMapFormat = format;
+
+	UINT window = m_streamWindowTiles * HeightTileCache::TILE_CELLS + 1;
+	m_streaming = m_streamWindowTiles > 0 && ((UINT)hmWidth > window || (UINT)hmHeight > window);
+	m_tileCache.Close();
+
+	if (m_streaming) {
+		std::vector<float>().swap(m_heightMapData);
+
+		// a window can straddle one more tile each way than it spans, the spare ring keeps the tiles it just left
+		// so turning back does not decode them again
+		return m_tileCache.Open(hmFileName, hmWidth, hmHeight, format, m_terrainInfo.m_heightScale, (m_streamWindowTiles + 2) * (m_streamWindowTiles + 2));
+	}
 
 	// height per vertex
-	std::vector<unsigned char> in(hmWidth * hmHeight);
+	m_heightMapData.assign(hmHeight * hmWidth, 0.0f);
+
+	HeightMapStream file;
+	HRESULT hr = file.Open(hmFileName, hmWidth, hmHeight, format, m_terrainInfo.m_heightScale);
+	if (FAILED(hr)) return hr; // flat terrain, same as a missing file before
+
+	const UINT bandRows = 64;
+	for (UINT row = 0; row < (UINT)hmHeight; row += bandRows) {
+		if (!file.ReadRows(row, min(bandRows, hmHeight - row), &m_heightMapData[row * hmWidth])) {
+			m_heightMapData.assign(hmHeight * hmWidth, 0.0f);
+			return E_FAIL;
+		}
+	}
+
+	return S_OK;
+}
 
-	std::ifstream inFile;
-	inFile.open(hmFileName.c_str(), std::ios_base::binary);
+/// <summary>
+/// fills the height data from procedural noise instead of a RAW file, call before generating flat grid
+/// </summary>
+/// <param name="hmWidth"></param>
+/// <param name="hmHeight"></param>
+/// <param name="settings"></param>
+void Terrain::GenerateHeightMap(UINT hmWidth, UINT hmHeight, const NoiseSettings& settings) {
+	m_terrainInfo.m_heightMapWidth = hmWidth;
+	m_terrainInfo.m_heightMapHeight = hmHeight;
+	m_terrainInfo.m_heightMapFilename.clear();
+	m_streaming = false;
+	m_tileCache.Close();
+
+	m_heightMapData.resize(hmWidth * hmHeight);
+
+	HeightMapGenerator generator(settings);
+	generator.GenerateRegion(0, 0, hmWidth, hmHeight, m_terrainInfo.m_heightScale, m_heightMapData.data());
+}
+
+/// <summary>
+/// runs hydraulic and thermal erosion over the loaded height data, call before generating flat grid
+/// </summary>
+/// <param name="settings"></param>
+void Terrain::Erode(const ErosionSettings& settings) {
+	if (m_heightMapData.empty() || m_streaming) return; // needs the whole map, see SetStreamWindow
 
-	if (inFile) {
-		// read raw bytes
-		inFile.read((char*)&in[0], (std::streamsize)in.size());
+	TerrainErosion erosion(settings);
+	erosion.Apply(m_heightMapData, m_terrainInfo.m_heightMapWidth, m_terrainInfo.m_heightMapHeight, m_terrainInfo.m_cellSpacing);
+}
 
-		inFile.close();
+/// <summary>
+/// writes the current height data as a RAW file, so baked results can be loaded with LoadHeightMap
+/// </summary>
+/// <param name="hmFileName"></param>
+/// <param name="format"></param>
+/// <returns></returns>
+HRESULT Terrain::SaveHeightMap(std::string hmFileName, HeightMapFormat format) {
+	if (m_heightMapData.empty() || m_streaming) return E_FAIL; // a streamed map only holds its window
+
+	std::ofstream outFile(hmFileName.c_str(), std::ios::out | std::ios::binary);
+	if (!outFile) return E_FAIL;
+
+	UINT width = m_terrainInfo.m_heightMapWidth;
+	std::vector<unsigned char> row(width * GetHeightMapSampleSize(format));
+
+	for (UINT z = 0; z < m_terrainInfo.m_heightMapHeight; ++z) {
+		EncodeHeightSamples(&m_heightMapData[z * width], width, format, m_terrainInfo.m_heightScale, row.data());
+		outFile.write((char*)row.data(), (std::streamsize)row.size());
 	}
 
-	m_heightMapData.resize(sizeof(float) * hmHeight * hmWidth);
+	outFile.close();
+	return outFile.fail() ? E_FAIL : S_OK;
+}
+
+/// <summary>
+/// whether the blend map on disk was baked from these heights, this grid and these settings. needs GenGrid
+/// </summary>
+/// <param name="settings"></param>
+/// <returns>false when it is missing, was not written by SaveSplatMap or is stale, and always while streaming</returns>
+bool Terrain::IsSplatMapCurrent(const SplatSettings& settings) {
+	if (m_heightMapData.empty() || m_columns == 0 || m_streaming) return false;
+
+	UINT64 stored;
+	if (!ReadSplatDDSKey(m_terrainInfo.m_blendMapFilename, m_columns, m_rows, stored)) return false;
 
-	// copy array data and scale it
-	for (UINT i = 0; i < hmHeight * hmWidth; ++i) {
-		m_heightMapData[i] = (in[i] / 255.0f) * m_terrainInfo.m_heightScale;
+	return stored == ComputeSplatKey(m_heightMapData.data(), m_columns, m_rows, m_cellSizeX, m_cellSizeZ, m_terrainInfo.m_heightScale, settings);
+}
+
+/// <summary>
+/// works out layer weights from height and slope once, so the pixel shader only has to blend. needs GenGrid for the normals
+/// </summary>
+/// <param name="settings"></param>
+void Terrain::BakeSplatMap(const SplatSettings& settings) {
+	if (m_heightMapData.empty() || m_columns == 0) return;
+
+	float invScale = m_terrainInfo.m_heightScale != 0.0f ? 1.0f / m_terrainInfo.m_heightScale : 0.0f;
+
+	m_splatSettings = settings;
+	m_splatTexels.resize(m_columns * m_rows);
+	m_splatKey = ComputeSplatKey(m_heightMapData.data(), m_columns, m_rows, m_cellSizeX, m_cellSizeZ, m_terrainInfo.m_heightScale, settings);
+
+	for (UINT row = 0; row < m_rows; ++row) {
+		for (UINT column = 0; column < m_columns; ++column) {
+			UINT i = row * m_columns + column;
+			m_splatTexels[i] = ComputeSplatTexel(m_heightMapData[i] * invScale, ComputeNormal(row, column).y, settings);
+		}
 	}
 }
 
 /// <summary>
-/// set shader resource, buffers and cb Data for textures.
+/// uploads the baked weights as the blend map and frees them
+/// </summary>
+/// <param name="device"></param>
+/// <returns></returns>
+HRESULT Terrain::CreateSplatTexture(ID3D11Device* device) {
+	if (m_splatTexels.empty()) return E_FAIL;
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = m_columns;
+	desc.Height = m_rows;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = m_streaming ? D3D11_USAGE_DEFAULT : D3D11_USAGE_IMMUTABLE; // a streamed window is rebaked as it moves
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA initData = {};
+	initData.pSysMem = m_splatTexels.data();
+	initData.SysMemPitch = m_columns * sizeof(UINT);
+
+	ID3D11Texture2D* texture = nullptr;
+	HRESULT hr = device->CreateTexture2D(&desc, &initData, &texture);
+	if (FAILED(hr)) return hr;
+
+	hr = device->CreateShaderResourceView(texture, nullptr, &m_blend);
+	texture->Release(); // view holds its own reference
+	if (FAILED(hr)) return hr;
+
+	std::vector<UINT>().swap(m_splatTexels);
+
+	return S_OK;
+}
+
+/// <summary>
+/// moves a streamed window once the camera is more than a tile from its centre, reading the tiles it now covers and
+/// refreshing the heights, grid constants, blend map and occluder in place so the material's views stay valid.
+/// a move repacks and uploads the whole window, which the one tile of slack keeps to every tile or so of travel
 /// </summary>
 /// <param name="deviceContext"></param>
-/// <param name="cbData"></param>
-void Terrain::Draw(ID3D11DeviceContext* deviceContext, ConstantBuffer* cbData) {
-	UINT stride = { sizeof(SimpleVertex) };
-	UINT offset = 0;
+/// <param name="position">camera position in world space, the terrain is never moved</param>
+void Terrain::UpdateStreaming(ID3D11DeviceContext* deviceContext, XMFLOAT3 position) {
+	if (!m_streaming || !m_heightBuffer) return;
+
+	float column = (position.x - m_mapOriginX) / m_cellSizeX;
+	float row = (m_mapOriginZ - position.z) / m_cellSizeZ;
+
+	const float slack = (float)HeightTileCache::TILE_CELLS;
+	if (fabsf(column - (m_windowColumn0 + (m_columns - 1) * 0.5f)) <= slack && fabsf(row - (m_windowRow0 + (m_rows - 1) * 0.5f)) <= slack) return;
+
+	UINT column0 = GetWindowStart(column, m_mapColumns, m_columns);
+	UINT row0 = GetWindowStart(row, m_mapRows, m_rows);
+	if (column0 == m_windowColumn0 && row0 == m_windowRow0) return; // already against the edge of the map
+
+	SetWindow(column0, row0);
+
+	PackWindow();
+	deviceContext->UpdateSubresource(m_heightBuffer, 0, nullptr, m_packedVertices.data(), 0, 0);
+	std::vector<UINT>().swap(m_packedVertices);
+
+	TerrainGridBuffer grid = GetGridConstants();
+	deviceContext->UpdateSubresource(m_gridBuffer, 0, nullptr, &grid, 0, 0);
+
+	if (m_blend) {
+		BakeSplatMap(m_splatSettings);
+
+		ID3D11Resource* texture = nullptr;
+		m_blend->GetResource(&texture);
+		deviceContext->UpdateSubresource(texture, 0, nullptr, m_splatTexels.data(), m_columns * sizeof(UINT), 0);
+		texture->Release();
+
+		std::vector<UINT>().swap(m_splatTexels);
+	}
 
+	if (m_occluderPatchCells > 0) BuildOccluder(m_occluderPatchCells, m_occluderSink);
+
+	// same as BuildBuffers, the window's heights are only kept if they will be edited
+	if (!m_deformable) std::vector<float>().swap(m_heightMapData);
+}
+
+/// <summary>
+/// layer textures then the blend map in t0-t5, packed heights and grid constants for the vertex stage,
+/// detail displacement for the domain stage which is only read when tessellating
+/// </summary>
+/// <returns></returns>
+RenderMaterial Terrain::GetMaterial() {
+	RenderMaterial material;
 	for (UINT i = 0; i < sizeof(m_textures) / sizeof(m_textures[0]); i++) {
-		deviceContext->PSSetShaderResources(i, 1, &m_textures[i]);
+		material.m_pixelResources[i] = m_textures[i];
 	}
-	deviceContext->PSSetShaderResources(sizeof(m_textures) / sizeof(m_textures[0]), 1, &m_blend);
+	material.m_pixelResources[sizeof(m_textures) / sizeof(m_textures[0])] = m_blend;
+	material.m_pixelResourceCount = sizeof(m_textures) / sizeof(m_textures[0]) + 1;
 
-	deviceContext->IASetVertexBuffers(0, 1, &m_vertexBuffer, &stride, &offset);
-	deviceContext->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	material.m_vertexResource = m_heightView;
+	material.m_vertexConstants = m_gridBuffer;
+	material.m_domainResource = m_detail;
 
-	cbData->HasTexture = 1;
-	cbData->SpecMap = 0;
-	cbData->NormMap = 0;
+	material.m_hasTexture = 1;
+	material.m_specMap = 0;
+	material.m_normMap = 0;
+	return material;
+}
+
+/// <summary>
+/// no vertex or index buffer, the vertex shader builds the grid from SV_VertexID
+/// </summary>
+/// <returns></returns>
+RenderMesh Terrain::GetMesh() {
+	RenderMesh mesh;
+	mesh.m_count = GetVertexCount();
+	mesh.m_indexed = false;
+	return mesh;
 }
\ No newline at end of file
@@ -5,41 +5,134 @@
 #include <fstream>		
 #include <vector>			
 #include "Structures.h"
+#include "HeightMapStream.h"
+#include "HeightTileCache.h"
+#include "HeightMapGenerator.h"
+#include "TerrainErosion.h"
+#include "TerrainSplat.h"
+#include "RenderQueue.h"
+
+enum class TerrainBrush
+{
+	Raise, // negative strength lowers
+	Crater,
+	Flatten,
+	Smooth
+};
+
+// inclusive range of grid vertices
+struct TerrainRect
+{
+	UINT m_column0;
+	UINT m_row0;
+	UINT m_column1;
+	UINT m_row1;
+};
 
 class Terrain
 {
 private:
-	// used as arrays for Vertex/Index Buffer creation
-	std::vector<SimpleVertex> m_vertices;
-	std::vector<unsigned int> m_indices; // DXGI format of R32 rather than R16
-	 
-	ID3D11Buffer* m_vertexBuffer;
-	ID3D11Buffer* m_indexBuffer;
+	// packed height + normal per vertex, only held between GenGrid and BuildBuffers
+	std::vector<UINT> m_packedVertices;
+
+	ID3D11Buffer* m_heightBuffer = nullptr;
+	ID3D11ShaderResourceView* m_heightView = nullptr;
+	ID3D11Buffer* m_gridBuffer = nullptr;
+
+	ID3D11ShaderResourceView* m_textures[5] = {};
+	ID3D11ShaderResourceView* m_blend = nullptr;
+	ID3D11ShaderResourceView* m_detail = nullptr;
 
-	ID3D11ShaderResourceView* m_textures[5];
-	ID3D11ShaderResourceView* m_blend;
+	std::vector<float> m_heightMapData; // the window's heights while streaming
+	std::vector<UINT> m_splatTexels; // baked layer weights, one per vertex, freed once uploaded
+	UINT64 m_splatKey = 0; // what m_splatTexels were baked from, see ComputeSplatKey
+	SplatSettings m_splatSettings; // kept so a streamed window can be rebaked when it moves
 
-	std::vector<float> m_heightMapData;
+	// maps too large for one window are drawn through a window of tiles that follows the camera
+	HeightTileCache m_tileCache;
+	bool m_streaming = false;
+	UINT m_streamWindowTiles = 4; // window side in tiles, 0 always reads the whole map
 
 	TerrainInfo m_terrainInfo;
 
 	XMFLOAT4X4 m_world;
 
+	// grid layout from GenGrid, needed to map world positions to vertices. m_columns and m_rows are the drawn window,
+	// which is the whole map unless streaming
+	UINT m_columns = 0;
+	UINT m_rows = 0;
+	UINT m_mapColumns = 0;
+	UINT m_mapRows = 0;
+	UINT m_windowColumn0 = 0; // map sample at the window's first vertex
+	UINT m_windowRow0 = 0;
+	float m_cellSizeX = 1.0f;
+	float m_cellSizeZ = 1.0f;
+	float m_mapOriginX = 0.0f; // world x and z of map sample 0, 0
+	float m_mapOriginZ = 0.0f;
+	float m_originX = 0.0f; // world x and z of the window's first vertex
+	float m_originZ = 0.0f;
+	float m_heightOffset = 0.0f;
+	float m_heightRange = 1.0f;
+
+	bool m_deformable = false; // keeps m_heightMapData after upload
+
+	// coarse surface for software occlusion, one quad per patch, kept at or below the full grid everywhere
+	std::vector<XMFLOAT3> m_occluderVertices;
+	std::vector<UINT> m_occluderIndices;
+	UINT m_occluderPatchCells = 0; // 0 until BuildOccluder
+	UINT m_occluderPatchColumns = 0;
+	UINT m_occluderPatchRows = 0;
+	std::vector<float> m_occluderPatchMin; // lowest height in each patch, kept so an edit only revisits its own patches
+	float m_occluderSink = 0.0f;
+
+	XMFLOAT3 ComputeNormal(UINT row, UINT column);
+	UINT PackVertex(UINT row, UINT column);
+	void PackWindow();
+	void SetWindow(UINT column0, UINT row0);
+	UINT GetWindowStart(float centre, UINT mapSamples, UINT windowSamples);
+	TerrainGridBuffer GetGridConstants();
+	void UploadRegion(ID3D11DeviceContext* deviceContext, const TerrainRect& region);
+	void ComputeOccluderPatch(UINT patchRow, UINT patchColumn);
+	void ComputeOccluderCorner(UINT cornerRow, UINT cornerColumn);
+	void UpdateOccluder(const TerrainRect& dirty);
+
 public:
 	Terrain();
 	~Terrain();
 
-	int GetIndexCount() { return m_indices.size(); }
+	UINT GetVertexCount() { return m_columns > 1 && m_rows > 1 ? (m_columns - 1) * (m_rows - 1) * 6 : 0; }
+	void SetDeformable(bool deformable) { m_deformable = deformable; }
+	void SetStreamWindow(UINT tiles) { m_streamWindowTiles = tiles; } // before LoadHeightMap
+	bool IsStreaming() { return m_streaming; }
+	UINT GetResidentTileCount() { return m_tileCache.GetResidentTileCount(); }
 
 	void GenGrid(float width, float depth, float columns, float rows);
 	HRESULT BuildBuffers(ID3D11Device* device);
 
-	void LoadHeightMap(int hmWidth, int hmHeight, std::string hmFileName);
+	void Deform(ID3D11DeviceContext* deviceContext, XMFLOAT3 centre, float radius, float strength, TerrainBrush brush);
+	bool DeformHeights(XMFLOAT3 centre, float radius, float strength, TerrainBrush brush, TerrainRect& dirty);
+
+	HRESULT LoadHeightMap(int hmWidth, int hmHeight, std::string hmFileName, HeightMapFormat format = HeightMapFormat::R8);
+	void UpdateStreaming(ID3D11DeviceContext* deviceContext, XMFLOAT3 position);
+
+	void GenerateHeightMap(UINT hmWidth, UINT hmHeight, const NoiseSettings& settings);
+	void Erode(const ErosionSettings& settings);
+	HRESULT SaveHeightMap(std::string hmFileName, HeightMapFormat format);
+	bool IsSplatMapCurrent(const SplatSettings& settings);
+	void BakeSplatMap(const SplatSettings& settings);
+	bool HasSplatMap() { return !m_splatTexels.empty(); }
+	HRESULT SaveSplatMap() { return SaveSplatDDS(m_terrainInfo.m_blendMapFilename, m_columns, m_rows, m_splatTexels, m_splatKey); }
+	HRESULT CreateSplatTexture(ID3D11Device* device);
+
+	void BuildOccluder(UINT patchCells, float sink);
+	const std::vector<XMFLOAT3>& GetOccluderVertices() { return m_occluderVertices; }
+	const std::vector<UINT>& GetOccluderIndices() { return m_occluderIndices; }
 
 	void SetPosition(XMFLOAT4X4 newWorld) { m_world = newWorld; }
 	XMFLOAT4X4* getPosition() { return &m_world; }
 
-	void Draw(ID3D11DeviceContext* deviceContext, ConstantBuffer* cbData);
+	RenderMaterial GetMaterial();
+	RenderMesh GetMesh();
 
 	std::wstring GetFileName(UINT index) { std::wstring bbName(m_terrainInfo.m_layerMapFilenames[index].begin(), m_terrainInfo.m_layerMapFilenames[index].end()); return bbName; }
 	std::wstring GetBlendName() { std::wstring bbName(m_terrainInfo.m_blendMapFilename.begin(), m_terrainInfo.m_blendMapFilename.end()); return bbName; }
@@ -47,6 +140,9 @@ public:
 	ID3D11ShaderResourceView** GetShaderResource(UINT index) { return &m_textures[index]; }
 	ID3D11ShaderResourceView** GetShaderResourceBlend() { return &m_blend; }
 
+	std::wstring GetDetailName() { std::wstring bbName(m_terrainInfo.m_detailMapFilename.begin(), m_terrainInfo.m_detailMapFilename.end()); return bbName; }
+	ID3D11ShaderResourceView** GetShaderResourceDetail() { return &m_detail; }
+
 	int GetAmtTex() { return sizeof(m_textures) / sizeof(m_textures[0]); }
 };
 
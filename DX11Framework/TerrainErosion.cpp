@@ -0,0 +1,371 @@
+#include "TerrainErosion.h"
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+enum { FLUX_LEFT = 0, FLUX_RIGHT = 1, FLUX_TOP = 2, FLUX_BOTTOM = 3 };
+
+/// <summary>
+/// stateless hash to 0-1, rain depends only on seed, iteration and cell so thread order cannot change it
+/// </summary>
+/// <param name="seed"></param>
+/// <param name="iteration"></param>
+/// <param name="cell"></param>
+/// <returns></returns>
+static float Hash01(UINT seed, UINT iteration, UINT cell) {
+	UINT h = seed * 0x9E3779B9u ^ iteration * 0x85EBCA6Bu ^ cell * 0xC2B2AE35u;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return (h >> 8) * (1.0f / 16777216.0f);
+}
+
+TerrainErosion::TerrainErosion(const ErosionSettings& settings) {
+	m_settings = settings;
+	if (m_settings.m_tileSize == 0) m_settings.m_tileSize = 64;
+	if (m_settings.m_threadCount == 0) m_settings.m_threadCount = max(1u, std::thread::hardware_concurrency());
+}
+
+/// <summary>
+/// runs func over every tile on the pool's workers and this thread, tiles are handed out through an atomic counter
+/// </summary>
+template<typename TileFunc>
+void TerrainErosion::ForEachTile(TileFunc func) {
+	const UINT tileSize = m_settings.m_tileSize;
+	const UINT tilesX = (m_width + tileSize - 1) / tileSize;
+	const UINT tilesZ = (m_height + tileSize - 1) / tileSize;
+	const UINT tileCount = tilesX * tilesZ;
+
+	std::atomic<UINT> next(0);
+
+	m_workers.Run(min(m_settings.m_threadCount, tileCount), [&](UINT) {
+		for (UINT tile = next++; tile < tileCount; tile = next++) {
+			UINT x0 = (tile % tilesX) * tileSize;
+			UINT z0 = (tile / tilesX) * tileSize;
+			func(x0, min(x0 + tileSize, m_width), z0, min(z0 + tileSize, m_height));
+		}
+	});
+}
+
+/// <summary>
+/// pipe outflow for one cell, edge cells never flow off the map
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+void TerrainErosion::FluxCell(UINT x, UINT z) {
+	const UINT i = z * m_width + x;
+	const float k = m_settings.m_timeStep * m_settings.m_gravity;
+	const float h = m_terrain[i] + m_water[i];
+
+	float f[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (x > 0) f[FLUX_LEFT] = max(0.0f, m_flux[FLUX_LEFT][i] + k * (h - m_terrain[i - 1] - m_water[i - 1]));
+	if (x + 1 < m_width) f[FLUX_RIGHT] = max(0.0f, m_flux[FLUX_RIGHT][i] + k * (h - m_terrain[i + 1] - m_water[i + 1]));
+	if (z > 0) f[FLUX_TOP] = max(0.0f, m_flux[FLUX_TOP][i] + k * (h - m_terrain[i - m_width] - m_water[i - m_width]));
+	if (z + 1 < m_height) f[FLUX_BOTTOM] = max(0.0f, m_flux[FLUX_BOTTOM][i] + k * (h - m_terrain[i + m_width] - m_water[i + m_width]));
+
+	// cannot send out more water than the cell holds
+	float sum = f[0] + f[1] + f[2] + f[3];
+	float scale = sum > 0.0f ? min(1.0f, m_water[i] * m_cellSpacing * m_cellSpacing / (sum * m_settings.m_timeStep)) : 1.0f;
+
+	for (UINT n = 0; n < 4; ++n) m_fluxNext[n][i] = f[n] * scale;
+}
+
+/// <summary>
+/// outflow pass, interior cells of each row are done 4 at a time
+/// </summary>
+void TerrainErosion::FluxTile(UINT x0, UINT x1, UINT z0, UINT z1) {
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR k = XMVectorReplicate(m_settings.m_timeStep * m_settings.m_gravity);
+	const XMVECTOR area = XMVectorReplicate(m_cellSpacing * m_cellSpacing);
+	const XMVECTOR dt = XMVectorReplicate(m_settings.m_timeStep);
+	const XMVECTOR epsilon = XMVectorReplicate(1e-12f);
+
+	const float* b = m_terrain.data();
+	const float* d = m_water.data();
+
+	for (UINT z = z0; z < z1; ++z) {
+		if (z == 0 || z + 1 == m_height) {
+			for (UINT x = x0; x < x1; ++x) FluxCell(x, z);
+			continue;
+		}
+
+		UINT x = x0;
+		if (x == 0) FluxCell(x++, z);
+
+		UINT interiorEnd = min(x1, m_width - 1);
+		for (; x + 4 <= interiorEnd; x += 4) {
+			const UINT i = z * m_width + x;
+
+			XMVECTOR h = XMVectorAdd(XMLoadFloat4((const XMFLOAT4*)(b + i)), XMLoadFloat4((const XMFLOAT4*)(d + i)));
+			XMVECTOR hl = XMVectorAdd(XMLoadFloat4((const XMFLOAT4*)(b + i - 1)), XMLoadFloat4((const XMFLOAT4*)(d + i - 1)));
+			XMVECTOR hr = XMVectorAdd(XMLoadFloat4((const XMFLOAT4*)(b + i + 1)), XMLoadFloat4((const XMFLOAT4*)(d + i + 1)));
+			XMVECTOR ht = XMVectorAdd(XMLoadFloat4((const XMFLOAT4*)(b + i - m_width)), XMLoadFloat4((const XMFLOAT4*)(d + i - m_width)));
+			XMVECTOR hb = XMVectorAdd(XMLoadFloat4((const XMFLOAT4*)(b + i + m_width)), XMLoadFloat4((const XMFLOAT4*)(d + i + m_width)));
+
+			XMVECTOR fl = XMVectorMax(zero, XMVectorMultiplyAdd(k, XMVectorSubtract(h, hl), XMLoadFloat4((const XMFLOAT4*)&m_flux[FLUX_LEFT][i])));
+			XMVECTOR fr = XMVectorMax(zero, XMVectorMultiplyAdd(k, XMVectorSubtract(h, hr), XMLoadFloat4((const XMFLOAT4*)&m_flux[FLUX_RIGHT][i])));
+			XMVECTOR ft = XMVectorMax(zero, XMVectorMultiplyAdd(k, XMVectorSubtract(h, ht), XMLoadFloat4((const XMFLOAT4*)&m_flux[FLUX_TOP][i])));
+			XMVECTOR fb = XMVectorMax(zero, XMVectorMultiplyAdd(k, XMVectorSubtract(h, hb), XMLoadFloat4((const XMFLOAT4*)&m_flux[FLUX_BOTTOM][i])));
+
+			XMVECTOR sum = XMVectorAdd(XMVectorAdd(fl, fr), XMVectorAdd(ft, fb));
+			XMVECTOR limit = XMVectorDivide(XMVectorMultiply(XMLoadFloat4((const XMFLOAT4*)(d + i)), area), XMVectorMax(XMVectorMultiply(sum, dt), epsilon));
+			XMVECTOR scale = XMVectorMin(one, limit);
+
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_LEFT][i], XMVectorMultiply(fl, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_RIGHT][i], XMVectorMultiply(fr, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_TOP][i], XMVectorMultiply(ft, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_BOTTOM][i], XMVectorMultiply(fb, scale));
+		}
+
+		for (; x < x1; ++x) FluxCell(x, z);
+	}
+}
+
+/// <summary>
+/// adds rain, moves water by the net flux and derives the velocity field
+/// </summary>
+void TerrainErosion::WaterTile(UINT x0, UINT x1, UINT z0, UINT z1, UINT iteration) {
+	const float dt = m_settings.m_timeStep;
+	const float invArea = 1.0f / (m_cellSpacing * m_cellSpacing);
+
+	for (UINT z = z0; z < z1; ++z) {
+		for (UINT x = x0; x < x1; ++x) {
+			const UINT i = z * m_width + x;
+
+			float inLeft = x > 0 ? m_flux[FLUX_RIGHT][i - 1] : 0.0f;
+			float inRight = x + 1 < m_width ? m_flux[FLUX_LEFT][i + 1] : 0.0f;
+			float inTop = z > 0 ? m_flux[FLUX_BOTTOM][i - m_width] : 0.0f;
+			float inBottom = z + 1 < m_height ? m_flux[FLUX_TOP][i + m_width] : 0.0f;
+
+			float outflow = m_flux[FLUX_LEFT][i] + m_flux[FLUX_RIGHT][i] + m_flux[FLUX_TOP][i] + m_flux[FLUX_BOTTOM][i];
+			float rain = m_settings.m_rainRate * dt * 2.0f * Hash01(m_settings.m_seed, iteration, i);
+
+			float before = m_water[i] + rain;
+			float after = max(0.0f, before + dt * (inLeft + inRight + inTop + inBottom - outflow) * invArea);
+			m_waterNext[i] = after;
+
+			// average flow through the cell in each axis
+			float flowX = (inLeft - m_flux[FLUX_LEFT][i] + m_flux[FLUX_RIGHT][i] - inRight) * 0.5f;
+			float flowZ = (inTop - m_flux[FLUX_TOP][i] + m_flux[FLUX_BOTTOM][i] - inBottom) * 0.5f;
+			float depth = (before + after) * 0.5f;
+
+			m_velocityX[i] = depth > 1e-4f ? flowX / (depth * m_cellSpacing) : 0.0f;
+			m_velocityZ[i] = depth > 1e-4f ? flowZ / (depth * m_cellSpacing) : 0.0f;
+		}
+	}
+}
+
+/// <summary>
+/// dissolves or deposits sediment against the carry capacity of the local flow
+/// </summary>
+void TerrainErosion::ErodeTile(UINT x0, UINT x1, UINT z0, UINT z1) {
+	const float dt = m_settings.m_timeStep;
+	const float invSpacing = 0.5f / m_cellSpacing;
+
+	for (UINT z = z0; z < z1; ++z) {
+		for (UINT x = x0; x < x1; ++x) {
+			const UINT i = z * m_width + x;
+
+			float left = m_terrain[x > 0 ? i - 1 : i];
+			float right = m_terrain[x + 1 < m_width ? i + 1 : i];
+			float top = m_terrain[z > 0 ? i - m_width : i];
+			float bottom = m_terrain[z + 1 < m_height ? i + m_width : i];
+
+			float gx = (right - left) * invSpacing;
+			float gz = (bottom - top) * invSpacing;
+			float gradient = gx * gx + gz * gz;
+			float sinTilt = max(m_settings.m_minTilt, sqrtf(gradient / (1.0f + gradient)));
+
+			float speed = sqrtf(m_velocityX[i] * m_velocityX[i] + m_velocityZ[i] * m_velocityZ[i]);
+			float capacity = m_settings.m_sedimentCapacity * sinTilt * speed;
+
+			float sediment = m_sediment[i];
+			float amount;
+			if (capacity > sediment) {
+				amount = m_settings.m_dissolveRate * (capacity - sediment) * dt;
+			}
+			else {
+				amount = -m_settings.m_depositRate * (sediment - capacity) * dt;
+			}
+
+			m_terrainNext[i] = m_terrain[i] - amount;
+			m_sedimentNext[i] = sediment + amount;
+		}
+	}
+}
+
+/// <summary>
+/// semi-lagrangian advection of sediment along the velocity field, then evaporation
+/// </summary>
+void TerrainErosion::TransportTile(UINT x0, UINT x1, UINT z0, UINT z1) {
+	const float dt = m_settings.m_timeStep;
+	const float evaporation = max(0.0f, 1.0f - m_settings.m_evaporationRate * dt);
+	const float maxX = (float)(m_width - 1);
+	const float maxZ = (float)(m_height - 1);
+
+	for (UINT z = z0; z < z1; ++z) {
+		for (UINT x = x0; x < x1; ++x) {
+			const UINT i = z * m_width + x;
+
+			float px = min(maxX, max(0.0f, x - m_velocityX[i] * dt));
+			float pz = min(maxZ, max(0.0f, z - m_velocityZ[i] * dt));
+
+			UINT sx = min((UINT)px, m_width - 2);
+			UINT sz = min((UINT)pz, m_height - 2);
+			float fx = px - sx;
+			float fz = pz - sz;
+
+			const float* s = &m_sedimentNext[sz * m_width + sx];
+			float top = s[0] + (s[1] - s[0]) * fx;
+			float bottom = s[m_width] + (s[m_width + 1] - s[m_width]) * fx;
+
+			m_sediment[i] = top + (bottom - top) * fz;
+			m_water[i] = m_waterNext[i] * evaporation;
+		}
+	}
+}
+
+/// <summary>
+/// material leaving one cell towards neighbours steeper than the talus slope
+/// </summary>
+/// <param name="x"></param>
+/// <param name="z"></param>
+void TerrainErosion::ThermalOutflowCell(UINT x, UINT z) {
+	const UINT i = z * m_width + x;
+	const float talus = m_settings.m_talusSlope * m_cellSpacing;
+	const float h = m_terrain[i];
+
+	float excess[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	if (x > 0) excess[FLUX_LEFT] = max(0.0f, h - m_terrain[i - 1] - talus);
+	if (x + 1 < m_width) excess[FLUX_RIGHT] = max(0.0f, h - m_terrain[i + 1] - talus);
+	if (z > 0) excess[FLUX_TOP] = max(0.0f, h - m_terrain[i - m_width] - talus);
+	if (z + 1 < m_height) excess[FLUX_BOTTOM] = max(0.0f, h - m_terrain[i + m_width] - talus);
+
+	float total = excess[0] + excess[1] + excess[2] + excess[3];
+	float largest = max(max(excess[0], excess[1]), max(excess[2], excess[3]));
+	float scale = total > 0.0f ? m_settings.m_thermalRate * largest * 0.5f / total : 0.0f;
+
+	for (UINT n = 0; n < 4; ++n) m_fluxNext[n][i] = excess[n] * scale;
+}
+
+/// <summary>
+/// thermal outflow pass, m_fluxNext is free scratch here as the hydraulic step has already swapped it
+/// </summary>
+void TerrainErosion::ThermalOutflowTile(UINT x0, UINT x1, UINT z0, UINT z1) {
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR talus = XMVectorReplicate(m_settings.m_talusSlope * m_cellSpacing);
+	const XMVECTOR rate = XMVectorReplicate(m_settings.m_thermalRate * 0.5f);
+	const XMVECTOR epsilon = XMVectorReplicate(1e-12f);
+	const float* b = m_terrain.data();
+
+	for (UINT z = z0; z < z1; ++z) {
+		if (z == 0 || z + 1 == m_height) {
+			for (UINT x = x0; x < x1; ++x) ThermalOutflowCell(x, z);
+			continue;
+		}
+
+		UINT x = x0;
+		if (x == 0) ThermalOutflowCell(x++, z);
+
+		UINT interiorEnd = min(x1, m_width - 1);
+		for (; x + 4 <= interiorEnd; x += 4) {
+			const UINT i = z * m_width + x;
+
+			XMVECTOR h = XMVectorSubtract(XMLoadFloat4((const XMFLOAT4*)(b + i)), talus);
+			XMVECTOR el = XMVectorMax(zero, XMVectorSubtract(h, XMLoadFloat4((const XMFLOAT4*)(b + i - 1))));
+			XMVECTOR er = XMVectorMax(zero, XMVectorSubtract(h, XMLoadFloat4((const XMFLOAT4*)(b + i + 1))));
+			XMVECTOR et = XMVectorMax(zero, XMVectorSubtract(h, XMLoadFloat4((const XMFLOAT4*)(b + i - m_width))));
+			XMVECTOR eb = XMVectorMax(zero, XMVectorSubtract(h, XMLoadFloat4((const XMFLOAT4*)(b + i + m_width))));
+
+			XMVECTOR total = XMVectorAdd(XMVectorAdd(el, er), XMVectorAdd(et, eb));
+			XMVECTOR largest = XMVectorMax(XMVectorMax(el, er), XMVectorMax(et, eb));
+			XMVECTOR scale = XMVectorDivide(XMVectorMultiply(rate, largest), XMVectorMax(total, epsilon));
+
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_LEFT][i], XMVectorMultiply(el, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_RIGHT][i], XMVectorMultiply(er, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_TOP][i], XMVectorMultiply(et, scale));
+			XMStoreFloat4((XMFLOAT4*)&m_fluxNext[FLUX_BOTTOM][i], XMVectorMultiply(eb, scale));
+		}
+
+		for (; x < x1; ++x) ThermalOutflowCell(x, z);
+	}
+}
+
+/// <summary>
+/// gathers thermal outflow from the neighbours, mass is conserved exactly
+/// </summary>
+void TerrainErosion::ThermalApplyTile(UINT x0, UINT x1, UINT z0, UINT z1) {
+	for (UINT z = z0; z < z1; ++z) {
+		for (UINT x = x0; x < x1; ++x) {
+			const UINT i = z * m_width + x;
+
+			float out = m_fluxNext[FLUX_LEFT][i] + m_fluxNext[FLUX_RIGHT][i] + m_fluxNext[FLUX_TOP][i] + m_fluxNext[FLUX_BOTTOM][i];
+			float in = 0.0f;
+			if (x > 0) in += m_fluxNext[FLUX_RIGHT][i - 1];
+			if (x + 1 < m_width) in += m_fluxNext[FLUX_LEFT][i + 1];
+			if (z > 0) in += m_fluxNext[FLUX_BOTTOM][i - m_width];
+			if (z + 1 < m_height) in += m_fluxNext[FLUX_TOP][i + m_width];
+
+			m_terrainNext[i] = m_terrain[i] - out + in;
+		}
+	}
+}
+
+/// <summary>
+/// erodes heights in place, heights are in world units and cellSpacing is the distance between samples
+/// </summary>
+/// <param name="heights"></param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="cellSpacing"></param>
+void TerrainErosion::Apply(std::vector<float>& heights, UINT width, UINT height, float cellSpacing) {
+	if (width < 2 || height < 2 || heights.size() < (size_t)width * height) return;
+
+	m_width = width;
+	m_height = height;
+	m_cellSpacing = cellSpacing;
+
+	const size_t cells = (size_t)width * height;
+	m_terrain.assign(heights.begin(), heights.begin() + cells);
+	m_terrainNext.assign(cells, 0.0f);
+	m_water.assign(cells, 0.0f);
+	m_waterNext.assign(cells, 0.0f);
+	m_sediment.assign(cells, 0.0f);
+	m_sedimentNext.assign(cells, 0.0f);
+	m_velocityX.assign(cells, 0.0f);
+	m_velocityZ.assign(cells, 0.0f);
+	for (UINT n = 0; n < 4; ++n) {
+		m_flux[n].assign(cells, 0.0f);
+		m_fluxNext[n].assign(cells, 0.0f);
+	}
+
+	UINT iterations = max(m_settings.m_hydraulicIterations, m_settings.m_thermalIterations);
+
+	for (UINT it = 0; it < iterations; ++it) {
+		if (it < m_settings.m_hydraulicIterations) {
+			ForEachTile([this](UINT x0, UINT x1, UINT z0, UINT z1) { FluxTile(x0, x1, z0, z1); });
+			for (UINT n = 0; n < 4; ++n) m_flux[n].swap(m_fluxNext[n]);
+
+			ForEachTile([this, it](UINT x0, UINT x1, UINT z0, UINT z1) { WaterTile(x0, x1, z0, z1, it); });
+
+			ForEachTile([this](UINT x0, UINT x1, UINT z0, UINT z1) { ErodeTile(x0, x1, z0, z1); });
+			m_terrain.swap(m_terrainNext);
+
+			ForEachTile([this](UINT x0, UINT x1, UINT z0, UINT z1) { TransportTile(x0, x1, z0, z1); });
+		}
+
+		if (it < m_settings.m_thermalIterations) {
+			ForEachTile([this](UINT x0, UINT x1, UINT z0, UINT z1) { ThermalOutflowTile(x0, x1, z0, z1); });
+			ForEachTile([this](UINT x0, UINT x1, UINT z0, UINT z1) { ThermalApplyTile(x0, x1, z0, z1); });
+			m_terrain.swap(m_terrainNext);
+		}
+	}
+
+	// sediment still suspended settles where it is
+	for (size_t i = 0; i < cells; ++i) {
+		heights[i] = m_terrain[i] + m_sediment[i];
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "WorkerPool.h"
+
+using namespace DirectX;
+
+struct ErosionSettings
+{
+	UINT m_seed = 1;
+	UINT m_hydraulicIterations = 200;
+	UINT m_thermalIterations = 200;
+	float m_timeStep = 0.05f;
+	float m_gravity = 9.81f;
+	float m_rainRate = 0.01f; // water height per second, randomised per cell
+	float m_sedimentCapacity = 1.0f;
+	float m_dissolveRate = 0.3f;
+	float m_depositRate = 0.3f;
+	float m_evaporationRate = 0.015f;
+	float m_minTilt = 0.05f; // keeps flat ground eroding slowly
+	float m_talusSlope = 0.8f; // max stable height difference per unit distance
+	float m_thermalRate = 0.5f;
+	UINT m_tileSize = 64;
+	UINT m_threadCount = 0; // 0 uses every hardware thread
+};
+
+/// grid based hydraulic (virtual pipe) and thermal erosion over a heightfield.
+/// every pass reads the previous pass's buffers and writes new ones, tiles read a one cell ghost border
+/// from the source buffers, so tiles run in any order on any thread and the result only depends on the seed
+class TerrainErosion
+{
+private:
+	ErosionSettings m_settings;
+
+	UINT m_width = 0;
+	UINT m_height = 0;
+	float m_cellSpacing = 1.0f;
+
+	// per cell state, SoA so the inner loops can load 4 neighbouring cells at once
+	std::vector<float> m_terrain, m_terrainNext;
+	std::vector<float> m_water, m_waterNext;
+	std::vector<float> m_sediment, m_sedimentNext;
+	std::vector<float> m_flux[4], m_fluxNext[4]; // left, right, top, bottom
+	std::vector<float> m_velocityX, m_velocityZ;
+
+	WorkerPool m_workers; // created by the first pass, every later pass of the bake wakes the same threads
+
+	template<typename TileFunc>
+	void ForEachTile(TileFunc func);
+
+	void FluxTile(UINT x0, UINT x1, UINT z0, UINT z1);
+	void WaterTile(UINT x0, UINT x1, UINT z0, UINT z1, UINT iteration);
+	void ErodeTile(UINT x0, UINT x1, UINT z0, UINT z1);
+	void TransportTile(UINT x0, UINT x1, UINT z0, UINT z1);
+	void ThermalOutflowTile(UINT x0, UINT x1, UINT z0, UINT z1);
+	void ThermalApplyTile(UINT x0, UINT x1, UINT z0, UINT z1);
+
+	void FluxCell(UINT x, UINT z);
+	void ThermalOutflowCell(UINT x, UINT z);
+
+public:
+	TerrainErosion(const ErosionSettings& settings);
+
+	void Apply(std::vector<float>& heights, UINT width, UINT height, float cellSpacing);
+};
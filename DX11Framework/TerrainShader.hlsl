@@ -1,11 +1,15 @@
+#include "Tessellation.hlsli"
+
 Texture2D texLDirt : register(t0);
 Texture2D texDDirt : register(t1);
 Texture2D texGrass : register(t2);
 Texture2D texStone : register(t3);
 Texture2D texSnow : register(t4);
-Texture2D texBlend : register(t5);
+Texture2D texBlend : register(t5); // baked splat weights: grass, dark dirt, stone, snow. light dirt is the remainder
 SamplerState bilinerSampler : register(s0);
 
+Buffer<uint> PackedVertices : register(t0); // vertex stage, 16 bit height | snorm8 normal x | snorm8 normal z
+
 struct DirectionalLight
 {
     float4 m_ambientColor;
@@ -33,25 +37,47 @@ struct Fog
     float m_range;
 };
 
-cbuffer ConstantBuffer : register(b0)
+cbuffer FrameBuffer : register(b0)
 {
     float4x4 Projection;
     float4x4 View;
-    float4x4 World;
-    float4 DiffuseMaterial;
-    float4 AmbientMaterial;
-    float4 SpecularMaterial;
     DirectionalLight DirLight;
     PointLight PtLight;
-    uint HasTexture;
     float3 EyePosW;
+    uint FogEnabled;
     Fog FogW;
+}
+
+cbuffer MaterialBuffer : register(b1)
+{
+    float4 DiffuseMaterial;
+    float4 AmbientMaterial;
+    float4 SpecularMaterial;
+    uint HasTexture;
     uint SpecMap;
     uint NormMap;
     float SpecularPower;
-    uint FogEnabled;
 }
 
+cbuffer ObjectBuffer : register(b2)
+{
+    float4x4 World;
+}
+
+cbuffer TerrainGrid : register(b3)
+{
+    uint GridColumns;
+    uint GridRows;
+    float2 CellSize;
+    float2 Origin;
+    float HeightOffset;
+    float HeightRange;
+    float2 TexcoordOffset;
+    float2 TexcoordScale;
+}
+
+static const uint2 QuadCorners[6] = { uint2(0, 0), uint2(1, 0), uint2(0, 1), uint2(1, 0), uint2(1, 1), uint2(0, 1) };
+
 struct VS_Out
 {
     float4 position : SV_POSITION;
@@ -59,28 +85,119 @@ struct VS_Out
     float4 color : COLOR;
     float2 texcoord : TEXCOORD0;
     float3 WorldPos : TEXCOORD1;
+    float2 blendTexcoord : TEXCOORD2;
     float3 EyePos : LIGHTPOS;
     float3 Tangent : TANGENT;
 };
 
-VS_Out VS_main(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoord : TEXCOORD, float3 Tangent : TANGENT)
+struct HS_In
 {
-    VS_Out output = (VS_Out) 0;
+    float3 WorldPos : WORLDPOS;
+    float3 normal : NORMAL;
+    float2 texcoord : TEXCOORD0;
+    float2 blendTexcoord : TEXCOORD1;
+};
+
+struct HS_ConstantOut
+{
+    float edges[3] : SV_TessFactor;
+    float inside : SV_InsideTessFactor;
+};
+
+static const float DetailTiling = 128.0f; // DISP repeats across the terrain rather than stretching over it
+
+// rebuilds the grid vertex for VertexID, 6 vertices per quad, quads run along each row
+HS_In GridVertex(uint VertexID)
+{
+    HS_In output = (HS_In) 0;
+    
+    uint quad = VertexID / 6;
+    uint2 corner = QuadCorners[VertexID % 6];
+    uint column = quad % (GridColumns - 1) + corner.x;
+    uint row = quad / (GridColumns - 1) + corner.y;
+    
+    uint packed = PackedVertices.Load(row * GridColumns + column);
     
-    output.texcoord = TexCoord;
+    float height = HeightOffset + (packed & 0xFFFF) / 65535.0f * HeightRange;
+    float nx = max((float) ((int) (packed << 8) >> 24) / 127.0f, -1.0f);
+    float nz = max((float) ((int) packed >> 24) / 127.0f, -1.0f);
     
-    float4 Pos4 = float4(Position, 1.0f);
-    output.position = mul(Pos4, World);
-    output.WorldPos = output.position; //
+    float3 Position = float3(Origin.x + column * CellSize.x, height, Origin.y - row * CellSize.y);
     
-    output.normal = Normal;
+    output.WorldPos = mul(float4(Position, 1.0f), World).xyz;
+    output.normal = float3(nx, sqrt(saturate(1.0f - nx * nx - nz * nz)), nz);
+    output.texcoord = float2(column, row) * TexcoordScale + TexcoordOffset;
     
-    output.Tangent = Tangent;
+    // one blend texel per grid vertex, so vertex column c is the centre of texel c
+    output.blendTexcoord = (float2(column, row) + 0.5f) / float2(GridColumns, GridRows);
     
+    return output;
+}
+
+VS_Out VS_main(uint VertexID : SV_VertexID)
+{
+    VS_Out output = (VS_Out) 0;
+    
+    HS_In vertex = GridVertex(VertexID);
+    
+    output.texcoord = vertex.texcoord;
+    output.blendTexcoord = vertex.blendTexcoord;
+    output.WorldPos = vertex.WorldPos;
+    output.normal = vertex.normal;
     output.EyePos = EyePosW;
     
-    output.position = mul(output.position, View);
+    output.position = mul(float4(vertex.WorldPos, 1.0f), View);
+    
+    output.position = mul(output.position, Projection);
+    
+    return output;
+}
+
+HS_In VS_patch(uint VertexID : SV_VertexID)
+{
+    return GridVertex(VertexID);
+}
+
+HS_ConstantOut HS_Constant(InputPatch<HS_In, 3> patch)
+{
+    HS_ConstantOut output;
+    
+    // edge i is opposite control point i
+    output.edges[0] = TessEdgeFactor(patch[1].WorldPos, patch[2].WorldPos, EyePosW);
+    output.edges[1] = TessEdgeFactor(patch[2].WorldPos, patch[0].WorldPos, EyePosW);
+    output.edges[2] = TessEdgeFactor(patch[0].WorldPos, patch[1].WorldPos, EyePosW);
+    output.inside = (output.edges[0] + output.edges[1] + output.edges[2]) / 3.0f;
+    
+    return output;
+}
+
+[domain("tri")]
+[partitioning("fractional_odd")]
+[outputtopology("triangle_cw")]
+[outputcontrolpoints(3)]
+[patchconstantfunc("HS_Constant")]
+[maxtessfactor(64.0f)]
+HS_In HS_main(InputPatch<HS_In, 3> patch, uint i : SV_OutputControlPointID)
+{
+    return patch[i];
+}
+
+[domain("tri")]
+VS_Out DS_main(HS_ConstantOut factors, float3 bary : SV_DomainLocation, const OutputPatch<HS_In, 3> patch)
+{
+    VS_Out output = (VS_Out) 0;
+    
+    float3 worldPos = patch[0].WorldPos * bary.x + patch[1].WorldPos * bary.y + patch[2].WorldPos * bary.z;
+    
+    output.normal = normalize(patch[0].normal * bary.x + patch[1].normal * bary.y + patch[2].normal * bary.z);
+    output.texcoord = patch[0].texcoord * bary.x + patch[1].texcoord * bary.y + patch[2].texcoord * bary.z;
+    output.blendTexcoord = patch[0].blendTexcoord * bary.x + patch[1].blendTexcoord * bary.y + patch[2].blendTexcoord * bary.z;
+    
+    // terrain world is never rotated, so the grid normal is already in world space
+    output.WorldPos = Displace(worldPos, output.normal, output.texcoord * DetailTiling);
+    output.EyePos = EyePosW;
     
+    output.position = mul(float4(output.WorldPos, 1.0f), View);
     output.position = mul(output.position, Projection);
     
     return output;
@@ -88,14 +205,27 @@ VS_Out VS_main(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoo
 
 float4 PS_main(VS_Out input) : SV_TARGET
 {
-    float4 tex0 = texLDirt.Sample(bilinerSampler, input.texcoord); // replaces ambient and diffuse mat
-    float4 tex1 = texDDirt.Sample(bilinerSampler, input.texcoord);
-    float4 tex2 = texGrass.Sample(bilinerSampler, input.texcoord);
-    float4 tex3 = texStone.Sample(bilinerSampler, input.texcoord);
-    float4 tex4 = texSnow.Sample(bilinerSampler, input.texcoord);
-    float4 tex5 = texBlend.Sample(bilinerSampler, input.texcoord);
+    float4 weights = texBlend.Sample(bilinerSampler, input.blendTexcoord);
+    float baseWeight = saturate(1.0f - dot(weights, 1.0f));
+    
+    // a texel holds at most three layers and most pixels see one or two, so only layers with any filtered weight are
+    // fetched. texels without light dirt sum to exactly 255, the base test only allows for float error in the filter.
+    // the gradients are taken up front as the branches can diverge across a quad
+    float2 uvDdx = ddx(input.texcoord);
+    float2 uvDdy = ddy(input.texcoord);
+    
+    float4 albedo = float4(0.0f, 0.0f, 0.0f, 0.0f);
+    [branch] if (baseWeight > 0.5f / 255.0f) albedo += texLDirt.SampleGrad(bilinerSampler, input.texcoord, uvDdx, uvDdy) * baseWeight;
+    [branch] if (weights.r > 0.0f) albedo += texGrass.SampleGrad(bilinerSampler, input.texcoord, uvDdx, uvDdy) * weights.r;
+    [branch] if (weights.g > 0.0f) albedo += texDDirt.SampleGrad(bilinerSampler, input.texcoord, uvDdx, uvDdy) * weights.g;
+    [branch] if (weights.b > 0.0f) albedo += texStone.SampleGrad(bilinerSampler, input.texcoord, uvDdx, uvDdy) * weights.b;
+    [branch] if (weights.a > 0.0f) albedo += texSnow.SampleGrad(bilinerSampler, input.texcoord, uvDdx, uvDdy) * weights.a;
     
-    clip(tex0.a - 0.1f);
+    clip(albedo.a - 0.1f);
+    
+    // replaces ambient and diffuse mat
+    float4 diffuseMat = HasTexture == 1 ? albedo : DiffuseMaterial;
+    float4 ambientMat = HasTexture == 1 ? albedo : AmbientMaterial;
     
     float3 WorldNorm = normalize(mul(float4(input.normal, 0), World));
     
@@ -120,40 +250,8 @@ float4 PS_main(VS_Out input) : SV_TARGET
     
     float dotViewReflect = dot(Reflect, ViewV);
     
-    if (HasTexture == 1)
-    {
-        // height checks - workd without any smoothness - use blend map to edit
-        if (input.WorldPos.y > 0 && input.WorldPos.y <= 10)
-        {
-            diffuse = DiffuseAmount * (DirLight.m_diffuseColor * lerp(tex2, tex1, input.WorldPos.y / 10));
-            ambient = DirLight.m_ambientColor * lerp(tex2, tex1, input.WorldPos.y / 10);
-        }
-        else if (input.WorldPos.y > 10 && input.WorldPos.y <= 20)
-        {
-            diffuse = DiffuseAmount * (DirLight.m_diffuseColor * lerp(tex1, tex0, (input.WorldPos.y - 10) / 10));
-            ambient = DirLight.m_ambientColor * lerp(tex1, tex0, (input.WorldPos.y - 10) / 10);
-        }
-        else if (input.WorldPos.y > 20 && input.WorldPos.y <= 30)
-        {
-            diffuse = DiffuseAmount * (DirLight.m_diffuseColor * lerp(tex0, tex3, (input.WorldPos.y - 20) / 10));
-            ambient = DirLight.m_ambientColor * lerp(tex0, tex3, (input.WorldPos.y - 20) / 10);
-        }
-        else if (input.WorldPos.y > 30 && input.WorldPos.y <= 40)
-        {
-            diffuse = DiffuseAmount * (DirLight.m_diffuseColor * lerp(tex3, tex4, (input.WorldPos.y - 30) / 10));
-            ambient = DirLight.m_ambientColor * lerp(tex3, tex4, (input.WorldPos.y - 30) / 10);
-        }
-        else
-        {
-            diffuse = DiffuseAmount * (DirLight.m_diffuseColor * tex4);
-            ambient = DirLight.m_ambientColor * tex4;
-        }
-    }
-    else
-    {
-        diffuse = DiffuseAmount * (DirLight.m_diffuseColor * DiffuseMaterial);
-        ambient = DirLight.m_ambientColor * AmbientMaterial;
-    }
+    diffuse = DiffuseAmount * (DirLight.m_diffuseColor * diffuseMat);
+    ambient = DirLight.m_ambientColor * ambientMat;
     
     specular = DirLight.m_specularColor * SpecularMaterial * pow(saturate(dotViewReflect), SpecularPower);
     
@@ -179,34 +277,7 @@ float4 PS_main(VS_Out input) : SV_TARGET
             SpecFactor = pow(saturate(dot(Ref, ViewV)), SpecularPower);
         }
         
-        if (HasTexture == 1)
-        {
-            // height checks - workd without any smoothness - use blend map to edit
-            if (input.WorldPos.y > 0 && input.WorldPos.y <= 10)
-            {
-                pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * lerp(tex2, tex1, input.WorldPos.y / 10));
-            }
-            else if (input.WorldPos.y > 10 && input.WorldPos.y <= 20)
-            {
-                pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * lerp(tex1, tex0, (input.WorldPos.y - 10) / 10));
-            }
-            else if (input.WorldPos.y > 20 && input.WorldPos.y <= 30)
-            {
-                pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * lerp(tex0, tex3, (input.WorldPos.y - 20) / 10));
-            }
-            else if (input.WorldPos.y > 30 && input.WorldPos.y <= 40)
-            {
-                pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * lerp(tex3, tex4, (input.WorldPos.y - 30) / 10));
-            }
-            else
-            {
-                pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * tex4);
-            }
-        }
-        else
-        {
-            pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * DiffuseMaterial);
-        }
+        pDiffuse = DiffuseAmountPt * (PtLight.m_diffuseColor * diffuseMat);
 
         pSpecular = PtLight.m_specularColor * SpecularMaterial * SpecFactor;
         
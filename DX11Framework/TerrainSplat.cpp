@@ -0,0 +1,204 @@
+#include "TerrainSplat.h"
+#include <fstream>
+
+/// <summary>
+/// height bands give up to two layers, steep ground is then pulled towards stone.
+/// rounding keeps the four stored weights summing to no more than 255 so light dirt never goes negative, and to exactly
+/// 255 where there is no light dirt
+/// </summary>
+/// <param name="normalisedHeight">world height / height scale</param>
+/// <param name="normalY"></param>
+/// <param name="settings"></param>
+/// <returns></returns>
+UINT ComputeSplatTexel(float normalisedHeight, float normalY, const SplatSettings& settings) {
+	const UINT order[LAYER_COUNT] = { LAYER_GRASS, LAYER_DARKDIRT, LAYER_LIGHTDIRT, LAYER_STONE, LAYER_SNOW };
+	const float heights[LAYER_COUNT] = { settings.m_grassHeight, settings.m_darkDirtHeight, settings.m_lightDirtHeight, settings.m_stoneHeight, settings.m_snowHeight };
+
+	float weights[LAYER_COUNT] = {};
+
+	if (normalisedHeight <= heights[0]) {
+		weights[order[0]] = 1.0f;
+	}
+	else if (normalisedHeight >= heights[LAYER_COUNT - 1]) {
+		weights[order[LAYER_COUNT - 1]] = 1.0f;
+	}
+	else {
+		for (UINT i = 0; i < LAYER_COUNT - 1; ++i) {
+			if (normalisedHeight <= heights[i + 1]) {
+				float range = heights[i + 1] - heights[i];
+				float t = range > 0.0f ? (normalisedHeight - heights[i]) / range : 1.0f;
+				weights[order[i]] = 1.0f - t;
+				weights[order[i + 1]] += t;
+				break;
+			}
+		}
+	}
+
+	float slopeRange = settings.m_slopeEnd - settings.m_slopeStart;
+	float slope = slopeRange > 0.0f ? (1.0f - normalY - settings.m_slopeStart) / slopeRange : 0.0f;
+	slope = min(1.0f, max(0.0f, slope));
+
+	for (UINT i = 0; i < LAYER_COUNT; ++i) {
+		weights[i] *= 1.0f - slope;
+	}
+	weights[LAYER_STONE] += slope;
+
+	const UINT stored[4] = { LAYER_GRASS, LAYER_DARKDIRT, LAYER_STONE, LAYER_SNOW };
+	UINT bytes[4];
+	UINT total = 0;
+
+	for (UINT i = 0; i < 4; ++i) {
+		bytes[i] = (UINT)(min(1.0f, max(0.0f, weights[stored[i]])) * 255.0f + 0.5f);
+		total += bytes[i];
+	}
+
+	UINT largest = 0;
+	for (UINT i = 1; i < 4; ++i) {
+		if (bytes[i] > bytes[largest]) largest = i;
+	}
+
+	// rounding up every channel can overshoot by a few steps, take it off the largest. rounding down would leave
+	// light dirt a few steps it never had, which costs the shader a fetch, so the largest gets those back
+	if (total > 255) bytes[largest] -= total - 255;
+	else if (total < 255 && weights[LAYER_LIGHTDIRT] * 255.0f < 0.5f) bytes[largest] += 255 - total;
+
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
+}
+
+// bump when ComputeSplatTexel changes, so splat maps baked by the old rules are not reused
+static const UINT SPLAT_BAKE_VERSION = 2;
+
+// 64 bit FNV-1a
+static UINT64 HashBytes(UINT64 hash, const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/// <summary>
+/// hashes everything ComputeSplatTexel's inputs come from, a stored splat map is only reused while this matches
+/// </summary>
+/// <param name="heights">columns * rows world heights</param>
+/// <param name="columns"></param>
+/// <param name="rows"></param>
+/// <param name="cellSizeX"></param>
+/// <param name="cellSizeZ"></param>
+/// <param name="heightScale"></param>
+/// <param name="settings"></param>
+/// <returns></returns>
+UINT64 ComputeSplatKey(const float* heights, UINT columns, UINT rows, float cellSizeX, float cellSizeZ, float heightScale, const SplatSettings& settings) {
+	UINT64 hash = 0xcbf29ce484222325ull;
+	hash = HashBytes(hash, &SPLAT_BAKE_VERSION, sizeof(SPLAT_BAKE_VERSION));
+	hash = HashBytes(hash, &columns, sizeof(columns));
+	hash = HashBytes(hash, &rows, sizeof(rows));
+	hash = HashBytes(hash, &cellSizeX, sizeof(cellSizeX));
+	hash = HashBytes(hash, &cellSizeZ, sizeof(cellSizeZ));
+	hash = HashBytes(hash, &heightScale, sizeof(heightScale));
+
+	const float fields[] = { settings.m_grassHeight, settings.m_darkDirtHeight, settings.m_lightDirtHeight, settings.m_stoneHeight,
+		settings.m_snowHeight, settings.m_slopeStart, settings.m_slopeEnd };
+	hash = HashBytes(hash, fields, sizeof(fields));
+
+	return HashBytes(hash, heights, (size_t)columns * rows * sizeof(float));
+}
+
+// minimal DDS header layout, see the DDS_HEADER docs
+struct SplatDDSPixelFormat
+{
+	UINT m_size;
+	UINT m_flags;
+	UINT m_fourCC;
+	UINT m_rgbBitCount;
+	UINT m_rBitMask;
+	UINT m_gBitMask;
+	UINT m_bBitMask;
+	UINT m_aBitMask;
+};
+
+struct SplatDDSHeader
+{
+	UINT m_size;
+	UINT m_flags;
+	UINT m_height;
+	UINT m_width;
+	UINT m_pitchOrLinearSize;
+	UINT m_depth;
+	UINT m_mipMapCount;
+	UINT m_reserved1[11];
+	SplatDDSPixelFormat m_pixelFormat;
+	UINT m_caps;
+	UINT m_caps2;
+	UINT m_caps3;
+	UINT m_caps4;
+	UINT m_reserved2;
+};
+
+static const UINT DDS_MAGIC = 0x20534444; // "DDS "
+static const UINT SPLAT_TAG = 0x544c5053; // "SPLT" in m_reserved1[0], the key follows in [1] and [2]
+
+/// <summary>
+/// writes the texels as a single mip DDS
+/// </summary>
+/// <param name="fileName"></param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="texels"></param>
+/// <param name="key">from ComputeSplatKey, read back by ReadSplatDDSKey</param>
+/// <returns></returns>
+HRESULT SaveSplatDDS(const std::string& fileName, UINT width, UINT height, const std::vector<UINT>& texels, UINT64 key) {
+	if (texels.size() < (size_t)width * height) return E_INVALIDARG;
+
+	std::ofstream outFile(fileName.c_str(), std::ios::out | std::ios::binary);
+	if (!outFile) return E_FAIL;
+
+	SplatDDSHeader header = {};
+	header.m_size = sizeof(SplatDDSHeader);
+	header.m_flags = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000; // caps, height, width, pitch, pixel format
+	header.m_height = height;
+	header.m_width = width;
+	header.m_pitchOrLinearSize = width * sizeof(UINT);
+	header.m_reserved1[0] = SPLAT_TAG;
+	header.m_reserved1[1] = (UINT)key;
+	header.m_reserved1[2] = (UINT)(key >> 32);
+	header.m_pixelFormat.m_size = sizeof(SplatDDSPixelFormat);
+	header.m_pixelFormat.m_flags = 0x40 | 0x1; // rgb, alpha pixels
+	header.m_pixelFormat.m_rgbBitCount = 32;
+	header.m_pixelFormat.m_rBitMask = 0x000000ff;
+	header.m_pixelFormat.m_gBitMask = 0x0000ff00;
+	header.m_pixelFormat.m_bBitMask = 0x00ff0000;
+	header.m_pixelFormat.m_aBitMask = 0xff000000;
+	header.m_caps = 0x1000; // texture
+
+	outFile.write((const char*)&DDS_MAGIC, sizeof(DDS_MAGIC));
+	outFile.write((const char*)&header, sizeof(header));
+	outFile.write((const char*)texels.data(), (std::streamsize)width * height * sizeof(UINT));
+
+	outFile.close();
+	return outFile.fail() ? E_FAIL : S_OK;
+}
+
+/// <summary>
+/// reads just the header of a splat map for the key it was baked with
+/// </summary>
+/// <param name="fileName"></param>
+/// <param name="width">expected size, a map of any other size is not a match</param>
+/// <param name="height"></param>
+/// <param name="key"></param>
+/// <returns></returns>
+bool ReadSplatDDSKey(const std::string& fileName, UINT width, UINT height, UINT64& key) {
+	std::ifstream inFile(fileName.c_str(), std::ios::in | std::ios::binary);
+	if (!inFile) return false;
+
+	UINT magic = 0;
+	SplatDDSHeader header = {};
+	inFile.read((char*)&magic, sizeof(magic));
+	inFile.read((char*)&header, sizeof(header));
+	if (!inFile || magic != DDS_MAGIC || header.m_reserved1[0] != SPLAT_TAG) return false;
+	if (header.m_width != width || header.m_height != height) return false;
+
+	key = header.m_reserved1[1] | ((UINT64)header.m_reserved1[2] << 32);
+	return true;
+}
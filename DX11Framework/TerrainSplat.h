@@ -0,0 +1,41 @@
+#pragma once
+#include <windows.h>
+#include <string>
+#include <vector>
+
+// texture layers as they are bound to the terrain pixel shader (t0 - t4)
+enum TerrainLayer
+{
+	LAYER_LIGHTDIRT,
+	LAYER_DARKDIRT,
+	LAYER_GRASS,
+	LAYER_STONE,
+	LAYER_SNOW,
+	LAYER_COUNT
+};
+
+struct SplatSettings
+{
+	// height of each layer as a fraction of the height scale, layers blend linearly between their neighbours
+	float m_grassHeight = 0.0f;
+	float m_darkDirtHeight = 0.2f;
+	float m_lightDirtHeight = 0.4f;
+	float m_stoneHeight = 0.6f;
+	float m_snowHeight = 0.8f;
+
+	// 1 - normal.y where slopes start and finish turning to stone
+	float m_slopeStart = 0.25f;
+	float m_slopeEnd = 0.45f;
+};
+
+// weights for one texel packed as RGBA8: grass, dark dirt, stone, snow. light dirt takes whatever is left
+UINT ComputeSplatTexel(float normalisedHeight, float normalY, const SplatSettings& settings);
+
+// identifies what a bake was made from: the heights, the grid spacing the normals use and the settings
+UINT64 ComputeSplatKey(const float* heights, UINT columns, UINT rows, float cellSizeX, float cellSizeZ, float heightScale, const SplatSettings& settings);
+
+// writes an uncompressed R8G8B8A8 DDS that the DDS loader reads back as DXGI_FORMAT_R8G8B8A8_UNORM, key goes in reserved header fields
+HRESULT SaveSplatDDS(const std::string& fileName, UINT width, UINT height, const std::vector<UINT>& texels, UINT64 key);
+
+// false unless the file is a width x height splat map written by SaveSplatDDS
+bool ReadSplatDDSKey(const std::string& fileName, UINT width, UINT height, UINT64& key);
@@ -0,0 +1,83 @@
+#include "Tessellation.h"
+#include <cmath>
+
+/// <summary>
+/// projection _22 is cot(fovY / 2), so half the viewport height over that is one unit's height in pixels at distance 1
+/// </summary>
+/// <param name="projection"></param>
+/// <param name="viewportHeight"></param>
+/// <returns></returns>
+float GetPixelsPerUnit(const XMFLOAT4X4& projection, float viewportHeight) {
+	return projection._22 * viewportHeight * 0.5f;
+}
+
+/// <summary>
+/// screen space edge length sets the factor, distance then caps it so far edges fall back to a single segment
+/// </summary>
+/// <param name="p0"></param>
+/// <param name="p1"></param>
+/// <param name="eye"></param>
+/// <param name="pixelsPerUnit"></param>
+/// <param name="settings"></param>
+/// <returns>factor between 1 and the settings max</returns>
+float ComputeEdgeTessFactor(XMFLOAT3 p0, XMFLOAT3 p1, XMFLOAT3 eye, float pixelsPerUnit, const TessellationSettings& settings) {
+	XMVECTOR a = XMLoadFloat3(&p0);
+	XMVECTOR b = XMLoadFloat3(&p1);
+
+	float edgeLength = XMVectorGetX(XMVector3Length(b - a));
+	float distance = XMVectorGetX(XMVector3Length((a + b) * 0.5f - XMLoadFloat3(&eye)));
+	distance = max(distance, 0.0001f);
+
+	float edgePixels = edgeLength * pixelsPerUnit / distance;
+	float screenFactor = edgePixels / max(settings.m_targetEdgePixels, 1.0f);
+
+	float range = settings.m_farDistance - settings.m_nearDistance;
+	float falloff = range > 0.0f ? (distance - settings.m_nearDistance) / range : (distance > settings.m_farDistance ? 1.0f : 0.0f);
+	falloff = 1.0f - min(1.0f, max(0.0f, falloff));
+
+	float distanceCap = 1.0f + (settings.m_maxFactor - 1.0f) * falloff;
+
+	return min(distanceCap, max(1.0f, screenFactor));
+}
+
+/// <summary>
+/// factors worked by hand from the formula TessEdgeFactor and ComputeEdgeTessFactor share, at 500 pixels per unit with
+/// the default settings: near 5, far 80, max 16 and 8 pixel segments. each edge lies across the view with its middle
+/// straight ahead, and is also tried the other way round, as a shared edge must get one factor from either patch
+/// </summary>
+/// <param name="caseCount">worked cases checked</param>
+/// <returns>true when every case is within rounding</returns>
+bool CheckEdgeTessFactors(UINT& caseCount) {
+	struct EdgeCase
+	{
+		float m_edgeLength;
+		float m_distance; // eye to the edge's middle
+		float m_expected;
+	};
+
+	const EdgeCase cases[] = {
+		{ 1.0f, 10.0f, 6.25f }, // 50 pixels over 8, under the cap of 15
+		{ 1.0f, 2.0f, 16.0f }, // inside the near distance, 31.25 clamps to the max
+		{ 4.0f, 42.5f, 100.0f / 17.0f }, // half way out, under the cap of 8.5
+		{ 10.0f, 42.5f, 8.5f }, // half way out, 14.7 clamps to the cap
+		{ 0.01f, 10.0f, 1.0f }, // under a segment's worth of pixels
+		{ 50.0f, 100.0f, 1.0f }, // past the far distance
+	};
+
+	TessellationSettings settings;
+	XMFLOAT3 eye(0.0f, 0.0f, 0.0f);
+	bool matches = true;
+
+	for (const EdgeCase& edge : cases) {
+		XMFLOAT3 p0(-edge.m_edgeLength * 0.5f, 0.0f, edge.m_distance);
+		XMFLOAT3 p1(edge.m_edgeLength * 0.5f, 0.0f, edge.m_distance);
+
+		float forward = ComputeEdgeTessFactor(p0, p1, eye, 500.0f, settings);
+		float backward = ComputeEdgeTessFactor(p1, p0, eye, 500.0f, settings);
+
+		if (fabsf(forward - edge.m_expected) > edge.m_expected * 1e-4f || forward != backward) matches = false;
+	}
+
+	caseCount = sizeof(cases) / sizeof(cases[0]);
+	return matches;
+}
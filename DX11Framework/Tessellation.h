@@ -0,0 +1,24 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+struct TessellationSettings
+{
+	float m_nearDistance = 5.0f; // edges closer than this may use the full factor
+	float m_farDistance = 80.0f; // edges further than this are not tessellated
+	float m_maxFactor = 16.0f;
+	float m_targetEdgePixels = 8.0f; // screen length each tessellated segment should end up with
+	float m_displacementScale = 0.3f; // world units for a full white DISP texel, centred on mid grey
+};
+
+// pixels covered by one world unit at distance 1, scale by 1 / distance for anything further away
+float GetPixelsPerUnit(const XMFLOAT4X4& projection, float viewportHeight);
+
+// tessellation factor for the edge p0 - p1, must stay in step with TessEdgeFactor in Tessellation.hlsli.
+// symmetric in p0 and p1 so patches sharing an edge always agree and never crack
+float ComputeEdgeTessFactor(XMFLOAT3 p0, XMFLOAT3 p1, XMFLOAT3 eye, float pixelsPerUnit, const TessellationSettings& settings);
+
+// checks ComputeEdgeTessFactor against worked cases under the default settings, -benchmark reports the result
+bool CheckEdgeTessFactors(UINT& caseCount);
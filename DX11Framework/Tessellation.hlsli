@@ -0,0 +1,36 @@
+// shared by every shader with a hull/domain stage, TessEdgeFactor mirrors ComputeEdgeTessFactor in Tessellation.cpp
+
+cbuffer TessellationBuffer : register(b4)
+{
+    float NearDistance;
+    float FarDistance;
+    float MaxFactor;
+    float TargetEdgePixels;
+    float PixelsPerUnit;
+    float DisplacementScale;
+    float2 padding;
+}
+
+Texture2D dispTex : register(t0); // domain stage
+SamplerState dispSampler : register(s0);
+
+float TessEdgeFactor(float3 p0, float3 p1, float3 eye)
+{
+    float edgeLength = length(p1 - p0);
+    float dist = max(length((p0 + p1) * 0.5f - eye), 0.0001f);
+    
+    float screenFactor = edgeLength * PixelsPerUnit / dist / max(TargetEdgePixels, 1.0f);
+    
+    float range = FarDistance - NearDistance;
+    float falloff = range > 0.0f ? (dist - NearDistance) / range : (dist > FarDistance ? 1.0f : 0.0f);
+    float distanceCap = 1.0f + (MaxFactor - 1.0f) * (1.0f - saturate(falloff));
+    
+    return min(distanceCap, max(1.0f, screenFactor));
+}
+
+// mid grey is the undisplaced surface
+float3 Displace(float3 worldPos, float3 worldNormal, float2 uv)
+{
+    float height = dispTex.SampleLevel(dispSampler, uv, 0).r;
+    return worldPos + worldNormal * (height - 0.5f) * DisplacementScale;
+}
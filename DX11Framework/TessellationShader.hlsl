@@ -0,0 +1,143 @@
+#include "Tessellation.hlsli"
+
+// hull/domain path for GameObject meshes, the domain output matches SimpleShaders VS_Out so its PS_main is reused
+
+struct DirectionalLight
+{
+    float4 m_ambientColor;
+    float4 m_specularColor;
+    float4 m_diffuseColor;
+    float3 m_direction;
+    float padding;
+};
+
+struct PointLight
+{
+    float4 m_ambientColor;
+    float4 m_specularColor;
+    float4 m_diffuseColor;
+    float m_maxDistance;
+    float3 m_position;
+    float3 m_attenuation; // control light intensity falloff
+    float padding;
+};
+
+struct Fog
+{
+    float4 m_color;
+    float m_start;
+    float m_range;
+};
+
+cbuffer FrameBuffer : register(b0)
+{
+    float4x4 Projection;
+    float4x4 View;
+    DirectionalLight DirLight;
+    PointLight PtLight;
+    float3 EyePosW;
+    uint FogEnabled;
+    Fog FogW;
+}
+
+cbuffer MaterialBuffer : register(b1)
+{
+    float4 DiffuseMaterial;
+    float4 AmbientMaterial;
+    float4 SpecularMaterial;
+    uint HasTexture;
+    uint SpecMap;
+    uint NormMap;
+    float SpecularPower;
+}
+
+cbuffer ObjectBuffer : register(b2)
+{
+    float4x4 World;
+}
+
+struct VS_Out
+{
+    float4 position : SV_POSITION;
+    float3 normal : NORMAL;
+    float4 color : COLOR;
+    float2 texcoord : TEXCOORD0;
+    float3 WorldPos : TEXCOORD1;
+    float3 EyePos : LIGHTPOS;
+    float3 LightPosPoint : LIGHTPOS1;
+    float3 Tangent : TANGENT;
+};
+
+struct HS_In
+{
+    float3 WorldPos : WORLDPOS;
+    float3 normal : NORMAL;
+    float2 texcoord : TEXCOORD0;
+    float3 Tangent : TANGENT;
+};
+
+struct HS_ConstantOut
+{
+    float edges[3] : SV_TessFactor;
+    float inside : SV_InsideTessFactor;
+};
+
+HS_In VS_main(float3 Position : POSITION, float3 Normal : NORMAL, float2 TexCoord : TEXCOORD, float3 Tangent : TANGENT)
+{
+    HS_In output = (HS_In) 0;
+    
+    output.WorldPos = mul(float4(Position, 1.0f), World).xyz;
+    output.normal = Normal;
+    output.texcoord = TexCoord;
+    output.Tangent = Tangent;
+    
+    return output;
+}
+
+HS_ConstantOut HS_Constant(InputPatch<HS_In, 3> patch)
+{
+    HS_ConstantOut output;
+    
+    // edge i is opposite control point i
+    output.edges[0] = TessEdgeFactor(patch[1].WorldPos, patch[2].WorldPos, EyePosW);
+    output.edges[1] = TessEdgeFactor(patch[2].WorldPos, patch[0].WorldPos, EyePosW);
+    output.edges[2] = TessEdgeFactor(patch[0].WorldPos, patch[1].WorldPos, EyePosW);
+    output.inside = (output.edges[0] + output.edges[1] + output.edges[2]) / 3.0f;
+    
+    return output;
+}
+
+[domain("tri")]
+[partitioning("fractional_odd")]
+[outputtopology("triangle_cw")]
+[outputcontrolpoints(3)]
+[patchconstantfunc("HS_Constant")]
+[maxtessfactor(64.0f)]
+HS_In HS_main(InputPatch<HS_In, 3> patch, uint i : SV_OutputControlPointID)
+{
+    return patch[i];
+}
+
+[domain("tri")]
+VS_Out DS_main(HS_ConstantOut factors, float3 bary : SV_DomainLocation, const OutputPatch<HS_In, 3> patch)
+{
+    VS_Out output = (VS_Out) 0;
+    
+    float3 worldPos = patch[0].WorldPos * bary.x + patch[1].WorldPos * bary.y + patch[2].WorldPos * bary.z;
+    float3 normal = normalize(patch[0].normal * bary.x + patch[1].normal * bary.y + patch[2].normal * bary.z);
+    
+    output.texcoord = patch[0].texcoord * bary.x + patch[1].texcoord * bary.y + patch[2].texcoord * bary.z;
+    output.Tangent = patch[0].Tangent * bary.x + patch[1].Tangent * bary.y + patch[2].Tangent * bary.z;
+    output.normal = normal;
+    
+    worldPos = Displace(worldPos, normalize(mul(float4(normal, 0), World).xyz), output.texcoord);
+    
+    output.WorldPos = worldPos;
+    output.EyePos = EyePosW;
+    output.LightPosPoint = PtLight.m_position;
+    
+    output.position = mul(float4(worldPos, 1.0f), View);
+    output.position = mul(output.position, Projection);
+    
+    return output;
+}
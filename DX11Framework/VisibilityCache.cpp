@@ -0,0 +1,286 @@
+#include "VisibilityCache.h"
+#include <algorithm>
+#include <random>
+
+// a frame moving or turning further than this would lapse most results, the cache starts over instead. neither
+// can carry a clock half way round its ring in one frame
+static const float FAST_TRAVEL = 4.0f;
+static const float FAST_TURN = XM_PI / 16.0f;
+static const double TRAVEL_BUCKET = 1.0 / 32.0;
+static const double TURN_BUCKET = 1.0 / 2048.0;
+
+// how much of a margin either clock can get, whatever the camera has been doing
+static const double MIN_SHARE = 0.1;
+
+VisibilityCache::VisibilityCache() {
+	m_travel.m_width = TRAVEL_BUCKET;
+	m_turn.m_width = TURN_BUCKET;
+}
+
+/// <summary>
+/// results for the camera given by view, reusing the last frame's where the camera cannot have moved far enough
+/// to change them
+/// </summary>
+/// <param name="bvh">the BVH the cache was filled from, its object count must not change between calls</param>
+/// <param name="frustum">of view and the camera's projection, which must not change between calls</param>
+/// <param name="view"></param>
+/// <returns>true when every object was classified again</returns>
+bool VisibilityCache::Update(SceneBVH& bvh, const Frustum& frustum, const XMFLOAT4X4& view) {
+	// a view matrix is a rotation and then the eye moved to the origin
+	XMMATRIX viewMatrix = XMLoadFloat4x4(&view);
+	XMVECTOR eye = XMVectorNegate(XMVector3TransformNormal(viewMatrix.r[3], XMMatrixTranspose(viewMatrix)));
+
+	float travel = 0.0f, turn = 0.0f;
+	if (m_valid) {
+		travel = XMVectorGetX(XMVector3Length(XMVectorSubtract(eye, XMLoadFloat3(&m_eye))));
+
+		// two rotations an angle a apart differ by 2 * sqrt(2) * sin(a / 2) over their nine entries, which unlike
+		// the cosine from a dot product does not round small turns down to nothing
+		XMMATRIX lastView = XMLoadFloat4x4(&m_view);
+		float chordSq = 0.0f;
+		for (UINT r = 0; r < 3; r++) chordSq += XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(viewMatrix.r[r], lastView.r[r])));
+		turn = 2.0f * asinf(min(1.0f, sqrtf(chordSq * 0.125f)));
+
+		// a switch to another camera is just more travel and turn, every camera has the same projection
+		if (travel > FAST_TRAVEL || turn > FAST_TURN || bvh.GetObjectCount() != (UINT)m_objects.size()) m_valid = false;
+
+		m_travelRate = 0.9f * m_travelRate + 0.1f * travel;
+		m_turnRate = 0.9f * m_turnRate + 0.1f * turn;
+	}
+
+	XMStoreFloat3(&m_eye, eye);
+	m_view = view;
+
+	if (!m_valid) {
+		Rebuild(bvh, frustum);
+		return true;
+	}
+
+	m_tested = 0;
+	for (UINT object : m_changed) Store(object, bvh.ClassifyObject(frustum, m_eye, object));
+	m_changed.clear();
+
+	Advance(m_travel, travel);
+	Advance(m_turn, turn);
+	Expire(bvh, frustum, m_travel);
+	Expire(bvh, frustum, m_turn);
+
+	// every test leaves an entry behind on the clock that did not lapse, and a standing camera never passes them
+	if (m_queued > 4 * (UINT)m_objects.size() + 64) Compact();
+	return false;
+}
+
+/// <summary>
+/// classify every object from the BVH and start both clocks again
+/// </summary>
+/// <param name="bvh"></param>
+/// <param name="frustum"></param>
+void VisibilityCache::Rebuild(SceneBVH& bvh, const Frustum& frustum) {
+	bvh.ClassifyObjects(frustum, m_eye, m_classified);
+
+	UINT count = (UINT)m_classified.size();
+	m_objects.assign(count, { 0, (UINT)NOT_VISIBLE });
+	m_visible.clear();
+	m_changed.clear();
+
+	for (LapseClock* clock : { &m_travel, &m_turn }) {
+		clock->m_sum = 0.0;
+		clock->m_next = 0;
+		clock->m_spread = 0;
+		for (std::vector<Expiry>& bucket : clock->m_ring) bucket.clear();
+		clock->m_later.clear();
+		clock->m_due.clear();
+	}
+	m_queued = 0;
+
+	for (UINT object = 0; object < count; object++) Store(object, m_classified[object]);
+
+	m_valid = true;
+	m_tested = count;
+}
+
+/// <summary>
+/// keep a fresh result and queue when it lapses. moving the eye by t and turning by a about it moves a point r away
+/// by at most t + r * a, and the eye can have got t further away while turning, so the margin is shared between
+/// travel and (r + t) * a. the shares follow how fast the camera has lately been moving and turning, so a camera
+/// doing only one of them keeps results nearly twice as long as an even split would
+/// </summary>
+/// <param name="object"></param>
+/// <param name="visibility"></param>
+void VisibilityCache::Store(UINT object, const ObjectVisibility& visibility) {
+	CachedObject& cached = m_objects[object];
+	UINT stamp = ++cached.m_stamp;
+	m_tested++;
+
+	UINT& slot = cached.m_visibleSlot;
+	if (visibility.m_visible && slot == NOT_VISIBLE) {
+		slot = (UINT)m_visible.size();
+		m_visible.push_back(object);
+	}
+	else if (!visibility.m_visible && slot != NOT_VISIBLE) {
+		// the last visible object takes its place
+		m_visible[slot] = m_visible.back();
+		m_objects[m_visible.back()].m_visibleSlot = slot;
+		m_visible.pop_back();
+		slot = NOT_VISIBLE;
+	}
+
+	double margin = max(visibility.m_margin, 0.0f);
+	double sweep = m_travelRate + visibility.m_reach * m_turnRate;
+	double travelShare = sweep > 0.0 ? min(max(m_travelRate / sweep, MIN_SHARE), 1.0 - MIN_SHARE) : 0.5;
+
+	double travel = travelShare * margin;
+	double turn = margin > 0.0 ? (margin - travel) / (visibility.m_reach + travel) : 0.0;
+	Queue(m_travel, { m_travel.m_sum + travel, object, stamp });
+	Queue(m_turn, { m_turn.m_sum + turn, object, stamp });
+}
+
+void VisibilityCache::Queue(LapseClock& clock, const Expiry& expiry) {
+	UINT64 bucket = (UINT64)(expiry.m_at / clock.m_width);
+	if (bucket < clock.m_next) clock.m_due.push_back(expiry);
+	else if (bucket < clock.m_next + CLOCK_BUCKETS) clock.m_ring[bucket % CLOCK_BUCKETS].push_back(expiry);
+	else clock.m_later.push_back(expiry);
+	m_queued++;
+}
+
+/// <summary>
+/// add to a clock's sum and move every bucket it has reached to m_due. whatever is past the ring is spread into it
+/// each time the clock has gone half way round, so nothing there can be due before it is in the ring
+/// </summary>
+/// <param name="clock"></param>
+/// <param name="distance">this frame's travel or turn</param>
+void VisibilityCache::Advance(LapseClock& clock, double distance) {
+	clock.m_sum += distance;
+
+	UINT64 next = (UINT64)(clock.m_sum / clock.m_width) + 1;
+	for (UINT64 bucket = clock.m_next; bucket < next && bucket < clock.m_next + CLOCK_BUCKETS; bucket++) {
+		std::vector<Expiry>& entries = clock.m_ring[bucket % CLOCK_BUCKETS];
+		clock.m_due.insert(clock.m_due.end(), entries.begin(), entries.end());
+		entries.clear();
+	}
+	clock.m_next = max(clock.m_next, next);
+
+	if (clock.m_next - clock.m_spread < CLOCK_BUCKETS / 2) return;
+	clock.m_spread = clock.m_next;
+
+	m_scratch.swap(clock.m_later);
+	clock.m_later.clear();
+	for (const Expiry& expiry : m_scratch) {
+		m_queued--;
+		if (expiry.m_stamp == m_objects[expiry.m_object].m_stamp) Queue(clock, expiry);
+	}
+	m_scratch.clear();
+}
+
+/// <summary>
+/// test again every result on a clock's due list that its sum has passed, the rest wait for the next Update
+/// </summary>
+/// <param name="bvh"></param>
+/// <param name="frustum"></param>
+/// <param name="clock"></param>
+void VisibilityCache::Expire(SceneBVH& bvh, const Frustum& frustum, LapseClock& clock) {
+	// Store can queue onto the due list, so it is walked from a copy
+	m_scratch.swap(clock.m_due);
+	clock.m_due.clear();
+
+	for (const Expiry& expiry : m_scratch) {
+		if (expiry.m_stamp != m_objects[expiry.m_object].m_stamp) {
+			m_queued--;
+		}
+		else if (expiry.m_at < clock.m_sum) {
+			m_queued--;
+			Store(expiry.m_object, bvh.ClassifyObject(frustum, m_eye, expiry.m_object));
+		}
+		else {
+			clock.m_due.push_back(expiry);
+		}
+	}
+	m_scratch.clear();
+}
+
+/// <summary>
+/// drop entries for results that have since been replaced
+/// </summary>
+void VisibilityCache::Compact() {
+	auto stale = [this](const Expiry& expiry) { return expiry.m_stamp != m_objects[expiry.m_object].m_stamp; };
+	auto compact = [&stale](std::vector<Expiry>& entries) { entries.erase(std::remove_if(entries.begin(), entries.end(), stale), entries.end()); return (UINT)entries.size(); };
+
+	m_queued = 0;
+	for (LapseClock* clock : { &m_travel, &m_turn }) {
+		for (std::vector<Expiry>& bucket : clock->m_ring) m_queued += compact(bucket);
+		m_queued += compact(clock->m_later);
+		m_queued += compact(clock->m_due);
+	}
+}
+
+/// <summary>
+/// average milliseconds per frame to cull count random boxes with SceneBVH::CullFrustum and with the cache, for a
+/// camera moving forward and turning by a fixed amount each frame. the cache's first full classification is left
+/// out, as it only happens when the camera jumps
+/// </summary>
+/// <param name="count"></param>
+/// <param name="frames"></param>
+/// <param name="travel">distance per frame</param>
+/// <param name="turn">degrees per frame</param>
+/// <param name="cullMs"></param>
+/// <param name="cachedMs"></param>
+/// <param name="testedFraction">objects the cache tested per frame over count</param>
+/// <param name="identical">whether the cache matched testing every object afresh on every frame</param>
+void VisibilityCache::Benchmark(UINT count, UINT frames, float travel, float turn, double& cullMs, double& cachedMs, float& testedFraction, bool& identical) {
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> position(-500.0f, 500.0f), size(0.5f, 2.0f);
+
+	std::vector<AABB> bounds(count);
+	for (UINT i = 0; i < count; i++) bounds[i] = SphereToAABB(XMFLOAT4(position(random), position(random), position(random), size(random)));
+
+	SceneBVH bvh;
+	bvh.Build(bounds.data(), count);
+
+	XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(90), 16.0f / 9.0f, 0.01f, 1000.0f);
+
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+	double msPerTick = 1000.0 / (double)frequency.QuadPart;
+
+	VisibilityCache cache;
+	std::vector<UINT> visible, cached;
+	LONGLONG cullTicks = 0, cachedTicks = 0;
+	UINT tested = 0;
+	identical = true;
+
+	for (UINT frame = 0; frame <= frames; frame++) {
+		float yaw = XMConvertToRadians(turn * frame);
+		XMFLOAT4X4 view, viewProjection;
+		XMFLOAT3 eye(0.0f, 0.0f, travel * frame);
+		XMStoreFloat4x4(&view, XMMatrixLookToLH(XMLoadFloat3(&eye), XMVectorSet(sinf(yaw), 0.0f, cosf(yaw), 0.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+		XMStoreFloat4x4(&viewProjection, XMLoadFloat4x4(&view) * projection);
+		Frustum frustum = ExtractFrustum(viewProjection);
+
+		QueryPerformanceCounter(&start);
+		bvh.CullFrustum(frustum, visible);
+		QueryPerformanceCounter(&end);
+		if (frame > 0) cullTicks += end.QuadPart - start.QuadPart;
+
+		QueryPerformanceCounter(&start);
+		cache.Update(bvh, frustum, view);
+		QueryPerformanceCounter(&end);
+		if (frame > 0) {
+			cachedTicks += end.QuadPart - start.QuadPart;
+			tested += cache.GetTestedCount();
+		}
+
+		// against each object's own test, CullFrustum can round a node's box out where the object's is just in
+		cached = cache.GetVisible();
+		std::sort(cached.begin(), cached.end());
+		visible.clear();
+		for (UINT i = 0; i < count; i++) {
+			if (bvh.ClassifyObject(frustum, eye, i).m_visible) visible.push_back(i);
+		}
+		if (visible != cached) identical = false;
+	}
+
+	UINT timed = max(frames, 1u);
+	cullMs = cullTicks * msPerTick / timed;
+	cachedMs = cachedTicks * msPerTick / timed;
+	testedFraction = count > 0 ? tested / ((float)count * timed) : 0.0f;
+}
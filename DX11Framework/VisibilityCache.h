@@ -0,0 +1,88 @@
+#pragma once
+#include <windows.h>
+#include <DirectXMath.h>
+#include <vector>
+#include "SceneBVH.h"
+
+using namespace DirectX;
+
+/// one camera's frustum results for every object of a SceneBVH, kept from frame to frame. a result stands until the
+/// camera has travelled part of its margin or turned far enough to sweep the rest across the object, so while
+/// the camera creeps or stands still only objects close to a plane and objects whose bounds changed are tested again.
+/// travel and turn are summed along the camera's path, which can only overstate how far it got, and every result
+/// waits in a bucket of the sum it lapses at, so a frame costs the results that lapse rather than the object count.
+/// a jump or a fast turn drops every result and classifies the whole BVH again
+class VisibilityCache
+{
+public:
+	static const UINT NOT_VISIBLE = 0xffffffff;
+
+private:
+	static const UINT CLOCK_BUCKETS = 1024;
+
+	struct Expiry
+	{
+		double m_at; // travel or turn sum the result lapses past
+		UINT m_object;
+		UINT m_stamp; // the object's stamp when queued, entries from before its last test are dropped
+	};
+
+	// results waiting on the travel or turn sum, in buckets of m_width by the sum they lapse at. a bucket is moved
+	// to m_due once the sum reaches it and m_due is held against the exact sum, so nothing is tested late
+	struct LapseClock
+	{
+		double m_sum = 0.0;
+		double m_width;
+		UINT64 m_next = 0; // first bucket not yet moved to m_due
+		UINT64 m_spread = 0; // m_next when m_later was last spread into the ring
+		std::vector<Expiry> m_ring[CLOCK_BUCKETS]; // bucket k in k % CLOCK_BUCKETS, up to CLOCK_BUCKETS past m_next
+		std::vector<Expiry> m_later;
+		std::vector<Expiry> m_due;
+	};
+
+	// together, as a retest is a random access to each object
+	struct CachedObject
+	{
+		UINT m_stamp; // bumped by every test
+		UINT m_visibleSlot; // index in m_visible, NOT_VISIBLE when culled
+	};
+
+	std::vector<CachedObject> m_objects; // by object id
+	std::vector<ObjectVisibility> m_classified; // scratch for Rebuild
+	std::vector<UINT> m_visible;
+	std::vector<UINT> m_changed; // objects whose bounds moved since the last Update
+	LapseClock m_travel;
+	LapseClock m_turn; // radians
+	std::vector<Expiry> m_scratch;
+	UINT m_queued = 0; // entries across both clocks, stale ones included
+
+	float m_travelRate = 0.0f; // per frame, smoothed
+	float m_turnRate = 0.0f;
+
+	XMFLOAT3 m_eye;
+	XMFLOAT4X4 m_view; // the last Update's
+	bool m_valid = false;
+	UINT m_tested = 0;
+
+	void Rebuild(SceneBVH& bvh, const Frustum& frustum);
+	void Store(UINT object, const ObjectVisibility& visibility);
+	void Queue(LapseClock& clock, const Expiry& expiry);
+	void Advance(LapseClock& clock, double distance);
+	void Expire(SceneBVH& bvh, const Frustum& frustum, LapseClock& clock);
+	void Compact();
+
+public:
+	VisibilityCache();
+
+	bool Update(SceneBVH& bvh, const Frustum& frustum, const XMFLOAT4X4& view);
+
+	// the object's bounds changed, it is tested again on the next Update
+	void Invalidate(UINT object) { if (m_valid) m_changed.push_back(object); }
+	void Reset() { m_valid = false; m_changed.clear(); }
+
+	// objects the frustum sees, in no particular order
+	const std::vector<UINT>& GetVisible() { return m_visible; }
+	UINT GetTestedCount() { return m_tested; } // by the last Update
+
+	static void Benchmark(UINT count, UINT frames, float travel, float turn, double& cullMs, double& cachedMs, float& testedFraction, bool& identical);
+};
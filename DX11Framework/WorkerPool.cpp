@@ -0,0 +1,67 @@
+#include "WorkerPool.h"
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_wake.notify_all();
+
+	for (std::thread& thread : m_threads) thread.join();
+}
+
+/// <summary>
+/// park until the generation moves, run this worker's task if the job has one for it, report back and park again
+/// </summary>
+/// <param name="index">task index this worker always takes</param>
+/// <param name="generation">the generation when the worker was created, it only wakes for later jobs</param>
+void WorkerPool::WorkerLoop(UINT index, UINT64 generation) {
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this, generation]() { return m_stopping || m_generation != generation; });
+			if (m_stopping) return;
+
+			generation = m_generation;
+			if (index + 1 >= m_taskCount) continue; // a smaller job, the calling thread has the last task
+		}
+
+		(*m_task)(index);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (--m_remaining == 0) m_done.notify_one();
+	}
+}
+
+/// <summary>
+/// run task(0) to task(taskCount - 1) and return once every one has finished. tasks 0 to taskCount - 2 go to the
+/// workers, creating any that do not exist yet, and the last runs on the calling thread. a single task never
+/// touches the workers. only one thread may call Run at a time
+/// </summary>
+/// <param name="taskCount"></param>
+/// <param name="task">called with the task index</param>
+void WorkerPool::Run(UINT taskCount, const std::function<void(UINT)>& task) {
+	if (taskCount == 0) return;
+	if (taskCount == 1) {
+		task(0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while (m_threads.size() + 1 < taskCount) m_threads.emplace_back(&WorkerPool::WorkerLoop, this, (UINT)m_threads.size(), m_generation);
+
+		m_task = &task;
+		m_taskCount = taskCount;
+		m_remaining = taskCount - 1;
+		++m_generation;
+	}
+	m_wake.notify_all();
+
+	task(taskCount - 1);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [this]() { return m_remaining == 0; });
+	m_task = nullptr;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <windows.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/// threads that are created the first time a job needs them and then kept, parked on a condition variable between
+/// jobs rather than spawned and joined each time. Run hands worker t task t and the calling thread the last task, so
+/// a worker always gets the same task index and anything indexed by it (a deferred context, a band) stays with one thread
+class WorkerPool
+{
+private:
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+
+	const std::function<void(UINT)>* m_task = nullptr; // the running job's, only valid inside Run
+	UINT m_taskCount = 0;
+	UINT m_remaining = 0; // worker tasks of the running job still going
+	UINT64 m_generation = 0; // bumped once per job, workers wake when it moves
+	bool m_stopping = false;
+
+	void WorkerLoop(UINT index, UINT64 generation);
+
+public:
+	WorkerPool() {}
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Run(UINT taskCount, const std::function<void(UINT)>& task);
+
+	UINT GetThreadCount() { return (UINT)m_threads.size(); }
+};